@@ -17,6 +17,11 @@
 #include "Camera.h"
 #include "D3D7Config.h"
 
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define TILEMESH_SSE2 // vectorised patch mesh generation
+#include <emmintrin.h>
+#endif
+
 // =======================================================================
 // Externals
 
@@ -34,6 +39,136 @@ static D3DLIGHT7 nightlight = {
 	0,0,0,0,0,0,0
 };
 
+// =======================================================================
+// =======================================================================
+// Class PatchTemplateCache
+
+PATCHTEMPLATE *PatchTemplateCache::tpl[MAXPATCHTEMPLATE] = {0};
+int PatchTemplateCache::ntpl = 0;
+DWORD PatchTemplateCache::tcount = 0;
+int PatchTemplateCache::nhit = 0;
+int PatchTemplateCache::nmiss = 0;
+CRITICAL_SECTION PatchTemplateCache::cs;
+
+void PatchTemplateCache::Init ()
+{
+	InitializeCriticalSection (&cs);
+	ntpl = 0;
+	tcount = 0;
+	nhit = nmiss = 0;
+}
+
+// -----------------------------------------------------------------------
+
+void PatchTemplateCache::Cleanup ()
+{
+	for (int i = 0; i < ntpl; i++)
+		Delete (tpl[i]);
+	ntpl = 0;
+	DeleteCriticalSection (&cs);
+	if (nhit+nmiss)
+		oapiWriteLogV ("PatchTemplateCache: %d of %d patch meshes built from cached latitude band templates", nhit, nhit+nmiss);
+}
+
+// -----------------------------------------------------------------------
+
+const PATCHTEMPLATE *PatchTemplateCache::Acquire (int lvl, int ilat, int grdlat, int grdlng)
+{
+	int i, ilru = -1;
+	PATCHTEMPLATE *t = NULL;
+
+	EnterCriticalSection (&cs);
+	tcount++;
+	for (i = 0; i < ntpl; i++) {
+		if (tpl[i]->lvl == lvl && tpl[i]->ilat == ilat && tpl[i]->grdlat == grdlat && tpl[i]->grdlng == grdlng) {
+			t = tpl[i];
+			break;
+		}
+		if (!tpl[i]->nref && (ilru < 0 || tpl[i]->tlast < tpl[ilru]->tlast))
+			ilru = i;
+	}
+	if (t) {
+		nhit++;
+	} else {
+		nmiss++;
+		t = Create (lvl, ilat, grdlat, grdlng);
+		if (ntpl < MAXPATCHTEMPLATE) {
+			tpl[ntpl++] = t;
+		} else if (ilru >= 0) { // replace the least recently used template
+			Delete (tpl[ilru]);
+			tpl[ilru] = t;
+		} else {                // all cached templates are in use
+			t->nref = -1;
+		}
+	}
+	if (t->nref >= 0) {
+		t->nref++;
+		t->tlast = tcount;
+	}
+	LeaveCriticalSection (&cs);
+	return t;
+}
+
+// -----------------------------------------------------------------------
+
+void PatchTemplateCache::Release (const PATCHTEMPLATE *tpl)
+{
+	PATCHTEMPLATE *t = (PATCHTEMPLATE*)tpl;
+
+	EnterCriticalSection (&cs);
+	if (t->nref > 0) t->nref--;
+	else if (t->nref < 0) Delete (t); // not cached
+	LeaveCriticalSection (&cs);
+}
+
+// -----------------------------------------------------------------------
+
+PATCHTEMPLATE *PatchTemplateCache::Create (int lvl, int ilat, int grdlat, int grdlng)
+{
+	int i, j;
+	int nlng = 2 << lvl;
+	int nlat = 1 << lvl;
+	double lat, lng, minlng = 0;
+
+	PATCHTEMPLATE *t = new PATCHTEMPLATE;
+	t->lvl = lvl;
+	t->ilat = ilat;
+	t->grdlat = grdlat;
+	t->grdlng = grdlng;
+	t->minlat = PI * (double)(nlat/2-ilat-1)/(double)nlat;
+	t->maxlat = PI * (double)(nlat/2-ilat)/(double)nlat;
+	t->maxlng = PI2/(double)nlng;
+	t->clat0 = cos(t->minlat), t->slat0 = sin(t->minlat);
+	t->clng0 = cos(minlng),    t->slng0 = sin(minlng);
+	t->clat1 = cos(t->maxlat), t->slat1 = sin(t->maxlat);
+	t->clng1 = cos(t->maxlng), t->slng1 = sin(t->maxlng);
+
+	t->clat = new double[2*(grdlat+1)];
+	t->slat = t->clat + grdlat+1;
+	for (i = 0; i <= grdlat; i++) {
+		lat = t->minlat + (t->maxlat-t->minlat) * (double)i/(double)grdlat;
+		t->slat[i] = sin(lat), t->clat[i] = cos(lat);
+	}
+	t->clng = new double[2*(grdlng+1)];
+	t->slng = t->clng + grdlng+1;
+	for (j = 0; j <= grdlng; j++) {
+		lng = minlng + (t->maxlng-minlng) * (double)j/(double)grdlng;
+		t->slng[j] = sin(lng), t->clng[j] = cos(lng);
+	}
+	t->nref = 0;
+	t->tlast = 0;
+	return t;
+}
+
+// -----------------------------------------------------------------------
+
+void PatchTemplateCache::Delete (PATCHTEMPLATE *tpl)
+{
+	delete []tpl->clat;
+	delete []tpl->clng;
+	delete tpl;
+}
+
 // =======================================================================
 // =======================================================================
 // Class Tile
@@ -163,11 +298,10 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 	int nlat = 1 << lvl;
 	bool north = (ilat < nlat/2);
 
-	double lat, slat, clat, lng, slng, clng, eradius, dx, dy;
-	double minlat = PI * (double)(nlat/2-ilat-1)/(double)nlat;
-	double maxlat = PI * (double)(nlat/2-ilat)/(double)nlat;
-	double minlng = 0;
-	double maxlng = PI2/(double)nlng;
+	// the trigonometric terms of the grid are shared by the latitude band
+	const PATCHTEMPLATE *tpl = PatchTemplateCache::Acquire (lvl, ilat, grdlat, grdlng);
+
+	double slat, clat, slng, clng, eradius, dx, dy;
 	double radius = mgr->obj_size;
 	VECTOR3 pos, tpos, nml;
 	if (!range) range = &fullrange;
@@ -183,10 +317,10 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 	// from (minlng,minlat) corner to (maxlng,minlat) corner (origin is halfway between)
 	// y-axis points from local origin to middle between (minlng,maxlat) and (maxlng,maxlat)
 	// bounding box is created in this system and then transformed back to planet coords.
-	double clat0 = cos(minlat), slat0 = sin(minlat);
-	double clng0 = cos(minlng), slng0 = sin(minlng);
-	double clat1 = cos(maxlat), slat1 = sin(maxlat);
-	double clng1 = cos(maxlng), slng1 = sin(maxlng);
+	double clat0 = tpl->clat0, slat0 = tpl->slat0;
+	double clng0 = tpl->clng0, slng0 = tpl->slng0;
+	double clat1 = tpl->clat1, slat1 = tpl->slat1;
+	double clng1 = tpl->clng1, slng1 = tpl->slng1;
 	VECTOR3 ex = {clat0*clng1 - clat0*clng0, 0, clat0*slng1 - clat0*slng0}; normalise (ex);
 	VECTOR3 ey = {0.5*(clng0+clng1)*(clat1-clat0), slat1-slat0, 0.5*(slng0+slng1)*(clat1-clat0)}; normalise (ey);
 	VECTOR3 ez = crossp (ey, ex);
@@ -209,14 +343,60 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 
 	// create the vertices
 	for (i = n = 0; i <= grdlat; i++) {
-		lat = minlat + (maxlat-minlat) * (double)i/(double)grdlat;
-		slat = sin(lat), clat = cos(lat);
-		for (j = 0; j <= grdlng; j++) {
-			lng = minlng + (maxlng-minlng) * (double)j/(double)grdlng;
-			slng = sin(lng), clng = cos(lng);
+		slat = tpl->slat[i], clat = tpl->clat[i];
+		const INT16 *erow = (elev ? elev + (i+1)*TILE_ELEVSTRIDE + 1 : 0);
+		j = 0;
+#ifdef TILEMESH_SSE2
+		// two grid columns at a time
+		const __m128d vclat = _mm_set1_pd (clat), vslat = _mm_set1_pd (slat);
+		const __m128d vrad = _mm_set1_pd (radius + globelev), vscale = _mm_set1_pd (elev_scale);
+		const __m128d vdx = _mm_set1_pd (dx), vdy = _mm_set1_pd (dy);
+		const __m128d pfx = _mm_set1_pd (pref.x), pfy = _mm_set1_pd (pref.y), pfz = _mm_set1_pd (pref.z);
+		__m128d bbmin[3], bbmax[3];
+		for (; j < grdlng; j += 2, n += 2) {
+			__m128d er = vrad; // radius including node elevation
+			if (erow) er = _mm_add_pd (er, _mm_mul_pd (_mm_set_pd ((double)erow[j+1], (double)erow[j]), vscale));
+			__m128d nx = _mm_mul_pd (vclat, _mm_loadu_pd (tpl->clng+j));
+			__m128d nz = _mm_mul_pd (vclat, _mm_loadu_pd (tpl->slng+j));
+			__m128d px = _mm_mul_pd (nx, er), py = _mm_mul_pd (vslat, er), pz = _mm_mul_pd (nz, er);
+			__m128d qx = _mm_sub_pd (px, pfx), qy = _mm_sub_pd (py, pfy), qz = _mm_sub_pd (pz, pfz);
+			__m128d t[3];
+			for (int k = 0; k < 3; k++) {
+				const double *r = R.data + 3*k;
+				t[k] = _mm_add_pd (_mm_add_pd (_mm_mul_pd (_mm_set1_pd (r[0]), qx), _mm_mul_pd (_mm_set1_pd (r[1]), qy)),
+					_mm_mul_pd (_mm_set1_pd (r[2]), qz));
+				if (!j) bbmin[k] = bbmax[k] = t[k];
+				else bbmin[k] = _mm_min_pd (bbmin[k], t[k]), bbmax[k] = _mm_max_pd (bbmax[k], t[k]);
+			}
+			float fp[3][4], fn[3][4];
+			_mm_storeu_ps (fp[0], _mm_cvtpd_ps (_mm_sub_pd (px, vdx)));
+			_mm_storeu_ps (fp[1], _mm_cvtpd_ps (_mm_sub_pd (py, vdy)));
+			_mm_storeu_ps (fp[2], _mm_cvtpd_ps (pz));
+			_mm_storeu_ps (fn[0], _mm_cvtpd_ps (nx));
+			_mm_storeu_ps (fn[1], _mm_cvtpd_ps (vslat));
+			_mm_storeu_ps (fn[2], _mm_cvtpd_ps (nz));
+			for (int k = 0; k < 2; k++) {
+				vtx[n+k].x = fp[0][k]; vtx[n+k].nx = fn[0][k];
+				vtx[n+k].y = fp[1][k]; vtx[n+k].ny = fn[1][k];
+				vtx[n+k].z = fp[2][k]; vtx[n+k].nz = fn[2][k];
+			}
+		}
+		if (j) { // merge the bounding box lanes
+			for (int k = 0; k < 3; k++) {
+				double mn[2], mx[2];
+				_mm_storeu_pd (mn, bbmin[k]);
+				_mm_storeu_pd (mx, bbmax[k]);
+				if (!i) tpmin.data[k] = mn[0], tpmax.data[k] = mx[0];
+				else tpmin.data[k] = min (tpmin.data[k], mn[0]), tpmax.data[k] = max (tpmax.data[k], mx[0]);
+				tpmin.data[k] = min (tpmin.data[k], mn[1]), tpmax.data[k] = max (tpmax.data[k], mx[1]);
+			}
+		}
+#endif
+		for (; j <= grdlng; j++, n++) {
+			clng = tpl->clng[j], slng = tpl->slng[j];
 
 			eradius = radius + globelev; // radius including node elevation
-			if (elev) eradius += (double)elev[(i+1)*TILE_ELEVSTRIDE + j+1]*elev_scale;
+			if (erow) eradius += (double)erow[j]*elev_scale;
 			nml = _V(clat*clng, slat, clat*slng);
 			pos = nml*eradius;
 			tpos = mul (R, pos-pref);
@@ -234,7 +414,12 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 			vtx[n].x = D3DVAL(pos.x - dx); vtx[n].nx = D3DVAL(nml.x);
 			vtx[n].y = D3DVAL(pos.y - dy); vtx[n].ny = D3DVAL(nml.y);
 			vtx[n].z = D3DVAL(pos.z);      vtx[n].nz = D3DVAL(nml.z);
+		}
+	}
 
+	// texture coordinates
+	for (i = n = 0; i <= grdlat; i++) {
+		for (j = 0; j <= grdlng; j++, n++) {
 			vtx[n].tu0 = D3DVAL((c1*j)/grdlng+c2); // overlap to avoid seams
 			vtx[n].tv0 = D3DVAL(grdlat-i)/D3DVAL(grdlat);
 			vtx[n].tu1 = vtx[n].tu0 * TEX2_MULTIPLIER;
@@ -243,7 +428,6 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 			// map texture coordinates to subrange
 			vtx[n].tu0 = vtx[n].tu0*turange + range->tumin;
 			vtx[n].tv0 = vtx[n].tv0*tvrange + range->tvmin;
-			n++;
 		}
 	}
 
@@ -307,20 +491,49 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 		dy = radius * PI/(nlat*grdlat);  // y-distance between vertices
 		ny_x = shade_exaggerate*dy;
 		for (i = n = 0; i <= grdlat; i++) {
-			lat = minlat + (maxlat-minlat) * (double)i/(double)grdlat;
-			slat = sin(lat), clat = cos(lat);
-			dz = radius * PI2*cos(lat) / (nlng*grdlng); // z-distance between vertices on unit sphere
+			slat = tpl->slat[i], clat = tpl->clat[i];
+			dz = radius * PI2*clat / (nlng*grdlng); // z-distance between vertices on unit sphere
 			dydz = dy*dz;
 			nz_x = shade_exaggerate*dz;
-			for (j = 0; j <= grdlng; j++) {
-				lng = minlng + (maxlng-minlng) * (double)j/(double)grdlng;
-				slng = sin(lng), clng = cos(lng);
+			double ey_scale = dz*elev_scale, ez_scale = dy*elev_scale;
+			j = 0;
+#ifdef TILEMESH_SSE2
+			// two grid columns at a time
+			const __m128d vclat = _mm_set1_pd (clat), vslat = _mm_set1_pd (slat);
+			const __m128d vnx = _mm_set1_pd (2.0*dydz), vey = _mm_set1_pd (ey_scale), vez = _mm_set1_pd (ez_scale);
+			for (; j < grdlng; j += 2, n += 2) {
+				const INT16 *e0 = elev + (i+1)*TILE_ELEVSTRIDE + (j+1);
+				const INT16 *e1 = e0+1;
+				__m128d ny = _mm_mul_pd (vey, _mm_set_pd ((double)(e1[-TILE_ELEVSTRIDE]-e1[TILE_ELEVSTRIDE]), (double)(e0[-TILE_ELEVSTRIDE]-e0[TILE_ELEVSTRIDE])));
+				__m128d nz = _mm_mul_pd (vez, _mm_set_pd ((double)(e1[-1]-e1[1]), (double)(e0[-1]-e0[1])));
+				__m128d len = _mm_sqrt_pd (_mm_add_pd (_mm_add_pd (_mm_mul_pd (vnx, vnx), _mm_mul_pd (ny, ny)), _mm_mul_pd (nz, nz)));
+				__m128d nx = _mm_div_pd (vnx, len);
+				ny = _mm_div_pd (ny, len);
+				nz = _mm_div_pd (nz, len);
+				// rotate into place
+				__m128d rx = _mm_sub_pd (_mm_mul_pd (nx, vclat), _mm_mul_pd (ny, vslat));
+				__m128d ry = _mm_add_pd (_mm_mul_pd (nx, vslat), _mm_mul_pd (ny, vclat));
+				__m128d cl = _mm_loadu_pd (tpl->clng+j), sl = _mm_loadu_pd (tpl->slng+j);
+				float fn[3][4];
+				_mm_storeu_ps (fn[0], _mm_cvtpd_ps (_mm_sub_pd (_mm_mul_pd (rx, cl), _mm_mul_pd (nz, sl))));
+				_mm_storeu_ps (fn[1], _mm_cvtpd_ps (ry));
+				_mm_storeu_ps (fn[2], _mm_cvtpd_ps (_mm_add_pd (_mm_mul_pd (rx, sl), _mm_mul_pd (nz, cl))));
+				for (int k = 0; k < 2; k++) {
+					vtx[n+k].nx = fn[0][k];
+					vtx[n+k].ny = fn[1][k];
+					vtx[n+k].nz = fn[2][k];
+				}
+			}
+#endif
+			for (; j <= grdlng; j++, n++) {
+				clng = tpl->clng[j], slng = tpl->slng[j];
 				en = (i+1)*TILE_ELEVSTRIDE + (j+1);
 
 				// This version avoids the normalisation of the 4 intermediate face normals
 				// It's faster and doesn't seem to make much difference
-				VECTOR3 nml = {2.0*dydz, dz*elev_scale*(elev[en-TILE_ELEVSTRIDE]-elev[en+TILE_ELEVSTRIDE]), dy*elev_scale*(elev[en-1]-elev[en+1])};
+				VECTOR3 nml = {2.0*dydz, ey_scale*(elev[en-TILE_ELEVSTRIDE]-elev[en+TILE_ELEVSTRIDE]), ez_scale*(elev[en-1]-elev[en+1])};
 				normalise (nml);
+
 				// rotate into place
 				nx1 = nml.x*clat - nml.y*slat;
 				ny1 = nml.x*slat + nml.y*clat;
@@ -328,7 +541,6 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 				vtx[n].nx = (float)(nx1*clng - nz1*slng);
 				vtx[n].ny = (float)(ny1);
 				vtx[n].nz = (float)(nx1*slng + nz1*clng);
-				n++;
 			}
 		}
 	}
@@ -371,6 +583,8 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 	mesh->bbvtx[6] = _V(tmul (R, _V(tpmin.x, tpmax.y, tpmax.z)) + pref);
 	mesh->bbvtx[7] = _V(tmul (R, _V(tpmax.x, tpmax.y, tpmax.z)) + pref);
 
+	PatchTemplateCache::Release (tpl);
+
 	mesh->MapVertices (TileManager2Base::d3d, TileManager2Base::dev, TileManager2Base::vbMemCaps); // TODO
 	return mesh;
 }
@@ -754,6 +968,7 @@ void TileManager2Base::GlobalInit (oapi::D3D7Client *gclient)
 	bTileLoadThread = true; // TODO: g_pOrbiter->Cfg()->CfgPRenderPrm.bLoadOnThread;
 
 	loader = new TileLoader (gc);
+	PatchTemplateCache::Init ();
 }
 
 // -----------------------------------------------------------------------
@@ -761,6 +976,7 @@ void TileManager2Base::GlobalInit (oapi::D3D7Client *gclient)
 void TileManager2Base::GlobalExit ()
 {
 	delete loader;
+	PatchTemplateCache::Cleanup ();
 }
 
 // -----------------------------------------------------------------------
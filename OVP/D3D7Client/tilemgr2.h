@@ -24,6 +24,7 @@
 #include "ztreemgr.h"
 
 #define MAXQUEUE2 20
+#define MAXPATCHTEMPLATE 256 // max. number of cached patch templates
 
 #define TILE_VALID  0x0001
 #define TILE_ACTIVE 0x0002
@@ -41,6 +42,49 @@ typedef struct {
 
 // =======================================================================
 
+// Trigonometric terms of the vertex grid of a quadrilateral patch. Patches
+// are generated at longitude 0 and rotated into place by the world matrix,
+// so the grid only depends on the resolution level and latitude index, and
+// is shared by all patches of a latitude band.
+
+struct PATCHTEMPLATE {
+	int lvl, ilat;               // latitude band
+	int grdlat, grdlng;          // grid resolution
+	double minlat, maxlat;       // latitude range [rad]
+	double maxlng;               // longitude range [rad] (from 0)
+	double clat0, slat0, clat1, slat1; // cos and sin of minlat and maxlat
+	double clng0, slng0, clng1, slng1; // cos and sin of 0 and maxlng
+	double *clat, *slat;         // cos and sin of the grid row latitudes [grdlat+1]
+	double *clng, *slng;         // cos and sin of the grid column longitudes [grdlng+1]
+	int nref;                    // reference count (-1: not cached)
+	DWORD tlast;                 // last access (for LRU eviction)
+};
+
+class PatchTemplateCache {
+public:
+	static void Init ();
+	static void Cleanup ();
+
+	static const PATCHTEMPLATE *Acquire (int lvl, int ilat, int grdlat, int grdlng);
+	// returns the template for a latitude band, creating it if required.
+	// The template must be returned with Release.
+
+	static void Release (const PATCHTEMPLATE *tpl);
+
+protected:
+	static PATCHTEMPLATE *Create (int lvl, int ilat, int grdlat, int grdlng);
+	static void Delete (PATCHTEMPLATE *tpl);
+
+private:
+	static PATCHTEMPLATE *tpl[MAXPATCHTEMPLATE];
+	static int ntpl;
+	static DWORD tcount;         // access counter
+	static int nhit, nmiss;      // statistics
+	static CRITICAL_SECTION cs;
+};
+
+// =======================================================================
+
 class Tile {
 	friend class TileManager2Base;
 	friend class TileLoader;
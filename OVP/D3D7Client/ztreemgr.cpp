@@ -18,6 +18,15 @@
 
 #include "ztreemgr.h"
 #include "OrbiterAPI.h"
+#ifdef TREE_LZ4
+#include "lz4.h"
+#endif
+#ifdef TREE_ZSTD
+#include "zstd.h"
+#endif
+
+// Size of version 1 file headers, which have no codec field
+static const DWORD TREEHDR_V1_SIZE = 48;
 
 // =======================================================================
 // File header for compressed tree files
@@ -28,19 +37,21 @@ TreeFileHeader::TreeFileHeader ()
 	magic[1] = 'X';
 	magic[2] = 1;
 	magic[3] = 0;
-	size = sizeof(TreeFileHeader);
+	size = TREEHDR_V1_SIZE;
 	flags = 0;
 	nodeCount = 0;
 	dataOfs = size;
 	dataLength = 0;
 	rootPos1 = rootPos2 = rootPos3 = rootPos4[0] = rootPos4[1] = (DWORD)-1;
+	codec = TREE_CODEC_ZLIB;
+	reserved = 0;
 }
 
 // -----------------------------------------------------------------------
 
 size_t TreeFileHeader::fwrite(FILE *f)
 {
-	return ::fwrite(this, sizeof(TreeFileHeader), 1, f);
+	return ::fwrite(this, size, 1, f);
 }
 
 // -----------------------------------------------------------------------
@@ -49,10 +60,13 @@ bool TreeFileHeader::fread(FILE *f)
 {
 	BYTE buf[4];
 	DWORD sz, flags;
-	if (::fread(buf, 1, 4, f) < 4 || memcmp(buf, magic, 4))
+	if (::fread(buf, 1, 4, f) < 4 || memcmp(buf, magic, 2) || buf[2] < 1 || buf[2] > 2 || buf[3])
 		return false;
-	if (::fread(&sz, sizeof(DWORD), 1, f) != 1 || sz != size)
+	DWORD hsize = (buf[2] == 1 ? TREEHDR_V1_SIZE : sizeof(TreeFileHeader));
+	if (::fread(&sz, sizeof(DWORD), 1, f) != 1 || sz != hsize)
 		return false;
+	magic[2] = buf[2];
+	size = sz;
 	::fread(&flags, sizeof(DWORD), 1, f);
 	::fread(&dataOfs, sizeof(DWORD), 1, f);
 	::fread(&dataLength, sizeof(__int64), 1, f);
@@ -61,6 +75,11 @@ bool TreeFileHeader::fread(FILE *f)
 	::fread(&rootPos2, sizeof(DWORD), 1, f);
 	::fread(&rootPos3, sizeof(DWORD), 1, f);
 	::fread(rootPos4, sizeof(DWORD), 2, f);
+	codec = TREE_CODEC_ZLIB;
+	if (buf[2] >= 2) {
+		::fread(&codec, sizeof(DWORD), 1, f);
+		::fread(&reserved, sizeof(DWORD), 1, f);
+	}
 	return true;
 }
 
@@ -117,6 +136,7 @@ ZTreeMgr::ZTreeMgr(const char *PlanetPath, Layer _layer)
 	strcpy(path, PlanetPath);
 	layer = _layer;
 	treef = 0;
+	codec = TREE_CODEC_ZLIB;
 	OpenArchive();
 }
 
@@ -150,6 +170,13 @@ bool ZTreeMgr::OpenArchive()
 	for (int i = 0; i < 2; i++)
 		rootPos4[i] = tfh.rootPos4[i];
 	dofs = (__int64)tfh.dataOfs;
+	codec = tfh.codec;
+	if (!CodecSupported(codec)) {
+		oapiWriteLogV("D3D7Client: %s: unsupported compression codec %d", fname, codec);
+		fclose(treef);
+		treef = 0;
+		return false;
+	}
 
 	if (!toc.fread(tfh.nodeCount, treef)) {
 		fclose(treef);
@@ -211,9 +238,46 @@ DWORD ZTreeMgr::ReadData(DWORD idx, BYTE **outp)
 
 // -----------------------------------------------------------------------
 
+bool ZTreeMgr::CodecSupported(DWORD codec)
+{
+	switch (codec) {
+	case TREE_CODEC_ZLIB:
+		return true;
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4:
+		return true;
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+// -----------------------------------------------------------------------
+
 DWORD ZTreeMgr::Inflate(const BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp)
 {
-	return oapiInflate(inp, ninp, outp, noutp);
+	switch (codec) {
+	case TREE_CODEC_ZLIB:
+		return oapiInflate(inp, ninp, outp, noutp);
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4: {
+		int ndata = LZ4_decompress_safe((const char*)inp, (char*)outp, (int)ninp, (int)noutp);
+		return (ndata > 0 ? (DWORD)ndata : 0);
+		}
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD: {
+		size_t ndata = ZSTD_decompress(outp, noutp, inp, ninp);
+		return (ZSTD_isError(ndata) ? 0 : (DWORD)ndata);
+		}
+#endif
+	default:
+		return 0;
+	}
 }
 
 // -----------------------------------------------------------------------
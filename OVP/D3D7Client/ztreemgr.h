@@ -20,6 +20,11 @@
 #include <iostream>
 #include <windows.h>
 
+// Compression codecs for node data (as Src/Orbiter/ZTreeMgr.h)
+#define TREE_CODEC_ZLIB 0
+#define TREE_CODEC_LZ4  1
+#define TREE_CODEC_ZSTD 2
+
 // =======================================================================
 // Tree node structure
 
@@ -37,6 +42,8 @@ struct TreeNode {
 
 // =======================================================================
 // File header for compressed tree files
+// Version 1 headers end after rootPos4, and imply zlib compression.
+// Version 2 headers add the codec field.
 
 class TreeFileHeader {
 	friend class ZTreeMgr;
@@ -57,6 +64,8 @@ private:
 	DWORD rootPos2;     // index of level-2 tile ((DWORD)-1 for not present)
 	DWORD rootPos3;     // index of level-3 tile ((DWORD)-1 for not present)
 	DWORD rootPos4[2];  // index of the level-4 tiles (quadtree roots; (DWORD)-1 for not present)
+	DWORD codec;        // compression codec (TREE_CODEC_xxx; version 2 only)
+	DWORD reserved;     // (version 2 only)
 };
 
 // =======================================================================
@@ -106,6 +115,9 @@ public:
 
 	void ReleaseData(BYTE *data);
 
+	static bool CodecSupported(DWORD codec);
+	// true if archives compressed with codec can be read by this build
+
 	inline DWORD NodeSizeDeflated(DWORD idx) const { return toc.NodeSizeDeflated(idx); }
 	inline DWORD NodeSizeInflated(DWORD idx) const { return toc.NodeSizeInflated(idx); }
 
@@ -123,6 +135,7 @@ private:
 	DWORD rootPos3;    // index of level-3 tile ((DWORD)-1 for not present)
 	DWORD rootPos4[2]; // index of the level-4 tiles (quadtree roots; (DWORD)-1 for not present)
 	__int64 dofs;
+	DWORD codec;       // compression codec (TREE_CODEC_xxx)
 };
 
 #endif // !__ZTREEMGR_H
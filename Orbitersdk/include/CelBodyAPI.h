@@ -12,12 +12,14 @@
 //   functions.
 // - This class interface replaces the previous interface consisting of
 //   global opcXXX callback functions.
+// - Chebyshev series utilities and segment cache (ChebEphem) for fast
+//   ephemerides.
 // ======================================================================
 
 /**
  * \file CelBodyAPI.h
  * \brief Contains interface classes for celestial bodies: \ref CELBODY and
- *   \ref CELBODY2.
+ *   \ref CELBODY2, and the Chebyshev ephemeris cache \ref ChebEphem.
  */
 
 #ifndef __CELBODYAPI_H
@@ -624,4 +626,175 @@ protected:
 	CELBODY2 *cbody; ///< associated celestial body instance
 };
 
+// ======================================================================
+/// \ingroup defines
+/// \defgroup chebephem Chebyshev ephemeris parameters
+///  Chebyshev series limits and segment cache parameters
+// ======================================================================
+//@{
+#define CHEB_MAXCOEFF 32 ///< max. number of coefficients per series for \ref ChebEval
+#define CHEB_NCOEFF   14 ///< coefficients per component and segment of a \ref ChebEphem cache
+#define CHEB_NSLOT    8  ///< cached segments per \ref ChebEphem instance (power of 2)
+#define CHEB_NJOB     64 ///< max. queued segment requests of all \ref ChebEphem instances
+//@}
+
+/**
+ * \brief Chebyshev nodes of order n.
+ * \param n number of nodes
+ * \param x array of n values, returns the nodes x[j] = cos(pi(j+1/2)/n), j=0..n-1
+ */
+OAPIFUNC void ChebNodes (int n, double *x);
+
+/**
+ * \brief Chebyshev series interpolating a function sampled at the Chebyshev nodes.
+ * \param n number of samples and coefficients
+ * \param f array of n samples of the function at the nodes returned by \ref ChebNodes
+ * \param cf array of n values, returns the series coefficients
+ */
+OAPIFUNC void ChebFit (int n, const double *f, double *cf);
+
+/**
+ * \brief Evaluates a set of Chebyshev series and their derivatives.
+ * \param n coefficients per series (<= \ref CHEB_MAXCOEFF)
+ * \param ncomp number of series
+ * \param cf ncomp consecutive arrays of n coefficients
+ * \param x normalised argument (-1..1)
+ * \param dxdt scale factor applied to the derivatives
+ * \param pos array of ncomp values, returns the series values
+ * \param vel array of ncomp values, returns the derivatives, scaled by dxdt
+ */
+OAPIFUNC void ChebEval (int n, int ncomp, const double *cf, double x, double dxdt, double *pos, double *vel);
+
+/**
+ * \brief Ephemeris sampling function for a \ref ChebEphem cache.
+ * \details Returns position (ret[0-2]) and velocity (ret[3-5]) at date mjd.
+ *   This is called from the cache worker thread, so it must not modify any
+ *   shared state.
+ */
+typedef void (*EPHEMPROC)(void *context, double mjd, double *ret);
+
+
+// ======================================================================
+/**
+* \class ChebEphem
+* \brief Chebyshev segment cache for fast sequential ephemerides.
+* \details Celestial body modules with expensive ephemeris solutions can
+*   use this class to implement CELBODY::clbkFastEphemeris. The time axis
+*   is divided into segments of fixed length. For each segment, the
+*   position components are fitted with a Chebyshev series sampled from the
+*   full ephemeris solution. Velocities are obtained from the derivative of
+*   the series.
+*   Segments are fitted ahead of time by a worker thread shared by all
+*   caches, or on the calling thread if a segment is needed before the
+*   worker has fitted it.
+* \sa CELBODY2, ChebFit, ChebEval
+*/
+// ======================================================================
+
+class OAPIFUNC ChebEphem {
+public:
+	/**
+	 * \brief Creates a cache for an ephemeris sampling function.
+	 * \param proc ephemeris sampling function
+	 * \param context data passed to proc
+	 * \param polar true if proc returns spherical coordinates (longitude,
+	 *   latitude, radius [AU]), false for cartesian coordinates [m]
+	 * \param mjd_ref date at simulation time 0
+	 */
+	ChebEphem (EPHEMPROC proc, void *context, bool polar, double mjd_ref);
+
+	~ChebEphem ();
+
+	/**
+	 * \brief Sets the segment length.
+	 * \param tol position tolerance [m]
+	 * \param maxlen max. segment length [s]
+	 * \return Segment length [s]
+	 * \note The segment length is set to the largest value (maxlen/2^n) for
+	 *   which the position error of the fit is below tol, or below the noise
+	 *   level of the sampling function if that is larger.
+	 */
+	double Calibrate (double tol, double maxlen = 86400.0*32.0);
+
+	/**
+	 * \brief Runs \ref Calibrate on a separate thread, so that the fit error
+	 *   tests don't hold up the caller.
+	 * \note The next call of \ref Ephem waits for the calibration to complete,
+	 *   so the results are the same as after \ref Calibrate.
+	 */
+	void CalibrateAsync (double tol, double maxlen = 86400.0*32.0);
+
+	/**
+	 * \brief Waits for a calibration started by \ref CalibrateAsync to complete.
+	 * \return Wait time [ms]
+	 */
+	double WaitCalibration ();
+
+	inline bool Calibrating () const { return hCalib != 0; }
+	inline double SegmentLength () const { return seglen; }     ///< segment length [s]
+	inline double CalibrationTime () const { return tcalib; }   ///< duration of the last calibration [ms]
+	inline int CalibrationSamples () const { return ncalib; }   ///< sampling function calls of the last calibration
+	inline int SyncFits () const { return nsync; }              ///< number of segments fitted on the calling thread in \ref Ephem
+
+	/**
+	 * \brief Returns the position and velocity at a simulation time.
+	 * \param simt simulation time [s]
+	 * \param ret array of 6 values, returns position and velocity in the
+	 *   format of the sampling function
+	 * \note If the segment containing simt has not yet been fitted by the
+	 *   worker thread, it is fitted on the calling thread. A fit only depends
+	 *   on the segment index and length, so the result does not depend on
+	 *   which thread fitted the segment.
+	 * \note Must only be called from a single thread.
+	 */
+	void Ephem (double simt, double *ret);
+
+	/**
+	 * \brief Position difference [m] between two ephemeris samples.
+	 */
+	double PosError (const double *p, const double *q) const;
+
+private:
+	double FitError (double len, int &nsample) const;
+	// max. position error [m] of fits with segment length len. Adds the
+	// number of sampling function calls to nsample.
+
+	void Fit (double t0, double len, double (*cf)[CHEB_NCOEFF]) const;
+	// fit the series for segment [t0,t0+len] into cf
+
+	void Request (__int64 k);
+	// queue segment k for fitting, if it is not already cached or pending
+
+	EPHEMPROC proc;
+	void *context;
+	bool polar;
+	double mjd_ref;
+	double seglen;      // segment length [s]
+	double tcalib;      // duration of the last calibration [ms]
+	int ncalib;         // sampling function calls of the last calibration
+	int nsync;          // segments fitted on the calling thread
+
+	// asynchronous calibration
+	static DWORD WINAPI Calib_ThreadProc (void *data);
+	HANDLE hCalib;      // calibration thread, while running
+	double caltol, calmaxlen;
+
+	struct SEGMENT {
+		volatile LONG state; // 0=empty, 1=pending, 2=ready
+		__int64 k;           // segment index: segment covers [k,k+1)*seglen
+		double cf[3][CHEB_NCOEFF];
+	} seg[CHEB_NSLOT];
+
+	// worker thread shared by all instances
+	static DWORD WINAPI Fit_ThreadProc (void *data);
+	static CRITICAL_SECTION cs;
+	static HANDLE hThread;
+	static HANDLE hWake;
+	static volatile bool bRunThread;
+	static int nref;
+	static struct JOB { ChebEphem *ce; int slot; } job[CHEB_NJOB];
+	static int njob;
+	static ChebEphem *active; // instance currently processed by the worker
+};
+
 #endif // !__CELBODYAPI_H
\ No newline at end of file
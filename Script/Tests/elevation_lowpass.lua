@@ -0,0 +1,75 @@
+note = oapi.create_annotation()
+note:set_pos (0.2,0.1,0.8,0.9);
+note:set_size(0.5)
+note:set_colour ({r=0.7,g=0.8,b=1})
+
+buf = ""
+
+function add_line(line)
+	buf = buf .. line .. "\n"
+	note:set_text(buf)
+end
+
+function assert(cond)
+	if cond == false then
+		add_line("Test failed!")
+		error("Test failed!")
+	end
+end
+
+function pass()
+	buf = string.sub(buf, 1, -2) .. " - passed!\n"
+	note:set_text(buf)
+	proc.wait_sysdt(0.5)
+end
+
+-- lunar surface elevation range [m], with some margin
+emin = -9500
+emax = 11000
+-- longest acceptable frame after the warm-up [s]. Elevation queries
+-- never wait for tiles during the session, so crossing tile boundaries
+-- must not stall the frame.
+max_sysstep = 0.25
+
+vlist = {vessel.get_interface("LLO-Polar"), vessel.get_interface("LLO-Equ")}
+
+-- fly for syst seconds of system time at time acceleration tacc and
+-- check the surface elevation below each vessel in every frame
+function fly(syst, tacc)
+	oapi.set_tacc(tacc)
+	proc.wait_sysdt(5) -- warm-up: initial tile requests
+	local t1 = oapi.get_systime() + syst
+	local res = {maxstep = 0, elo = emax, ehi = emin}
+	while oapi.get_systime() < t1 do
+		proc.skip()
+		res.maxstep = math.max(res.maxstep, oapi.get_sysstep())
+		for i,v in ipairs(vlist) do
+			local e = v:get_surfaceelevation()
+			assert(e >= emin and e <= emax)
+			assert(v:get_altitude(ALTMODE.GROUND) > 0)
+			res.elo = math.min(res.elo, e)
+			res.ehi = math.max(res.ehi, e)
+		end
+	end
+	return res
+end
+
+add_line("=== Low-altitude elevation query tests ===")
+add_line("")
+
+for i,tacc in ipairs({1, 10}) do
+	add_line(string.format("Test: surface elevation in low orbit at %dx", tacc))
+	res = fly(60, tacc)
+	assert(res.ehi - res.elo > 100) -- terrain is resolved, not a flat fallback
+	pass()
+	add_line(string.format("  elevation range %0.0f ... %0.0f m", res.elo, res.ehi))
+
+	add_line(string.format("Test: no frame stalls at %dx", tacc))
+	assert(res.maxstep < max_sysstep)
+	pass()
+	add_line(string.format("  longest frame %0.3f s", res.maxstep))
+end
+
+oapi.set_tacc(1)
+add_line("")
+add_line("=== All tests passed ===")
@@ -0,0 +1,110 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// ======================================================================
+// Chebeph.cpp
+// Generic celestial body module which serves ephemerides from a
+// precomputed Chebyshev coefficient file (see EphemFile.h), as written
+// by the EphemGen plugin. This replaces the runtime evaluation of the
+// analytic ephemeris theories, for example for long batch runs.
+//
+// Planet config file entries:
+//   Module = Chebeph
+//   EphemFile = <path>  ; file path relative to the Orbiter root
+//                       ; (default: Config\<Name>\Data\Chebeph.bin)
+// ======================================================================
+
+#define ORBITER_MODULE
+
+#include "OrbiterAPI.h"
+#include "CelbodyAPI.h"
+#include "EphemFile.h"
+#include <stdio.h>
+
+// ======================================================================
+// class Chebeph: interface
+// ======================================================================
+
+class Chebeph: public CELBODY2 {
+public:
+	Chebeph (OBJHANDLE hObj);
+	void clbkInit (FILEHANDLE cfg);
+	bool bEphemeris () const;
+	int clbkEphemeris (double mjd, int req, double *ret);
+	int clbkFastEphemeris (double simt, int req, double *ret);
+
+private:
+	EphemFile ephem;
+	bool bRangeWarning; // out of range warning has been issued
+};
+
+// ======================================================================
+// class Chebeph: implementation
+// ======================================================================
+
+Chebeph::Chebeph (OBJHANDLE hObj): CELBODY2 (hObj)
+{
+	bRangeWarning = false;
+}
+
+void Chebeph::clbkInit (FILEHANDLE cfg)
+{
+	char name[256], fname[256];
+
+	CELBODY2::clbkInit (cfg);
+	oapiGetObjectName (GetHandle(), name, 256);
+	if (!oapiReadItem_string (cfg, "EphemFile", fname))
+		sprintf (fname, "Config\\%s\\Data\\Chebeph.bin", name);
+
+	if (ephem.Open (fname)) {
+		const EPHFILE_HEADER *hdr = ephem.Header();
+		oapiWriteLogV ("Chebeph %s: %s, MJD %0.1lf-%0.1lf, %d segments of %0.3lf days, fit error %0.2le m",
+			name, fname, ephem.MJDmin(), ephem.MJDmax(), hdr->nseg, hdr->seglen, hdr->maxerr);
+	} else {
+		oapiWriteLogError ("Chebeph %s: Could not open ephemeris file %s", name, fname);
+	}
+}
+
+bool Chebeph::bEphemeris () const
+{
+	return ephem.IsOpen();
+}
+
+int Chebeph::clbkEphemeris (double mjd, int req, double *ret)
+{
+	int flg = ephem.Ephem (mjd, req, ret);
+	if (!flg && !bRangeWarning) {
+		char name[256];
+		oapiGetObjectName (GetHandle(), name, 256);
+		oapiWriteLogError ("Chebeph %s: Date MJD %0.4lf outside ephemeris file range (%0.1lf-%0.1lf)",
+			name, mjd, ephem.MJDmin(), ephem.MJDmax());
+		bRangeWarning = true;
+	}
+	return flg;
+}
+
+int Chebeph::clbkFastEphemeris (double simt, int req, double *ret)
+{
+	// The series evaluation is cheap enough for every frame
+	return clbkEphemeris (oapiTime2MJD (simt), req, ret);
+}
+
+// ======================================================================
+// API interface
+// ======================================================================
+
+DLLCLBK void InitModule (HINSTANCE hModule)
+{}
+
+DLLCLBK void ExitModule (HINSTANCE hModule)
+{}
+
+DLLCLBK CELBODY *InitInstance (OBJHANDLE hBody)
+{
+	return new Chebeph (hBody);
+}
+
+DLLCLBK void ExitInstance (CELBODY *body)
+{
+	delete (Chebeph*)body;
+}
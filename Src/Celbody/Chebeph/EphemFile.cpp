@@ -0,0 +1,113 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// EphemFile.cpp
+// Precomputed ephemeris files
+// =======================================================================
+
+#include "OrbiterAPI.h"
+#include "CelbodyAPI.h"
+#include "EphemFile.h"
+
+// =======================================================================
+// class EphemFile
+
+EphemFile::EphemFile ()
+{
+	hFile = INVALID_HANDLE_VALUE;
+	hMap = NULL;
+	hdr = 0;
+	data = 0;
+	mjd1 = 0.0;
+}
+
+// -----------------------------------------------------------------------
+
+EphemFile::~EphemFile ()
+{
+	Close ();
+}
+
+// -----------------------------------------------------------------------
+
+bool EphemFile::Open (const char *fname)
+{
+	LARGE_INTEGER fsize;
+
+	Close ();
+	hFile = CreateFile (fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) return false;
+	if (!GetFileSizeEx (hFile, &fsize) || fsize.QuadPart < sizeof(EPHFILE_HEADER)) {
+		Close ();
+		return false;
+	}
+	hMap = CreateFileMapping (hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!hMap) {
+		Close ();
+		return false;
+	}
+	hdr = (const EPHFILE_HEADER*)MapViewOfFile (hMap, FILE_MAP_READ, 0, 0, 0);
+	if (!hdr) {
+		Close ();
+		return false;
+	}
+
+	// sanity checks
+	if (memcmp (hdr->magic, EPHFILE_MAGIC, 8) || hdr->version != EPHFILE_VERSION ||
+		hdr->hdrsize < sizeof(EPHFILE_HEADER) || hdr->nseg == 0 || hdr->seglen <= 0.0 ||
+		hdr->ncoeff < 2 || hdr->ncoeff > EPHFILE_MAXCOEFF || (hdr->ncomp != 3 && hdr->ncomp != 6) ||
+		(LONGLONG)hdr->hdrsize + (LONGLONG)hdr->nseg*hdr->ncomp*hdr->ncoeff*sizeof(double) > fsize.QuadPart) {
+		Close ();
+		return false;
+	}
+	data = (const double*)((const char*)hdr + hdr->hdrsize);
+	mjd1 = hdr->mjd0 + hdr->nseg*hdr->seglen;
+	return true;
+}
+
+// -----------------------------------------------------------------------
+
+void EphemFile::Close ()
+{
+	if (hdr) {
+		UnmapViewOfFile (hdr);
+		hdr = 0;
+		data = 0;
+	}
+	if (hMap) {
+		CloseHandle (hMap);
+		hMap = NULL;
+	}
+	if (hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle (hFile);
+		hFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+// -----------------------------------------------------------------------
+
+int EphemFile::Ephem (double mjd, int req, double *ret) const
+{
+	double s = (mjd - hdr->mjd0)/hdr->seglen;
+	if (s < 0.0 || s > hdr->nseg) return 0;
+
+	DWORD k = (DWORD)s;
+	if (k == hdr->nseg) k--; // end point of last segment
+	int n = hdr->ncoeff;
+	const double *cf = data + (size_t)k*hdr->ncomp*n;
+	double x = 2.0*(s-k) - 1.0;
+	double dxdt = 2.0/(hdr->seglen*86400.0);
+	int flg = hdr->flags | EPHEM_TRUEPOS | EPHEM_TRUEVEL;
+
+	ChebEval (n, 3, cf, x, dxdt, ret, ret+3);
+	if (req & (EPHEM_BARYPOS | EPHEM_BARYVEL)) {
+		if (hdr->ncomp == 6) {
+			ChebEval (n, 3, cf+3*n, x, dxdt, ret+6, ret+9);
+			flg |= EPHEM_BARYPOS | EPHEM_BARYVEL;
+		} else if (hdr->flags & EPHEM_BARYISTRUE) {
+			for (int i = 0; i < 6; i++) ret[i+6] = ret[i];
+		}
+	}
+	return flg;
+}
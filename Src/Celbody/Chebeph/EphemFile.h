@@ -0,0 +1,77 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// EphemFile.h
+// Precomputed ephemeris files: Chebyshev coefficients of the positions of
+// a celestial body over a span of time, divided into segments of equal
+// length. Velocities are obtained from the derivatives of the series.
+//
+// File layout (little-endian):
+//   EPHFILE_HEADER
+//   nseg segments, each containing ncomp series of ncoeff coefficients
+//   (double): x,y,z of the true position [m], followed by x,y,z of the
+//   barycentre position [m] if ncomp = 6
+// Positions are cartesian, in the ecliptic frame of the ephemeris source,
+// with the y and z axes swapped into the orbiter convention.
+// =======================================================================
+
+#ifndef __EPHEMFILE_H
+#define __EPHEMFILE_H
+
+#include <windows.h>
+
+#define EPHFILE_MAGIC    "OEPHCHB"  // file identifier (8 bytes including terminator)
+#define EPHFILE_VERSION  1
+#define EPHFILE_MAXCOEFF CHEB_MAXCOEFF // max. number of coefficients per series (see CelBodyAPI.h)
+
+struct EPHFILE_HEADER {
+	char magic[8];   // EPHFILE_MAGIC
+	DWORD version;   // EPHFILE_VERSION
+	DWORD hdrsize;   // header size [bytes] = offset of the coefficient data
+	char name[64];   // body name
+	double mjd0;     // start date of the first segment [MJD]
+	double seglen;   // segment length [days]
+	DWORD nseg;      // number of segments
+	DWORD ncoeff;    // coefficients per series
+	DWORD ncomp;     // series per segment: 3 (true position) or 6 (true and barycentre position)
+	DWORD flags;     // EPHEM_xxx flags returned with the data
+	double tol;      // fit tolerance [m]
+	double maxerr;   // max. fit error at the test points [m]
+};
+
+// =======================================================================
+// class EphemFile
+// Read access to a memory-mapped ephemeris file
+// =======================================================================
+
+class EphemFile {
+public:
+	EphemFile ();
+	~EphemFile ();
+
+	bool Open (const char *fname);
+	// Map the file into memory. Returns false if the file can not be opened
+	// or is not a valid ephemeris file.
+
+	void Close ();
+
+	inline bool IsOpen () const { return hdr != 0; }
+	inline const EPHFILE_HEADER *Header () const { return hdr; }
+	inline double MJDmin () const { return hdr->mjd0; }
+	inline double MJDmax () const { return mjd1; }
+
+	int Ephem (double mjd, int req, double *ret) const;
+	// Returns the ephemeris data at date mjd in the format of
+	// CELBODY::clbkEphemeris. The return value contains the EPHEM_xxx flags
+	// of the returned data, or 0 if mjd is outside the range of the file.
+	// This function is reentrant.
+
+private:
+	HANDLE hFile, hMap;
+	const EPHFILE_HEADER *hdr;
+	const double *data;
+	double mjd1;     // end date of the last segment
+};
+
+#endif // !__EPHEMFILE_H
@@ -3,11 +3,16 @@
 
 #include "Vsop87.h"
 #include <stdio.h>
+#include <string.h>
 
 #define DLLCLBK extern "C" __declspec(dllexport)
 
 using namespace std;
 
+static const double mjd2000 = 51544.5;  // MJD date of epoch J2000
+static const double a1000   = 365250.0; // days per millenium
+static const double rsec    = 1.0/(a1000*86400.0); // 1/seconds per millenium
+
 inline double Radius (double *data)
 {
 	return sqrt (data[0]*data[0] + data[1]*data[1] + data[2]*data[2]);
@@ -21,20 +26,29 @@ inline double Radius (double *data)
 VSOPOBJ::VSOPOBJ (OBJHANDLE hCBody): CELBODY2 (hCBody)
 {
 	a0 = 1.0;               // should be overwritten by derived class
-	double interval = 10.0; // default sampling interval
+	interval = 10.0;        // default sampling interval
 	prec = 1e-6;            // default precision
+	ephtol = 0.1;           // default Chebyshev cache tolerance [m]
+	bBenchmark = false;
+	cheb = 0;
+	cbname[0] = '\0';
 	termidx = 0;
 	termlen = 0;
-	term = 0;
+	termA = termB = termC = 0;
+	kernel = VsopKernelSupport();
+	sumproc = VsopSumKernel (kernel);
 	sp[0].t = sp[1].t = -1e20; // invalidate
 	SetSeries ('B');        // default series: spherical, J2000
 }
 
 VSOPOBJ::~VSOPOBJ ()
 {
+	if (cheb) delete cheb;
 	if (termidx) delete []termidx;
 	if (termlen) delete []termlen;
-	if (term) delete []term;
+	if (termA) delete []termA;
+	if (termB) delete []termB;
+	if (termC) delete []termC;
 }
 
 bool VSOPOBJ::bEphemeris () const
@@ -47,6 +61,13 @@ void VSOPOBJ::clbkInit (FILEHANDLE cfg)
 	CELBODY2::clbkInit (cfg);
 	oapiReadItem_float (cfg, "ErrorLimit", prec); // read custom precision from config file
 	oapiReadItem_float (cfg, "SamplingInterval", interval);
+	oapiReadItem_float (cfg, "EphemTolerance", ephtol);
+	oapiReadItem_bool (cfg, "EphemBenchmark", bBenchmark);
+	int k;
+	if (oapiReadItem_int (cfg, "VsopKernel", k) && k >= 0 && k < kernel) { // restrict to a less capable kernel
+		kernel = k;
+		sumproc = VsopSumKernel (kernel);
+	}
 }
 
 void VSOPOBJ::SetSeries (char series)
@@ -99,19 +120,30 @@ bool VSOPOBJ::ReadData (char *name)
 		}
 		termlen[alpha][cooidx] = 0;
 	}
-	// now copy everything into a single array
-	term = new TERM3[nused];
+	// now copy everything into a single set of arrays, one per coefficient
+	termA = new double[nused];
+	termB = new double[nused];
+	termC = new double[nused];
 	for (cooidx = 0; cooidx < 3; cooidx++) {
 		for (alpha = 0; alpha <= nalpha; alpha++) {
-			memcpy (term+termidx[alpha][cooidx], ppterm[cooidx*(nalpha+1)+alpha], termlen[alpha][cooidx]*sizeof(TERM3));
-			delete []ppterm[cooidx*(nalpha+1)+alpha];
+			pterm = ppterm[cooidx*(nalpha+1)+alpha];
+			for (i = 0; i < termlen[alpha][cooidx]; i++) {
+				termA[termidx[alpha][cooidx]+i] = pterm[i][0];
+				termB[termidx[alpha][cooidx]+i] = pterm[i][1];
+				termC[termidx[alpha][cooidx]+i] = pterm[i][2];
+			}
+			delete []pterm;
 		}
 	}
 	delete []ppterm;
 
+	strncpy (cbname, name, 31); cbname[31] = '\0';
+	KernelCheck (name);
 	Init();
 
-	oapiWriteLogV("VSOP87(%c) %s: Precision %0.1le, Terms %d/%d", sid, name, prec, nused, ntot);
+	oapiWriteLogV("VSOP87(%c) %s: Precision %0.1le, Terms %d/%d, kernel %s", sid, name, prec, nused, ntot, VsopKernelName (kernel));
+	if (bBenchmark)
+		Benchmark (name);
 	return true;
 }
 
@@ -123,6 +155,30 @@ void VSOPOBJ::Init ()
 	VsopEphem (oapiTime2MJD(sp[1].t), sp[1].param);
 	sp[0].rad = Radius (sp[0].param);
 	sp[1].rad = Radius (sp[1].param);
+
+	if (ephtol > 0.0) {
+		if (!cheb) cheb = new ChebEphem (EphemProc, this, (fmtflag & EPHEM_POLAR) != 0, oapiTime2MJD (0.0));
+		cheb->CalibrateAsync (ephtol); // completed on first use, see ChebWait
+	}
+}
+
+// ===========================================================
+// Name: ChebWait()
+// Desc: Wait for the calibration of the Chebyshev cache
+//       started in Init, and log the segment length and the
+//       calibration cost, including the time the caller was
+//       held up.
+// ===========================================================
+void VSOPOBJ::ChebWait ()
+{
+	double wait = cheb->WaitCalibration ();
+	oapiWriteLogV("VSOP87(%c) %s: Chebyshev segment length %0.0lf s (tolerance %0.1le m), calibration %0.1lf ms, %d samples, wait %0.1lf ms",
+		sid, cbname, cheb->SegmentLength(), ephtol, cheb->CalibrationTime(), cheb->CalibrationSamples(), wait);
+}
+
+void VSOPOBJ::EphemProc (void *context, double mjd, double *ret)
+{
+	((VSOPOBJ*)context)->VsopEphem (mjd, ret);
 }
 
 // ===========================================================
@@ -140,20 +196,53 @@ void VSOPOBJ::Init ()
 // ===========================================================
 void VSOPOBJ::VsopEphem (double mjd, double *ret)
 {
-	static const double mjd2000 = 51544.5;  // MJD date of epoch J2000
-	static const double a1000   = 365250.0; // days per millenium
-	static const double rsec    = 1.0/(a1000*86400.0); // 1/seconds per millenium
-
-	static const double c0   = 299792458;     // speed of light [m/s]
-	static const double tauA = 499.004783806; // light time for 1 AU [s]
-	static const double AU   = c0*tauA;       // 1 AU in meters
-	static const double pscl = AU;            // convert AU -> m
-	static const double vscl = AU*rsec;       // convert AU/millenium -> m/s
+	TermSum (sumproc, (mjd-mjd2000)/a1000, ret);
+	ScaleEphem (ret);
+}
 
-	TERM3 *pterm;
+// ===========================================================
+// Name: VsopEphemBatch()
+// Desc: Ephemerides for a list of epochs. The series loop is
+//       outermost, so each term table is read from memory once
+//       per call rather than once per epoch.
+// ===========================================================
+void VSOPOBJ::VsopEphemBatch (const double *mjd, int n, double *ret)
+{
+	const int nbuf = 256;
+	double t1[nbuf], tm, termdot, ta, ta1;
+	int i, k, n0, nb, cooidx, alpha, ofs, len;
+
+	for (n0 = 0; n0 < n; n0 += nbuf, mjd += nbuf, ret += 6*nbuf) {
+		nb = (n-n0 < nbuf ? n-n0 : nbuf);
+		for (k = 0; k < nb; k++) {
+			t1[k] = (mjd[k]-mjd2000)/a1000;
+			for (i = 0; i < 6; i++) ret[k*6+i] = 0.0;
+		}
+		for (cooidx = 0; cooidx < 3; ++cooidx) {
+			for (alpha = 0; (len = termlen[alpha][cooidx]); ++alpha) {
+				ofs = termidx[alpha][cooidx];
+				for (k = 0; k < nb; k++) {
+					sumproc (termA+ofs, termB+ofs, termC+ofs, len, t1[k], &tm, &termdot);
+					for (i = 0, ta1 = 0.0, ta = 1.0; i < alpha; i++) ta1 = ta, ta *= t1[k];
+					ret[k*6+cooidx] += ta * tm;
+					ret[k*6+cooidx+3] += ta * termdot + alpha * ta1 * tm;
+				}
+			}
+		}
+		for (k = 0; k < nb; k++)
+			ScaleEphem (ret+k*6);
+	}
+}
 
-	double a, b, c, arg, tm, termdot;
-	int i, cooidx, alpha;
+// ===========================================================
+// Name: TermSum()
+// Desc: Sum the VSOP87 series at time t1 [millenia since J2000]
+//       using summation kernel proc.
+// ===========================================================
+void VSOPOBJ::TermSum (VSOPSUMPROC proc, double t1, double *ret) const
+{
+	double tm, termdot;
+	int i, cooidx, alpha, ofs;
 
 	// zero result array
 	for (i = 0; i < 6; i++) ret[i] = 0.0;
@@ -161,7 +250,7 @@ void VSOPOBJ::VsopEphem (double mjd, double *ret)
 	// set time and powers
 	double t[VSOP_MAXALPHA+1];
 	t[0] = 1.0;
-	t[1] = (mjd-mjd2000)/a1000;
+	t[1] = t1;
 	for (i = 2; i <= VSOP_MAXALPHA; ++i) t[i] = t[i-1] * t[1];
 
 	// term summation
@@ -169,22 +258,30 @@ void VSOPOBJ::VsopEphem (double mjd, double *ret)
 
 		for (alpha = 0; termlen[alpha][cooidx]; ++alpha) { // loop over powers of time
 
-			pterm = term+termidx[alpha][cooidx];
-			tm = termdot = 0.0;
-		    for (i = 0; i < termlen[alpha][cooidx]; ++i) {
-				a        = pterm[i][0];
-				b        = pterm[i][1];
-				c        = pterm[i][2];
-				arg      = b + c * t[1];
-				tm      += a * cos(arg);
-				termdot -= c * a * sin(arg);
-			}
+			ofs = termidx[alpha][cooidx];
+			proc (termA+ofs, termB+ofs, termC+ofs, termlen[alpha][cooidx], t[1], &tm, &termdot);
 			ret[cooidx] += t[alpha] * tm;
 			ret[cooidx+3] += t[alpha] * termdot +
 				(alpha > 0 ? alpha * t[alpha - 1] * tm : 0.0);
 
 		} // end loop alpha
 	} // end loop cooidx
+}
+
+// ===========================================================
+// Name: ScaleEphem()
+// Desc: Convert summed series to the units returned by
+//       VsopEphem. Rectangular series are returned as position
+//       [m] and velocity [m/s] in the orbiter frame.
+// ===========================================================
+void VSOPOBJ::ScaleEphem (double *ret) const
+{
+	static const double c0   = 299792458;     // speed of light [m/s]
+	static const double tauA = 499.004783806; // light time for 1 AU [s]
+	static const double AU   = c0*tauA;       // 1 AU in meters
+	static const double pscl = AU;            // convert AU -> m
+	static const double vscl = AU*rsec;       // convert AU/millenium -> m/s
+	int i;
 
 	if (fmtflag & EPHEM_POLAR) {
 		// convert millenium rate to second rate
@@ -203,6 +300,23 @@ void VSOPOBJ::VsopEphem (double mjd, double *ret)
 // ===========================================================
 // Name: VsopFastEphem()
 // Desc: Generate planetary position and velocity data at the
+//       current simulation time from the Chebyshev segment
+//       cache. The segment length is calibrated at startup so
+//       that the position error remains below EphemTolerance.
+// ===========================================================
+void VSOPOBJ::VsopFastEphem (double simt, double *ret)
+{
+	if (cheb) {
+		if (cheb->Calibrating()) ChebWait ();
+		cheb->Ephem (simt, ret);
+	} else {
+		VsopLinearEphem (simt, ret);
+	}
+}
+
+// ===========================================================
+// Name: VsopLinearEphem()
+// Desc: Generate planetary position and velocity data at the
 //       current simulation time using linear interpolation
 //		 This interpolation scheme, with the sampling frequencies
 //       defined below, produces the following position errors [m]:
@@ -213,7 +327,7 @@ void VSOPOBJ::VsopEphem (double mjd, double *ret)
 //       Jupiter: 7e-3
 //       Saturn:  7e-3
 // ===========================================================
-void VSOPOBJ::VsopFastEphem (double simt, double *ret)
+void VSOPOBJ::VsopLinearEphem (double simt, double *ret)
 {
 	Sample *s0, *s1;
 	
@@ -287,4 +401,157 @@ void VSOPOBJ::Interpolate (double t, double *data, const Sample *s0, const Sampl
 	}
 }
 
+// ===========================================================
+// Name: Benchmark()
+// Desc: Sequential ephemeris calls with different time steps,
+//       starting at epochs spread over a century from the
+//       current date. Logs the mean cost per call, and the max.
+//       position error of the fast methods with respect to
+//       VsopEphem.
+//       Note that segments are fitted ahead of time by the
+//       worker thread, so in the tight benchmark loop the
+//       Chebyshev cache can fall behind at large time steps.
+//       The rate of segments fitted on the calling thread
+//       (sync) is logged.
+//       The term summation kernels supported by the CPU are
+//       timed separately, for single and batch evaluation.
+// ===========================================================
+void VSOPOBJ::Benchmark (const char *name)
+{
+	BenchmarkKernels (name);
+
+	if (!cheb) {
+		oapiWriteLogV("VSOP87(%c) %s: Benchmark requires Chebyshev cache (EphemTolerance > 0)", sid, name);
+		return;
+	}
 
+	const int nrun = 20;       // runs per time step, spread over a century
+	const int ncall = 1000;    // sequential calls per run
+	const int nchk = 10;       // accuracy check interval [calls]
+	const double century = 100.0*365.25*86400.0;
+	static const double step[3] = {1.0, 100.0, 10000.0};
+	LARGE_INTEGER freq, c0, c1;
+	double ret[6], ref[6], t, t0, e;
+	int i, j, run, nsync;
+
+	if (cheb->Calibrating()) ChebWait ();
+	QueryPerformanceFrequency (&freq);
+	for (i = 0; i < 3; i++) {
+		double cost[3] = {0,0,0};
+		double err[2] = {0,0};
+		for (run = nsync = 0; run < nrun; run++) {
+			t0 = run*century/nrun;
+			cheb->Ephem (t0, ret); // initial segment
+
+			// timing
+			QueryPerformanceCounter (&c0);
+			for (j = 0, t = t0; j < ncall; j++, t += step[i])
+				VsopEphem (oapiTime2MJD (t), ret);
+			QueryPerformanceCounter (&c1);
+			cost[0] += (double)(c1.QuadPart-c0.QuadPart);
+
+			QueryPerformanceCounter (&c0);
+			for (j = 0, t = t0; j < ncall; j++, t += step[i])
+				VsopLinearEphem (t, ret);
+			QueryPerformanceCounter (&c1);
+			cost[1] += (double)(c1.QuadPart-c0.QuadPart);
+
+			int nsync0 = cheb->SyncFits();
+			QueryPerformanceCounter (&c0);
+			for (j = 0, t = t0; j < ncall; j++, t += step[i])
+				cheb->Ephem (t, ret);
+			QueryPerformanceCounter (&c1);
+			cost[2] += (double)(c1.QuadPart-c0.QuadPart);
+			nsync += cheb->SyncFits() - nsync0;
+
+			// accuracy
+			for (j = 0, t = t0; j < ncall; j++, t += step[i]) {
+				VsopLinearEphem (t, ret);
+				if (j % nchk) continue;
+				VsopEphem (oapiTime2MJD (t), ref);
+				if ((e = cheb->PosError (ref, ret)) > err[0]) err[0] = e;
+				cheb->Ephem (t, ret);
+				if ((e = cheb->PosError (ref, ret)) > err[1]) err[1] = e;
+			}
+		}
+		for (j = 0; j < 3; j++)
+			cost[j] *= 1e6/((double)freq.QuadPart*nrun*ncall); // us per call
+		oapiWriteLogV("VSOP87(%c) %s: step %0.0lf s: VsopEphem %0.3lf us | linear %0.3lf us, err %0.2le m | Chebyshev %0.3lf us, err %0.2le m, sync %0.1lf%%",
+			sid, name, step[i], cost[0], cost[1], err[0], cost[2], err[1], 100.0*nsync/(nrun*ncall));
+	}
+	sp[0].t = sp[1].t = -1e20; // invalidate the linear interpolation samples
+}
+
+void VSOPOBJ::BenchmarkKernels (const char *name)
+{
+	const int nepoch = 1000;   // epochs spread over a century from the current date
+	const double century = 100.0*365.25*86400.0;
+	LARGE_INTEGER freq, c0, c1;
+	double *mjd = new double[nepoch];
+	double *ret = new double[6*nepoch];
+	double cost;
+	char cbuf[256], *pc = cbuf;
+	int k, j;
+
+	for (j = 0; j < nepoch; j++)
+		mjd[j] = oapiTime2MJD (j*century/nepoch);
+	QueryPerformanceFrequency (&freq);
+	for (k = VSOPKERNEL_SCALAR; k <= VsopKernelSupport(); k++) {
+		VSOPSUMPROC proc = VsopSumKernel (k);
+		QueryPerformanceCounter (&c0);
+		for (j = 0; j < nepoch; j++)
+			TermSum (proc, (mjd[j]-mjd2000)/a1000, ret);
+		QueryPerformanceCounter (&c1);
+		cost = (double)(c1.QuadPart-c0.QuadPart)*1e6/((double)freq.QuadPart*nepoch);
+		pc += sprintf (pc, "%s %0.3lf us | ", VsopKernelName (k), cost);
+	}
+	QueryPerformanceCounter (&c0);
+	VsopEphemBatch (mjd, nepoch, ret);
+	QueryPerformanceCounter (&c1);
+	cost = (double)(c1.QuadPart-c0.QuadPart)*1e6/((double)freq.QuadPart*nepoch);
+	oapiWriteLogV("VSOP87(%c) %s: term summation: %sbatch (%s) %0.3lf us/epoch", sid, name, cbuf, VsopKernelName (kernel), cost);
+	delete []mjd;
+	delete []ret;
+}
+
+// ===========================================================
+// Name: KernelCheck()
+// Desc: Compare the series sums of the selected summation
+//       kernel with the scalar reference at epochs spread over
+//       +-4 millenia from J2000. Errors are taken relative to
+//       the sum of the absolute term amplitudes of each series,
+//       which bounds the magnitude of the series.
+// ===========================================================
+bool VSOPOBJ::KernelCheck (const char *name)
+{
+	if (kernel == VSOPKERNEL_SCALAR) return true;
+
+	const int nchk = 64;
+	VSOPSUMPROC ref = VsopSumKernel (VSOPKERNEL_SCALAR);
+	double t, s0, ds0, s1, ds1, sa, sca, e, err = 0.0;
+	int i, k, cooidx, alpha, ofs, len;
+
+	for (cooidx = 0; cooidx < 3; cooidx++) {
+		for (alpha = 0; (len = termlen[alpha][cooidx]); alpha++) {
+			ofs = termidx[alpha][cooidx];
+			for (i = 0, sa = sca = 0.0; i < len; i++) {
+				sa  += fabs (termA[ofs+i]);
+				sca += fabs (termC[ofs+i]*termA[ofs+i]);
+			}
+			for (k = 0; k < nchk; k++) {
+				t = -4.0 + 8.0*(k+0.5)/nchk;
+				ref (termA+ofs, termB+ofs, termC+ofs, len, t, &s0, &ds0);
+				sumproc (termA+ofs, termB+ofs, termC+ofs, len, t, &s1, &ds1);
+				if ((e = fabs (s1-s0)/sa) > err) err = e;
+				if (sca > 0.0 && (e = fabs (ds1-ds0)/sca) > err) err = e;
+			}
+		}
+	}
+	if (err > 1e-12) {
+		oapiWriteLogError("VSOP87(%c) %s: %s kernel error %0.2le exceeds limit. Using scalar kernel.", sid, name, VsopKernelName (kernel), err);
+		kernel = VSOPKERNEL_SCALAR;
+		sumproc = ref;
+		return false;
+	}
+	return true;
+}
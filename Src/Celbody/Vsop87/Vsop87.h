@@ -6,6 +6,7 @@
 
 #include "OrbiterAPI.h"
 #include "CelbodyAPI.h"
+#include "VsopKernel.h"
 
 #define VSOP_MAXALPHA 5		// max power of time
 
@@ -24,6 +25,12 @@ public:
 	bool bEphemeris() const;
 	void clbkInit (FILEHANDLE cfg);
 
+	void VsopEphemBatch (const double *mjd, int n, double *ret);
+	// Ephemerides at n epochs mjd[0..n-1], in the format of VsopEphem.
+	// ret must provide 6n values. Each term series is summed for all epochs
+	// before moving to the next, so the term tables stay in cache.
+	// This function is reentrant.
+
 protected:
 	void SetSeries (char series);
 	// Set VSOP series ('A' to 'E')
@@ -34,25 +41,63 @@ protected:
 	void Init ();
 
 	void VsopEphem (double mjd, double *ret);
-	// Calculate ephemerides
+	// Calculate ephemerides. This function is reentrant.
 
 	void VsopFastEphem (double simt, double *ret);
-	// Interpolated sequential ephemerides
+	// Sequential ephemerides from the Chebyshev segment cache, or by linear
+	// interpolation if the cache is disabled (EphemTolerance = 0)
+
+	void VsopLinearEphem (double simt, double *ret);
+	// Sequential ephemerides by linear interpolation between samples
+
+	void Benchmark (const char *name);
+	// Compare cost and accuracy of the fast ephemeris methods against
+	// VsopEphem over a century, and the cost of the term summation kernels,
+	// and write the results to the log file
+
+	void BenchmarkKernels (const char *name);
+	// Cost of the term summation kernels supported by the CPU
+
+	bool KernelCheck (const char *name);
+	// Compare the selected summation kernel against the scalar reference
+	// over a range of epochs. Falls back to the scalar kernel if the
+	// relative error of any series exceeds 1e-12.
 
 	double a0;       // semi-major axis [AU]
 	double prec;     // tolerance limit (1e-3 .. 1e-8)
-	double interval; // sample interval for fast ephemeris [s]
+	double interval; // sample interval for linear interpolation [s]
+	double ephtol;   // position tolerance for the Chebyshev cache [m] (0=disabled)
+	bool bBenchmark; // run ephemeris benchmark after initialisation
+	ChebEphem *cheb; // Chebyshev segment cache for fast ephemeris
 	int fmtflag;     // data format flag
 	int nalpha;      // order of time polynomials
 	IDX3 *termidx;   // term index list
 	IDX3 *termlen;   // term list lengths
-	TERM3 *term;     // term list
+	double *termA;   // term list: amplitudes
+	double *termB;   // term list: phases
+	double *termC;   // term list: frequencies
+	int kernel;      // term summation kernel type (VSOPKERNEL_xxx)
+	VSOPSUMPROC sumproc; // term summation kernel
 	Sample sp[2];
 
 private:
 	void Interpolate (double t, double *data, const Sample *s0, const Sample *s1);
 
+	void TermSum (VSOPSUMPROC proc, double t1, double *ret) const;
+	// Sum the series for time t1 [millenia since J2000] with kernel proc,
+	// before unit conversion
+
+	void ScaleEphem (double *ret) const;
+	// Convert summed series to the units and axes returned by VsopEphem
+
+	static void EphemProc (void *context, double mjd, double *ret);
+	// sampling function for the Chebyshev cache
+
+	void ChebWait ();
+	// complete the Chebyshev cache calibration started by Init
+
 	char sid;
+	char cbname[32]; // body name, for log output
 	int datatp;  // return data type: true pos or barycentric
 };
 
@@ -0,0 +1,262 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// VsopKernel.cpp
+// Term summation kernels for VSOP87 series
+//
+// Vectorised sine/cosine: the argument is reduced to r in [-pi/4,pi/4]
+// with x = r + q pi/2, using a 3-part Cody-Waite split of pi/2. sin(r)
+// and cos(r) are evaluated with the Cephes minimax polynomials, and
+// swapped/negated according to q mod 4. The reduction is accurate for
+// |x| < 2^29 (VSOP87 arguments stay below 1e6 within +-10 millennia).
+// =======================================================================
+
+#include "VsopKernel.h"
+#include <math.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+static const double PIO2_1 = 1.57079625129699707031e+00; // pi/2 split into
+static const double PIO2_2 = 7.54978941586159635335e-08; // three parts with
+static const double PIO2_3 = 5.39030285815811905290e-15; // exact products q*PIO2_1, q*PIO2_2
+static const double TWOOPI = 6.36619772367581343076e-01; // 2/pi
+static const double RMAGIC = 6755399441055744.0;         // 1.5*2^52: round to integer
+
+// sin(r) = r + r^3 (S0 + S1 z + ... + S5 z^5), z = r^2
+static const double S0 = -1.66666666666666307295e-01;
+static const double S1 =  8.33333333332211858878e-03;
+static const double S2 = -1.98412698295895385996e-04;
+static const double S3 =  2.75573136213857245213e-06;
+static const double S4 = -2.50507477628578072866e-08;
+static const double S5 =  1.58962301576546568060e-10;
+
+// cos(r) = 1 - z/2 + z^2 (C0 + C1 z + ... + C5 z^5)
+static const double C0 =  4.16666666666665929218e-02;
+static const double C1 = -1.38888888888730564116e-03;
+static const double C2 =  2.48015872888517045348e-05;
+static const double C3 = -2.75573141792967388112e-07;
+static const double C4 =  2.08757008419747316778e-09;
+static const double C5 = -1.13585365213876817300e-11;
+
+// =======================================================================
+// Scalar reference kernel
+
+static void VsopSum_Scalar (const double *a, const double *b, const double *c, int n, double t, double *sum, double *dsum)
+{
+	double arg, tm = 0.0, termdot = 0.0;
+	for (int i = 0; i < n; i++) {
+		arg      = b[i] + c[i] * t;
+		tm      += a[i] * cos(arg);
+		termdot -= c[i] * a[i] * sin(arg);
+	}
+	*sum = tm;
+	*dsum = termdot;
+}
+
+// =======================================================================
+// SSE2 kernel: 2 terms per iteration
+
+static inline __m128d Poly_SSE2 (__m128d z, double p0, double p1, double p2, double p3, double p4, double p5)
+{
+	__m128d y = _mm_set1_pd (p5);
+	y = _mm_add_pd (_mm_mul_pd (y, z), _mm_set1_pd (p4));
+	y = _mm_add_pd (_mm_mul_pd (y, z), _mm_set1_pd (p3));
+	y = _mm_add_pd (_mm_mul_pd (y, z), _mm_set1_pd (p2));
+	y = _mm_add_pd (_mm_mul_pd (y, z), _mm_set1_pd (p1));
+	y = _mm_add_pd (_mm_mul_pd (y, z), _mm_set1_pd (p0));
+	return y;
+}
+
+static inline void SinCos_SSE2 (__m128d x, __m128d &sn, __m128d &cs)
+{
+	// range reduction
+	__m128d qm = _mm_add_pd (_mm_mul_pd (x, _mm_set1_pd (TWOOPI)), _mm_set1_pd (RMAGIC));
+	__m128d q  = _mm_sub_pd (qm, _mm_set1_pd (RMAGIC));
+	__m128d r  = _mm_sub_pd (x, _mm_mul_pd (q, _mm_set1_pd (PIO2_1)));
+	r = _mm_sub_pd (r, _mm_mul_pd (q, _mm_set1_pd (PIO2_2)));
+	r = _mm_sub_pd (r, _mm_mul_pd (q, _mm_set1_pd (PIO2_3)));
+
+	// polynomials
+	__m128d z = _mm_mul_pd (r, r);
+	__m128d ps = _mm_add_pd (r, _mm_mul_pd (_mm_mul_pd (z, r), Poly_SSE2 (z, S0, S1, S2, S3, S4, S5)));
+	__m128d pc = _mm_add_pd (_mm_sub_pd (_mm_set1_pd (1.0), _mm_mul_pd (z, _mm_set1_pd (0.5))),
+		_mm_mul_pd (_mm_mul_pd (z, z), Poly_SSE2 (z, C0, C1, C2, C3, C4, C5)));
+
+	// quadrant q mod 4 from the low bits of the rounded value. The low
+	// dword of each lane is copied into both dwords, so that 32-bit shifts
+	// produce 64-bit lane masks.
+	__m128i qi = _mm_shuffle_epi32 (_mm_castpd_si128 (qm), _MM_SHUFFLE(2,2,0,0));
+	__m128d swap = _mm_castsi128_pd (_mm_srai_epi32 (_mm_slli_epi32 (qi, 31), 31));
+	__m128d sign = _mm_set1_pd (-0.0);
+	__m128d neg_s = _mm_and_pd (sign, _mm_castsi128_pd (_mm_srai_epi32 (_mm_slli_epi32 (qi, 30), 31)));
+	__m128d neg_c = _mm_and_pd (sign, _mm_castsi128_pd (_mm_srai_epi32 (_mm_slli_epi32 (_mm_add_epi32 (qi, _mm_set1_epi32 (1)), 30), 31)));
+	sn = _mm_xor_pd (_mm_or_pd (_mm_and_pd (swap, pc), _mm_andnot_pd (swap, ps)), neg_s);
+	cs = _mm_xor_pd (_mm_or_pd (_mm_and_pd (swap, ps), _mm_andnot_pd (swap, pc)), neg_c);
+}
+
+static void VsopSum_SSE2 (const double *a, const double *b, const double *c, int n, double t, double *sum, double *dsum)
+{
+	__m128d vt = _mm_set1_pd (t);
+	__m128d acc_c = _mm_setzero_pd(), acc_s = _mm_setzero_pd();
+	__m128d va, vc, sn, cs;
+	double res[2];
+	int i;
+
+	for (i = 0; i+2 <= n; i += 2) {
+		va = _mm_loadu_pd (a+i);
+		vc = _mm_loadu_pd (c+i);
+		SinCos_SSE2 (_mm_add_pd (_mm_loadu_pd (b+i), _mm_mul_pd (vc, vt)), sn, cs);
+		acc_c = _mm_add_pd (acc_c, _mm_mul_pd (va, cs));
+		acc_s = _mm_add_pd (acc_s, _mm_mul_pd (_mm_mul_pd (vc, va), sn));
+	}
+	_mm_storeu_pd (res, acc_c);
+	double tm = res[0] + res[1];
+	_mm_storeu_pd (res, acc_s);
+	double termdot = -(res[0] + res[1]);
+	for (; i < n; i++) {
+		double arg = b[i] + c[i] * t;
+		tm      += a[i] * cos(arg);
+		termdot -= c[i] * a[i] * sin(arg);
+	}
+	*sum = tm;
+	*dsum = termdot;
+}
+
+// =======================================================================
+// AVX2 kernel: 4 terms per iteration, FMA in the polynomials
+// (the argument b+c*t is formed without FMA, to round like the scalar path)
+
+TARGET_AVX2 static inline __m256d Poly_AVX2 (__m256d z, double p0, double p1, double p2, double p3, double p4, double p5)
+{
+	__m256d y = _mm256_set1_pd (p5);
+	y = _mm256_fmadd_pd (y, z, _mm256_set1_pd (p4));
+	y = _mm256_fmadd_pd (y, z, _mm256_set1_pd (p3));
+	y = _mm256_fmadd_pd (y, z, _mm256_set1_pd (p2));
+	y = _mm256_fmadd_pd (y, z, _mm256_set1_pd (p1));
+	y = _mm256_fmadd_pd (y, z, _mm256_set1_pd (p0));
+	return y;
+}
+
+TARGET_AVX2 static inline void SinCos_AVX2 (__m256d x, __m256d &sn, __m256d &cs)
+{
+	// range reduction
+	__m256d qm = _mm256_fmadd_pd (x, _mm256_set1_pd (TWOOPI), _mm256_set1_pd (RMAGIC));
+	__m256d q  = _mm256_sub_pd (qm, _mm256_set1_pd (RMAGIC));
+	__m256d r  = _mm256_fnmadd_pd (q, _mm256_set1_pd (PIO2_1), x);
+	r = _mm256_fnmadd_pd (q, _mm256_set1_pd (PIO2_2), r);
+	r = _mm256_fnmadd_pd (q, _mm256_set1_pd (PIO2_3), r);
+
+	// polynomials
+	__m256d z = _mm256_mul_pd (r, r);
+	__m256d ps = _mm256_fmadd_pd (_mm256_mul_pd (z, r), Poly_AVX2 (z, S0, S1, S2, S3, S4, S5), r);
+	__m256d pc = _mm256_fmadd_pd (_mm256_mul_pd (z, z), Poly_AVX2 (z, C0, C1, C2, C3, C4, C5),
+		_mm256_fnmadd_pd (z, _mm256_set1_pd (0.5), _mm256_set1_pd (1.0)));
+
+	// quadrant q mod 4
+	__m256i qi = _mm256_castpd_si256 (qm);
+	__m256i one = _mm256_set1_epi64x (1);
+	__m256d swap = _mm256_castsi256_pd (_mm256_cmpeq_epi64 (_mm256_and_si256 (qi, one), one));
+	__m256d neg_s = _mm256_castsi256_pd (_mm256_slli_epi64 (qi, 62));
+	__m256d neg_c = _mm256_castsi256_pd (_mm256_slli_epi64 (_mm256_add_epi64 (qi, one), 62));
+	__m256d sign = _mm256_set1_pd (-0.0);
+	sn = _mm256_xor_pd (_mm256_blendv_pd (ps, pc, swap), _mm256_and_pd (neg_s, sign));
+	cs = _mm256_xor_pd (_mm256_blendv_pd (pc, ps, swap), _mm256_and_pd (neg_c, sign));
+}
+
+TARGET_AVX2 static void VsopSum_AVX2 (const double *a, const double *b, const double *c, int n, double t, double *sum, double *dsum)
+{
+	__m256d vt = _mm256_set1_pd (t);
+	__m256d acc_c = _mm256_setzero_pd(), acc_s = _mm256_setzero_pd();
+	__m256d va, vc, sn, cs;
+	double res[4];
+	int i;
+
+	for (i = 0; i+4 <= n; i += 4) {
+		va = _mm256_loadu_pd (a+i);
+		vc = _mm256_loadu_pd (c+i);
+		SinCos_AVX2 (_mm256_add_pd (_mm256_loadu_pd (b+i), _mm256_mul_pd (vc, vt)), sn, cs);
+		acc_c = _mm256_fmadd_pd (va, cs, acc_c);
+		acc_s = _mm256_fmadd_pd (_mm256_mul_pd (vc, va), sn, acc_s);
+	}
+	_mm256_storeu_pd (res, acc_c);
+	double tm = (res[0] + res[1]) + (res[2] + res[3]);
+	_mm256_storeu_pd (res, acc_s);
+	double termdot = -((res[0] + res[1]) + (res[2] + res[3]));
+	_mm256_zeroupper ();
+	for (; i < n; i++) {
+		double arg = b[i] + c[i] * t;
+		tm      += a[i] * cos(arg);
+		termdot -= c[i] * a[i] * sin(arg);
+	}
+	*sum = tm;
+	*dsum = termdot;
+}
+
+// =======================================================================
+// Kernel selection
+
+static void CpuId (int *r, int leaf)
+{
+#ifdef _MSC_VER
+	__cpuidex (r, leaf, 0);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count (leaf, 0, a, b, c, d);
+	r[0] = a, r[1] = b, r[2] = c, r[3] = d;
+#endif
+}
+
+static unsigned long long XGetBV0 ()
+{
+#ifdef _MSC_VER
+	return _xgetbv (0);
+#else
+	unsigned int lo, hi;
+	__asm__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+int VsopKernelSupport ()
+{
+	static int type = -1;
+	if (type < 0) {
+		int r[4];
+		type = VSOPKERNEL_SCALAR;
+		CpuId (r, 0);
+		int maxleaf = r[0];
+		CpuId (r, 1);
+		if (r[3] & (1 << 26)) type = VSOPKERNEL_SSE2;
+		bool fma     = (r[2] & (1 << 12)) != 0;
+		bool osxsave = (r[2] & (1 << 27)) != 0;
+		bool avx     = (r[2] & (1 << 28)) != 0;
+		if (fma && osxsave && avx && maxleaf >= 7 && (XGetBV0() & 6) == 6) { // OS saves YMM state
+			CpuId (r, 7);
+			if (r[1] & (1 << 5)) type = VSOPKERNEL_AVX2;
+		}
+	}
+	return type;
+}
+
+VSOPSUMPROC VsopSumKernel (int type)
+{
+	switch (type) {
+	case VSOPKERNEL_SSE2: return VsopSum_SSE2;
+	case VSOPKERNEL_AVX2: return VsopSum_AVX2;
+	default:              return VsopSum_Scalar;
+	}
+}
+
+const char *VsopKernelName (int type)
+{
+	static const char *name[3] = {"scalar", "SSE2", "AVX2"};
+	return name[type >= 0 && type <= 2 ? type : 0];
+}
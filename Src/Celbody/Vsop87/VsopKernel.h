@@ -0,0 +1,32 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// VsopKernel.h
+// Term summation kernels for VSOP87 series
+//   sum  =  sum_i a_i cos(b_i + c_i t)
+//   dsum = -sum_i c_i a_i sin(b_i + c_i t)
+// The term coefficients are passed as separate arrays (structure of
+// arrays). The SIMD kernels use their own vectorised sine/cosine with
+// Cody-Waite range reduction. The kernel is selected at runtime from the
+// instruction sets supported by the CPU.
+// =======================================================================
+
+#ifndef __VSOPKERNEL_H
+#define __VSOPKERNEL_H
+
+#define VSOPKERNEL_SCALAR 0 // reference implementation using the C library cos/sin
+#define VSOPKERNEL_SSE2   1
+#define VSOPKERNEL_AVX2   2 // AVX2 + FMA
+
+typedef void (*VSOPSUMPROC)(const double *a, const double *b, const double *c, int n, double t, double *sum, double *dsum);
+
+int VsopKernelSupport ();
+// Returns the most capable kernel type supported by the CPU and OS
+
+VSOPSUMPROC VsopSumKernel (int type);
+// Returns the summation function for a kernel type
+
+const char *VsopKernelName (int type);
+
+#endif // !__VSOPKERNEL_H
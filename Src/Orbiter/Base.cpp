@@ -11,6 +11,7 @@
 #include "Mesh.h"
 #include "Log.h"
 #include "Util.h"
+#include "IndexedStream.h"
 #include "GraphicsAPI.h"
 #include <fstream>
 
@@ -54,7 +55,7 @@ Base::Base (char *fname, Planet *_planet, double _lng, double _lat)
 
 	InitDeviceObjects ();
 
-	ifstream ifs (g_pOrbiter->ConfigPath(fname));
+	IndexedIfstream ifs (g_pOrbiter->ConfigPath(fname));
 
 	// read location information from file, if available
 	if (ifs && GetItemString (ifs, "LOCATION", cbuf)) {
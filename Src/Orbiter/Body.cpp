@@ -9,6 +9,7 @@
 #include <fstream>
 #include "Orbiter.h"
 #include "Config.h"
+#include "IndexedStream.h"
 #include "Psys.h"
 #include "Body.h"
 #include "Element.h"
@@ -52,7 +53,7 @@ Body::Body (char *fname)
 	g_pOrbiter->OutputLoadStatus (cpath, 1);
 
 	Setup ();
-	ifstream ifs (cpath);
+	IndexedIfstream ifs (cpath);
 	if (!ifs) return;
 
 	char cbuf[256], *_name = 0;
@@ -42,110 +42,17 @@
 
 #include "Orbiter.h"
 #include "Rigidbody.h"
+#include "Celbody.h"
 #include "Element.h"
+#include "Propagator.h"
 #include "Log.h"
 #include <stdio.h>
 
+using namespace std;
+
 extern TimeData td;
 extern char DBG_MSG[256];
 
-// ===========================================================================
-// Runge-Kutta integration parameters (RK5-RK8)
-// Used by the driver routines below
-// (Note that RK2 and RK4 are implemented directly without using the driver
-// routines)
-// ===========================================================================
-
-// ---------------------------------------------------------------------------
-// RK5 6-stage parameters
-// ---------------------------------------------------------------------------
-
-static const int RK5_n = 6;
-static const double RK5_alpha[RK5_n-1] = {
-	1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0
-};
-static const double RK5_beta[(RK5_n-1)*(RK5_n-1)] = {
-	1.0/5.0, 0, 0, 0, 0,
-	3.0/40.0, 9.0/40.0, 0, 0, 0,
-	44.0/45.0, -56.0/15.0, 32.0/9.0, 0, 0,
-	19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0, 0,
-	9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0
-};
-static const double RK5_gamma[RK5_n] = {
-	35.0/384.0, 0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0
-};
-
-// ---------------------------------------------------------------------------
-// RK6 8-stage parameters
-// ---------------------------------------------------------------------------
-
-static const int RK6_n = 8;
-static const double RK6_alpha[RK6_n-1] = {
-	1.0/6.0, 4.0/15.0, 2.0/3.0, 5.0/6.0, 1.0, 1.0/15.0, 1.0
-};
-static const double RK6_beta[(RK6_n-1)*(RK6_n-1)] = {
-	1.0/6.0, 0, 0, 0, 0, 0, 0,
-	4.0/75.0, 16.0/75.0, 0, 0, 0, 0, 0,
-	5.0/6.0, -8.0/3.0, 5.0/2.0, 0, 0, 0, 0,
-	-165.0/64.0, 55.0/6.0, -425.0/64.0, 85.0/96.0, 0, 0, 0,
-	12.0/5.0, -8.0, 4015.0/612.0, -11.0/36.0, 88.0/255.0, 0, 0,
-	-8263.0/15000.0, 124.0/75.0, -643.0/680.0, -81.0/250.0, 2484.0/10625.0, 0, 0,
-	3501.0/1720.0, -300.0/43.0, 297275.0/52632.0, -319.0/2322.0, 24068.0/84065.0, 0, 3850.0/26703.0
-};
-static const double RK6_gamma[RK6_n] = {
-	3.0/40.0, 0, 875.0/2244.0, 23.0/72.0, 264.0/1955.0, 0, 125.0/11592.0, 43.0/616.0
-};
-
-// ---------------------------------------------------------------------------
-// RK7 11-stage parameters
-// ---------------------------------------------------------------------------
-
-static const int RK7_n = 11;
-static const double RK7_alpha[RK7_n-1] = {
-	2.0/27.0, 1.0/9.0, 1.0/6.0, 5.0/12.0, 1.0/2.0, 5.0/6.0, 1.0/6.0, 2.0/3.0, 1.0/3.0, 1.0
-};
-static const double RK7_beta[(RK7_n-1)*(RK7_n-1)] = {
-	2.0/27.0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	1.0/36.0, 1.0/12.0, 0, 0, 0, 0, 0, 0, 0, 0,
-	1.0/24.0, 0, 1.0/8.0, 0, 0, 0, 0, 0, 0, 0,
-	5.0/12.0, 0, -25.0/16.0, 25.0/16.0, 0, 0, 0, 0, 0, 0,
-	1.0/20.0, 0, 0, 1.0/4.0, 1.0/5.0, 0, 0, 0, 0, 0,
-	-25.0/108.0, 0, 0, 125.0/108.0, -65.0/27.0, 125.0/54.0, 0, 0, 0, 0,
-	31.0/300.0, 0, 0, 0, 61.0/225.0, -2.0/9.0, 13.0/900.0, 0, 0, 0,
-	2.0, 0, 0, -53.0/6.0, 704.0/45.0, -107.0/9.0, 67.0/90.0, 3.0, 0, 0,
-	-91.0/108.0, 0, 0, 23.0/108.0, -976.0/135.0, 311.0/54.0, -19.0/60.0, 17.0/6.0, -1.0/12.0, 0,
-	2383.0/4100.0, 0, 0, -341.0/164.0, 4496.0/1025.0, -301.0/82.0, 2133.0/4100.0, 45.0/82.0, 45.0/164.0, 18.0/41.0
-};
-static const double RK7_gamma[RK7_n] = {
-	41.0/840.0, 0, 0, 0, 0, 34.0/105.0, 9.0/35.0, 9.0/35.0, 9.0/280.0, 9.0/280.0, 41.0/840.0
-};
-
-// ---------------------------------------------------------------------------
-// RK8 13-stage parameters
-// ---------------------------------------------------------------------------
-
-static const int RK8_n = 13;
-static const double RK8_alpha[RK8_n-1] = {
-	2.0/27.0, 1.0/9.0, 1.0/6.0, 5.0/12.0, 1.0/2.0, 5.0/6.0, 1.0/6.0, 2.0/3.0, 1.0/3.0, 1.0, 0, 1.0
-};
-static const double RK8_beta[(RK8_n-1)*(RK8_n-1)] = {
-	2.0/27.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	1.0/36.0, 1.0/12.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	1.0/24.0, 0, 1.0/8.0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	5.0/12.0, 0, -25.0/16.0, 25.0/16.0, 0, 0, 0, 0, 0, 0, 0, 0,
-	1.0/20.0, 0, 0, 1.0/4.0, 1.0/5.0, 0, 0, 0, 0, 0, 0, 0,
-	-25.0/108.0, 0, 0, 125.0/108.0, -65.0/27.0, 125.0/54.0, 0, 0, 0, 0, 0, 0,
-	31.0/300.0, 0, 0, 0, 61.0/225.0, -2.0/9.0, 13.0/900.0, 0, 0, 0, 0, 0,
-	2.0, 0, 0, -53.0/6.0, 704.0/45.0, -107.0/9.0, 67.0/90.0, 3.0, 0, 0, 0, 0,
-	-91.0/108.0, 0, 0, 23.0/108.0, -976.0/135.0, 311.0/54.0, -19.0/60.0, 17.0/6.0, -1.0/12.0, 0, 0, 0,
-	2383.0/4100.0, 0, 0, -341.0/164.0, 4496.0/1025.0, -301.0/82.0, 2133.0/4100.0, 45.0/82.0, 45.0/164.0, 18.0/41.0, 0, 0,
-	3.0/205.0, 0, 0, 0, 0, -6.0/41.0, -3.0/205.0, -3.0/41.0, 3.0/41.0, 6.0/41.0, 0, 0,
-	-1777.0/4100.0, 0, 0, -341.0/164.0, 4496.0/1025.0, -289.0/82.0, 2193.0/4100.0, 51.0/82.0, 33.0/164.0, 12.0/41.0, 0, 1.0
-};
-static const double RK8_gamma[RK8_n] = {
-	0, 0, 0, 0, 0, 34.0/105.0, 9.0/35.0, 9.0/35.0, 9.0/280.0, 9.0/280.0, 0, 41.0/840.0, 41.0/840.0
-};
-
 // ===========================================================================
 // Propagators for linear and angular state vectors combined
 // ===========================================================================
@@ -213,47 +120,14 @@ void RigidBody::RK4_LinAng (double h, int nsub, int isub)
 
 // ---------------------------------------------------------------------------
 // Driver routine for Runge-Kutta solvers RK5-RK8 (linear+angular)
-// Note: NOT THREADSAFE
+// Instantiated for each tableau type RK (see RKStep_LinAng in Propagator.h)
 // ---------------------------------------------------------------------------
 
-void RigidBody::RKdrv_LinAng (double h, int nsub, int isub, int n, const double *alpha, const double *beta, const double *gamma)
+template<class RK>
+void RigidBody::RKdrv_LinAng (double h, int nsub, int isub)
 {
-	int i, j;
-	double bh;
-	static int nbuf = 8;
-	static StateVectors *s = new StateVectors[nbuf]; TRACENEW
-	static Vector *a       = new Vector[nbuf]; TRACENEW  // linear acceleration
-	static Vector *d       = new Vector[nbuf]; TRACENEW  // angular acceleration
-	Vector tau;
-	if (n > nbuf) { // grow buffers
-		delete []s;
-		delete []a;
-		delete []d;
-		s = new StateVectors[n]; TRACENEW
-		a = new Vector[n]; TRACENEW
-		d = new Vector[n]; TRACENEW
-		nbuf = n;
-	}
-
-	s[0].Set (s1->vel, s1->pos, s1->omega, s1->Q);
-	a[0].Set (acc);
-	d[0].Set (arot);
-
-	for (i = 1; i < n; i++) {
-		s[i].Set (s1->vel, s1->pos, s1->omega, s1->Q);
-		for (j = 0; j < i; j++)
-			s[i].Advance (beta[j]*h, a[j], s[j].vel, d[j], s[j].omega);
-		GetIntermediateMoments (a[i],tau,s[i],(isub+alpha[i-1])/nsub, h);
-		d[i].Set (EulerInv_full (tau, s[i].omega));
-		beta += n-1;
-	}
-	for (i = 0; i < n; i++) {
-		bh = gamma[i]*h;
-		rvel_add += a[i]       * bh;
-		rpos_add += s[i].vel   * bh;
-		s1->Q.Rotate (s[i].omega * bh);
-		s1->omega += d[i]      * bh;
-	}
+	LinAngState st = {*s1, acc, arot, rpos_base, rvel_base, rpos_add, rvel_add};
+	RKStep_LinAng<RK> (*this, st, h, (double)isub/nsub, 1.0/nsub);
 }
 
 // ---------------------------------------------------------------------------
@@ -262,7 +136,7 @@ void RigidBody::RKdrv_LinAng (double h, int nsub, int isub, int n, const double
 
 void RigidBody::RK5_LinAng (double h, int nsub, int isub)
 {
-	RKdrv_LinAng (h, nsub, isub, RK5_n, RK5_alpha, RK5_beta, RK5_gamma);
+	RKdrv_LinAng<RK5_Tableau> (h, nsub, isub);
 }
 
 // ---------------------------------------------------------------------------
@@ -271,7 +145,7 @@ void RigidBody::RK5_LinAng (double h, int nsub, int isub)
 
 void RigidBody::RK6_LinAng (double h, int nsub, int isub)
 {
-	RKdrv_LinAng (h, nsub, isub, RK6_n, RK6_alpha, RK6_beta, RK6_gamma);
+	RKdrv_LinAng<RK6_Tableau> (h, nsub, isub);
 }
 
 // ---------------------------------------------------------------------------
@@ -280,7 +154,7 @@ void RigidBody::RK6_LinAng (double h, int nsub, int isub)
 
 void RigidBody::RK7_LinAng (double h, int nsub, int isub)
 {
-	RKdrv_LinAng (h, nsub, isub, RK7_n, RK7_alpha, RK7_beta, RK7_gamma);
+	RKdrv_LinAng<RK7_Tableau> (h, nsub, isub);
 }
 
 // ---------------------------------------------------------------------------
@@ -289,9 +163,44 @@ void RigidBody::RK7_LinAng (double h, int nsub, int isub)
 
 void RigidBody::RK8_LinAng (double h, int nsub, int isub)
 {
-	RKdrv_LinAng (h, nsub, isub, RK8_n, RK8_alpha, RK8_beta, RK8_gamma);
+	RKdrv_LinAng<RK8_Tableau> (h, nsub, isub);
+}
+
+
+// ---------------------------------------------------------------------------
+// Adaptive step size control for the embedded propagators (linear+angular)
+// Propagates s1 across the full frame interval in sub-steps of at most
+// SimDT/nmin (see AdaptiveFrame_LinAng in Propagator.h). The local error
+// tolerance is relative to the distance from the reference body. Step size
+// proposals are carried over to the next frame.
+// Returns the number of accepted sub-steps.
+// ---------------------------------------------------------------------------
+
+template<class RK>
+int RigidBody::Adaptive_LinAng (int nmin)
+{
+	LinAngState st = {*s1, acc, arot, rpos_base, rvel_base, rpos_add, rvel_add};
+	double scale = PropTol * max (pcpos.length(), size);
+	return AdaptiveFrame_LinAng<RK> (*this, st, td.SimDT, nmin, adapt_h, scale);
+}
+
+// ---------------------------------------------------------------------------
+// Adaptive Dormand-Prince 5(4) (linear+angular)
+// ---------------------------------------------------------------------------
+
+int RigidBody::DP5_LinAng (int nmin)
+{
+	return Adaptive_LinAng<DP5_Tableau> (nmin);
 }
 
+// ---------------------------------------------------------------------------
+// Adaptive Fehlberg 7(8) (linear+angular)
+// ---------------------------------------------------------------------------
+
+int RigidBody::RK87_LinAng (int nmin)
+{
+	return Adaptive_LinAng<RK87_Tableau> (nmin);
+}
 
 // ---------------------------------------------------------------------------
 // 2nd order symplectic propagator (linear+angular)
@@ -532,7 +441,7 @@ void RigidBody::RKdrv_Pert (const PertIntData &data, int n, const double *alpha,
 
 void RigidBody::RK8_Pert (const PertIntData &data)
 {
-	RKdrv_Pert (data, RK8_n, RK8_alpha, RK8_beta, RK8_gamma);
+	RKdrv_Pert (data, RK8_Tableau::n, RK8_Tableau::alpha, RK8_Tableau::beta, RK8_Tableau::gamma);
 }
 #endif
 
@@ -664,3 +573,26 @@ void RigidBody::Encke ()
 		for (i = 0; i < 6; i++) x[i] = 0.0;
 	}
 }
+
+// ===========================================================================
+// Symplectic propagator for unpowered orbits (Wisdom-Holman splitting)
+// The Hamiltonian is split into the 2-body Kepler problem with respect to
+// cbody, which is propagated analytically (KeplerDrift), and the perturbations (third
+// bodies, nonspherical gravity field, torques), which are applied as kicks.
+// ===========================================================================
+
+// ---------------------------------------------------------------------------
+// 4th order Wisdom-Holman propagator (linear+angular)
+// Yoshida composition of three 2nd order kick-drift-kick maps.
+// The linear state is propagated in cbody-relative coordinates cpos/cvel.
+// On entry, acc_pert and arot must contain the perturbation and angular
+// accelerations at the start of the step.
+// Note: the propagation of angular state is a leapfrog scheme, and only
+// symplectic for torque-free or decoupled rotation
+// ---------------------------------------------------------------------------
+
+void RigidBody::WH4_LinAng (double h, int nsub, int isub)
+{
+	WH4Step_LinAng (*this, cpos, cvel, acc_pert, *s1, arot, Ggrav * cbody->Mass(), h,
+		(double)isub/nsub, 1.0/nsub);
+}
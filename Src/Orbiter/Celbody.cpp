@@ -12,7 +12,9 @@
 #include "Orbiter.h"
 #include "Element.h"
 #include "Celbody.h"
+#include "GravField.h"
 #include "Log.h"
+#include "IndexedStream.h"
 #include "Orbitersdk.h"
 
 using namespace std;
@@ -43,7 +45,7 @@ CelestialBody::CelestialBody (char *fname)
 	DefaultParam ();
 	ClearModule ();
 
-	ifstream ifs (g_pOrbiter->ConfigPath (fname));
+	IndexedIfstream ifs (g_pOrbiter->ConfigPath (fname));
 	if (!ifs) {
 		LOGOUT_ERR_FILENOTFOUND_MSG(g_pOrbiter->ConfigPath (fname), "while initialising celestial body");
 		g_pOrbiter->TerminateOnError();
@@ -78,6 +80,23 @@ CelestialBody::CelestialBody (char *fname)
 		}
 	}
 
+	if (GetItemString (ifs, "GravityModel", cbuf)) {
+		// spherical harmonic gravity field: file name (relative to config dir)
+		// and optional max. degree
+		const CFG_PHYSICSPRM &prm = g_pOrbiter->Cfg()->CfgPhysicsPrm;
+		char path[256];
+		int maxdeg = prm.GravFieldMaxDegree;
+		if (sscanf (cbuf, "%255s%d", path, &maxdeg) >= 1) {
+			if (maxdeg > prm.GravFieldMaxDegree) maxdeg = prm.GravFieldMaxDegree;
+			gfield = new GravityField; TRACENEW
+			if (!gfield->Load (g_pOrbiter->Cfg()->ConfigPathNoext (path), maxdeg, size, Ggrav*mass, prm.GravFieldTol)) {
+				LOGOUT_WARN ("Could not read gravity model %s", path);
+				delete gfield;
+				gfield = 0;
+			}
+		}
+	}
+
 	if (GetItemBool (ifs, "HasElements", bInitFromElements) && bInitFromElements) {
 		if (GetItemString (ifs, "ElReference", cbuf) &&
 			!_stricmp (cbuf, "ParentEquator"))
@@ -116,6 +135,7 @@ CelestialBody::~CelestialBody ()
 	ClearModule();
 	if (nsecondary) delete []secondary;
 	if (njcoeff) delete []jcoeff;
+	if (gfield) delete gfield;
 }
 
 void CelestialBody::DefaultParam ()
@@ -130,6 +150,7 @@ void CelestialBody::DefaultParam ()
 	rot_T             = 1e100; // no planet rotation
 	Dphi              = 0.0;
 	njcoeff           = 0;     // shape for gravity calculations: spherical by default
+	gfield            = 0;     // no spherical harmonic gravity model
 	cbody             = 0;     // no parent body
 	nsecondary        = 0;     // no child bodies
 	el                = 0;     // elements undefined
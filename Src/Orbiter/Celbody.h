@@ -18,6 +18,8 @@ typedef int    (*OPLANET_Ephemeris)(double mjd, double *ret, int &format);
 typedef int    (*OPLANET_FastEphemeris)(double mjd, double *ret, int &format);
 typedef void   (*OPLANET_AtmPrm)(double alt, ATMPARAM *prm);
 
+class GravityField;
+
 // =======================================================================
 // Class CelestialBody
 // =======================================================================
@@ -120,6 +122,11 @@ public:
 	// shape description for nonspherical gravity calculation. Note that the
 	// first coefficient Jcoeff(0) is J2
 
+	inline const GravityField *GravField () const { return gfield; }
+	// returns the spherical harmonic gravity field model, if defined (GravityModel
+	// entry in the config file). If present, it replaces the Jn coefficients for
+	// nonspherical gravity calculation.
+
 protected:
 	//Matrix R_ref_rel;     // rotation matrix for tilting the axis of rotation (including precession)
 	Matrix R_ecl;         // precession matrix
@@ -210,6 +217,7 @@ private:
 
 	double *jcoeff;          // coefficients Jn of the harmonic expansion of planet ellipsoid shape, starting with J2 (jcoeff[0]=J2, jcoeff[1]=J3, etc.)
 	DWORD njcoeff;           // number of coefficients in the jcoeff list
+	GravityField *gfield;    // spherical harmonic gravity field model (NULL if not defined)
 
 	Vector bpos, bvel;       // object's barycentre state (the barycentre of the set of bodies including *this and its children) with respect to the true position of the parent of *this
 	Vector bposofs, bvelofs; // body barycentre state - true state
@@ -0,0 +1,356 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// ChebEphem.cpp
+// Chebyshev series utilities and segment cache for fast sequential
+// ephemerides, available to celestial body modules (see CelBodyAPI.h)
+// =======================================================================
+
+#define OAPI_IMPLEMENTATION
+
+#include "Orbitersdk.h"
+#include <math.h>
+#include <string.h>
+
+// =======================================================================
+// Chebyshev series utilities
+
+void ChebNodes (int n, double *x)
+{
+	for (int j = 0; j < n; j++)
+		x[j] = cos (PI*(j+0.5)/n);
+}
+
+// -----------------------------------------------------------------------
+
+void ChebFit (int n, const double *f, double *cf)
+{
+	int j, k;
+	for (k = 0; k < n; k++) {
+		double c = 0.0;
+		for (j = 0; j < n; j++)
+			c += f[j] * cos (PI*k*(j+0.5)/n);
+		cf[k] = (k ? 2.0 : 1.0)/n * c;
+	}
+}
+
+// -----------------------------------------------------------------------
+
+void ChebEval (int n, int ncomp, const double *cf, double x, double dxdt, double *pos, double *vel)
+{
+	double T[CHEB_MAXCOEFF], dT[CHEB_MAXCOEFF];
+	int i, k;
+
+	// Chebyshev polynomials and their derivatives
+	T[0] = 1.0, T[1] = x;
+	dT[0] = 0.0, dT[1] = 1.0;
+	for (k = 2; k < n; k++) {
+		T[k]  = 2.0*x*T[k-1] - T[k-2];
+		dT[k] = 2.0*T[k-1] + 2.0*x*dT[k-1] - dT[k-2];
+	}
+	for (i = 0; i < ncomp; i++, cf += n) {
+		double p = 0.0, v = 0.0;
+		for (k = 0; k < n; k++) {
+			p += cf[k]*T[k];
+			v += cf[k]*dT[k];
+		}
+		pos[i] = p;
+		vel[i] = v*dxdt;
+	}
+}
+
+// =======================================================================
+// class ChebEphem
+
+CRITICAL_SECTION ChebEphem::cs;
+HANDLE ChebEphem::hThread = 0;
+HANDLE ChebEphem::hWake = 0;
+volatile bool ChebEphem::bRunThread = false;
+int ChebEphem::nref = 0;
+ChebEphem::JOB ChebEphem::job[CHEB_NJOB];
+int ChebEphem::njob = 0;
+ChebEphem *ChebEphem::active = 0;
+
+// -----------------------------------------------------------------------
+
+ChebEphem::ChebEphem (EPHEMPROC _proc, void *_context, bool _polar, double _mjd_ref)
+{
+	proc = _proc;
+	context = _context;
+	polar = _polar;
+	mjd_ref = _mjd_ref;
+	seglen = 86400.0;
+	tcalib = 0.0;
+	ncalib = nsync = 0;
+	hCalib = 0;
+	for (int i = 0; i < CHEB_NSLOT; i++) {
+		seg[i].state = 0;
+		seg[i].k = 0;
+	}
+
+	if (!nref++) { // first instance starts the worker thread
+		DWORD id;
+		InitializeCriticalSection (&cs);
+		hWake = CreateEvent (NULL, FALSE, FALSE, NULL);
+		bRunThread = true;
+		njob = 0;
+		active = 0;
+		hThread = CreateThread (NULL, 65536, Fit_ThreadProc, 0, 0, &id);
+	}
+}
+
+// -----------------------------------------------------------------------
+
+ChebEphem::~ChebEphem ()
+{
+	int i, j;
+
+	WaitCalibration ();
+	EnterCriticalSection (&cs);
+	for (i = j = 0; i < njob; i++) // remove our pending jobs
+		if (job[i].ce != this) job[j++] = job[i];
+	njob = j;
+	while (active == this) { // wait for the worker to finish our current segment
+		LeaveCriticalSection (&cs);
+		Sleep (1);
+		EnterCriticalSection (&cs);
+	}
+	bool bLast = (--nref == 0);
+	LeaveCriticalSection (&cs);
+
+	if (bLast) { // last instance stops the worker thread
+		bRunThread = false;
+		SetEvent (hWake);
+		WaitForSingleObject (hThread, INFINITE);
+		CloseHandle (hThread);
+		CloseHandle (hWake);
+		DeleteCriticalSection (&cs);
+	}
+}
+
+// -----------------------------------------------------------------------
+
+double ChebEphem::Calibrate (double tol, double maxlen)
+{
+	const double minlen = 3600.0;  // min. segment length [s]
+	LARGE_INTEGER freq, c0, c1;
+	double len, err, err0 = 0.0;
+	int i, nsample = 0;
+
+	QueryPerformanceFrequency (&freq);
+	QueryPerformanceCounter (&c0);
+	for (len = maxlen;; len *= 0.5) {
+		err = FitError (len, nsample);
+		if (err <= tol) break;
+		if (len < maxlen && err > 0.25*err0) {
+			// The fit error should drop by orders of magnitude with each
+			// halving of the segment length. If it doesn't, we have reached
+			// the numerical noise level of the sampling function.
+			len *= 2.0;
+			break;
+		}
+		if (len <= minlen) break;
+		err0 = err;
+	}
+
+	EnterCriticalSection (&cs);
+	seglen = len;
+	for (i = 0; i < CHEB_NSLOT; i++) // invalidate cached segments
+		seg[i].state = 0;
+	LeaveCriticalSection (&cs);
+	QueryPerformanceCounter (&c1);
+	tcalib = (double)(c1.QuadPart-c0.QuadPart)*1e3/(double)freq.QuadPart;
+	ncalib = nsample;
+	return seglen;
+}
+
+// -----------------------------------------------------------------------
+
+void ChebEphem::CalibrateAsync (double tol, double maxlen)
+{
+	DWORD id;
+	WaitCalibration ();
+	caltol = tol;
+	calmaxlen = maxlen;
+	hCalib = CreateThread (NULL, 65536, Calib_ThreadProc, this, 0, &id);
+	if (!hCalib) Calibrate (tol, maxlen);
+}
+
+// -----------------------------------------------------------------------
+
+double ChebEphem::WaitCalibration ()
+{
+	if (!hCalib) return 0.0;
+	LARGE_INTEGER freq, c0, c1;
+	QueryPerformanceFrequency (&freq);
+	QueryPerformanceCounter (&c0);
+	WaitForSingleObject (hCalib, INFINITE);
+	QueryPerformanceCounter (&c1);
+	CloseHandle (hCalib);
+	hCalib = 0;
+	return (double)(c1.QuadPart-c0.QuadPart)*1e3/(double)freq.QuadPart;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD WINAPI ChebEphem::Calib_ThreadProc (void *data)
+{
+	ChebEphem *ce = (ChebEphem*)data;
+	ce->Calibrate (ce->caltol, ce->calmaxlen);
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+
+double ChebEphem::FitError (double len, int &nsample) const
+{
+	// The fit is tested on a set of segments spread over about a year, at
+	// the points halfway between the sampling nodes.
+	const int ntest = 6;           // number of test segments
+	const double tspace = 5.3e6;   // test segment spacing [s]
+	double cf[3][CHEB_NCOEFF], p[6], q[6], err = 0.0;
+	int i, j;
+
+	for (i = 0; i < ntest; i++) {
+		double t0 = i*tspace;
+		Fit (t0, len, cf);
+		for (j = 0; j < 2*CHEB_NCOEFF; j++) {
+			double x = (j+0.5)/CHEB_NCOEFF - 1.0;
+			proc (context, mjd_ref + (t0 + 0.5*len*(x+1.0))/86400.0, p);
+			ChebEval (CHEB_NCOEFF, 3, cf[0], x, 2.0/len, q, q+3);
+			double e = PosError (p, q);
+			if (e > err) err = e;
+		}
+	}
+	nsample += ntest*3*CHEB_NCOEFF;
+	return err;
+}
+
+// -----------------------------------------------------------------------
+
+void ChebEphem::Ephem (double simt, double *ret)
+{
+	if (hCalib) WaitCalibration ();
+
+	__int64 k = (__int64)floor (simt/seglen);
+	SEGMENT &sg = seg[k & (CHEB_NSLOT-1)];
+
+	if (sg.state != 2 || sg.k != k) {
+		// Not fitted yet: fit it here rather than falling back to the
+		// sampling function, so that the result doesn't depend on the
+		// progress of the worker. The worker discards its own fit of the
+		// slot when it finds it no longer pending.
+		double cf[3][CHEB_NCOEFF];
+		Fit (k*seglen, seglen, cf);
+		EnterCriticalSection (&cs);
+		memcpy (sg.cf, cf, sizeof(cf));
+		sg.k = k;
+		InterlockedExchange (&sg.state, 2);
+		LeaveCriticalSection (&cs);
+		nsync++;
+	}
+	double x = 2.0*(simt - k*seglen)/seglen - 1.0;
+	ChebEval (CHEB_NCOEFF, 3, sg.cf[0], x, 2.0/seglen, ret, ret+3);
+	Request (x >= 0.0 ? k+1 : k-1); // prefetch the neighbour we are moving towards
+}
+
+// -----------------------------------------------------------------------
+
+double ChebEphem::PosError (const double *p, const double *q) const
+{
+	double dx, dy, dz;
+	if (polar) {
+		double r = 0.5*(p[2]+q[2]);
+		dx = (p[0]-q[0]) * r * cos (p[1]);
+		dy = (p[1]-q[1]) * r;
+		dz = (p[2]-q[2]);
+		return sqrt (dx*dx + dy*dy + dz*dz) * AU;
+	} else {
+		dx = p[0]-q[0];
+		dy = p[1]-q[1];
+		dz = p[2]-q[2];
+		return sqrt (dx*dx + dy*dy + dz*dz);
+	}
+}
+
+// -----------------------------------------------------------------------
+
+void ChebEphem::Fit (double t0, double len, double (*cf)[CHEB_NCOEFF]) const
+{
+	double x[CHEB_NCOEFF], f[3][CHEB_NCOEFF], ret[6];
+	int i, j;
+
+	// sample at the Chebyshev nodes
+	ChebNodes (CHEB_NCOEFF, x);
+	for (j = 0; j < CHEB_NCOEFF; j++) {
+		proc (context, mjd_ref + (t0 + 0.5*len*(x[j]+1.0))/86400.0, ret);
+		for (i = 0; i < 3; i++) f[i][j] = ret[i];
+	}
+	if (polar) { // remove phase wraps in longitude
+		for (j = 1; j < CHEB_NCOEFF; j++) {
+			if      (f[0][j]-f[0][j-1] >  PI) f[0][j] -= PI2;
+			else if (f[0][j]-f[0][j-1] < -PI) f[0][j] += PI2;
+		}
+	}
+
+	for (i = 0; i < 3; i++)
+		ChebFit (CHEB_NCOEFF, f[i], cf[i]);
+}
+
+// -----------------------------------------------------------------------
+
+void ChebEphem::Request (__int64 k)
+{
+	int i, slot = (int)(k & (CHEB_NSLOT-1));
+	SEGMENT &sg = seg[slot];
+	if (sg.k == k && sg.state) return; // already cached or pending
+
+	EnterCriticalSection (&cs);
+	for (i = 0; i < njob; i++)
+		if (job[i].ce == this && job[i].slot == slot) break;
+	if (i < njob || njob < CHEB_NJOB) {
+		sg.k = k;
+		sg.state = 1;
+		if (i == njob) {
+			job[njob].ce = this;
+			job[njob].slot = slot;
+			njob++;
+		}
+		SetEvent (hWake);
+	}
+	LeaveCriticalSection (&cs);
+}
+
+// -----------------------------------------------------------------------
+
+DWORD WINAPI ChebEphem::Fit_ThreadProc (void *data)
+{
+	double cf[3][CHEB_NCOEFF];
+
+	while (bRunThread) {
+		WaitForSingleObject (hWake, INFINITE);
+		EnterCriticalSection (&cs);
+		while (njob && bRunThread) {
+			ChebEphem *ce = job[0].ce;
+			SEGMENT &sg = ce->seg[job[0].slot];
+			memmove (job, job+1, --njob*sizeof(JOB));
+			if (sg.state != 1) continue;
+			__int64 k = sg.k;
+			double len = ce->seglen;
+			active = ce;
+			LeaveCriticalSection (&cs);
+
+			ce->Fit (k*len, len, cf);
+
+			EnterCriticalSection (&cs);
+			if (sg.state == 1 && sg.k == k) { // still wanted
+				memcpy (sg.cf, cf, sizeof(cf));
+				InterlockedExchange (&sg.state, 2);
+			}
+			active = 0;
+		}
+		LeaveCriticalSection (&cs);
+	}
+	return 0;
+}
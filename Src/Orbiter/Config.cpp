@@ -15,6 +15,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "Config.h"
+#include "IndexedStream.h"
 #include "Astro.h"
 #include "Log.h"
 #include "VectorMap.h"
@@ -48,19 +49,24 @@ CFG_PHYSICSPRM CfgPhysicsPrm_default = {
 	true,		// bOrbitStabilise (use Encke orbit stabilisation)
 	0.05,		// Stabilise_PLimit (perturbation limit for stabilisation)
 	0.01,		// Stabilise_SLimit (step size limit for stabilisation)
+	true,		// bSymplecticWarp (symplectic propagation of unpowered orbits at high time accelerations)
 	0.02,		// PPropSubLimit (orbit step target for perturbation subsampling)
 	10,			// PPropSubMax (max number of subsampling steps for perturbation integration)
 	0.05,		// PPropStepLimit (orbit step limit for nonspherical gravity suppression)
+	20,			// GravFieldMaxDegree (max. degree of spherical harmonic gravity models)
+	1e-10,		// GravFieldTol (relative acceleration threshold for gravity model degree cutoff)
 	4,			// nLPropLevel (number of linear propagator definitions)
 	{PROP_RK2,PROP_RK4,PROP_RK6,PROP_RK8,PROP_RK8},	// LPropMode (linear propagator methods)
 	{0.1,  2.0,  20.0, 200, 500},                   // PropTTgt (time step targets for the propagation levels)
 	{0.2*RAD, 2*RAD, 5*RAD, 20*RAD, 50*RAD},        // PropATgt (angle step targets for the propagation levels)
 	{0.5, 10.0, 100.0, 1e10, 1e10},					// PropTLimit (time step limits for the propagation levels)
 	{1.0*RAD, 4.0*RAD, 10.0*RAD, 1e10, 1e10},		// PropALimit (angle limits for angular propagation levels)
+	1e-10,		// PropTol (relative local error tolerance for adaptive propagators)
 	20.0*RAD,	// APropSubLimit (angle step limit for angular subsampling)
 	10, 		// PropSubMax (max number of subsampling steps)
 	30.0*RAD,	// APropCouplingLimit (angle step limit for cross term suppresion)
-	3600.0*RAD	// APropTorqueLimit (angle step limit for torque suppression)
+	3600.0*RAD,	// APropTorqueLimit (angle step limit for torque suppression)
+	1			// nPhysicsThread (serial vessel state updates)
 };
 
 CFG_LOGICPRM CfgLogicPrm_default = {
@@ -141,7 +147,8 @@ CFG_DEBUGPRM CfgDebugPrm_default = {
 	true,       // bSaveExitScreen (capture screen on scenario exit)
 	false,      // bWireframeMode (don't set renderer to wireframe mode)
 	false,      // bNormaliseNormals (don't auto-normalise all normals)
-	false       // bVerboseLog (no verbose log output)
+	false,      // bVerboseLog (no verbose log output)
+	false       // bStateChecksum (no state checksum output)
 };
 
 CFG_PLANETRENDERPRM CfgPRenderPrm_default = {
@@ -154,7 +161,9 @@ CFG_PLANETRENDERPRM CfgPRenderPrm_default = {
 	5,          // patch mesh resolution power
 	50,			// load frequency (Hz)
 	3,			// aniso mode (1=none)
-	0x0003      // TileLoadFlags (load from individual tile files + compressed archives)
+	0x0003,     // TileLoadFlags (load from individual tile files + compressed archives)
+	4.0,        // PrefetchTime (tile prefetch look-ahead time [s])
+	1024        // TileMemBudget (tile memory budget [MB])
 };
 
 CFG_MAPPRM CfgMapPrm_default = {
@@ -320,6 +329,9 @@ char *readline (istream &is)
 
 bool GetItemString (istream &is, const char *label, char *val)
 {
+	IndexedIfstream *iis = dynamic_cast<IndexedIfstream*>(&is);
+	if (iis) return iis->GetItemString (label, val);
+
 	char cbuf[512], *cl, *cv;
 	int i;
 
@@ -395,6 +407,9 @@ bool GetItemVECTOR (istream &is, const char *label, VECTOR3 &val)
 
 bool FindLine (istream &is, char *line)
 {
+	IndexedIfstream *iis = dynamic_cast<IndexedIfstream*>(&is);
+	if (iis) return iis->FindLine (line);
+
 	bool ok = false;
 	is.seekg (0); // rewind stream
 	if (is.good()) {
@@ -532,6 +547,10 @@ Config::Config (char *fname)
 		CfgPRenderPrm.ResolutionBias = max (-2.0, min (2.0, d));
 	if (GetInt (ifs, "TileLoadFlags", i))
 		CfgPRenderPrm.TileLoadFlags = max (min((DWORD)i, 3), 1);
+	if (GetReal (ifs, "TilePrefetchTime", d))
+		CfgPRenderPrm.PrefetchTime = max (0.0, min (30.0, d));
+	if (GetInt (ifs, "TileMemoryBudget", i))
+		CfgPRenderPrm.TileMemBudget = max (0, i);
 
 	// map dialog parameters
 	if (GetInt (ifs, "MapDlgFlag", i))
@@ -559,9 +578,14 @@ Config::Config (char *fname)
 	GetBool (ifs, "StabiliseOrbits", CfgPhysicsPrm.bOrbitStabilise);
 	GetReal (ifs, "StabilisePLimit", CfgPhysicsPrm.Stabilise_PLimit);
 	GetReal (ifs, "StabiliseSLimit", CfgPhysicsPrm.Stabilise_SLimit);
+	GetBool (ifs, "SymplecticWarp", CfgPhysicsPrm.bSymplecticWarp);
 	if (GetString (ifs, "PertPropSubsampling", cbuf))
 		sscanf (cbuf, "%d%lf", &CfgPhysicsPrm.PPropSubMax, &CfgPhysicsPrm.PPropSubLimit);
 	GetReal (ifs, "PertPropNonsphericalLimit", CfgPhysicsPrm.PPropStepLimit);
+	if (GetInt (ifs, "GravityFieldDegree", i) && i >= 2)
+		CfgPhysicsPrm.GravFieldMaxDegree = i;
+	if (GetReal (ifs, "GravityFieldTolerance", d) && d > 0.0)
+		CfgPhysicsPrm.GravFieldTol = d;
 	GetInt (ifs, "PropStages", CfgPhysicsPrm.nLPropLevel);
 	for (i = 0; i < MAX_PROP_LEVEL; i++) {
 		int n, mode;
@@ -578,7 +602,10 @@ Config::Config (char *fname)
 	}
 	CfgPhysicsPrm.PropTLim[CfgPhysicsPrm.nLPropLevel-1] = 1e10;
 	CfgPhysicsPrm.PropALim[CfgPhysicsPrm.nLPropLevel-1] = 1e10;
+	if (GetReal (ifs, "PropTolerance", d) && d > 0.0)
+		CfgPhysicsPrm.PropTol = d;
 	GetInt (ifs, "PropSubsampling", CfgPhysicsPrm.PropSubMax);
+	GetInt (ifs, "PhysicsThreads", CfgPhysicsPrm.nPhysicsThread);
 
 #ifdef UNDEF
 	// BEGIN OBSOLETE
@@ -674,6 +701,7 @@ Config::Config (char *fname)
 	GetBool (ifs, "WireframeMode", CfgDebugPrm.bWireframeMode);
     GetBool (ifs, "NormaliseNormals", CfgDebugPrm.bNormaliseNormals);
 	GetBool (ifs, "VerboseLog", CfgDebugPrm.bVerboseLog);
+	GetBool (ifs, "StateChecksum", CfgDebugPrm.bStateChecksum);
 
 	GetReal (ifs, "CameraPanspeed", CfgCameraPrm.Panspeed);
 	GetReal (ifs, "CameraTerrainLimit", CfgCameraPrm.TerrainLimit);
@@ -1138,6 +1166,8 @@ BOOL Config::Write (const char *fname) const
 			ofs << "NormaliseNormals = " << BoolStr (CfgDebugPrm.bNormaliseNormals) << '\n';
 		if (CfgDebugPrm.bVerboseLog != CfgDebugPrm_default.bVerboseLog || bEchoAll)
 			ofs << "VerboseLog = " << BoolStr (CfgDebugPrm.bVerboseLog) << '\n';
+		if (CfgDebugPrm.bStateChecksum != CfgDebugPrm_default.bStateChecksum || bEchoAll)
+			ofs << "StateChecksum = " << BoolStr (CfgDebugPrm.bStateChecksum) << '\n';
 	}
 
 	if (memcmp (&CfgPhysicsPrm, &CfgPhysicsPrm_default, sizeof(CFG_PHYSICSPRM)) || bEchoAll) {
@@ -1156,10 +1186,16 @@ BOOL Config::Write (const char *fname) const
 			ofs << "StabilisePLimit = " << CfgPhysicsPrm.Stabilise_PLimit << '\n';
 		if (CfgPhysicsPrm.Stabilise_SLimit != CfgPhysicsPrm_default.Stabilise_SLimit || bEchoAll)
 			ofs << "StabiliseSLimit = " << CfgPhysicsPrm.Stabilise_SLimit << '\n';
+		if (CfgPhysicsPrm.bSymplecticWarp != CfgPhysicsPrm_default.bSymplecticWarp || bEchoAll)
+			ofs << "SymplecticWarp = " << BoolStr (CfgPhysicsPrm.bSymplecticWarp) << '\n';
 		if (CfgPhysicsPrm.PPropSubMax != CfgPhysicsPrm_default.PPropSubMax || CfgPhysicsPrm.PPropSubLimit != CfgPhysicsPrm_default.PPropSubLimit || bEchoAll)
 			ofs << "PertPropSubsampling = " << CfgPhysicsPrm.PPropSubMax << ' ' << CfgPhysicsPrm.PPropSubLimit << '\n';
 		if (CfgPhysicsPrm.PPropStepLimit != CfgPhysicsPrm_default.PPropStepLimit || bEchoAll)
 			ofs << "PertPropNonsphericalLimit = " << CfgPhysicsPrm.PPropStepLimit << '\n';
+		if (CfgPhysicsPrm.GravFieldMaxDegree != CfgPhysicsPrm_default.GravFieldMaxDegree || bEchoAll)
+			ofs << "GravityFieldDegree = " << CfgPhysicsPrm.GravFieldMaxDegree << '\n';
+		if (CfgPhysicsPrm.GravFieldTol != CfgPhysicsPrm_default.GravFieldTol || bEchoAll)
+			ofs << "GravityFieldTolerance = " << CfgPhysicsPrm.GravFieldTol << '\n';
 		if (CfgPhysicsPrm.nLPropLevel != CfgPhysicsPrm_default.nLPropLevel || bEchoAll)
 			ofs << "PropStages = " << CfgPhysicsPrm.nLPropLevel << '\n';
 		for (i = 0; i < MAX_PROP_LEVEL; i++)
@@ -1172,6 +1208,8 @@ BOOL Config::Write (const char *fname) const
 					ofs << ' ' << CfgPhysicsPrm.PropTLim[i] << ' ' << CfgPhysicsPrm.PropALim[i];
 				ofs << '\n';
 			}
+		if (CfgPhysicsPrm.PropTol != CfgPhysicsPrm_default.PropTol || bEchoAll)
+			ofs << "PropTolerance = " << CfgPhysicsPrm.PropTol << '\n';
 #ifdef UNDEF
 		if (CfgPhysicsPrm.APropSubMax != CfgPhysicsPrm_default.APropSubMax || CfgPhysicsPrm.APropSubLimit != CfgPhysicsPrm_default.APropSubLimit || bEchoAll)
 			ofs << "AngPropSubsampling = " << CfgPhysicsPrm.APropSubMax << ' ' << CfgPhysicsPrm.APropSubLimit << '\n';
@@ -1180,6 +1218,8 @@ BOOL Config::Write (const char *fname) const
 #endif
 		if (CfgPhysicsPrm.PropSubMax != CfgPhysicsPrm_default.PropSubMax || bEchoAll)
 			ofs << "PropSubsampling = " << CfgPhysicsPrm.PropSubMax << '\n';
+		if (CfgPhysicsPrm.nPhysicsThread != CfgPhysicsPrm_default.nPhysicsThread || bEchoAll)
+			ofs << "PhysicsThreads = " << CfgPhysicsPrm.nPhysicsThread << '\n';
 	}
 
 	if (memcmp (&CfgPRenderPrm, &CfgPRenderPrm_default, sizeof(CFG_PLANETRENDERPRM)) || bEchoAll) {
@@ -1204,6 +1244,10 @@ BOOL Config::Write (const char *fname) const
 			ofs << "PlanetResolutionBias = " << CfgPRenderPrm.ResolutionBias << '\n';
 		if (CfgPRenderPrm.TileLoadFlags != CfgPRenderPrm_default.TileLoadFlags || bEchoAll)
 			ofs << "TileLoadFlags = " << CfgPRenderPrm.TileLoadFlags << '\n';
+		if (CfgPRenderPrm.PrefetchTime != CfgPRenderPrm_default.PrefetchTime || bEchoAll)
+			ofs << "TilePrefetchTime = " << CfgPRenderPrm.PrefetchTime << '\n';
+		if (CfgPRenderPrm.TileMemBudget != CfgPRenderPrm_default.TileMemBudget || bEchoAll)
+			ofs << "TileMemoryBudget = " << CfgPRenderPrm.TileMemBudget << '\n';
 	}
 
 	if (memcmp (&CfgMapPrm, &CfgMapPrm_default, sizeof (CFG_MAPPRM)) || bEchoAll) {
@@ -37,7 +37,7 @@
 // dynamic state propagation methods
 #define MAX_PROP_LEVEL  5
 #define MAX_APROP_LEVEL 5
-#define NPROP_METHOD   10
+#define NPROP_METHOD   12
 #define NAPROP_METHOD   6
 #define PROP_RK2        0
 #define PROP_RK4        1
@@ -49,6 +49,8 @@
 #define PROP_SY4        7
 #define PROP_SY6        8
 #define PROP_SY8        9
+#define PROP_DP5       10
+#define PROP_RK87      11
 
 #define SURF_MAX_PATCHLEVEL 14
 #define SURF_MAX_PATCHLEVEL2 19
@@ -81,19 +83,24 @@ struct CFG_PHYSICSPRM {
 	bool   bOrbitStabilise;		// use Encke orbit stabilisation at high time accelerations
 	double Stabilise_PLimit;	// perturbation limit for stabilisation
 	double Stabilise_SLimit;	// step size limit for stabilisation
+	bool   bSymplecticWarp;		// symplectic propagation of unpowered orbits at high time accelerations
 	double PPropSubLimit;		// orbit step target for perturbation subsampling
 	int    PPropSubMax;			// max number of subsampling steps (perturbation integration)
 	double PPropStepLimit;		// orbit step limit for nonspherical gravity suppression
+	int    GravFieldMaxDegree;	// max. degree of spherical harmonic gravity models
+	double GravFieldTol;		// relative acceleration threshold for the altitude-dependent gravity model degree cutoff
 	int    nLPropLevel;			// number of linear state propagation levels defined
 	int    PropMode[MAX_PROP_LEVEL];	// propagation mode indices
 	double PropTTgt[MAX_PROP_LEVEL];    // time step targets for the propagation levels
 	double PropATgt[MAX_PROP_LEVEL];    // angle step targets for the propagation levels
 	double PropTLim[MAX_PROP_LEVEL];	// time step limits for the propagation levels
 	double PropALim[MAX_PROP_LEVEL];  // angle step limits for the propagation levels
+	double PropTol;				// relative local error tolerance for adaptive propagators
 	double APropSubLimit;		// angle step limit for subsampling
 	int    PropSubMax;			// max number of subsampling steps
 	double APropCouplingLimit;	// angle step limit for cross term suppresion
 	double APropTorqueLimit;	// angle step limit for torque suppression
+	int    nPhysicsThread;		// number of threads for concurrent vessel state updates (0=auto, 1=serial)
 };
 
 struct CFG_LOGICPRM {
@@ -181,6 +188,7 @@ struct CFG_DEBUGPRM {
 	bool   bWireframeMode;      // set renderer to wireframe mode?
 	bool   bNormaliseNormals;   // force auto-normalisation of all normals?
 	bool   bVerboseLog;         // verbose log output?
+	bool   bStateChecksum;      // log a checksum of all vessel states after each time step?
 };
 
 struct CFG_PLANETRENDERPRM {
@@ -194,6 +202,8 @@ struct CFG_PLANETRENDERPRM {
 	int    LoadFrequency;       // tile load frequency
 	int    AnisoMode;
 	DWORD  TileLoadFlags;       // flags for planetary tile load mechanism
+	double PrefetchTime;        // look-ahead time for predictive tile prefetch [s] (0=disabled)
+	int    TileMemBudget;       // memory budget for planetary tiles [MB] (0=unlimited)
 };
 
 struct CFG_MAPPRM {
@@ -300,6 +310,10 @@ char *readline (std::istream &is);
 // buffer containing the line. The buffer is grown dynamically to
 // hold a string of arbitrary length.
 
+// The item lookups and FindLine scan the stream from the beginning, unless
+// 'is' is an IndexedIfstream (IndexedStream.h), which answers them from an
+// index built on the first query.
+
 bool GetItemString (std::istream &is, const char *label, char *val);
 bool GetItemReal   (std::istream &is, const char *label, double &val);
 bool GetItemInt    (std::istream &is, const char *label, int &val);
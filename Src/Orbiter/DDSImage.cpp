@@ -0,0 +1,138 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// DDSImage.cpp
+// Device-independent reading of DDS texture files.
+// =======================================================================
+
+#include "DDSImage.h"
+#include <stdio.h>
+#include <string.h>
+
+// =======================================================================
+
+HRESULT ParseDDSHeader (const BYTE *buf, size_t nbuf, DDSURFACEDESC2 &ddsd)
+{
+	DWORD dwMagic;
+
+	if (nbuf < DDS_HEADERSIZE)
+		return E_FAIL;
+	memcpy (&dwMagic, buf, sizeof(DWORD));
+	if (dwMagic != MAKEFOURCC('D','D','S',' '))
+		return E_FAIL;
+	memcpy (&ddsd, buf+sizeof(DWORD), sizeof(DDSURFACEDESC2));
+	if (ddsd.dwSize != sizeof(DDSURFACEDESC2) || !ddsd.dwWidth || !ddsd.dwHeight)
+		return E_FAIL;
+	return S_OK;
+}
+
+// =======================================================================
+
+HRESULT ParseDDSImage (const BYTE *buf, size_t nbuf, DDSImage &img)
+{
+	if (FAILED (ParseDDSHeader (buf, nbuf, img.ddsd)))
+		return E_FAIL;
+	if (nbuf-DDS_HEADERSIZE < DDSLevelSize (img.ddsd, 0))
+		return E_FAIL; // truncated
+	img.data.assign (buf+DDS_HEADERSIZE, buf+nbuf);
+	return S_OK;
+}
+
+// =======================================================================
+
+HRESULT ReadDDSImage (const char *path, DDSImage &img)
+{
+	BYTE    hdr[DDS_HEADERSIZE];
+	FILE   *file;
+	long    size;
+	HRESULT hr = E_FAIL;
+
+	if (!(file = fopen (path, "rb")))
+		return hr;
+
+	// read the header, then the surface data straight into the image
+	if (fseek (file, 0, SEEK_END) || (size = ftell (file)) < (long)DDS_HEADERSIZE)
+		goto LFail;
+	fseek (file, 0, SEEK_SET);
+	if (fread (hdr, DDS_HEADERSIZE, 1, file) != 1)
+		goto LFail;
+	if (FAILED (ParseDDSHeader (hdr, DDS_HEADERSIZE, img.ddsd)))
+		goto LFail;
+	img.data.resize (size - DDS_HEADERSIZE);
+	if (img.data.size() && fread (&img.data[0], img.data.size(), 1, file) != 1)
+		goto LFail;
+	if (img.data.size() < DDSLevelSize (img.ddsd, 0))
+		goto LFail; // truncated
+	hr = S_OK;
+
+LFail:
+	fclose (file);
+	return hr;
+}
+
+// =======================================================================
+
+DWORD DDSLevelSize (const DDSURFACEDESC2 &ddsd, DWORD level)
+{
+	const DDPIXELFORMAT &ddpf = ddsd.ddpfPixelFormat;
+	DWORD w = ddsd.dwWidth >> level;  if (!w) w = 1;
+	DWORD h = ddsd.dwHeight >> level; if (!h) h = 1;
+
+	if (ddpf.dwFlags & DDPF_FOURCC) {
+		switch (ddpf.dwFourCC) {
+		case MAKEFOURCC('D','X','T','1'):
+			return ((w+3)/4) * ((h+3)/4) * 8;
+		case MAKEFOURCC('D','X','T','2'):
+		case MAKEFOURCC('D','X','T','3'):
+		case MAKEFOURCC('D','X','T','4'):
+		case MAKEFOURCC('D','X','T','5'):
+			return ((w+3)/4) * ((h+3)/4) * 16;
+		default:
+			return 0;
+		}
+	}
+	return w * h * (ddpf.dwRGBBitCount/8);
+}
+
+// =======================================================================
+
+DWORD DDSFillPattern (const DDPIXELFORMAT &ddpf, BYTE *pattern)
+{
+	static const BYTE grey_block[8]   = {0x10,0x84, 0x10,0x84, 0,0,0,0}; // DXT colour block: both colours 0x8410 (RGB565)
+	static const BYTE dxt3_alpha[8]   = {0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff}; // explicit alpha: all opaque
+	static const BYTE dxt5_alpha[8]   = {0xff,0xff, 0,0,0,0,0,0};          // interpolated alpha: all opaque
+
+	if (ddpf.dwFlags & DDPF_FOURCC) {
+		switch (ddpf.dwFourCC) {
+		case MAKEFOURCC('D','X','T','1'):
+			memcpy (pattern, grey_block, 8);
+			return 8;
+		case MAKEFOURCC('D','X','T','2'):
+		case MAKEFOURCC('D','X','T','3'):
+			memcpy (pattern, dxt3_alpha, 8);
+			memcpy (pattern+8, grey_block, 8);
+			return 16;
+		case MAKEFOURCC('D','X','T','4'):
+		case MAKEFOURCC('D','X','T','5'):
+			memcpy (pattern, dxt5_alpha, 8);
+			memcpy (pattern+8, grey_block, 8);
+			return 16;
+		default:
+			return 0;
+		}
+	}
+	if (ddpf.dwFlags & DDPF_RGB) {
+		// set the most significant bit of each colour channel, and the full alpha channel
+		DWORD i, npix = ddpf.dwRGBBitCount/8, pix = 0;
+		if (!npix || npix > 4) return 0;
+		pix |= ddpf.dwRBitMask & ~(ddpf.dwRBitMask >> 1);
+		pix |= ddpf.dwGBitMask & ~(ddpf.dwGBitMask >> 1);
+		pix |= ddpf.dwBBitMask & ~(ddpf.dwBBitMask >> 1);
+		if (ddpf.dwFlags & DDPF_ALPHAPIXELS) pix |= ddpf.dwRGBAlphaBitMask;
+		for (i = 0; i < npix; i++)
+			pattern[i] = (BYTE)(pix >> (8*i));
+		return npix;
+	}
+	return 0;
+}
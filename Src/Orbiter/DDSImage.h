@@ -0,0 +1,48 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// DDSImage.h
+// Device-independent reading of DDS texture files.
+// The file header and surface data are parsed into system memory without
+// using a Direct3D device, so that textures can be decoded on worker
+// threads (or without a graphics client), and copied into device surfaces
+// in a separate step (see TextureManager).
+// =======================================================================
+
+#ifndef __DDSIMAGE_H
+#define __DDSIMAGE_H
+
+#include <stddef.h>
+#include <vector>
+#include <windows.h>
+#include <ddraw.h>
+
+#define DDS_HEADERSIZE (sizeof(DWORD)+sizeof(DDSURFACEDESC2)) // magic number and surface description
+
+struct DDSImage {
+	DDSURFACEDESC2 ddsd;             // surface description from the file header
+	std::vector<BYTE> data;          // surface data: top level, followed by the mipmaps
+};
+
+HRESULT ParseDDSHeader (const BYTE *buf, size_t nbuf, DDSURFACEDESC2 &ddsd);
+// Check the magic number and surface description at the beginning of a DDS
+// file and return the surface description in ddsd.
+
+HRESULT ParseDDSImage (const BYTE *buf, size_t nbuf, DDSImage &img);
+// Parse a DDS file held in memory. Fails if the header is invalid or the
+// file doesn't contain the complete top level surface.
+
+HRESULT ReadDDSImage (const char *path, DDSImage &img);
+// Read and parse DDS file 'path'. Can be called from any thread.
+
+DWORD DDSLevelSize (const DDSURFACEDESC2 &ddsd, DWORD level);
+// Data size [bytes] of mipmap level 'level' (0 = top level) of a DDS surface,
+// or 0 if the pixel format is not supported.
+
+DWORD DDSFillPattern (const DDPIXELFORMAT &ddpf, BYTE *pattern);
+// Write a neutral grey (opaque) pixel, or compressed block, for pixel format
+// ddpf into pattern (max. 16 bytes), and return its size in bytes, or 0 if
+// the pixel format is not supported.
+
+#endif // !__DDSIMAGE_H
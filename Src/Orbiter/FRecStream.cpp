@@ -0,0 +1,418 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// FRecStream.cpp
+// Binary flight recorder stream.
+// =======================================================================
+
+#include "FRecStream.h"
+#include <string.h>
+
+using namespace std;
+
+const char *FRecStreamExt[FREC_NSTREAM] = {"pos", "att", "atc"};
+
+// =======================================================================
+// Number of values in a sample record of type 'type' (0 for line records)
+
+static DWORD FRecBinNVal (BYTE type)
+{
+	switch (type) {
+	case FRECBIN_POS: return FRECBIN_NPOS;
+	case FRECBIN_ATT: return FRECBIN_NATT;
+	default:          return 0;
+	}
+}
+
+// =======================================================================
+// Text stream line for a sample record, with the precisions used by the
+// text recorder
+
+static void FRecFormatSample (BYTE type, const double *v, char *line)
+{
+	if (type == FRECBIN_POS)
+		sprintf (line, "%.10g %.12g %.12g %.12g %.10g %.10g %.10g", v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+	else
+		sprintf (line, "%.10g %.6g %.6g %.6g", v[0], v[1], v[2], v[3]);
+}
+
+// =======================================================================
+
+static void FRecWriteHeader (FILE *f)
+{
+	FRecBinHeader hdr;
+	memset (&hdr, 0, sizeof(hdr));
+	memcpy (hdr.id, FRECBIN_ID, 8);
+	hdr.version = FRECBIN_VERSION;
+	hdr.hdrSize = sizeof(FRecBinHeader);
+	fwrite (&hdr, sizeof(hdr), 1, f);
+}
+
+static void FRecWriteRecord (FILE *f, BYTE type, BYTE stream, const void *data, DWORD size)
+{
+	FRecBinRecord rec = {type, stream, 0, size};
+	fwrite (&rec, sizeof(rec), 1, f);
+	if (size) fwrite (data, size, 1, f);
+}
+
+// =======================================================================
+// class FRecBinFile
+// =======================================================================
+
+bool FRecBinFile::Open (const char *fname)
+{
+	FILE *f;
+	long size;
+
+	buf.clear();
+	if (!(f = fopen (fname, "rb")))
+		return false;
+	if (!fseek (f, 0, SEEK_END) && (size = ftell (f)) >= (long)sizeof(FRecBinHeader)) {
+		buf.resize (size);
+		fseek (f, 0, SEEK_SET);
+		if (fread (&buf[0], size, 1, f) != 1) buf.clear();
+	}
+	fclose (f);
+
+	if (buf.size() >= sizeof(FRecBinHeader)) {
+		const FRecBinHeader *hdr = (const FRecBinHeader*)&buf[0];
+		if (!memcmp (hdr->id, FRECBIN_ID, 8) && hdr->version == FRECBIN_VERSION && hdr->hdrSize == sizeof(FRecBinHeader))
+			return true;
+	}
+	buf.clear();
+	return false;
+}
+
+// =======================================================================
+
+bool FRecBinFile::Next (size_t &pos, FRecBinRecord &rec, const BYTE *&data) const
+{
+	if (pos < sizeof(FRecBinHeader)) pos = sizeof(FRecBinHeader);
+	if (buf.size() < pos + sizeof(FRecBinRecord))
+		return false;
+	memcpy (&rec, &buf[pos], sizeof(FRecBinRecord));
+	if (buf.size() - (pos + sizeof(FRecBinRecord)) < rec.size)
+		return false; // truncated
+	if (rec.size < FRecBinNVal (rec.type) * sizeof(double))
+		return false; // damaged
+	data = &buf[pos + sizeof(FRecBinRecord)];
+	pos += sizeof(FRecBinRecord) + rec.size;
+	return true;
+}
+
+// =======================================================================
+
+string FRecBinFile::Text (BYTE stream) const
+{
+	string text;
+	FRecBinRecord rec;
+	const BYTE *data;
+	for (size_t pos = 0; Next (pos, rec, data);) {
+		if (rec.type == FRECBIN_LINE && rec.stream == stream) {
+			text.append ((const char*)data, rec.size);
+			text += '\n';
+		}
+	}
+	return text;
+}
+
+// =======================================================================
+// class FRecReader
+// =======================================================================
+
+FRecReader::FRecReader (const FRecBinFile *_bin, const char *textname, BYTE _stream)
+{
+	bin = _bin;
+	pos = 0;
+	stream = _stream;
+	if (!bin) ifs.open (textname);
+}
+
+// =======================================================================
+
+int FRecReader::Next (char *line, int nline, double *val)
+{
+	if (bin) {
+		FRecBinRecord rec;
+		const BYTE *data;
+		while (bin->Next (pos, rec, data)) {
+			if (rec.stream != stream) continue;
+			if (rec.type == FRECBIN_LINE) {
+				DWORD n = min (rec.size, (DWORD)(nline-1));
+				memcpy (line, data, n);
+				line[n] = '\0';
+			} else if (FRecBinNVal (rec.type)) {
+				memcpy (val, data, FRecBinNVal (rec.type) * sizeof(double));
+			} else continue; // unknown record type
+			return rec.type;
+		}
+		return -1;
+	} else {
+		string s;
+		if (!getline (ifs, s)) return -1;
+		if (s.size() && s[s.size()-1] == '\r') s.erase (s.size()-1);
+		strncpy (line, s.c_str(), nline-1);
+		line[nline-1] = '\0';
+		if (stream == FREC_POS && sscanf (line, "%lf%lf%lf%lf%lf%lf%lf", val+0, val+1, val+2, val+3, val+4, val+5, val+6) == 7)
+			return FRECBIN_POS;
+		if (stream == FREC_ATT && sscanf (line, "%lf%lf%lf%lf", val+0, val+1, val+2, val+3) == 4)
+			return FRECBIN_ATT;
+		return FRECBIN_LINE;
+	}
+}
+
+// =======================================================================
+// Conversion between binary and text streams
+// =======================================================================
+
+bool FRecBinToText (const char *basename)
+{
+	char fname[256], line[1024];
+	FRecBinFile bin;
+	FRecBinRecord rec;
+	const BYTE *data;
+	FILE *f[FREC_NSTREAM] = {0};
+	bool ok = true;
+	int i;
+
+	sprintf (fname, "%s.%s", basename, FRECBIN_EXT);
+	if (!bin.Open (fname))
+		return false;
+	for (size_t pos = 0; bin.Next (pos, rec, data);) {
+		if (rec.stream >= FREC_NSTREAM) continue;
+		if (!f[rec.stream]) {
+			sprintf (fname, "%s.%s", basename, FRecStreamExt[rec.stream]);
+			if (!(f[rec.stream] = fopen (fname, "w"))) { ok = false; break; }
+		}
+		if (rec.type == FRECBIN_LINE) {
+			fwrite (data, 1, rec.size, f[rec.stream]);
+			fputc ('\n', f[rec.stream]);
+		} else if (FRecBinNVal (rec.type)) {
+			double val[FRECBIN_NPOS];
+			memcpy (val, data, FRecBinNVal (rec.type) * sizeof(double));
+			FRecFormatSample (rec.type, val, line);
+			fprintf (f[rec.stream], "%s\n", line);
+		}
+	}
+	for (i = 0; i < FREC_NSTREAM; i++)
+		if (f[i] && fclose (f[i])) ok = false;
+	return ok;
+}
+
+// =======================================================================
+
+bool FRecTextToBin (const char *basename)
+{
+	char fname[256], line[1024];
+	double val[FRECBIN_NPOS];
+	FILE *f;
+	int i, type;
+
+	sprintf (fname, "%s.%s", basename, FRecStreamExt[FREC_POS]);
+	if (!(f = fopen (fname, "r")))
+		return false;
+	fclose (f);
+	sprintf (fname, "%s.%s", basename, FRECBIN_EXT);
+	if (!(f = fopen (fname, "wb")))
+		return false;
+	FRecWriteHeader (f);
+	for (i = 0; i < FREC_NSTREAM; i++) {
+		sprintf (fname, "%s.%s", basename, FRecStreamExt[i]);
+		FRecReader rd (0, fname, i);
+		while ((type = rd.Next (line, 1024, val)) >= 0) {
+			if (type == FRECBIN_LINE) FRecWriteRecord (f, FRECBIN_LINE, i, line, strlen(line));
+			else FRecWriteRecord (f, type, i, val, FRecBinNVal (type) * sizeof(double));
+		}
+	}
+	return !fclose (f);
+}
+
+// =======================================================================
+// class FRecWriter
+// =======================================================================
+
+// ring buffer entry: stream handle, record header and record data, padded
+// to FRECENTRY_ALIGN bytes
+struct FRecEntry {
+	DWORD hstream;                    // stream handle, or FRECENTRY_PAD
+	FRecBinRecord rec;
+};
+
+#define FRECENTRY_ALIGN 8
+#define FRECENTRY_PAD   0xffffffff    // marks the unused end of the ring buffer
+
+FRecWriter::FRecWriter (DWORD _ringsize)
+{
+	DWORD id;
+	ringsize = _ringsize & ~(FRECENTRY_ALIGN-1);
+	ring = new BYTE[ringsize];
+	head = tail = used = 0;
+	nrec = nwait = 0;
+	nbyte = 0;
+	InitializeCriticalSection (&cs);
+	InitializeConditionVariable (&data_cv);
+	InitializeConditionVariable (&space_cv);
+	bRunThread = true;
+	hThread = CreateThread (NULL, 65536, Write_ThreadProc, this, 0, &id);
+}
+
+// =======================================================================
+
+FRecWriter::~FRecWriter ()
+{
+	Close();
+	DeleteCriticalSection (&cs);
+	delete []ring;
+}
+
+// =======================================================================
+
+bool FRecWriter::Close ()
+{
+	bool complete = true;
+	if (hThread) {
+		EnterCriticalSection (&cs);
+		bRunThread = false;
+		WakeConditionVariable (&data_cv);
+		LeaveCriticalSection (&cs);
+		if (WaitForSingleObject (hThread, 10000) == WAIT_TIMEOUT) {
+			TerminateThread (hThread, 0);
+			complete = false;
+		}
+		CloseHandle (hThread);
+		hThread = NULL;
+	}
+	head = tail = used = 0;
+	for (size_t i = 0; i < file.size(); i++)
+		if (file[i] && fclose (file[i])) complete = false;
+	file.clear();
+	return complete;
+}
+
+// =======================================================================
+
+int FRecWriter::OpenStream (const char *fname, bool append)
+{
+	FILE *f = fopen (fname, append ? "ab" : "wb");
+	if (!f) return -1;
+	setvbuf (f, NULL, _IOFBF, 16384);
+	fseek (f, 0, SEEK_END);
+	if (!ftell (f)) // new stream
+		FRecWriteHeader (f);
+
+	EnterCriticalSection (&cs);
+	file.push_back (f);
+	int hstream = (int)file.size()-1;
+	LeaveCriticalSection (&cs);
+	return hstream;
+}
+
+// =======================================================================
+
+void FRecWriter::PutLine (int hstream, BYTE stream, const char *line)
+{
+	Put (hstream, FRECBIN_LINE, stream, line, strlen (line));
+}
+
+void FRecWriter::PutSample (int hstream, BYTE type, const double *val)
+{
+	Put (hstream, type, (type == FRECBIN_POS ? FREC_POS : FREC_ATT), val, FRecBinNVal (type) * sizeof(double));
+}
+
+// =======================================================================
+
+void FRecWriter::Put (int hstream, BYTE type, BYTE stream, const void *data, DWORD size)
+{
+	DWORD need = (sizeof(FRecEntry) + size + FRECENTRY_ALIGN-1) & ~(FRECENTRY_ALIGN-1);
+	if (hstream < 0 || need > ringsize) return;
+
+	EnterCriticalSection (&cs);
+	if (!hThread) { // no writer thread: write synchronously
+		if ((size_t)hstream < file.size() && file[hstream]) {
+			FRecWriteRecord (file[hstream], type, stream, data, size);
+			nrec++;
+			nbyte += sizeof(FRecBinRecord) + size;
+		}
+		LeaveCriticalSection (&cs);
+		return;
+	}
+	for (;;) {
+		if (!used) head = tail = 0;
+		DWORD end = (head >= tail && used < ringsize ? ringsize : tail);
+		if (end-head >= need) break;
+		if (end == ringsize && tail >= need) {
+			// not enough space at the end of the buffer: pad and wrap around
+			*(DWORD*)(ring+head) = FRECENTRY_PAD;
+			used += ringsize-head;
+			head = 0;
+			continue;
+		}
+		// buffer full: wait for the writer thread
+		nwait++;
+		WakeConditionVariable (&data_cv);
+		SleepConditionVariableCS (&space_cv, &cs, INFINITE);
+	}
+	FRecEntry *e = (FRecEntry*)(ring+head);
+	e->hstream = hstream;
+	e->rec.type = type;
+	e->rec.stream = stream;
+	e->rec.reserved = 0;
+	e->rec.size = size;
+	memcpy (e+1, data, size);
+	head += need;
+	if (head == ringsize) head = 0;
+	used += need;
+	nrec++;
+	nbyte += sizeof(FRecBinRecord) + size;
+	if (used > ringsize/2) // otherwise the writer thread picks the data up at its next pass
+		WakeConditionVariable (&data_cv);
+	LeaveCriticalSection (&cs);
+}
+
+// =======================================================================
+// Write a block of ring buffer entries to their streams
+
+void FRecWriter::WriteBlock (const BYTE *block, DWORD size, const vector<FILE*> &files)
+{
+	for (DWORD ofs = 0; ofs < size;) {
+		const FRecEntry *e = (const FRecEntry*)(block+ofs);
+		if (e->hstream == FRECENTRY_PAD) break; // rest of the block is padding
+		if (e->hstream < files.size() && files[e->hstream])
+			FRecWriteRecord (files[e->hstream], e->rec.type, e->rec.stream, e+1, e->rec.size);
+		ofs += (sizeof(FRecEntry) + e->rec.size + FRECENTRY_ALIGN-1) & ~(FRECENTRY_ALIGN-1);
+	}
+}
+
+// =======================================================================
+
+DWORD WINAPI FRecWriter::Write_ThreadProc (void *data)
+{
+	FRecWriter *w = (FRecWriter*)data;
+	vector<FILE*> files; // copy of the stream list, for use outside the lock
+
+	EnterCriticalSection (&w->cs);
+	for (;;) {
+		if (!w->used) {
+			if (!w->bRunThread) break;
+			SleepConditionVariableCS (&w->data_cv, &w->cs, FRECWRITER_INTERVAL);
+			continue;
+		}
+		// take the contiguous block of entries at the tail of the buffer
+		DWORD start = w->tail;
+		DWORD n = (w->head > start ? w->head : w->ringsize) - start;
+		if (files.size() != w->file.size()) files = w->file;
+		LeaveCriticalSection (&w->cs);
+
+		w->WriteBlock (w->ring+start, n, files);
+
+		EnterCriticalSection (&w->cs);
+		w->tail = (start+n == w->ringsize ? 0 : start+n);
+		w->used -= n;
+		WakeConditionVariable (&w->space_cv);
+	}
+	LeaveCriticalSection (&w->cs);
+	for (size_t i = 0; i < files.size(); i++)
+		if (files[i]) fflush (files[i]);
+	return 0;
+}
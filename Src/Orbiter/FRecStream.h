@@ -0,0 +1,179 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// FRecStream.h
+// Binary flight recorder stream.
+// The flight recorder writes one binary stream (<vessel>.frb) per vessel
+// into the recording directory, instead of appending each sample to the
+// text streams <vessel>.pos, <vessel>.att and <vessel>.atc. Position/
+// velocity and attitude samples are stored as double-precision records,
+// header lines and articulation events as text line records tagged with
+// the text stream they belong to. The text streams can be generated from
+// a binary stream and vice versa (see frecconv), and playback reads either.
+//
+// File layout:
+//   FRecBinHeader
+//   records: FRecBinRecord, followed by 'size' bytes of record data
+// Values are little-endian. A stream truncated by an aborted session is
+// read up to its last complete record.
+// =======================================================================
+
+#ifndef __FRECSTREAM_H
+#define __FRECSTREAM_H
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <windows.h>
+
+#define FRECBIN_ID      "FRECBIN\x1a" // file identifier (8 bytes including terminator)
+#define FRECBIN_VERSION 1             // increment for any change of the layout
+#define FRECBIN_EXT     "frb"         // file extension of binary streams
+
+// record types
+#define FRECBIN_LINE    0             // text line (without line terminator)
+#define FRECBIN_POS     1             // position/velocity sample: simt, 3 position, 3 velocity values
+#define FRECBIN_ATT     2             // attitude sample: simt, 3 Euler angles
+
+#define FRECBIN_NPOS    7             // number of values in a position/velocity sample
+#define FRECBIN_NATT    4             // number of values in an attitude sample
+
+// text streams of a vessel recording
+enum FRecStreamId {
+	FREC_POS,                         // position/velocity stream (.pos)
+	FREC_ATT,                         // attitude stream (.att)
+	FREC_ATC,                         // articulation/event stream (.atc)
+	FREC_NSTREAM
+};
+
+extern const char *FRecStreamExt[FREC_NSTREAM]; // text stream file extensions
+
+#pragma pack(push,4)
+
+struct FRecBinHeader {                // 16 bytes
+	char id[8];                       // FRECBIN_ID
+	DWORD version;                    // FRECBIN_VERSION
+	DWORD hdrSize;                    // sizeof(FRecBinHeader)
+};
+
+struct FRecBinRecord {                // 8 bytes
+	BYTE type;                        // FRECBIN_xxx
+	BYTE stream;                      // FRecStreamId
+	WORD reserved;
+	DWORD size;                       // size of the record data [bytes]
+};
+
+#pragma pack(pop)
+
+// =======================================================================
+// Read access to a binary stream held in memory
+
+class FRecBinFile {
+public:
+	FRecBinFile () {}
+
+	bool Open (const char *fname);
+	// Read binary stream 'fname'. Returns false if the file does not exist,
+	// or is not a binary stream of this version.
+
+	bool Next (size_t &pos, FRecBinRecord &rec, const BYTE *&data) const;
+	// Return the record at offset 'pos' (0 for the first record) and advance
+	// pos to the next record. Returns false at the end of the stream.
+
+	std::string Text (BYTE stream) const;
+	// All text line records of 'stream', each terminated by '\n'
+
+private:
+	std::vector<BYTE> buf;            // file contents
+};
+
+// =======================================================================
+// Sequential read access to one text stream of a vessel recording, from
+// the binary stream if present, otherwise from the text file
+
+class FRecReader {
+public:
+	FRecReader (const FRecBinFile *bin, const char *textname, BYTE stream);
+	// If bin is 0, the stream is read from text file 'textname'.
+
+	bool IsOpen () const { return bin || ifs.is_open(); }
+
+	int Next (char *line, int nline, double *val);
+	// Read the next record. Returns FRECBIN_LINE with the text line in 'line'
+	// (truncated to nline-1 characters), FRECBIN_POS or FRECBIN_ATT with
+	// the sample values in 'val', or -1 at the end of the stream. Lines of
+	// a text file are returned as samples if they parse as such.
+
+private:
+	const FRecBinFile *bin;           // binary stream, or 0 to read the text file
+	size_t pos;                       // next record in bin
+	BYTE stream;                      // FRecStreamId
+	std::ifstream ifs;                // text file
+};
+
+// =======================================================================
+// Conversion between binary and text streams. 'basename' is the recording
+// path of a vessel without file extension (Flights\<recording>\<vessel>).
+
+bool FRecBinToText (const char *basename);
+// Write the text streams for binary stream <basename>.frb. Streams without
+// records are not written.
+
+bool FRecTextToBin (const char *basename);
+// Write binary stream <basename>.frb for the text streams <basename>.pos,
+// .att and .atc. Returns false if there is no .pos stream.
+
+// =======================================================================
+// Writer for the binary streams of a recording session.
+// Records are copied into a ring buffer by the simulation thread, and
+// written to the stream files by a background thread. The simulation
+// thread only waits if the ring buffer is full.
+
+#define FRECWRITER_RINGSIZE (1<<20)   // ring buffer size [bytes]
+#define FRECWRITER_INTERVAL 200       // max. interval between writer passes [ms]
+
+class FRecWriter {
+public:
+	FRecWriter (DWORD ringsize = FRECWRITER_RINGSIZE);
+	~FRecWriter ();
+
+	bool Close ();
+	// Write all queued records, stop the writer thread and close the streams.
+	// Returns false if records may have been lost. Called on destruction.
+
+	int OpenStream (const char *fname, bool append);
+	// Open binary stream 'fname' and return its handle, or -1 on error. With
+	// 'append', records are appended to an existing stream.
+
+	void PutLine (int hstream, BYTE stream, const char *line);
+	// Queue a text line record for text stream 'stream' (FRecStreamId)
+
+	void PutSample (int hstream, BYTE type, const double *val);
+	// Queue a sample record of type FRECBIN_POS or FRECBIN_ATT
+
+	DWORD nRecord () const { return nrec; }
+	DWORDLONG nByte () const { return nbyte; }
+	DWORD nWait () const { return nwait; }
+	// statistics: records and bytes queued, waits for free buffer space
+
+private:
+	void Put (int hstream, BYTE type, BYTE stream, const void *data, DWORD size);
+	void WriteBlock (const BYTE *block, DWORD size, const std::vector<FILE*> &files);
+	static DWORD WINAPI Write_ThreadProc (void *data);
+
+	BYTE *ring;                       // ring buffer of queued entries
+	DWORD ringsize;                   // ring buffer size [bytes]
+	DWORD head, tail, used;           // insertion and extraction offsets, bytes in use
+	std::vector<FILE*> file;          // open streams, indexed by handle
+	CRITICAL_SECTION cs;              // protects ring state and stream list
+	CONDITION_VARIABLE data_cv;       // signals queued data to the writer thread
+	CONDITION_VARIABLE space_cv;      // signals free buffer space to the simulation thread
+	HANDLE hThread;                   // writer thread
+	bool bRunThread;                  // writer thread keeps running while true
+	DWORD nrec, nwait;                // statistics
+	DWORDLONG nbyte;
+};
+
+#endif // !__FRECSTREAM_H
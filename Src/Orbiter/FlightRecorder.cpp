@@ -15,7 +15,9 @@
 #include "Pane.h"
 #include "State.h"
 #include "MenuInfoBar.h"
+#include "FRecStream.h"
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <io.h>
 #include <direct.h>
@@ -52,6 +54,11 @@ double RecordingSpeed = 1.0;
 double WarpDelay = 0.0;
 Vessel *vfocus = NULL;  // focus vessel as defined by playback stream
 
+static FRecWriter *frwriter = NULL; // binary stream writer of the current recording session
+static DWORD frec_nstep = 0;        // statistics: recorded time steps
+static double frec_stat_simt = -1e10;
+static LONGLONG frec_cost = 0;      // statistics: performance counts spent in Vessel::FRecorder_Save
+
 // ================================================================
 // Local prototypes
 // ================================================================
@@ -87,6 +94,7 @@ void Vessel::FRecorder_Reset ()
 	WarpDelay = 0.0;
 	vfocus = NULL;
 	FRatc_stream = 0;
+	FRstream = -1;
 }
 
 void Vessel::FRecorder_Activate (bool active, const char *fname, bool append)
@@ -96,10 +104,13 @@ void Vessel::FRecorder_Activate (bool active, const char *fname, bool append)
 		if (!append) FRecorder_Reset();
 		bFRrecord = true;
 		char cbuf[256];
-		sprintf (cbuf, "Flights\\%s\\%s.pos", fname, name);
+		sprintf (cbuf, "Flights\\%s\\%s.%s", fname, name, FRECBIN_EXT);
 		if (FRfname) delete []FRfname;
 		FRfname = new char[strlen(cbuf)+1]; TRACENEW
 		strcpy (FRfname, cbuf);
+		FRstream = (frwriter ? frwriter->OpenStream (FRfname, append) : -1);
+		if (FRstream < 0)
+			LOGOUT_ERR ("Flight recorder: cannot open %s", FRfname);
 		Tofs = td.SimT0;
 		MJDofs = td.MJD0;
 		//frec_last.frm = 1;  // for now, record in equatorial frame by default
@@ -107,14 +118,24 @@ void Vessel::FRecorder_Activate (bool active, const char *fname, bool append)
 	} else {
 		bFRrecord = false;
 		FRecorder_Save (true);
+		FRstream = -1;
 	}
 }
 
 void Vessel::FRecorder_Save (bool force)
 {
-	int i, iter = 0, niter = 1;
+	if (FRstream < 0) return;
+
+	int iter = 0, niter = 1;
 	DWORD j;
 	double dt, alim;
+	char cbuf[256];
+	LARGE_INTEGER t0, t1;
+	QueryPerformanceCounter (&t0);
+	if (td.SimT1 != frec_stat_simt) {
+		frec_stat_simt = td.SimT1;
+		frec_nstep++;
+	}
 	bool isfirst   = (frec_last.fstatus == FLIGHTSTATUS_UNDEFINED);
 	bool newstatus = (frec_last.fstatus != fstatus);
 	force = force || isfirst || newstatus;
@@ -157,31 +178,34 @@ void Vessel::FRecorder_Save (bool force)
 				}
 				frec_last.rvel    = vel;
 
-				ofstream ofs (FRfname, ios::app);
-				ofs << setprecision(10)  << (frec_last.simt-Tofs) << ' ';
+				double rec[FRECBIN_NPOS];
+				rec[0] = frec_last.simt-Tofs;
 				if (frec_last.crd == 1) { // store in polar coords
 					double r = frec_last.rpos.length();
 					double phi = atan2 (frec_last.rpos.z, frec_last.rpos.x);
 					double tht = asin (frec_last.rpos.y/r);
-					ofs << setprecision(12) << r << ' ' << phi << ' ' << tht << ' ';
 					double sphi = sin(phi), cphi = cos(phi), stht = sin(tht), ctht = cos(tht);
 					double arg  = cphi*frec_last.rvel.x + sphi*frec_last.rvel.z;
-					double vr   = stht*frec_last.rvel.y + ctht*arg;
-					double vphi = (cphi*frec_last.rvel.z - sphi*frec_last.rvel.x) / (r*ctht);
-					double vtht = (ctht*frec_last.rvel.y - stht*arg)/r;
-					ofs << setprecision(10) << vr << ' ' << vphi << ' ' << vtht << endl;
+					rec[1] = r;
+					rec[2] = phi;
+					rec[3] = tht;
+					rec[4] = stht*frec_last.rvel.y + ctht*arg;                              // vr
+					rec[5] = (cphi*frec_last.rvel.z - sphi*frec_last.rvel.x) / (r*ctht);    // vphi
+					rec[6] = (ctht*frec_last.rvel.y - stht*arg)/r;                          // vtht
 				} else {
-					ofs << setprecision(12) << frec_last.rpos.x << ' ' << frec_last.rpos.y << ' ' << frec_last.rpos.z << ' ';
-					ofs << setprecision(10) << frec_last.rvel.x << ' ' << frec_last.rvel.y << ' ' << frec_last.rvel.z << endl;
+					rec[1] = frec_last.rpos.x, rec[2] = frec_last.rpos.y, rec[3] = frec_last.rpos.z;
+					rec[4] = frec_last.rvel.x, rec[5] = frec_last.rvel.y, rec[6] = frec_last.rvel.z;
 				}
+				frwriter->PutSample (FRstream, FRECBIN_POS, rec);
 			}
 		}
 		if (cbody != ref) {
-			ofstream ofs(FRfname, isfirst ? ios::trunc : ios::app);
-			ofs << "STARTMJD " << setprecision(12) << MJDofs << endl;
-			ofs << "REF " << cbody->Name() << endl;
-			ofs << "FRM " << (frec_last.frm == 0 ? "ECLIPTIC" : "EQUATORIAL") << endl;
-			ofs << "CRD " << (frec_last.crd == 0 ? "CARTESIAN" : "POLAR") << endl;
+			sprintf (cbuf, "STARTMJD %.12g", MJDofs);
+			frwriter->PutLine (FRstream, FREC_POS, cbuf);
+			sprintf (cbuf, "REF %s", cbody->Name());
+			frwriter->PutLine (FRstream, FREC_POS, cbuf);
+			frwriter->PutLine (FRstream, FREC_POS, frec_last.frm == 0 ? "FRM ECLIPTIC" : "FRM EQUATORIAL");
+			frwriter->PutLine (FRstream, FREC_POS, frec_last.crd == 0 ? "CRD CARTESIAN" : "CRD POLAR");
 			frec_last.ref = ref = cbody;
 		}
 	} 
@@ -235,13 +259,8 @@ void Vessel::FRecorder_Save (bool force)
 				if (diff > alim) attforce = true;
 			}
 			if (attforce) {
-				char cbuf[256];
-				strcpy (cbuf, FRfname); strcpy (cbuf+strlen(cbuf)-3, "att");
-				ofstream ofs (cbuf, ios::app);
-				ofs << setprecision(10) << (td.SimT1-Tofs) << setprecision(6);
-				for (i = 0; i < 3; i++)
-					ofs << ' ' << (/*frec_att_last.att[i] =*/ a[i]);
-				ofs << endl;
+				double rec[FRECBIN_NATT] = {td.SimT1-Tofs, a[0], a[1], a[2]};
+				frwriter->PutSample (FRstream, FRECBIN_ATT, rec);
 				frec_att_last.q.Set (q);
 				frec_att_last_syst = td.SysT1;
 				frec_att_last.simt = td.SimT1;
@@ -249,18 +268,18 @@ void Vessel::FRecorder_Save (bool force)
 		
 		}
 		if (ref != sp.ref) {
-			char cbuf[256];
-			strcpy (cbuf, FRfname); strcpy (cbuf+strlen(cbuf)-3, "att");
-			ofstream ofs (cbuf, isfirst ? ios::trunc : ios::app);
-			if (isfirst)
-				ofs << "STARTMJD " << setprecision(12) << MJDofs << endl;
+			if (isfirst) {
+				sprintf (cbuf, "STARTMJD %.12g", MJDofs);
+				frwriter->PutLine (FRstream, FREC_ATT, cbuf);
+			}
 			switch (frec_att_last.frm) {
 			case 0:
-				ofs << "FRM ECLIPTIC" << endl;
+				frwriter->PutLine (FRstream, FREC_ATT, "FRM ECLIPTIC");
 				break;
 			case 1:
-				ofs << "REF " << sp.ref->Name() << endl;
-				ofs << "FRM HORIZON" << endl;
+				sprintf (cbuf, "REF %s", sp.ref->Name());
+				frwriter->PutLine (FRstream, FREC_ATT, cbuf);
+				frwriter->PutLine (FRstream, FREC_ATT, "FRM HORIZON");
 				break;
 			}
 			frec_att_last.ref = ref = sp.ref;
@@ -277,37 +296,36 @@ void Vessel::FRecorder_Save (bool force)
 		}
 		else frec_eng = 0;
 	}
-	bool bfopen = false;
+	std::string eng;
 	dt = td.SimT1-frec_eng_simt;
 	alim = min (0.2, 0.1/dt);
-	ofstream ofs;
 	for (j = 0; j < nthruster; j++) {
 		if (fabs(frec_eng[j]-thruster[j]->level) > alim || force) {
-			if (!bfopen) {
+			if (eng.empty()) {
 				frec_eng_simt = td.SimT1;
-				char cbuf[256];
-				strcpy (cbuf, FRfname); strcpy (cbuf+strlen(cbuf)-3, "atc");
-				ofs.open (cbuf, isfirst ? ios::trunc : ios::app);
-				ofs << setprecision(10) << (frec_eng_simt-Tofs) << " ENG";
-				bfopen = true;
+				sprintf (cbuf, "%.10g ENG", frec_eng_simt-Tofs);
+				eng = cbuf;
 			}
-			ofs << ' ' << j << ':' << setprecision(2) << (frec_eng[j] = thruster[j]->level);
+			sprintf (cbuf, " %d:%.2g", (int)j, frec_eng[j] = thruster[j]->level);
+			eng += cbuf;
 		}
 	}
-	if (bfopen) {
-		ofs << endl;
-		ofs.close();
-	}
+	if (!eng.empty())
+		frwriter->PutLine (FRstream, FREC_ATC, eng.c_str());
+
+	QueryPerformanceCounter (&t1);
+	frec_cost += t1.QuadPart - t0.QuadPart;
 }
 
 // Save a vessel-specific event
 void Vessel::FRecorder_SaveEvent (const char *event_type, const char *event)
 {
-	if (!bFRrecord) return;
+	if (!bFRrecord || FRstream < 0) return;
+	std::string line;
 	char cbuf[256];
-	strcpy (cbuf, FRfname); strcpy (cbuf+strlen(cbuf)-3, "atc");
-	ofstream ofs(cbuf, ios::app);
-	ofs << setprecision(10) << (td.SimT1-Tofs) << ' ' << event_type << ' ' << event << endl;
+	sprintf (cbuf, "%.10g ", td.SimT1-Tofs);
+	line = cbuf; line += event_type; line += ' '; line += event;
+	frwriter->PutLine (FRstream, FREC_ATC, line.c_str());
 }
 
 void Vessel::FRecorder_SaveEventInt (const char *event_type, int event)
@@ -353,36 +371,44 @@ bool Vessel::FRecorder_Read (const char *scname)
 
 	for (i = strlen(scname)-1; i > 0; i--)
 		if (scname[i-1] == '\\') break;
-	sprintf (fname, "Flights\\%s\\%s.pos", scname+i, name);
+	sprintf (fname, "Flights\\%s\\%s.%s", scname+i, name, FRECBIN_EXT);
 
-	ifstream ifs (fname);
-	if (!ifs) {
+	// read the binary stream if present, otherwise the text streams
+	FRecBinFile bin;
+	const FRecBinFile *pbin = (bin.Open (fname) ? &bin : 0);
+	strcpy (fname+strlen(fname)-strlen(FRECBIN_EXT), FRecStreamExt[FREC_POS]);
+
+	FRecReader rd (pbin, fname, FREC_POS);
+	if (!rd.IsOpen()) {
 		bFRplayback = false;
 		return false;
 	}
 
 	FRecorder_Clear();
 	
-	int nbuf = 0, nbuf_att = 0, frm = 0, crd = 0, attfrm = 0;
-	double simt, x, y, z, vx, vy, vz;
+	int nbuf = 0, nbuf_att = 0, frm = 0, crd = 0, attfrm = 0, type;
+	double simt, x, y, z, vx, vy, vz, val[FRECBIN_NPOS];
 	const CelestialBody *ref = g_psys->GetGravObj(0);
 
 	// open position/velocity stream
-	while (ifs.getline (cbuf, 256)) {
-		if (!_strnicmp (cbuf, "REF", 3)) {
-			ref = g_psys->GetGravObj (trim_string (cbuf+4), true);
-			if (!ref) ref = g_psys->GetGravObj (0);
-		} else if (!_strnicmp (cbuf, "FRM", 3)) {
-			if (!_stricmp (trim_string (cbuf+4), "EQUATORIAL")) frm = 1;
-			else frm = 0;
-		} else if (!_strnicmp (cbuf, "CRD", 3)) {
-			if (!_stricmp (trim_string (cbuf+4), "POLAR")) crd = 1;
-			else crd = 0;
-		} else if (!_strnicmp (cbuf, "STARTMJD", 8)) {
-			sscanf (cbuf+9, "%lf", &MJDofs);
-		} else {
-			if (sscanf (cbuf, "%lf%lf%lf%lf%lf%lf%lf", &simt, &x, &y, &z, &vx, &vy, &vz) != 7)
-				continue;
+	while ((type = rd.Next (cbuf, 256, val)) >= 0) {
+		if (type == FRECBIN_LINE) {
+			if (!_strnicmp (cbuf, "REF", 3)) {
+				ref = g_psys->GetGravObj (trim_string (cbuf+4), true);
+				if (!ref) ref = g_psys->GetGravObj (0);
+			} else if (!_strnicmp (cbuf, "FRM", 3)) {
+				if (!_stricmp (trim_string (cbuf+4), "EQUATORIAL")) frm = 1;
+				else frm = 0;
+			} else if (!_strnicmp (cbuf, "CRD", 3)) {
+				if (!_stricmp (trim_string (cbuf+4), "POLAR")) crd = 1;
+				else crd = 0;
+			} else if (!_strnicmp (cbuf, "STARTMJD", 8)) {
+				sscanf (cbuf+9, "%lf", &MJDofs);
+			}
+		} else if (type == FRECBIN_POS) {
+			simt = val[0];
+			x  = val[1], y  = val[2], z  = val[3];
+			vx = val[4], vy = val[5], vz = val[6];
 			if (crd == 1) { // map from polar coords
 				double xz, r = x, phi = y, tht = z;
 				double vr = vx, vphi = vy, vtht = vz;
@@ -411,28 +437,27 @@ bool Vessel::FRecorder_Read (const char *scname)
 			nfrec++;
 		}
 	}
-	ifs.close();
-	ifs.clear();
 	cfrec = 0;
 	cfrec_att = 0;
 
 	// open attitude stream
 	ref = g_psys->GetGravObj(0);
-	strcpy (fname+strlen(fname)-3, "att");
-	ifs.open (fname);
-	while (ifs.getline (cbuf, 256)) {
-		if (!_strnicmp (cbuf, "REF", 3)) {
-			ref = g_psys->GetGravObj (trim_string (cbuf+4), true);
-			if (!ref) ref = g_psys->GetGravObj (0);
-		} else if (!_strnicmp (cbuf, "FRM", 3)) {
-			if (!_stricmp (trim_string (cbuf+4), "HORIZON")) attfrm = 1;
-			else attfrm = 0;
-		} else if (!_strnicmp (cbuf, "STARTMJD", 8)) {
-			sscanf (cbuf+9, "%lf", &MJDofs);
-			// assumes that MJDofs from all streams are the same!
-		} else {
-			double a[3];
-			sscanf (cbuf, "%lf%lf%lf%lf", &simt, a+0, a+1, a+2);
+	strcpy (fname+strlen(fname)-3, FRecStreamExt[FREC_ATT]);
+	FRecReader rd_att (pbin, fname, FREC_ATT);
+	while ((type = rd_att.Next (cbuf, 256, val)) >= 0) {
+		if (type == FRECBIN_LINE) {
+			if (!_strnicmp (cbuf, "REF", 3)) {
+				ref = g_psys->GetGravObj (trim_string (cbuf+4), true);
+				if (!ref) ref = g_psys->GetGravObj (0);
+			} else if (!_strnicmp (cbuf, "FRM", 3)) {
+				if (!_stricmp (trim_string (cbuf+4), "HORIZON")) attfrm = 1;
+				else attfrm = 0;
+			} else if (!_strnicmp (cbuf, "STARTMJD", 8)) {
+				sscanf (cbuf+9, "%lf", &MJDofs);
+				// assumes that MJDofs from all streams are the same!
+			}
+		} else if (type == FRECBIN_ATT) {
+			simt = val[0];
 			if (nfrec_att == nbuf_att) { // re-allocate
 				FRecord_att *tmp = new FRecord_att[nbuf_att += 1024]; TRACENEW
 				if (nfrec_att) {
@@ -446,7 +471,7 @@ bool Vessel::FRecorder_Read (const char *scname)
 			frec_att[nfrec_att].ref = ref;
 
 			// convert Euler angles to quaternions
-			Euler2Quaternion (a, frec_att[nfrec_att].q, frec_att[nfrec_att].frm);
+			Euler2Quaternion (val+1, frec_att[nfrec_att].q, frec_att[nfrec_att].frm);
 			//for (int i = 0; i < 3; i++)
 			//	frec_att[nfrec_att].att[i] = a[i];
 
@@ -456,8 +481,12 @@ bool Vessel::FRecorder_Read (const char *scname)
 
 	// open articulation event stream
 	if (FRatc_stream) delete FRatc_stream;
-	strcpy (cbuf, fname); strcpy (cbuf+strlen(cbuf)-3, "atc");
-	FRatc_stream = new ifstream (cbuf); TRACENEW
+	if (pbin) {
+		FRatc_stream = new istringstream (pbin->Text (FREC_ATC)); TRACENEW
+	} else {
+		strcpy (cbuf, fname); strcpy (cbuf+strlen(cbuf)-3, FRecStreamExt[FREC_ATC]);
+		FRatc_stream = new ifstream (cbuf); TRACENEW
+	}
 	*FRatc_stream >> frec_eng_simt;
 	if (!FRatc_stream->good()) {
 		delete FRatc_stream;
@@ -796,10 +825,28 @@ void Orbiter::FRecorder_Activate (bool active, const char *fname, bool append)
 		if (FRsysname) delete []FRsysname;
 		FRsysname = new char[strlen(cbuf)+1]; TRACENEW
 		strcpy (FRsysname, cbuf);
+		if (!frwriter) {
+			frwriter = new FRecWriter; TRACENEW
+		}
+		frec_nstep = 0;
+		frec_stat_simt = -1e10;
+		frec_cost = 0;
 	} else {
+		// called after the vessels have saved their final samples
 		bRecord = false;
+		if (frwriter) {
+			LARGE_INTEGER freq;
+			QueryPerformanceFrequency (&freq);
+			if (!frwriter->Close())
+				LOGOUT_WARN ("Flight recorder: writer thread did not terminate, recording may be incomplete");
+			LOGOUT ("Flight recorder: %d steps, %0.2f us/step recording cost, %d records (%0.2f MB), %d waits for writer thread",
+				frec_nstep, frec_nstep ? (double)frec_cost/(double)freq.QuadPart*1e6/frec_nstep : 0.0,
+				frwriter->nRecord(), frwriter->nByte()/1048576.0, frwriter->nWait());
+			delete frwriter;
+			frwriter = NULL;
+		}
 	}
-	if (g_pane->MIBar()) g_pane->MIBar()->SetRecording(bRecord);
+	if (g_pane && g_pane->MIBar()) g_pane->MIBar()->SetRecording(bRecord);
 }
 
 // Save a system event
@@ -0,0 +1,254 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// GravField.cpp
+// Spherical harmonic gravity field models of celestial bodies
+//
+// References:
+// S. Pines, "Uniform representation of the gravitational potential and
+//   its derivatives", AIAA Journal 11(11), 1973
+// J. Lundberg and B. Schutz, "Recursion formulas of Legendre functions
+//   for use with nonsingular geopotential models", J. Guidance 11(1), 1988
+// =======================================================================
+
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "GravField.h"
+
+using namespace std;
+
+// normalisation factor ratio helper: K(0) = 1, K(m>0) = 2
+static inline double K (int m) { return (m ? 2.0 : 1.0); }
+
+// =======================================================================
+
+GravityField::GravityField ()
+{
+	GM = R = 0.0;
+	tol = 0.0;
+	nmax = 0;
+	cofs = 0;
+	C = S = 0;
+	n1 = n2 = 0;
+	f3 = f4 = 0;
+	diag = sub = dvar = 0;
+}
+
+// -----------------------------------------------------------------------
+
+GravityField::~GravityField ()
+{
+	Clear ();
+}
+
+// -----------------------------------------------------------------------
+
+void GravityField::Clear ()
+{
+	if (cofs) {
+		delete []cofs;
+		delete []C;
+		delete []S;
+		delete []n1;
+		delete []n2;
+		delete []f3;
+		delete []f4;
+		delete []diag;
+		delete []sub;
+		delete []dvar;
+		cofs = 0;
+		C = S = 0;
+		n1 = n2 = 0;
+		f3 = f4 = 0;
+		diag = sub = dvar = 0;
+	}
+	nmax = 0;
+}
+
+// -----------------------------------------------------------------------
+
+bool GravityField::Load (const char *fname, int maxdeg, double defR, double defGM, double _tol)
+{
+	Clear ();
+	ifstream ifs (fname);
+	if (!ifs) return false;
+
+	char line[512], *pc;
+	int i, n, m, N1, nc;
+	double c, s;
+	bool normalised = true;
+
+	if (maxdeg > GRAVFIELD_MAXDEG) maxdeg = GRAVFIELD_MAXDEG;
+	if (maxdeg < 2) return false;
+	GM = defGM;
+	R  = defR;
+	tol = _tol;
+
+	// coefficient arrays, column-major, degree 0..maxdeg+1 (the recursion
+	// factors are required up to one degree above the model degree)
+	N1 = maxdeg+1;
+	cofs = new int[N1+1];
+	for (m = nc = 0; m <= N1; m++) {
+		cofs[m] = nc;
+		nc += N1-m+1;
+	}
+	C  = new double[nc];
+	S  = new double[nc];
+	n1 = new double[nc];
+	n2 = new double[nc];
+	f3 = new double[nc];
+	f4 = new double[nc];
+	diag = new double[N1+1];
+	sub  = new double[N1+1];
+	dvar = new double[N1+1];
+	memset (C, 0, nc*sizeof(double));
+	memset (S, 0, nc*sizeof(double));
+
+	nmax = 0;
+	while (ifs.getline (line, 512)) {
+		for (pc = line; *pc; pc++) // Fortran-style exponents
+			if (*pc == 'D' || *pc == 'd') {
+				if (pc > line && (pc[-1] == '.' || (pc[-1] >= '0' && pc[-1] <= '9')) &&
+					(pc[1] == '+' || pc[1] == '-' || (pc[1] >= '0' && pc[1] <= '9')))
+					*pc = 'E';
+			}
+		for (pc = line; *pc == ' ' || *pc == '\t'; pc++);
+		if (!_strnicmp (pc, "gfc", 3)) {         // ICGEM data record (gfc or gfct)
+			if (sscanf (pc, "%*s%d%d%lf%lf", &n, &m, &c, &s) != 4) continue;
+		} else if (*pc >= '0' && *pc <= '9') {  // plain coefficient list
+			if (sscanf (pc, "%d%d%lf%lf", &n, &m, &c, &s) != 4) continue;
+		} else {                                // ICGEM header record
+			if (!_strnicmp (pc, "earth_gravity_constant", 22) || !_strnicmp (pc, "gravity_constant", 16))
+				sscanf (pc, "%*s%lf", &GM);
+			else if (!_strnicmp (pc, "radius", 6))
+				sscanf (pc, "%*s%lf", &R);
+			else if (!_strnicmp (pc, "norm", 4) && strstr (pc+4, "unnormalized"))
+				normalised = false;
+			continue;
+		}
+		if (n < 2 || n > maxdeg || m < 0 || m > n) continue; // degree 0 and 1 terms are not used
+		C[Idx(n,m)] = c;
+		S[Idx(n,m)] = s;
+		if (n > nmax) nmax = n;
+	}
+	if (nmax < 2 || R <= 0.0 || GM <= 0.0) {
+		Clear ();
+		return false;
+	}
+
+	if (!normalised) { // convert to fully normalised coefficients
+		for (m = 0; m <= nmax; m++)
+			for (n = (m < 2 ? 2 : m); n <= nmax; n++) {
+				double lnrm = 0.5 * (lgamma (n+m+1.0) - lgamma (n-m+1.0) - log (K(m)*(2.0*n+1.0)));
+				C[Idx(n,m)] *= exp (lnrm);
+				S[Idx(n,m)] *= exp (lnrm);
+			}
+	}
+
+	// recursion factors
+	diag[0] = 1.0;
+	sub[0] = 0.0;
+	for (n = 1; n <= N1; n++) {
+		diag[n] = sqrt ((2.0*n+1.0)*K(n) / (2.0*n*K(n-1))) * diag[n-1];
+		sub[n]  = sqrt (2.0*n*K(n-1) / K(n)) * diag[n];
+	}
+	for (m = 0; m <= N1; m++) {
+		for (n = m; n <= N1; n++) {
+			i = Idx(n,m);
+			if (n >= m+2) {
+				n1[i] = sqrt ((2.0*n-1.0)*(2.0*n+1.0) / ((double)(n-m)*(n+m)));
+				n2[i] = sqrt ((n+m-1.0)*(2.0*n+1.0)*(n-m-1.0) / ((double)(n-m)*(n+m)*(2.0*n-3.0)));
+			} else
+				n1[i] = n2[i] = 0.0;
+			f3[i] = sqrt ((n-m)*(n+m+1.0)*K(m)/K(m+1));
+			f4[i] = sqrt ((n+m+1.0)*(n+m+2.0)*(2.0*n+1.0)/(2.0*n+3.0)*K(m)/K(m+1));
+		}
+	}
+
+	// degree cutoff estimates
+	for (n = 0; n <= N1; n++) {
+		double sum = 0.0;
+		if (n >= 2 && n <= nmax)
+			for (m = 0; m <= n; m++)
+				sum += C[Idx(n,m)]*C[Idx(n,m)] + S[Idx(n,m)]*S[Idx(n,m)];
+		dvar[n] = (n+1.0)*sqrt(sum);
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------
+
+int GravityField::Degree (double r) const
+{
+	double q = R/r, qn = 1.0;
+	int n, deg = 0;
+	for (n = 1; n <= nmax; n++) {
+		qn *= q;
+		if (dvar[n]*qn > tol) deg = n;
+	}
+	return deg;
+}
+
+// -----------------------------------------------------------------------
+
+void GravityField::Column (int m, int nlim, double u, double *A) const
+{
+	int n, i;
+	if (m) A[m-1] = 0.0;
+	A[m] = diag[m];
+	if (nlim > m) A[m+1] = u*sub[m+1];
+	for (n = m+2, i = Idx(n,m); n <= nlim; n++, i++)
+		A[n] = u*n1[i]*A[n-1] - n2[i]*A[n-2];
+}
+
+// -----------------------------------------------------------------------
+
+Vector GravityField::Acc (const Vector &p, int deg) const
+{
+	double Abuf[2][GRAVFIELD_MAXDEG+3];
+	double rho[GRAVFIELD_MAXDEG+1];
+	int n, m, i;
+
+	if (deg > nmax) deg = nmax;
+	if (deg < 2) return Vector(0,0,0);
+
+	double r = p.length(), ir = 1.0/r;
+	double s = p.x*ir, t = p.y*ir, u = p.z*ir; // direction cosines
+	double q = R*ir;
+
+	// radial factors GM/r^2 (R/r)^n
+	rho[0] = GM*ir*ir;
+	for (n = 1; n <= deg; n++)
+		rho[n] = rho[n-1]*q;
+
+	// The derived Legendre functions are generated one order at a time.
+	// Order m requires the columns m and m+1.
+	double *A0 = Abuf[0], *A1 = Abuf[1], *tmp;
+	double re = 1.0, im = 0.0;  // Re, Im (s+it)^m
+	double re1 = 0.0, im1 = 0.0; // Re, Im (s+it)^(m-1)
+	double a1 = 0.0, a2 = 0.0, a3 = 0.0, a4 = 0.0;
+	Column (0, deg+1, u, A0);
+
+	for (m = 0; m <= deg; m++) {
+		Column (m+1, deg+1, u, A1);
+		n = (m < 2 ? 2 : m);
+		for (i = Idx(n,m); n <= deg; n++, i++) {
+			double D = C[i]*re + S[i]*im;
+			if (m) {
+				double rA = rho[n]*m*A0[n];
+				a1 += rA * (C[i]*re1 + S[i]*im1);
+				a2 += rA * (S[i]*re1 - C[i]*im1);
+			}
+			a3 += rho[n]*f3[i]*A1[n]*D;
+			a4 -= rho[n]*f4[i]*A1[n+1]*D;
+		}
+		re1 = re, im1 = im;
+		re = s*re1 - t*im1;
+		im = s*im1 + t*re1;
+		tmp = A0, A0 = A1, A1 = tmp;
+	}
+	return Vector (a1 + s*a4, a2 + t*a4, a3 + u*a4);
+}
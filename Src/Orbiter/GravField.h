@@ -0,0 +1,74 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// GravField.h
+// Spherical harmonic gravity field models of celestial bodies, given by
+// fully normalised coefficients Cnm, Snm up to degree and order N.
+// The field is evaluated with the singularity-free formulation of Pines,
+// using column-wise recursions of the normalised derived Legendre
+// functions, so that no trigonometric functions are required.
+// Depends only on the vector library, so that it can be shared with the
+// gravity field benchmark (Utils/gravbench).
+// =======================================================================
+
+#ifndef __GRAVFIELD_H
+#define __GRAVFIELD_H
+
+#include "Vecmat.h"
+
+#define GRAVFIELD_MAXDEG 180 // max. supported degree
+
+class GravityField {
+public:
+	GravityField ();
+	~GravityField ();
+
+	bool Load (const char *fname, int maxdeg, double defR, double defGM, double tol);
+	// Read coefficients up to degree maxdeg from a file in ICGEM (.gfc) format.
+	// Files without header are read as lists of "n m Cnm Snm" lines, using
+	// reference radius defR and gravitational parameter defGM.
+	// tol: relative acceleration threshold for the degree cutoff (see Degree)
+	// Replaces a previously loaded model.
+	// Return value: false if the file could not be read (no model is loaded).
+
+	inline int MaxDegree () const { return nmax; }
+	inline double RefRadius () const { return R; }
+
+	int Degree (double r) const;
+	// Returns the highest degree whose contribution to the acceleration at
+	// radius r is estimated to exceed the cutoff tolerance, relative to the
+	// point mass term
+
+	Vector Acc (const Vector &p, int deg) const;
+	// Returns the acceleration from the terms of degree 2 to deg at position p
+	// in the body-fixed frame (right-handed, z=north pole, x=prime meridian).
+	// The point mass term (degree 0) is not included.
+	// Note: evaluations are self-contained. The propagators evaluate each
+	// stage at a different point, and the recursions need no trigonometric
+	// functions, so there are no terms to reuse between calls.
+
+private:
+	void Clear ();
+	// release the coefficient arrays
+
+	inline int Idx (int n, int m) const { return cofs[m] + n - m; }
+	// coefficient index for degree n and order m (column-major storage)
+
+	void Column (int m, int nlim, double u, double *A) const;
+	// normalised derived Legendre functions A[n] (n=m..nlim) of order m at u=sin(lat)
+
+	double GM;         // gravitational parameter [m^3/s^2]
+	double R;          // reference radius [m]
+	double tol;        // degree cutoff tolerance
+	int nmax;          // max. degree
+	int *cofs;         // column offsets into the coefficient arrays
+	double *C, *S;     // normalised coefficients
+	double *n1, *n2;   // recursion factors for the derived Legendre functions
+	double *f3, *f4;   // normalisation factors for the order and degree derivatives
+	double *diag;      // diagonal terms A[n][n]
+	double *sub;       // subdiagonal factors: A[n][n-1] = u*sub[n]
+	double *dvar;      // degree cutoff estimate: (n+1)*sqrt(sum_m Cnm^2+Snm^2)
+};
+
+#endif // !__GRAVFIELD_H
@@ -0,0 +1,171 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// IndexedStream.cpp
+// Input file stream for configuration and scenario files which is
+// parsed once into an in-memory index of its items and lines.
+// =======================================================================
+
+#include "IndexedStream.h"
+#include <string.h>
+
+using namespace std;
+
+static const streampos eofpos = streampos(-1); // marks a line terminated by EOF
+
+// =======================================================================
+// Lower-case copy of a string, as used by _stricmp and _strnicmp
+
+static string LowerCase (const char *str)
+{
+	string s(str);
+	for (size_t i = 0; i < s.size(); i++)
+		if (s[i] >= 'A' && s[i] <= 'Z') s[i] += 'a'-'A';
+	return s;
+}
+
+// =======================================================================
+
+IndexedIfstream::IndexedIfstream (): ifstream ()
+{
+	items_indexed = lines_indexed = false;
+}
+
+IndexedIfstream::IndexedIfstream (const char *fname): ifstream (fname)
+{
+	items_indexed = lines_indexed = false;
+}
+
+// =======================================================================
+
+bool IndexedIfstream::GetItemString (const char *label, char *val)
+{
+	if (!items_indexed) IndexItems();
+
+	const ITEM *it = 0;
+	unordered_map<string,ITEM>::const_iterator i = item.find (LowerCase (label));
+	if (i != item.end()) it = &i->second;
+
+	// leave the stream where the scan would have left it
+	clear();
+	if (is_open()) {
+		streampos pos = (it ? it->next : item_end);
+		if (pos == eofpos) {
+			seekg (0, ios::end);
+			setstate (ios::eofbit);
+		} else seekg (pos);
+	}
+
+	if (!it || it->val.empty()) return false;
+	strcpy (val, it->val.c_str());
+	return true;
+}
+
+// =======================================================================
+
+bool IndexedIfstream::FindLine (const char *str)
+{
+	seekg (0); // rewind stream
+	if (good()) {
+		if (!lines_indexed) IndexLines();
+
+		// the lines starting with str are adjacent in the index
+		string s = LowerCase (str);
+		const LINE *ln = 0;
+		for (map<string,LINE>::const_iterator i = line.lower_bound (s); i != line.end() && !i->first.compare (0, s.size(), s); i++)
+			if (!ln || i->second.idx < ln->idx) ln = &i->second;
+		if (ln) {
+			clear();
+			if (ln->next == eofpos) {
+				seekg (0, ios::end);
+				setstate (ios::eofbit);
+			} else seekg (ln->next);
+			return true;
+		}
+	}
+	// reset stream
+	clear();
+	seekg (0);
+	return false;
+}
+
+// =======================================================================
+
+size_t IndexedIfstream::NumItems ()
+{
+	if (!items_indexed) IndexItems();
+	return item.size();
+}
+
+size_t IndexedIfstream::NumLines ()
+{
+	if (!lines_indexed) IndexLines();
+	return line.size();
+}
+
+// =======================================================================
+// Scan the file for "label = value" items in the same way as the original
+// GetItemString scan, and store the first occurrence of each label.
+
+void IndexedIfstream::IndexItems ()
+{
+	char cbuf[512], *cl, *cv, *c;
+	int i;
+
+	item.clear();
+	item_end = eofpos;
+	items_indexed = true;
+
+	clear();
+	seekg (0, ios::beg);
+	while (getline (cbuf, 512)) {
+		// strip comments and trailing white space, skip leading white space
+		for (c = cbuf; *c && *c != ';'; c++);
+		for (*c = '\0', --c; c >= cbuf && (*c == ' ' || *c == '\t'); c--) *c = '\0';
+		for (cl = cbuf; *cl == ' ' || *cl == '\t'; cl++);
+
+		if (!_stricmp (cl, "END_PARSE")) {
+			item_end = (eof() ? eofpos : tellg());
+			return;
+		}
+		for (i = 0; cl[i] && cl[i] != '='; i++);
+		cv = (cl[i] ? cl+(i+1) : cl+i);
+		for (cl[i--] = '\0'; i >= 0 && (cl[i] == ' ' || cl[i] == '\t'); i--)
+			cl[i] = '\0';
+		while (*cv == ' ' || *cv == '\t') cv++;
+		ITEM it = {cv, eofpos};
+		pair<unordered_map<string,ITEM>::iterator,bool> res = item.insert (make_pair (LowerCase (cl), it));
+		if (res.second && !eof()) // first occurrence
+			res.first->second.next = tellg();
+	}
+	clear();
+	item_end = tellg();
+}
+
+// =======================================================================
+// Scan the file lines in the same way as the original FindLine scan
+// (lines longer than the scan buffer are split into several entries),
+// and store the first occurrence of each line.
+
+void IndexedIfstream::IndexLines ()
+{
+	char cbuf[1024];
+
+	line.clear();
+	lines_indexed = true;
+
+	clear();
+	seekg (0);
+	for (size_t idx = 0;; idx++) {
+		if (!getline (cbuf, 1024)) {
+			if (eof()) break;  // EOF
+			else clear();      // heal stream to continue after truncation error
+		}
+		LINE ln = {idx, eofpos};
+		pair<map<string,LINE>::iterator,bool> res = line.insert (make_pair (LowerCase (cbuf), ln));
+		if (res.second && !eof()) // first occurrence
+			res.first->second.next = tellg();
+	}
+	clear();
+}
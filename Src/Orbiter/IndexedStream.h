@@ -0,0 +1,66 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// IndexedStream.h
+// Input file stream for configuration and scenario files which is
+// parsed once into an in-memory index of its items and lines.
+// =======================================================================
+
+#ifndef __INDEXEDSTREAM_H
+#define __INDEXEDSTREAM_H
+
+#include <fstream>
+#include <string>
+#include <map>
+#include <unordered_map>
+
+// =======================================================================
+// An ifstream which answers the item and line queries of GetItemString
+// and FindLine (Config.h) from an index built on the first query, instead
+// of rescanning the file for every key. The lookups return the same results
+// as the scans, and leave the stream at the same position, so the stream
+// can still be read sequentially (e.g. by readline after FindLine).
+// GetItemString and FindLine recognise these streams automatically, so
+// they can be passed anywhere a std::ifstream is expected.
+// Note: the file must not be modified or re-opened after the first query.
+
+class IndexedIfstream: public std::ifstream {
+public:
+	IndexedIfstream ();
+	explicit IndexedIfstream (const char *fname);
+
+	bool GetItemString (const char *label, char *val);
+	// Returns the value of the first "label = value" line (case-insensitive
+	// label) before an optional END_PARSE line. Returns false if the label
+	// is not found or has an empty value.
+
+	bool FindLine (const char *line);
+	// Finds the first line beginning with 'line' (case-insensitive) and
+	// leaves the file pointer at the beginning of the next line.
+
+	size_t NumItems ();
+	size_t NumLines ();
+	// number of indexed items and lines
+
+private:
+	void IndexItems ();
+	void IndexLines ();
+
+	struct ITEM {
+		std::string val;             // item value
+		std::streampos next;         // stream position after the item line
+	};
+	std::unordered_map<std::string,ITEM> item; // lower-case label -> first occurrence
+	std::streampos item_end;         // stream position where the item scan stopped
+	bool items_indexed;
+
+	struct LINE {
+		size_t idx;                  // line number
+		std::streampos next;         // stream position after the line
+	};
+	std::map<std::string,LINE> line; // lower-case line -> first occurrence
+	bool lines_indexed;
+};
+
+#endif // !__INDEXEDSTREAM_H
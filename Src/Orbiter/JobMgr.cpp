@@ -0,0 +1,182 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// JobMgr.cpp
+// Thread pool for distributing independent work items over multiple
+// cores, with work stealing between the threads.
+// =======================================================================
+
+#include "JobMgr.h"
+#include "Log.h"
+
+// -----------------------------------------------------------------------
+// Index ranges are packed into a single 64-bit word, so that the owner
+// (taking items from the front) and thieves (taking items from the back)
+// can modify them with a single compare-and-swap.
+
+static inline LONGLONG PackRange (DWORD begin, DWORD end)
+{
+	return (LONGLONG)(((ULONGLONG)end << 32) | (ULONGLONG)begin);
+}
+
+static inline DWORD RangeBegin (LONGLONG range)
+{
+	return (DWORD)((ULONGLONG)range & 0xFFFFFFFF);
+}
+
+static inline DWORD RangeEnd (LONGLONG range)
+{
+	return (DWORD)((ULONGLONG)range >> 32);
+}
+
+// =======================================================================
+
+JobManager::JobManager (int _nthread)
+{
+	DWORD id;
+	nthread = (_nthread > 1 ? _nthread : 1);
+	proc = 0;
+	context = 0;
+	nactive = 0;
+	bRunThread = true;
+	hDone = CreateEvent (NULL, TRUE, TRUE, NULL);
+	worker = new WORKER[nthread]; TRACENEW
+	for (int i = 0; i < nthread; i++) {
+		worker[i].range = 0;
+		worker[i].mgr = this;
+		worker[i].idx = i;
+		worker[i].hThread = NULL;
+		worker[i].hWake = NULL;
+		if (i) { // worker 0 is the calling thread
+			worker[i].hWake = CreateEvent (NULL, FALSE, FALSE, NULL);
+			worker[i].hThread = CreateThread (NULL, 65536, Worker_ThreadProc, worker+i, 0, &id);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+
+JobManager::~JobManager ()
+{
+	int i;
+	bRunThread = false;
+	for (i = 1; i < nthread; i++)
+		SetEvent (worker[i].hWake);
+	for (i = 1; i < nthread; i++) {
+		if (WaitForSingleObject (worker[i].hThread, 1000) == WAIT_TIMEOUT) {
+			TerminateThread (worker[i].hThread, 0);
+			LOGOUT_WARN ("JobManager: Wait for worker thread timed out.");
+		}
+		CloseHandle (worker[i].hThread);
+		CloseHandle (worker[i].hWake);
+	}
+	delete []worker;
+	CloseHandle (hDone);
+}
+
+// -----------------------------------------------------------------------
+
+int JobManager::DefaultThreadCount ()
+{
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	return (int)si.dwNumberOfProcessors;
+}
+
+// -----------------------------------------------------------------------
+
+void JobManager::ParallelFor (DWORD n, JobProc _proc, void *_context)
+{
+	DWORD i;
+
+	if (nthread == 1 || n < 2) { // nothing to distribute
+		for (i = 0; i < n; i++)
+			_proc (_context, i);
+		return;
+	}
+
+	proc = _proc;
+	context = _context;
+
+	// initial partition: contiguous blocks of similar size
+	for (i = 0; i < (DWORD)nthread; i++) {
+		DWORD begin = (DWORD)(((ULONGLONG)n*i)/nthread);
+		DWORD end   = (DWORD)(((ULONGLONG)n*(i+1))/nthread);
+		InterlockedExchange64 (&worker[i].range, PackRange (begin, end));
+	}
+	nactive = nthread-1;
+	ResetEvent (hDone);
+	for (i = 1; i < (DWORD)nthread; i++)
+		SetEvent (worker[i].hWake);
+
+	Work (0); // the calling thread acts as worker 0
+
+	WaitForSingleObject (hDone, INFINITE);
+}
+
+// -----------------------------------------------------------------------
+
+void JobManager::Work (int idx)
+{
+	DWORD item;
+	do {
+		while (Pop (idx, item))
+			proc (context, item);
+	} while (Steal (idx));
+}
+
+// -----------------------------------------------------------------------
+
+bool JobManager::Pop (int idx, DWORD &item)
+{
+	volatile LONGLONG *range = &worker[idx].range;
+	for (;;) {
+		LONGLONG cur = *range;
+		DWORD begin = RangeBegin (cur), end = RangeEnd (cur);
+		if (begin >= end) return false;
+		if (InterlockedCompareExchange64 (range, PackRange (begin+1, end), cur) == cur) {
+			item = begin;
+			return true;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+
+bool JobManager::Steal (int idx)
+{
+	// Note: the thief's own range is empty at this point, so no other
+	// thread can modify it until it is republished below
+	for (int k = 1; k < nthread; k++) {
+		volatile LONGLONG *range = &worker[(idx+k) % nthread].range;
+		for (;;) {
+			LONGLONG cur = *range;
+			DWORD begin = RangeBegin (cur), end = RangeEnd (cur);
+			if (begin >= end) break; // nothing left to steal from this worker
+			DWORD mid = begin + (end-begin)/2;
+			if (InterlockedCompareExchange64 (range, PackRange (begin, mid), cur) == cur) {
+				InterlockedExchange64 (&worker[idx].range, PackRange (mid, end));
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD WINAPI JobManager::Worker_ThreadProc (void *data)
+{
+	WORKER *w = (WORKER*)data;
+	JobManager *mgr = w->mgr;
+
+	for (;;) {
+		WaitForSingleObject (w->hWake, INFINITE);
+		if (!mgr->bRunThread) break;
+		mgr->Work (w->idx);
+		if (!InterlockedDecrement (&mgr->nactive))
+			SetEvent (mgr->hDone);
+	}
+	return 0;
+}
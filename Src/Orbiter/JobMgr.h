@@ -0,0 +1,69 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// JobMgr.h
+// Thread pool for distributing independent work items (e.g. vessel
+// state updates) over multiple cores.
+// Each worker owns a contiguous range of item indices and processes it
+// from the front. Workers that run out of work steal the back half of
+// another worker's range.
+// =======================================================================
+
+#ifndef __JOBMGR_H
+#define __JOBMGR_H
+
+#include <windows.h>
+
+typedef void (*JobProc)(void *context, DWORD idx);
+// job function template: processes item idx of the job described by context
+
+class JobManager {
+public:
+	JobManager (int nthread);
+	// Create a job manager with nthread threads in total. The calling thread
+	// participates in each job, so nthread-1 worker threads are created.
+
+	~JobManager ();
+
+	inline int nThread () const { return nthread; }
+
+	void ParallelFor (DWORD n, JobProc proc, void *context);
+	// Call proc(context,i) for i=0..n-1, distributed over all threads.
+	// Returns when all items have been processed.
+	// The order in which items are processed is undefined, so proc must not
+	// depend on the results of any other item of the same job.
+	// Must only be called from the thread that created the job manager.
+
+	static int DefaultThreadCount ();
+	// Number of logical processors of the system
+
+private:
+	struct WORKER {
+		volatile LONGLONG range; // packed index range (lo 32 bits: begin, hi 32 bits: end)
+		JobManager *mgr;
+		int idx;                 // worker index (0 = calling thread)
+		HANDLE hThread;
+		HANDLE hWake;            // auto-reset event: new job available
+	} *worker;
+
+	void Work (int idx);
+	// process the worker's own range, then steal from others until all ranges are empty
+
+	bool Pop (int idx, DWORD &item);
+	// take the next item from the front of worker idx's range
+
+	bool Steal (int idx);
+	// move the back half of another worker's range into worker idx's range
+
+	static DWORD WINAPI Worker_ThreadProc (void *data);
+
+	int nthread;               // total number of threads (including caller)
+	JobProc proc;              // current job function
+	void *context;             // current job context
+	volatile LONG nactive;     // number of worker threads still busy with current job
+	volatile bool bRunThread;  // flag for terminating the worker threads
+	HANDLE hDone;              // manual-reset event: all worker threads finished current job
+};
+
+#endif // !__JOBMGR_H
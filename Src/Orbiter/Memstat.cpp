@@ -2,9 +2,13 @@
 // Licensed under the MIT License
 
 #include "Memstat.h"
+#include "Log.h"
 
 bool MemStat::bLib = false;
 HMODULE MemStat::hLib = 0;
+volatile LONG64 MemStat::tileusage[MEMSTAT_NLAYER] = {0};
+volatile LONG64 MemStat::tilepeak[MEMSTAT_NLAYER] = {0};
+LONG64 MemStat::tilebudget = 0;
 
 MemStat::MemStat ()
 {
@@ -33,4 +37,40 @@ long MemStat::HeapUsage ()
 		pGetProcessMemoryInfo (hProc, &pmc, sizeof(pmc));
 		return (long)pmc.WorkingSetSize;
 	} else return 0;
-}
\ No newline at end of file
+}
+
+void MemStat::TileAlloc (int layer, LONG64 bytes)
+{
+	if (!bytes) return;
+	LONG64 usage = InterlockedExchangeAdd64 (tileusage+layer, bytes) + bytes;
+	LONG64 peak = tilepeak[layer];
+	while (usage > peak) {
+		LONG64 prev = InterlockedCompareExchange64 (tilepeak+layer, usage, peak);
+		if (prev == peak) break;
+		peak = prev;
+	}
+}
+
+LONG64 MemStat::TileUsage ()
+{
+	LONG64 usage = 0;
+	for (int i = 0; i < MEMSTAT_NLAYER; i++)
+		usage += tileusage[i];
+	return usage;
+}
+
+const char *MemStat::TileLayerName (int layer)
+{
+	static const char *name[MEMSTAT_NLAYER] = {"Surf", "Mask", "Elev", "Label", "Cloud", "Csphere"};
+	return name[layer];
+}
+
+void MemStat::LogTileUsage ()
+{
+	const double MB = 1.0/(1024.0*1024.0);
+	for (int i = 0; i < MEMSTAT_NLAYER; i++)
+		if (tilepeak[i])
+			LOGOUT ("MemStat: %s tiles %0.1f MB (peak %0.1f MB)", TileLayerName(i), tileusage[i]*MB, tilepeak[i]*MB);
+	if (tilebudget)
+		LOGOUT ("MemStat: tile memory budget %0.0f MB", tilebudget*MB);
+}
@@ -9,6 +9,15 @@
 
 typedef BOOL (CALLBACK *Proc_GetProcessMemoryInfo)(HANDLE,PPROCESS_MEMORY_COUNTERS,DWORD);
 
+// tile memory layers
+#define MEMSTAT_SURF     0 // surface textures and meshes
+#define MEMSTAT_MASK     1 // water mask/night light textures
+#define MEMSTAT_ELEV     2 // elevation data of surface tiles and elevation manager
+#define MEMSTAT_LABEL    3 // surface labels
+#define MEMSTAT_CLOUD    4 // cloud textures and meshes
+#define MEMSTAT_CSPHERE  5 // celestial sphere textures and meshes
+#define MEMSTAT_NLAYER   6
+
 class MemStat {
 public:
     MemStat ();
@@ -16,7 +25,34 @@ public:
 
     long HeapUsage ();
 
+	// Accounting of the memory used by planetary tiles, shared by all tile
+	// managers and elevation managers. Thread-safe.
+
+	static void TileAlloc (int layer, LONG64 bytes);
+	// register an allocation (bytes > 0) or release (bytes < 0) of tile memory
+
+	static LONG64 TileUsage (int layer) { return tileusage[layer]; }
+	static LONG64 TileUsage ();
+	// current tile memory of a layer, or of all layers [bytes]
+
+	static LONG64 TilePeak (int layer) { return tilepeak[layer]; }
+	// peak tile memory of a layer [bytes]
+
+	static void SetTileBudget (LONG64 bytes) { tilebudget = bytes; }
+	static LONG64 TileBudget () { return tilebudget; }
+	static bool TileBudgetExceeded () { return tilebudget && TileUsage() > tilebudget; }
+	// tile memory budget [bytes] (0: unlimited)
+
+	static const char *TileLayerName (int layer);
+
+	static void LogTileUsage ();
+	// write the current and peak tile memory of each layer to the log
+
 private:
+	static volatile LONG64 tileusage[MEMSTAT_NLAYER];
+	static volatile LONG64 tilepeak[MEMSTAT_NLAYER];
+	static LONG64 tilebudget;
+
     static HMODULE hLib;
 	static bool bLib;
     HANDLE hProc;
@@ -2,6 +2,7 @@
 // Licensed under the MIT License
 
 #include "Mesh.h"
+#include "MeshBin.h"
 #include <stdio.h>
 #include "D3dmath.h"
 #include "Orbiter.h"
@@ -1123,6 +1124,57 @@ istream &operator>> (istream &is, Mesh &mesh)
 	return is;
 }
 
+// the binary mesh blocks are copied directly into the group lists
+static_assert (sizeof(NTVERTEX) == sizeof(MeshBinVertex), "NTVERTEX layout does not match binary mesh");
+static_assert (sizeof(D3DMATERIAL7) == sizeof(MeshBinMaterial), "D3DMATERIAL7 layout does not match binary mesh");
+
+void ReadMeshBin (const MeshBinFile &file, Mesh &mesh)
+{
+	const MeshBinHeader &hdr = file.Header();
+	DWORD g, i;
+
+	mesh.Clear();
+
+	for (g = 0; g < hdr.nGrp; g++) {
+		const MeshBinGroup &grp = file.Group (g);
+		NTVERTEX *vtx = new NTVERTEX[grp.nVtx]; TRACENEW
+		memcpy (vtx, file.Vtx (g), grp.nVtx*sizeof(NTVERTEX));
+		WORD *idx = new WORD[grp.nIdx]; TRACENEW
+		memcpy (idx, file.Idx (g), grp.nIdx*sizeof(WORD));
+		mesh.AddGroup (vtx, grp.nVtx, idx, grp.nIdx, grp.mtrlIdx, grp.texIdx, grp.zBias);
+		mesh.Grp[g].Flags = grp.flags;
+		mesh.Grp[g].UsrFlag = grp.usrFlag;
+		if (grp.loadFlags & MESHBIN_GRP_CALCNORMALS) mesh.CalcNormals (g, true);
+		if (grp.flags & 0x04) mesh.MakeGroupVertexBuffer (g);
+	}
+
+	for (i = 0; i < hdr.nMtrl; i++) {
+		D3DMATERIAL7 mtrl;
+		memcpy (&mtrl, &file.Material (i), sizeof(D3DMATERIAL7));
+		mesh.AddMaterial (mtrl);
+	}
+
+	mesh.ReleaseTextures ();
+	if (hdr.nTex) {
+		mesh.Tex = new SURFHANDLE[mesh.nTex = hdr.nTex]; TRACENEW
+		for (i = 0; i < hdr.nTex; i++) {
+			const char *texname = file.TextureName (i);
+			mesh.Tex[i] = 0;
+			if (texname) {
+				bool uncompress = (file.Texture (i).flags & 1) != 0;
+#ifdef INLINEGRAPHICS
+				mesh.Tex[i] = g_texmanager->AcquireTexture (texname, uncompress);
+#else
+				if (g_pOrbiter->GetGraphicsClient())
+					mesh.Tex[i] = g_pOrbiter->GetGraphicsClient()->clbkLoadTexture (texname, 8 | (uncompress ? 2:0));
+#endif // INLINEGRAPHICS
+			}
+		}
+	}
+
+	mesh.Setup();
+}
+
 ostream &operator<< (ostream &os, const Mesh &mesh)
 {
 	DWORD g, i, ntri;
@@ -1205,69 +1257,227 @@ bool Mesh::bEnableSpecular = false;
 
 MeshManager::MeshManager()
 {
-	nmlist = nmlistbuf = 0;
+	nthread = 0;
+	bRunThread = true;
+	nload = npreload = nparsed = 0;
+	InitializeCriticalSection (&cs);
+	InitializeConditionVariable (&queue_cv);
+	InitializeConditionVariable (&done_cv);
 }
 
 MeshManager::~MeshManager()
 {
+	int i;
+	if (nthread) {
+		EnterCriticalSection (&cs);
+		bRunThread = false;
+		queue.clear();
+		WakeAllConditionVariable (&queue_cv);
+		LeaveCriticalSection (&cs);
+		if (WaitForMultipleObjects (nthread, hThread, TRUE, 1000) == WAIT_TIMEOUT) {
+			for (i = 0; i < nthread; i++)
+				TerminateThread (hThread[i], 0);
+			LOGOUT_WARN ("MeshManager: Wait for parse thread timed out.");
+		}
+		for (i = 0; i < nthread; i++)
+			CloseHandle (hThread[i]);
+	}
 	Flush();
+	DeleteCriticalSection (&cs);
 }
 
 void MeshManager::Flush()
 {
-	for (int i = 0; i < nmlist; i++)
-		delete mlist[i].mesh;
-	if (nmlistbuf) {
-		delete []mlist;
-		nmlist = nmlistbuf = 0;
+	MeshList::iterator it;
+
+	EnterCriticalSection (&cs);
+	queue.clear();
+	while (bRunThread) { // wait for the meshes still being parsed
+		for (it = mlist.begin(); it != mlist.end(); it++)
+			if (it->second.state == MESH_PARSING) break;
+		if (it == mlist.end()) break;
+		SleepConditionVariableCS (&done_cv, &cs, INFINITE);
 	}
+	for (it = mlist.begin(); it != mlist.end(); it++) {
+		if (it->second.mesh) delete it->second.mesh;
+		if (it->second.bin) delete it->second.bin;
+	}
+	mlist.clear();
+	if (nload)
+		LOGOUT ("MeshManager: %d meshes loaded, %d preloaded, %d parsed on worker threads", nload, npreload, nparsed);
+	nload = npreload = nparsed = 0;
+	LeaveCriticalSection (&cs);
 }
 
 const Mesh *MeshManager::LoadMesh (const char *fname, bool *firstload)
 {
-	int i;
-	DWORDLONG crc = Str2Crc (fname);
-	for (i = 0; i < nmlist; i++) {
-		if (crc == mlist[i].crc && !_strnicmp (fname, mlist[i].fname, 32)) {
-			if (firstload) *firstload = false;
-			return mlist[i].mesh; // found it
-		}
+	std::string key = Key (fname), path;
+	MeshBinFile *bin = 0;
+	MeshList::iterator it;
+	Mesh *mesh;
+
+	EnterCriticalSection (&cs);
+	for (;;) { // wait while the mesh is parsed or loaded by another thread
+		it = mlist.find (key);
+		if (it == mlist.end() || (it->second.state != MESH_PARSING && it->second.state != MESH_LOADING)) break;
+		SleepConditionVariableCS (&done_cv, &cs, INFINITE);
+	}
+	if (it != mlist.end() && it->second.state == MESH_READY) {
+		mesh = it->second.mesh;
+		LeaveCriticalSection (&cs);
+		if (firstload) *firstload = false;
+		return mesh; // found it
+	}
+	// not loaded yet: use the parse result of the worker thread if available,
+	// otherwise load from file (this also takes over meshes still queued)
+	if (it == mlist.end())
+		it = mlist.insert (std::make_pair (key, MeshEntry())).first;
+	else if (it->second.state == MESH_PARSED) {
+		bin = it->second.bin;
+		it->second.bin = 0;
+		if (bin) nparsed++;
 	}
-	// not found, so load from file
-	ifstream ifs (g_pOrbiter->MeshPath (fname), ios::in);
-	Mesh *mesh = new Mesh; TRACENEW
-	ifs >> *mesh;
-	if (!mesh->nGroup()) { // load error
+	it->second.state = MESH_LOADING;
+	path = g_pOrbiter->MeshPath (fname);
+	LeaveCriticalSection (&cs);
+
+	mesh = new Mesh; TRACENEW
+	if (bin) {
+		ReadMeshBin (*bin, *mesh);
+		delete bin;
+	} else {
+		LoadMeshFile (path.c_str(), *mesh);
+	}
+
+	EnterCriticalSection (&cs);
+	it = mlist.find (key);
+	if (mesh->nGroup()) {
+		it->second.mesh = mesh;
+		it->second.state = MESH_READY;
+		nload++;
+	} else { // load error
+		mlist.erase (it);
+		delete mesh;
+		mesh = 0;
+	}
+	WakeAllConditionVariable (&done_cv);
+	LeaveCriticalSection (&cs);
+
+	if (!mesh) {
 		if (!fname[0]) LOGOUT_ERR ("Mesh file name not provided");
-		else LOGOUT_ERR ("Mesh not found: %s", g_pOrbiter->MeshPath (fname));
+		else LOGOUT_ERR ("Mesh not found: %s", path.c_str());
 		//g_pOrbiter->TerminateOnError ();
-		delete mesh;
 		return 0;
 	}
-	if (nmlist == nmlistbuf) { // need to allocate buffer
-		MeshBuffer *tmp = new MeshBuffer[nmlistbuf += 32]; TRACENEW
-		if (nmlist) {
-			memcpy (tmp, mlist, nmlist*sizeof(MeshBuffer));
-			delete []mlist;
-		}
-		mlist = tmp;
-	}
-	mlist[nmlist].mesh = mesh;
-	mlist[nmlist].crc  = crc;
-	strncpy (mlist[nmlist].fname, fname, 32);
-	nmlist++;
 	if (firstload) *firstload = true;
 	return mesh;
 }
 
+void MeshManager::PreloadMesh (const char *fname)
+{
+	if (!fname[0]) return;
+	std::string key = Key (fname);
+
+	EnterCriticalSection (&cs);
+	if (mlist.find (key) == mlist.end()) {
+		MeshEntry &entry = mlist[key];
+		entry.state = MESH_QUEUED;
+		entry.path = g_pOrbiter->MeshPath (fname);
+		queue.push_back (key);
+		npreload++;
+		if (!nthread) StartThreads();
+		WakeConditionVariable (&queue_cv);
+	}
+	LeaveCriticalSection (&cs);
+}
+
+std::string MeshManager::Key (const char *fname)
+{
+	std::string key(fname);
+	for (size_t i = 0; i < key.size(); i++)
+		if (key[i] >= 'A' && key[i] <= 'Z') key[i] += 'a'-'A';
+		else if (key[i] == '/') key[i] = '\\';
+	return key;
+}
+
+void MeshManager::StartThreads ()
+{
+	// leave one processor to the main thread
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	nthread = max (1, min (MAXMESHTHREAD, (int)si.dwNumberOfProcessors-1));
+	DWORD id;
+	for (int i = 0; i < nthread; i++)
+		hThread[i] = CreateThread (NULL, 65536, Parse_ThreadProc, this, 0, &id);
+	LOGOUT ("MeshManager: %d parse thread(s)", nthread);
+}
+
+DWORD WINAPI MeshManager::Parse_ThreadProc (void *data)
+{
+	MeshManager *mm = (MeshManager*)data;
+	MeshList::iterator it;
+
+	EnterCriticalSection (&mm->cs);
+	while (mm->bRunThread) {
+		if (mm->queue.empty()) {
+			SleepConditionVariableCS (&mm->queue_cv, &mm->cs, INFINITE);
+			continue;
+		}
+		std::string key = mm->queue.front();
+		mm->queue.pop_front();
+		it = mm->mlist.find (key);
+		if (it == mm->mlist.end() || it->second.state != MESH_QUEUED)
+			continue; // flushed, or taken over by LoadMesh
+		it->second.state = MESH_PARSING;
+		std::string path = it->second.path;
+		LeaveCriticalSection (&mm->cs);
+
+		// read the binary mesh if up to date, otherwise compile the source
+		// (meshes the compiler can't handle are left to the parser in LoadMesh)
+		MeshBinFile *bin = new MeshBinFile;
+		if (bin->Open (path.c_str()) != MeshBinFile::MESHBIN_OK &&
+			bin->Compile (path.c_str()) != MeshBinFile::MESHBIN_OK) {
+			delete bin;
+			bin = 0;
+		}
+
+		EnterCriticalSection (&mm->cs);
+		it = mm->mlist.find (key);
+		it->second.bin = bin;
+		it->second.state = MESH_PARSED;
+		WakeAllConditionVariable (&mm->done_cv);
+	}
+	LeaveCriticalSection (&mm->cs);
+	return 0;
+}
+
 // =======================================================================
 // Nonmember functions
 
-bool LoadMesh (const char *meshname, Mesh &mesh)
+bool LoadMeshFile (const char *fname, Mesh &mesh)
 {
-	ifstream ifs (g_pOrbiter->MeshPath (meshname), ios::in);
+	MeshBinFile bin;
+	switch (bin.Open (fname)) {
+	case MeshBinFile::MESHBIN_OK:
+		ReadMeshBin (bin, mesh);
+		return true;
+	case MeshBinFile::MESHBIN_OUTDATED:
+		LOGOUT_WARN ("Binary mesh out of date, using mesh source: %s", fname);
+		break;
+	case MeshBinFile::MESHBIN_INVALID:
+		LOGOUT_WARN ("Binary mesh invalid, using mesh source: %s", fname);
+		break;
+	default:
+		break;
+	}
+	ifstream ifs (fname, ios::in);
 	ifs >> mesh;
-	if (ifs.good()) {
+	return ifs.good();
+}
+
+bool LoadMesh (const char *meshname, Mesh &mesh)
+{
+	if (LoadMeshFile (g_pOrbiter->MeshPath (meshname), mesh)) {
 		return true;
 	} else {
 		LOGOUT_ERR ("Mesh not found: %s", g_pOrbiter->MeshPath (meshname));
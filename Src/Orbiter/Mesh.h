@@ -13,10 +13,15 @@
 #include <d3d.h>
 #include <d3dtypes.h>
 #include <iostream>
+#include <string>
+#include <deque>
+#include <unordered_map>
 #include "OrbiterAPI.h"
 
 typedef char Str256[256];
 
+class MeshBinFile;
+
 const DWORD SPEC_DEFAULT = (DWORD)(-1); // "default" material/texture flag
 const DWORD SPEC_INHERIT = (DWORD)(-2); // "inherit" material/texture flag
 
@@ -206,6 +211,9 @@ public:
 	friend std::ostream &operator<< (std::ostream &os, const Mesh &mesh);
 	// write mesh to file
 
+	friend void ReadMeshBin (const MeshBinFile &file, Mesh &mesh);
+	// read mesh from a mapped binary mesh file (see MeshBin.h)
+
 protected:
 	void ReleaseTextures ();
 	// Release textures acquired by the mesh
@@ -237,6 +245,12 @@ private:
 
 // =======================================================================
 // Class MeshManager: globally managed meshes
+// Meshes are indexed by file name in a hash table, and the manager can be
+// used from several threads. Meshes can be queued for preloading, in which
+// case the mesh files are read and parsed on worker threads, and only the
+// final assembly of the mesh (including texture loading) is left to LoadMesh.
+
+#define MAXMESHTHREAD 8
 
 class MeshManager {
 public:
@@ -248,14 +262,47 @@ public:
 	// Load a mesh from file (or just return a handle if loaded already.
 	// If firstload is used, it is set to true if the mesh was loaded from
 	// file, and false if the mesh was in memory already
+	// If the mesh is being preloaded, the call waits for the worker thread.
+	// Meshes are assembled in the calling thread, which acquires the mesh
+	// textures from the graphics client.
+
+	void PreloadMesh (const char *fname);
+	// Queue a mesh for parsing on the worker threads, so that a subsequent
+	// LoadMesh call for it doesn't need to read the file. Returns immediately.
+	// Meshes already loaded or queued are ignored.
 
 private:
-	struct MeshBuffer {
-		Mesh *mesh;
-		DWORDLONG crc;
-		char fname[32];
-	} *mlist;
-	int nmlist, nmlistbuf;
+	static std::string Key (const char *fname);
+	// hash table key for a mesh file name (case-insensitive)
+
+	void StartThreads ();
+	static DWORD WINAPI Parse_ThreadProc (void *data);
+
+	enum MeshState {
+		MESH_QUEUED,    // waiting for a worker thread
+		MESH_PARSING,   // being parsed by a worker thread
+		MESH_PARSED,    // parsed by a worker thread, waiting for LoadMesh
+		MESH_LOADING,   // being loaded by LoadMesh
+		MESH_READY      // loaded
+	};
+	struct MeshEntry {
+		MeshEntry (): mesh(0), bin(0), state(MESH_LOADING) {}
+		Mesh *mesh;          // the loaded mesh (MESH_READY)
+		MeshBinFile *bin;    // parsed mesh (MESH_PARSED, 0 if the worker couldn't parse it)
+		std::string path;    // mesh file path (preloaded meshes)
+		MeshState state;
+	};
+	typedef std::unordered_map<std::string,MeshEntry> MeshList;
+	MeshList mlist;
+	std::deque<std::string> queue;   // keys of queued meshes
+
+	CRITICAL_SECTION cs;             // protects mlist, queue and statistics
+	CONDITION_VARIABLE queue_cv;     // signalled when meshes are queued
+	CONDITION_VARIABLE done_cv;      // signalled when a mesh has been parsed or loaded
+	HANDLE hThread[MAXMESHTHREAD];
+	int nthread;
+	bool bRunThread;
+	DWORD nload, npreload, nparsed;  // statistics
 };
 
 // =======================================================================
@@ -266,6 +313,12 @@ bool LoadMesh (const char *meshname, Mesh &mesh);
 // meshname is relative to MeshPath directory.
 // Returns true if mesh was loaded, false if not found.
 
+bool LoadMeshFile (const char *fname, Mesh &mesh);
+// Read a mesh from file 'fname' (full path of the mesh source). If an up to
+// date binary mesh (compiled by meshc) exists next to the source, the mesh
+// is read from the binary instead of being parsed from the source.
+// Returns true if the mesh was read, false if the file could not be read.
+
 void CreateSpherePatch (Mesh &mesh, int nlng, int nlat, int ilat, int res,
 	int bseg = -1, bool reduce = true, bool outside = true);
 // Create a mesh representing a rectangular patch on a sphere at a given
@@ -0,0 +1,508 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// MeshBin.cpp
+// Compiled binary mesh format: compiler (used by meshc) and mapped reader
+// (used by the mesh loader).
+// =======================================================================
+
+#include "MeshBin.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _WIN32
+#define strncasecmp _strnicmp
+#else
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+static const DWORD spec_inherit = (DWORD)-2; // as SPEC_INHERIT in Mesh.h
+
+// =======================================================================
+// Content hash: 64-bit multiplicative hash over 8-byte words, with a
+// final avalanche step. Not cryptographic, but any edit of a mesh source
+// changes it with overwhelming probability.
+
+DWORDLONG MeshBinHash (const void *data, size_t size)
+{
+	const DWORDLONG m = 0x9E3779B97F4A7C15ull;
+	const BYTE *p = (const BYTE*)data;
+	DWORDLONG w, h = (DWORDLONG)size * m;
+	size_t i, n = size/8;
+
+	for (i = 0; i < n; i++, p += 8) {
+		memcpy (&w, p, 8);
+		h ^= w;
+		h *= m;
+		h ^= h >> 32;
+	}
+	if (size & 7) {
+		w = 0;
+		memcpy (&w, p, size & 7);
+		h ^= w;
+		h *= m;
+		h ^= h >> 32;
+	}
+	h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+	h ^= h >> 27; h *= 0x94D049BB133111EBull;
+	h ^= h >> 31;
+	return h;
+}
+
+// =======================================================================
+
+string MeshBinName (const char *srcname)
+{
+	string name(srcname);
+	size_t n = strlen (srcname);
+	if (n > 4 && !strncasecmp (srcname+n-4, ".msh", 4)) name += MESHBIN_EXT+3;
+	else name += "." MESHBIN_EXT;
+	return name;
+}
+
+// =======================================================================
+// Line reader for an in-memory text file, with the semantics of
+// istream::getline(buf,256) on a stream opened in text mode, so that the
+// compiler reads a mesh exactly as the Mesh stream operator does:
+// lines are terminated by '\n' ("\r\n" in the file), a line which does not
+// fit the buffer sets the (sticky) fail state, as does reading past the
+// end of the file. A Ctrl-Z character marks the end of the file.
+
+class MeshBinLineReader {
+public:
+	MeshBinLineReader (const char *src, size_t size): p(src), end(src+size), fail(false)
+	{ const char *z = (const char*)memchr (src, 0x1a, size); if (z) end = z; }
+
+	bool getline (char *buf, size_t n)
+	{
+		size_t i = 0;
+		buf[0] = '\0';
+		if (fail) return false;
+		for (;;) {
+			if (p == end) {
+				fail = (i == 0); // nothing extracted
+				break;
+			}
+			char c = *p;
+			if (c == '\r' && p+1 < end && p[1] == '\n') c = *++p;
+			if (c == '\n') { p++; break; }
+			if (i == n-1) { fail = true; break; } // line too long
+			buf[i++] = c; p++;
+		}
+		buf[i] = '\0';
+		return !fail;
+	}
+
+private:
+	const char *p, *end;
+	bool fail;
+};
+
+// =======================================================================
+// The parser follows the Mesh stream operator (Mesh.cpp) line by line.
+// Sources which the stream operator only reads partially (truncated files,
+// groups skipped for parse errors) are rejected, so that they are always
+// loaded from the source.
+
+bool MeshBinParse (const char *src, size_t size, MeshBinData &data)
+{
+	MeshBinLineReader is(src, size);
+	char cbuf[256];
+	int i, j, g, ngrp, nvtx, ntri, nmtrl, mtrl_idx, ntex, tex_idx, flag, res;
+	DWORD uflag;
+	WORD zbias;
+	bool staticmesh = false;
+
+	data.grp.clear();
+	data.mtrl.clear();
+	data.tex.clear();
+
+	if (!is.getline (cbuf, 256)) return false;
+	if (strcmp (cbuf, "MSHX1")) return false;
+
+	for (;;) {
+		if (!is.getline (cbuf, 256)) return false;
+		if (!strncasecmp (cbuf, "GROUPS", 6)) {
+			if (sscanf (cbuf+6, "%d", &ngrp) != 1) return false;
+			break;
+		} else if (!strncasecmp (cbuf, "STATICMESH", 10)) {
+			staticmesh = true;
+		}
+	}
+	if (ngrp < 0) return false;
+
+	for (g = 0; g < ngrp; g++) {
+
+		// set defaults
+		mtrl_idx = spec_inherit;
+		tex_idx  = spec_inherit;
+		zbias    = 0;
+		flag     = (staticmesh ? 0x04 : 0);
+		uflag    = 0;
+		bool bnormal = true, calcnml = false;
+		bool flipidx = false;
+
+		for (;;) {
+			if (!is.getline (cbuf, 256)) return false;
+			if (!strncasecmp (cbuf, "MATERIAL", 8)) {       // read material index
+				sscanf (cbuf+8, "%d", &mtrl_idx);
+				mtrl_idx--;
+			} else if (!strncasecmp (cbuf, "TEXTURE", 7)) { // read texture index
+				sscanf (cbuf+7, "%d", &tex_idx);
+				tex_idx--;
+			} else if (!strncasecmp (cbuf, "ZBIAS", 5)) {   // read z-bias
+				sscanf (cbuf+5, "%hu", &zbias);
+			} else if (!strncasecmp (cbuf, "TEXWRAP", 7)) { // read wrap flags
+				char uvstr[10] = "";
+				sscanf (cbuf+7, "%9s", uvstr);
+				if (uvstr[0] == 'U' || uvstr[1] == 'U') flag |= 0x01;
+				if (uvstr[0] == 'V' || uvstr[1] == 'V') flag |= 0x02;
+			} else if (!strncasecmp (cbuf, "NONORMAL", 8)) {
+				bnormal = false; calcnml = true;
+			} else if (!strncasecmp (cbuf, "FLAG", 4)) {
+				unsigned int uf;
+				if (sscanf (cbuf+4, "%x", &uf) == 1) uflag = uf;
+			} else if (!strncasecmp (cbuf, "FLIP", 4)) {
+				flipidx = true;
+			} else if (!strncasecmp (cbuf, "LABEL", 5)) {
+				// ignore group labels here
+			} else if (!strncasecmp (cbuf, "STATIC", 6)) {
+				flag |= 0x04;
+			} else if (!strncasecmp (cbuf, "DYNAMIC", 7)) {
+				flag ^= 0x04;
+			} else if (!strncasecmp (cbuf, "GEOM", 4)) {    // read geometry
+				if (sscanf (cbuf+4, "%d%d", &nvtx, &ntri) != 2) return false;
+				if (nvtx <= 0 || ntri <= 0) return false;   // group would be skipped
+				break;
+			}
+		}
+
+		data.grp.push_back (MeshBinData::Group());
+		MeshBinData::Group &grp = data.grp.back();
+		grp.vtx.resize (nvtx);
+		grp.idx.resize (ntri*3);
+		for (i = 0; i < nvtx; i++) {
+			MeshBinVertex &v = grp.vtx[i];
+			if (!is.getline (cbuf, 256)) return false;
+			if (bnormal) {
+				j = sscanf (cbuf, "%f%f%f%f%f%f%f%f",
+					&v.x, &v.y, &v.z, &v.nx, &v.ny, &v.nz, &v.tu, &v.tv);
+				if (j < 6) calcnml = true;
+			} else {
+				j = sscanf (cbuf, "%f%f%f%f%f",
+					&v.x, &v.y, &v.z, &v.tu, &v.tv);
+			}
+		}
+		WORD *idx = grp.idx.data();
+		for (i = j = 0; i < ntri; i++) {
+			if (!is.getline (cbuf, 256)) return false;
+			sscanf (cbuf, "%hu%hu%hu", idx+j, idx+j+1, idx+j+2);
+			j += 3;
+		}
+		if (flipidx)
+			for (i = 0; i < ntri; i++) {
+				WORD tmp = idx[i*3+1]; idx[i*3+1] = idx[i*3+2]; idx[i*3+2] = tmp;
+			}
+
+		MeshBinGroup &spec = grp.spec;
+		memset (&spec, 0, sizeof(MeshBinGroup));
+		spec.nVtx = nvtx;
+		spec.nIdx = ntri*3;
+		spec.mtrlIdx = (DWORD)mtrl_idx;
+		spec.texIdx = (DWORD)tex_idx;
+		spec.usrFlag = uflag;
+		spec.zBias = zbias;
+		spec.flags = (WORD)flag;
+		spec.loadFlags = (calcnml ? MESHBIN_GRP_CALCNORMALS : 0);
+	}
+
+	// read material list
+	if (is.getline (cbuf, 256) && !strncmp (cbuf, "MATERIALS", 9) && (sscanf (cbuf+9, "%d", &nmtrl) == 1)) {
+		if (nmtrl < 0) return false;
+		for (i = 0; i < nmtrl; i++) // material names
+			if (!is.getline (cbuf, 256)) return false;
+		data.mtrl.resize (nmtrl);
+		for (i = 0; i < nmtrl; i++) {
+			MeshBinMaterial &mtrl = data.mtrl[i];
+			memset (&mtrl, 0, sizeof(MeshBinMaterial));
+			if (!is.getline (cbuf, 256)) return false;
+			if (!is.getline (cbuf, 256)) return false;
+			sscanf (cbuf, "%f%f%f%f", mtrl.diffuse+0, mtrl.diffuse+1, mtrl.diffuse+2, mtrl.diffuse+3);
+			if (!is.getline (cbuf, 256)) return false;
+			sscanf (cbuf, "%f%f%f%f", mtrl.ambient+0, mtrl.ambient+1, mtrl.ambient+2, mtrl.ambient+3);
+			if (!is.getline (cbuf, 256)) return false;
+			res = sscanf (cbuf, "%f%f%f%f%f", mtrl.specular+0, mtrl.specular+1, mtrl.specular+2, mtrl.specular+3, &mtrl.power);
+			if (res < 5) mtrl.power = 0.0f;
+			if (!is.getline (cbuf, 256)) return false;
+			sscanf (cbuf, "%f%f%f%f", mtrl.emissive+0, mtrl.emissive+1, mtrl.emissive+2, mtrl.emissive+3);
+		}
+	}
+
+	// read texture list
+	if (is.getline (cbuf, 256) && !strncmp (cbuf, "TEXTURES", 8) && (sscanf (cbuf+8, "%d", &ntex) == 1)) {
+		if (ntex < 0) return false;
+		char texname[256], flagstr[256];
+		data.tex.resize (ntex);
+		for (i = 0; i < ntex; i++) {
+			if (!is.getline (cbuf, 256)) return false;
+			flagstr[0] = '\0';
+			if (sscanf (cbuf, "%255s%255s", texname, flagstr) < 1) return false;
+			if (texname[0] != '0' || texname[1] != '\0')
+				data.tex[i].name = texname;
+			data.tex[i].flags = (toupper (flagstr[0]) == 'D' ? 1 : 0);
+		}
+	}
+	return true;
+}
+
+// =======================================================================
+
+static DWORD Align (DWORD ofs)
+{
+	return (ofs + (MESHBIN_ALIGN-1)) & ~(DWORD)(MESHBIN_ALIGN-1);
+}
+
+void MeshBinBuild (const MeshBinData &data, DWORDLONG srchash, DWORDLONG srcsize, vector<BYTE> &bin)
+{
+	DWORD i, ofs;
+	DWORD ngrp = (DWORD)data.grp.size();
+	DWORD nmtrl = (DWORD)data.mtrl.size();
+	DWORD ntex = (DWORD)data.tex.size();
+
+	// layout
+	MeshBinHeader hdr;
+	memset (&hdr, 0, sizeof(MeshBinHeader));
+	memcpy (hdr.id, MESHBIN_ID, 8);
+	hdr.version = MESHBIN_VERSION;
+	hdr.hdrSize = sizeof(MeshBinHeader);
+	hdr.srcHash = srchash;
+	hdr.srcSize = srcsize;
+	hdr.nGrp = ngrp;
+	hdr.nMtrl = nmtrl;
+	hdr.nTex = ntex;
+	hdr.grpOfs = ofs = Align (sizeof(MeshBinHeader));
+	hdr.mtrlOfs = ofs = Align (ofs + ngrp*sizeof(MeshBinGroup));
+	hdr.texOfs = ofs = Align (ofs + nmtrl*sizeof(MeshBinMaterial));
+	hdr.strOfs = ofs = ofs + ntex*sizeof(MeshBinTexture);
+	vector<MeshBinTexture> tex(ntex);
+	for (i = 0; i < ntex; i++) {
+		tex[i].flags = data.tex[i].flags;
+		if (data.tex[i].name.empty()) tex[i].nameOfs = 0;
+		else {
+			tex[i].nameOfs = ofs;
+			ofs += (DWORD)data.tex[i].name.size()+1;
+		}
+	}
+	vector<MeshBinGroup> grp(ngrp);
+	for (i = 0; i < ngrp; i++) {
+		grp[i] = data.grp[i].spec;
+		grp[i].vtxOfs = ofs = Align (ofs);
+		grp[i].idxOfs = ofs = Align (ofs + grp[i].nVtx*sizeof(MeshBinVertex));
+		ofs += grp[i].nIdx*sizeof(WORD);
+	}
+	hdr.fileSize = ofs = Align (ofs);
+
+	// fill the image
+	bin.assign (ofs, 0);
+	BYTE *b = bin.data();
+	memcpy (b, &hdr, sizeof(MeshBinHeader));
+	if (ngrp) memcpy (b+hdr.grpOfs, grp.data(), ngrp*sizeof(MeshBinGroup));
+	if (nmtrl) memcpy (b+hdr.mtrlOfs, data.mtrl.data(), nmtrl*sizeof(MeshBinMaterial));
+	if (ntex) memcpy (b+hdr.texOfs, tex.data(), ntex*sizeof(MeshBinTexture));
+	for (i = 0; i < ntex; i++)
+		if (tex[i].nameOfs)
+			memcpy (b+tex[i].nameOfs, data.tex[i].name.c_str(), data.tex[i].name.size()+1);
+	for (i = 0; i < ngrp; i++) {
+		memcpy (b+grp[i].vtxOfs, data.grp[i].vtx.data(), grp[i].nVtx*sizeof(MeshBinVertex));
+		memcpy (b+grp[i].idxOfs, data.grp[i].idx.data(), grp[i].nIdx*sizeof(WORD));
+	}
+}
+
+// =======================================================================
+
+bool MeshBinCompile (const char *srcname, const char *binname)
+{
+	MappedFile src;
+	if (!src.Open (srcname)) return false;
+
+	MeshBinData data;
+	if (!MeshBinParse ((const char*)src.Data(), src.Size(), data)) return false;
+
+	vector<BYTE> bin;
+	MeshBinBuild (data, MeshBinHash (src.Data(), src.Size()), src.Size(), bin);
+	src.Close();
+
+	string name = (binname ? string(binname) : MeshBinName (srcname));
+	FILE *f = fopen (name.c_str(), "wb");
+	if (!f) return false;
+	bool ok = (fwrite (bin.data(), 1, bin.size(), f) == bin.size());
+	if (fclose (f)) ok = false;
+	if (!ok) remove (name.c_str());
+	return ok;
+}
+
+// =======================================================================
+// class MappedFile
+
+MappedFile::MappedFile ()
+{
+#ifdef _WIN32
+	hFile = INVALID_HANDLE_VALUE;
+	hMap = NULL;
+#else
+	fd = -1;
+#endif
+	base = 0;
+	size = 0;
+}
+
+MappedFile::~MappedFile ()
+{
+	Close();
+}
+
+bool MappedFile::Open (const char *fname)
+{
+	Close();
+#ifdef _WIN32
+	hFile = CreateFile (fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	LARGE_INTEGER fsize;
+	if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx (hFile, &fsize) || !fsize.QuadPart ||
+		(DWORDLONG)fsize.QuadPart > (size_t)-1) {
+		Close();
+		return false;
+	}
+	size = (size_t)fsize.QuadPart;
+	if ((hMap = CreateFileMapping (hFile, NULL, PAGE_READONLY, 0, 0, NULL)))
+		base = (const BYTE*)MapViewOfFile (hMap, FILE_MAP_READ, 0, 0, 0);
+#else
+	struct stat st;
+	if ((fd = open (fname, O_RDONLY)) < 0 || fstat (fd, &st) || !st.st_size) {
+		Close();
+		return false;
+	}
+	size = (size_t)st.st_size;
+	void *p = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p != MAP_FAILED) base = (const BYTE*)p;
+#endif
+	if (!base) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close ()
+{
+#ifdef _WIN32
+	if (base) UnmapViewOfFile (base);
+	if (hMap) CloseHandle (hMap);
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle (hFile);
+	hMap = NULL;
+	hFile = INVALID_HANDLE_VALUE;
+#else
+	if (base) munmap ((void*)base, size);
+	if (fd >= 0) close (fd);
+	fd = -1;
+#endif
+	base = 0;
+	size = 0;
+}
+
+// =======================================================================
+// class MeshBinFile
+
+MeshBinFile::Status MeshBinFile::Open (const char *srcname)
+{
+	Close();
+	if (!file.Open (MeshBinName (srcname).c_str()))
+		return MESHBIN_NOFILE;
+	base = file.Data();
+	size = file.Size();
+	if (!Validate()) {
+		Close();
+		return MESHBIN_INVALID;
+	}
+
+	// check against the source
+	MappedFile src;
+	if (src.Open (srcname)) {
+		const MeshBinHeader &hdr = Header();
+		if (hdr.srcSize != src.Size() || hdr.srcHash != MeshBinHash (src.Data(), src.Size())) {
+			Close();
+			return MESHBIN_OUTDATED;
+		}
+	}
+	return MESHBIN_OK;
+}
+
+// -----------------------------------------------------------------------
+
+MeshBinFile::Status MeshBinFile::Compile (const char *srcname)
+{
+	Close();
+	MappedFile src;
+	if (!src.Open (srcname))
+		return MESHBIN_NOFILE;
+	MeshBinData data;
+	if (!MeshBinParse ((const char*)src.Data(), src.Size(), data))
+		return MESHBIN_INVALID;
+	MeshBinBuild (data, 0, src.Size(), image);
+	base = image.data();
+	size = image.size();
+	return MESHBIN_OK;
+}
+
+// -----------------------------------------------------------------------
+
+void MeshBinFile::Close ()
+{
+	file.Close();
+	image.clear();
+	base = 0;
+	size = 0;
+}
+
+// -----------------------------------------------------------------------
+// Check the header, and that all tables and blocks are inside the file, so
+// that the accessors can be used without further checks
+
+bool MeshBinFile::Validate () const
+{
+	const BYTE *b = base;
+	DWORD i;
+
+	if (size < sizeof(MeshBinHeader)) return false;
+	const MeshBinHeader &hdr = Header();
+	if (memcmp (hdr.id, MESHBIN_ID, 8) || hdr.version != MESHBIN_VERSION ||
+		hdr.hdrSize != sizeof(MeshBinHeader) || hdr.fileSize != size)
+		return false;
+
+	if (hdr.grpOfs % MESHBIN_ALIGN || hdr.mtrlOfs % MESHBIN_ALIGN || hdr.texOfs % MESHBIN_ALIGN ||
+		hdr.grpOfs + (DWORDLONG)hdr.nGrp*sizeof(MeshBinGroup) > size ||
+		hdr.mtrlOfs + (DWORDLONG)hdr.nMtrl*sizeof(MeshBinMaterial) > size ||
+		hdr.texOfs + (DWORDLONG)hdr.nTex*sizeof(MeshBinTexture) > size)
+		return false;
+
+	for (i = 0; i < hdr.nGrp; i++) {
+		const MeshBinGroup &grp = Group(i);
+		if (!grp.nVtx || !grp.nIdx || grp.vtxOfs % MESHBIN_ALIGN || grp.idxOfs % MESHBIN_ALIGN ||
+			grp.vtxOfs + (DWORDLONG)grp.nVtx*sizeof(MeshBinVertex) > size ||
+			grp.idxOfs + (DWORDLONG)grp.nIdx*sizeof(WORD) > size)
+			return false;
+	}
+	for (i = 0; i < hdr.nTex; i++) {
+		DWORD ofs = Texture(i).nameOfs;
+		if (ofs && (ofs < hdr.strOfs || ofs >= size || !memchr (b+ofs, '\0', (size_t)(size-ofs))))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,203 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// MeshBin.h
+// Compiled binary mesh format.
+// A binary mesh (<name>.mshb) is generated by meshc from the MSHX1 mesh
+// source (<name>.msh) and contains the same groups, materials and textures
+// as read by the Mesh stream operator, with the vertex and index lists
+// stored in aligned blocks that can be copied straight from the mapped file.
+// The binary stores a content hash of its source, so that it is ignored
+// (and the source parsed) as soon as the source is edited.
+//
+// File layout:
+//   MeshBinHeader
+//   MeshBinGroup[nGrp]       at grpOfs
+//   MeshBinMaterial[nMtrl]   at mtrlOfs
+//   MeshBinTexture[nTex]     at texOfs
+//   texture name strings     at strOfs
+//   for each group: MeshBinVertex[nVtx] at vtxOfs, WORD[nIdx] at idxOfs
+// All offsets are from the beginning of the file. Tables and blocks are
+// aligned to MESHBIN_ALIGN bytes. Values are little-endian.
+// =======================================================================
+
+#ifndef __MESHBIN_H
+#define __MESHBIN_H
+
+#include <stddef.h>
+#include <vector>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint64_t DWORDLONG;
+#endif
+
+#define MESHBIN_ID      "MSHBIN\x1a" // file identifier (8 bytes including terminator)
+#define MESHBIN_VERSION 1            // increment for any change of the layout
+#define MESHBIN_ALIGN   16           // alignment of tables and data blocks
+#define MESHBIN_EXT     "mshb"       // file extension of binary meshes
+
+// group load flags
+#define MESHBIN_GRP_CALCNORMALS 0x0001 // calculate missing normals on load
+
+#pragma pack(push,4)
+
+struct MeshBinHeader {               // 64 bytes
+	char id[8];                      // MESHBIN_ID
+	DWORD version;                   // MESHBIN_VERSION
+	DWORD hdrSize;                   // sizeof(MeshBinHeader)
+	DWORDLONG srcHash;        // content hash of the mesh source (MeshBinHash)
+	DWORDLONG srcSize;        // size of the mesh source [bytes]
+	DWORD fileSize;                  // size of the binary file [bytes]
+	DWORD nGrp, nMtrl, nTex;         // number of groups, materials, textures
+	DWORD grpOfs, mtrlOfs, texOfs;   // group, material and texture table offsets
+	DWORD strOfs;                    // string table offset
+};
+
+struct MeshBinGroup {                // 40 bytes
+	DWORD nVtx, nIdx;                // number of vertices and indices
+	DWORD mtrlIdx, texIdx;           // material and texture index (or SPEC_DEFAULT, SPEC_INHERIT)
+	DWORD usrFlag;                   // user-defined group flag
+	WORD zBias;                      // z-bias
+	WORD flags;                      // group flags (as in GroupSpec::Flags)
+	DWORD vtxOfs, idxOfs;            // vertex and index block offsets
+	DWORD loadFlags;                 // MESHBIN_GRP_xxx
+	DWORD reserved;
+};
+
+struct MeshBinVertex {               // layout of NTVERTEX
+	float x, y, z;
+	float nx, ny, nz;
+	float tu, tv;
+};
+
+struct MeshBinMaterial {             // layout of D3DMATERIAL7
+	float diffuse[4];
+	float ambient[4];
+	float specular[4];
+	float emissive[4];
+	float power;
+};
+
+struct MeshBinTexture {
+	DWORD nameOfs;                   // texture name offset (0 for "no texture")
+	DWORD flags;                     // bit 0: load uncompressed
+};
+
+#pragma pack(pop)
+
+// =======================================================================
+// Content hash of a mesh source
+
+DWORDLONG MeshBinHash (const void *data, size_t size);
+
+// =======================================================================
+// Binary mesh file name for a mesh source file name (<name>.msh -> <name>.mshb)
+
+std::string MeshBinName (const char *srcname);
+
+// =======================================================================
+// Mesh data parsed from an MSHX1 source, as read by the Mesh stream operator
+
+struct MeshBinData {
+	struct Group {
+		MeshBinGroup spec;           // vtxOfs and idxOfs are unused
+		std::vector<MeshBinVertex> vtx;
+		std::vector<WORD> idx;
+	};
+	struct Texture {
+		std::string name;            // empty for "no texture"
+		DWORD flags;
+	};
+	std::vector<Group> grp;
+	std::vector<MeshBinMaterial> mtrl;
+	std::vector<Texture> tex;
+};
+
+bool MeshBinParse (const char *src, size_t size, MeshBinData &data);
+// Parse an MSHX1 mesh source held in memory. Returns false if the source is
+// not a mesh, or is truncated.
+
+void MeshBinBuild (const MeshBinData &data, DWORDLONG srchash, DWORDLONG srcsize, std::vector<BYTE> &bin);
+// Build the binary mesh image for parsed mesh data
+
+bool MeshBinCompile (const char *srcname, const char *binname = 0);
+// Compile mesh source file 'srcname' into binary mesh file 'binname'
+// (default: MeshBinName(srcname)). Returns false if the source could not be
+// read or parsed, or the binary could not be written.
+
+// =======================================================================
+// Read-only memory-mapped file
+
+class MappedFile {
+public:
+	MappedFile ();
+	~MappedFile ();
+	bool Open (const char *fname);
+	void Close ();
+	const BYTE *Data () const { return base; }
+	size_t Size () const { return size; }
+
+private:
+#ifdef _WIN32
+	HANDLE hFile;      // mapped file
+	HANDLE hMap;       // file mapping object
+#else
+	int fd;            // mapped file
+#endif
+	const BYTE *base;  // start of mapped file (0 if not mapped)
+	size_t size;       // file size
+};
+
+// =======================================================================
+// Read access to a binary mesh through a file mapping, or to a binary
+// mesh image compiled in memory
+
+class MeshBinFile {
+public:
+	enum Status {
+		MESHBIN_OK,                  // binary mesh mapped and up to date
+		MESHBIN_NOFILE,              // no binary mesh
+		MESHBIN_OUTDATED,            // binary mesh does not match the source
+		MESHBIN_INVALID              // binary mesh is damaged or of a different version
+	};
+
+	MeshBinFile (): base(0), size(0) {}
+
+	Status Open (const char *srcname);
+	// Map the binary mesh for mesh source file 'srcname' and check it against
+	// the source. If the source does not exist, the binary mesh is used as is.
+
+	Status Compile (const char *srcname);
+	// Compile mesh source file 'srcname' into a binary mesh image in memory.
+	// Returns MESHBIN_NOFILE if the source can't be read, and MESHBIN_INVALID
+	// if it can't be compiled (see MeshBinParse).
+
+	void Close ();
+
+	const MeshBinHeader &Header () const { return *(const MeshBinHeader*)base; }
+	const MeshBinGroup &Group (DWORD grp) const { return ((const MeshBinGroup*)(base+Header().grpOfs))[grp]; }
+	const MeshBinVertex *Vtx (DWORD grp) const { return (const MeshBinVertex*)(base+Group(grp).vtxOfs); }
+	const WORD *Idx (DWORD grp) const { return (const WORD*)(base+Group(grp).idxOfs); }
+	const MeshBinMaterial &Material (DWORD mtrl) const { return ((const MeshBinMaterial*)(base+Header().mtrlOfs))[mtrl]; }
+	const MeshBinTexture &Texture (DWORD tex) const { return ((const MeshBinTexture*)(base+Header().texOfs))[tex]; }
+	const char *TextureName (DWORD tex) const
+	{ DWORD ofs = Texture(tex).nameOfs; return (ofs ? (const char*)base+ofs : 0); }
+	// table and block access (only valid after Open or Compile returned MESHBIN_OK)
+
+private:
+	bool Validate () const;
+
+	MappedFile file;                 // mapped binary mesh (Open)
+	std::vector<BYTE> image;         // compiled binary mesh (Compile)
+	const BYTE *base;                // start of binary mesh
+	size_t size;                     // size of binary mesh
+};
+
+#endif // !__MESHBIN_H
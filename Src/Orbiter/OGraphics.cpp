@@ -613,6 +613,9 @@ void OrbiterGraphics::clbkRenderScene ()
         return;
     }
 
+	// swap in the textures decoded since the last frame
+	if (g_texmanager) g_texmanager->Update();
+
 	// Set camera view transformation
 	static D3DMATRIX mView = Identity;
 	SetD3DRotation (mView, g_camera->GRot());
@@ -1428,8 +1431,10 @@ bool OrbiterGraphics::clbkParticleStreamExists (const oapi::ParticleStream *ps)
 SURFHANDLE OrbiterGraphics::clbkLoadTexture (const char *fname, DWORD flags)
 {
 	LPDIRECTDRAWSURFACE7 tex =  NULL;
-	if (flags & 8) // managed texture
+	if (flags & 8) { // managed texture
 		tex = g_texmanager->AcquireTexture (fname, (flags & 2) != 0);
+		if (tex) g_texmanager->Complete (tex); // returned to a module, so don't leave a placeholder
+	}
 	else {
 		FILE *f = orbiter->OpenTextureFile (fname, "");
 		if (f) {
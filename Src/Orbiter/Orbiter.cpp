@@ -22,6 +22,7 @@
 #include "D3d7util.h"
 #include "D3dmath.h"
 #include "Log.h"
+#include "IndexedStream.h"
 #include "State.h"
 #include "Astro.h"
 #include "Camera.h"
@@ -229,6 +230,9 @@ INT WINAPI WinMain (HINSTANCE hInstance, HINSTANCE, LPSTR strCmdLine, INT nCmdSh
 			case 'x':
 				g_pOrbiter->SetFastExit (true);
 				break;
+			case 'f':
+				g_pOrbiter->SetExitFirstFrame (true);
+				break;
 			case 'l':
 				keeplog = true;
 				break;
@@ -375,6 +379,8 @@ Orbiter::Orbiter ()
 	bPlayback       = false;
 	bCapture        = false;
 	bFastExit       = false;
+	bExitFirstFrame = false;
+	session_t0      = 0;
 	bRoughType      = false;
 	//lstatus.bkgDC   = 0;
 	cfglen          = 0;
@@ -696,9 +702,11 @@ HWND Orbiter::CreateRenderWindow (HWND parentWnd, Config *pCfg, const char *scen
 {
 	DWORD i;
 
+	session_t0 = timeGetTime();
 	SetLogVerbosity (pCfg->CfgDebugPrm.bVerboseLog);
 	LOGOUT("");
 	LOGOUT("**** Creating simulation session");
+	MemStat::SetTileBudget ((LONG64)pCfg->CfgPRenderPrm.TileMemBudget << 20);
 
 	ShowWindow (hDlg, SW_HIDE); // hide launchpad dialog
 	
@@ -819,14 +827,16 @@ HWND Orbiter::CreateRenderWindow (HWND parentWnd, Config *pCfg, const char *scen
 	}
 
 	// let plugins read their states from the scenario file
+	// (one indexed stream is shared by all plugins, so the file is only scanned once)
+	IndexedIfstream scnf (ScnPath (scenario));
 	for (i = 0; i < nmodule; i++) {
 		void (*opcLoadState)(FILEHANDLE) = (void(*)(FILEHANDLE))FindModuleProc (i, "opcLoadState");
 		if (opcLoadState) {
-			ifstream ifs (ScnPath (scenario));
 			char cbuf[256] = "BEGIN_";
 			strcat (cbuf, module[i].name);
-			if (FindLine (ifs, cbuf)) {
-				opcLoadState ((FILEHANDLE)&ifs);
+			scnf.clear(); // reset stream state left by the previous plugin
+			if (FindLine (scnf, cbuf)) {
+				opcLoadState ((FILEHANDLE)&scnf);
 			}
 		}
 	}
@@ -943,6 +953,7 @@ void Orbiter::CloseSession ()
 		DestroyWorld ();     // destroy logical objects
 		if (gclient)
 			gclient->clbkDestroyRenderWindow (false); // destroy graphics objects
+		MemStat::LogTileUsage ();
 
 		for (i = 0; i < nmodule; i++)
 			module[i].module->clbkSimulationEnd();
@@ -1095,6 +1106,15 @@ INT Orbiter::Run (const char *scenario)
 			bRenderOnce = FALSE;
 		}
 
+		if (session_t0 && bSession && launch_tick < 3) { // first frame of the session completed
+			LOGOUT ("Time to first frame: %0.3f s", (timeGetTime()-session_t0)*1e-3);
+			session_t0 = 0;
+			if (bExitFirstFrame) {
+				if (hRenderWnd) PostMessage (hRenderWnd, WM_CLOSE, 0, 0);
+				else CloseSession();
+			}
+		}
+
 		if (bSession) {
 #ifdef INLINEGRAPHICS
 			bCanRender = (oclient->m_pDD->TestCooperativeLevel() == DD_OK);
@@ -1210,9 +1230,14 @@ bool Orbiter::ParseConsoleCmd ()
 		} else if (!_strnicmp (pc, "gui", 3)) {
 			ConsoleOut ("Toggles the display of a dialog box that continuously monitors the simulation");
 			ConsoleOut ("state.");
+		} else if (!_strnicmp (pc, "record", 6)) {
+			ConsoleOut ("Start/stop the flight recorder.");
+			ConsoleOut ("record on   --  start recording (overwrites a previous recording of the same name)");
+			ConsoleOut ("record off  --  stop recording, and log the recording statistics");
+			ConsoleOut ("Without arguments, the current recorder state is displayed.");
 		} else {
 			ConsoleOut ("The following top-level commands are available:\n");
-			ConsoleOut ("  help exit vessel time tacc pause step gui\n");
+			ConsoleOut ("  help exit vessel time tacc pause step gui record\n");
 			ConsoleOut ("To get help for a command, type \"help <cmd>\"");
 		}
 	} else if (!_strnicmp (cmd, "exit", 4)) {
@@ -1268,6 +1293,12 @@ bool Orbiter::ParseConsoleCmd ()
 	} else if (!_strnicmp (cmd, "gui", 3)) {
 		if (!DestroyServerGuiDlg())
 			hServerWnd = CreateDialog (hInst, MAKEINTRESOURCE(IDD_SERVER), hDlg, ServerDlgProc);
+	} else if (!_strnicmp (cmd, "record", 6)) {
+		pc = trim_string (cmd+6);
+		if      (!_strnicmp (pc, "on", 2))  { if (!bRecord) ToggleRecorder (true); }
+		else if (!_strnicmp (pc, "off", 3)) { if (bRecord) ToggleRecorder (); }
+		sprintf_s (cbuf, 256, "Flight recorder %s", bRecord ? "recording" : "stopped");
+		ConsoleOut (cbuf);
 	}
 	return false;
 }
@@ -1779,9 +1810,10 @@ void Orbiter::ToggleRecorder (bool force, bool append)
 			return;
 		}
 	} else sname = 0;
-	FRecorder_Activate (bStartRecorder, sname, append);
+	if (bStartRecorder) FRecorder_Activate (true, sname, append);
 	for (i = 0; i < n; i++)
 		g_psys->GetVessel(i)->FRecorder_Activate (bStartRecorder, sname, append);
+	if (!bStartRecorder) FRecorder_Activate (false, 0); // after the vessels' final samples
 	if (bStartRecorder)
 		SavePlaybackScn (sname);
 	if (pDlg) PostMessage (pDlg->GetHwnd(), WM_USER+1, 0, 0);
@@ -213,8 +213,10 @@ public:
 	inline State*  PState() const { return pState; }
 	inline bool    IsActive() const { return bActive; } // temporary
 	inline bool    IsRunning() const { return bRunning; }
+	inline bool    SessionActive() const { return bSession; }
 	inline bool    UseStencil() const { return bUseStencil; }
 	inline void    SetFastExit (bool fexit) { bFastExit = fexit; }
+	inline void    SetExitFirstFrame (bool fexit) { bExitFirstFrame = fexit; }
 	inline bool    UseHtmlInline () { return (pConfig->CfgDebugPrm.bHtmlScnDesc == 1 || pConfig->CfgDebugPrm.bHtmlScnDesc == 2 && !bWINEenv); }
 
 	// DirectInput components
@@ -440,6 +442,8 @@ private:
 	bool            bPlayback;     // true if flight is being played back
 	bool            bCapture;      // capturing frame sequence is active
 	bool            bFastExit;     // terminate on simulation end?
+	bool            bExitFirstFrame; // close the session after the first frame?
+	DWORD           session_t0;    // system time at session start [ms] (0 after the first frame)
 	bool            bSysClearType; // is cleartype enabled on the user's system?
 	bool            bRoughType;    // font-smoothing disabled?
 
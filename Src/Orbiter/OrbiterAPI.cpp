@@ -15,6 +15,7 @@
 #include "Select.h"
 #include "DlgMgr.h"
 #include "Config.h"
+#include "IndexedStream.h"
 #include "Script.h"
 #include "Util.h"
 #include "Log.h"
@@ -26,6 +27,7 @@
 
 #ifdef INLINEGRAPHICS  // should be temporary
 #include "OGraphics.h"
+#include "Texture.h"
 #endif // INLINEGRAPHICS
 
 #include "Orbitersdk.h"
@@ -37,6 +39,9 @@ extern TimeData td;
 extern PlanetarySystem *g_psys;
 extern Camera *g_camera;
 extern Pane *g_pane;
+#ifdef INLINEGRAPHICS
+extern TextureManager *g_texmanager;
+#endif // INLINEGRAPHICS
 extern Vessel *g_focusobj;
 extern InputBox *g_input;
 extern bool g_bShowGrapple;
@@ -1311,9 +1316,8 @@ DLLEXPORT VISHANDLE *oapiObjectVisualPtr (OBJHANDLE hObject)
 
 DLLEXPORT MESHHANDLE oapiLoadMesh (const char *fname)
 {
-	ifstream ifs(g_pOrbiter->MeshPath(fname));
 	Mesh *mesh = new Mesh; TRACENEW
-	ifs >> *mesh;
+	LoadMeshFile (g_pOrbiter->MeshPath(fname), *mesh);
 	return (MESHHANDLE)mesh;
 }
 
@@ -1355,7 +1359,12 @@ DLLEXPORT DWORD oapiMeshTextureCount (MESHHANDLE hMesh)
 DLLEXPORT SURFHANDLE oapiGetTextureHandle (MESHHANDLE hMesh, DWORD texidx)
 {
 	Mesh *mesh = (Mesh*)hMesh;
-	return (mesh ? mesh->GetTexture (texidx-1) : 0);
+	SURFHANDLE tex = (mesh ? mesh->GetTexture (texidx-1) : 0);
+#ifdef INLINEGRAPHICS
+	// the caller may read or draw on the surface, so it must not be a streaming placeholder
+	if (tex && g_texmanager) g_texmanager->Complete ((LPDIRECTDRAWSURFACE7)tex);
+#endif // INLINEGRAPHICS
+	return tex;
 }
 
 DLLEXPORT SURFHANDLE oapiLoadTexture (const char *fname, bool dynamic)
@@ -2147,9 +2156,9 @@ DLLEXPORT FILEHANDLE oapiOpenFile (const char *fname, FileAccessMode mode, PathR
 
 	switch (mode) {
 	case FILE_IN:
-		return (FILEHANDLE)(new ifstream (cbuf));
+		return (FILEHANDLE)(new IndexedIfstream (cbuf));
 	case FILE_IN_ZEROONFAIL: {
-		ifstream *ifs = new ifstream (cbuf);
+		ifstream *ifs = new IndexedIfstream (cbuf);
 		if (ifs->fail()) {
 			delete ifs;
 			ifs = 0;
@@ -11,6 +11,7 @@
 #include <io.h>
 #include "Orbiter.h"
 #include "Config.h"
+#include "IndexedStream.h"
 #include "State.h"
 #include "Astro.h"
 #include "Element.h"
@@ -224,7 +225,7 @@ Planet::Planet (char *fname)
 	minelev      = 0.0;
 	labelLegend  = NULL;
 	nLabelLegend = 0;
-	ifstream ifs (g_pOrbiter->ConfigPath (fname));
+	IndexedIfstream ifs (g_pOrbiter->ConfigPath (fname));
 	if (!ifs) return;
 
 	AtmInterface = 0;
@@ -917,6 +918,7 @@ void Planet::Update (bool force)
 	}
 
 	CelestialBody::Update (force);
+	if (emgr) emgr->EndStep ();
 
 	// Update bases
 	for (DWORD i = 0; i < nbase; i++)
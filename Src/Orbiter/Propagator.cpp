@@ -0,0 +1,235 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// Propagator.cpp
+// Integration parameters and analytic 2-body propagation shared by the
+// body state propagators and the propagator benchmark
+// =======================================================================
+
+#include "Propagator.h"
+
+// ===========================================================================
+// Runge-Kutta integration parameters (RK5-RK8)
+// Used by the driver routines in BodyIntegrator.cpp. Each tableau is a separate type, so
+// that the driver can be instantiated with the stage count and coefficients
+// fixed at compile time.
+// (Note that RK2 and RK4 are implemented directly without using the driver
+// routines)
+// ===========================================================================
+
+// ---------------------------------------------------------------------------
+// RK5 6-stage parameters
+// ---------------------------------------------------------------------------
+
+const double RK5_Tableau::alpha[RK5_Tableau::n-1] = {
+	1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0
+};
+const double RK5_Tableau::beta[(RK5_Tableau::n-1)*(RK5_Tableau::n-1)] = {
+	1.0/5.0, 0, 0, 0, 0,
+	3.0/40.0, 9.0/40.0, 0, 0, 0,
+	44.0/45.0, -56.0/15.0, 32.0/9.0, 0, 0,
+	19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0, 0,
+	9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0
+};
+const double RK5_Tableau::gamma[RK5_Tableau::n] = {
+	35.0/384.0, 0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0
+};
+
+// ---------------------------------------------------------------------------
+// RK6 8-stage parameters
+// ---------------------------------------------------------------------------
+
+const double RK6_Tableau::alpha[RK6_Tableau::n-1] = {
+	1.0/6.0, 4.0/15.0, 2.0/3.0, 5.0/6.0, 1.0, 1.0/15.0, 1.0
+};
+const double RK6_Tableau::beta[(RK6_Tableau::n-1)*(RK6_Tableau::n-1)] = {
+	1.0/6.0, 0, 0, 0, 0, 0, 0,
+	4.0/75.0, 16.0/75.0, 0, 0, 0, 0, 0,
+	5.0/6.0, -8.0/3.0, 5.0/2.0, 0, 0, 0, 0,
+	-165.0/64.0, 55.0/6.0, -425.0/64.0, 85.0/96.0, 0, 0, 0,
+	12.0/5.0, -8.0, 4015.0/612.0, -11.0/36.0, 88.0/255.0, 0, 0,
+	-8263.0/15000.0, 124.0/75.0, -643.0/680.0, -81.0/250.0, 2484.0/10625.0, 0, 0,
+	3501.0/1720.0, -300.0/43.0, 297275.0/52632.0, -319.0/2322.0, 24068.0/84065.0, 0, 3850.0/26703.0
+};
+const double RK6_Tableau::gamma[RK6_Tableau::n] = {
+	3.0/40.0, 0, 875.0/2244.0, 23.0/72.0, 264.0/1955.0, 0, 125.0/11592.0, 43.0/616.0
+};
+
+// ---------------------------------------------------------------------------
+// RK7 11-stage parameters
+// ---------------------------------------------------------------------------
+
+const double RK7_Tableau::alpha[RK7_Tableau::n-1] = {
+	2.0/27.0, 1.0/9.0, 1.0/6.0, 5.0/12.0, 1.0/2.0, 5.0/6.0, 1.0/6.0, 2.0/3.0, 1.0/3.0, 1.0
+};
+const double RK7_Tableau::beta[(RK7_Tableau::n-1)*(RK7_Tableau::n-1)] = {
+	2.0/27.0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1.0/36.0, 1.0/12.0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1.0/24.0, 0, 1.0/8.0, 0, 0, 0, 0, 0, 0, 0,
+	5.0/12.0, 0, -25.0/16.0, 25.0/16.0, 0, 0, 0, 0, 0, 0,
+	1.0/20.0, 0, 0, 1.0/4.0, 1.0/5.0, 0, 0, 0, 0, 0,
+	-25.0/108.0, 0, 0, 125.0/108.0, -65.0/27.0, 125.0/54.0, 0, 0, 0, 0,
+	31.0/300.0, 0, 0, 0, 61.0/225.0, -2.0/9.0, 13.0/900.0, 0, 0, 0,
+	2.0, 0, 0, -53.0/6.0, 704.0/45.0, -107.0/9.0, 67.0/90.0, 3.0, 0, 0,
+	-91.0/108.0, 0, 0, 23.0/108.0, -976.0/135.0, 311.0/54.0, -19.0/60.0, 17.0/6.0, -1.0/12.0, 0,
+	2383.0/4100.0, 0, 0, -341.0/164.0, 4496.0/1025.0, -301.0/82.0, 2133.0/4100.0, 45.0/82.0, 45.0/164.0, 18.0/41.0
+};
+const double RK7_Tableau::gamma[RK7_Tableau::n] = {
+	41.0/840.0, 0, 0, 0, 0, 34.0/105.0, 9.0/35.0, 9.0/35.0, 9.0/280.0, 9.0/280.0, 41.0/840.0
+};
+
+// ---------------------------------------------------------------------------
+// RK8 13-stage parameters
+// ---------------------------------------------------------------------------
+
+const double RK8_Tableau::alpha[RK8_Tableau::n-1] = {
+	2.0/27.0, 1.0/9.0, 1.0/6.0, 5.0/12.0, 1.0/2.0, 5.0/6.0, 1.0/6.0, 2.0/3.0, 1.0/3.0, 1.0, 0, 1.0
+};
+const double RK8_Tableau::beta[(RK8_Tableau::n-1)*(RK8_Tableau::n-1)] = {
+	2.0/27.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1.0/36.0, 1.0/12.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1.0/24.0, 0, 1.0/8.0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	5.0/12.0, 0, -25.0/16.0, 25.0/16.0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1.0/20.0, 0, 0, 1.0/4.0, 1.0/5.0, 0, 0, 0, 0, 0, 0, 0,
+	-25.0/108.0, 0, 0, 125.0/108.0, -65.0/27.0, 125.0/54.0, 0, 0, 0, 0, 0, 0,
+	31.0/300.0, 0, 0, 0, 61.0/225.0, -2.0/9.0, 13.0/900.0, 0, 0, 0, 0, 0,
+	2.0, 0, 0, -53.0/6.0, 704.0/45.0, -107.0/9.0, 67.0/90.0, 3.0, 0, 0, 0, 0,
+	-91.0/108.0, 0, 0, 23.0/108.0, -976.0/135.0, 311.0/54.0, -19.0/60.0, 17.0/6.0, -1.0/12.0, 0, 0, 0,
+	2383.0/4100.0, 0, 0, -341.0/164.0, 4496.0/1025.0, -301.0/82.0, 2133.0/4100.0, 45.0/82.0, 45.0/164.0, 18.0/41.0, 0, 0,
+	3.0/205.0, 0, 0, 0, 0, -6.0/41.0, -3.0/205.0, -3.0/41.0, 3.0/41.0, 6.0/41.0, 0, 0,
+	-1777.0/4100.0, 0, 0, -341.0/164.0, 4496.0/1025.0, -289.0/82.0, 2193.0/4100.0, 51.0/82.0, 33.0/164.0, 12.0/41.0, 0, 1.0
+};
+const double RK8_Tableau::gamma[RK8_Tableau::n] = {
+	0, 0, 0, 0, 0, 34.0/105.0, 9.0/35.0, 9.0/35.0, 9.0/280.0, 9.0/280.0, 0, 41.0/840.0, 41.0/840.0
+};
+
+// ---------------------------------------------------------------------------
+// Embedded pairs for the adaptive propagators
+// delta: weights of the error estimate (difference between the propagating
+// solution and the embedded lower-order solution)
+// ---------------------------------------------------------------------------
+
+// Dormand-Prince 5(4), 7 stages. The last stage is evaluated at the new state
+// ("first same as last")
+const double DP5_Tableau::alpha[DP5_Tableau::n-1] = {
+	1.0/5.0, 3.0/10.0, 4.0/5.0, 8.0/9.0, 1.0, 1.0
+};
+const double DP5_Tableau::beta[(DP5_Tableau::n-1)*(DP5_Tableau::n-1)] = {
+	1.0/5.0, 0, 0, 0, 0, 0,
+	3.0/40.0, 9.0/40.0, 0, 0, 0, 0,
+	44.0/45.0, -56.0/15.0, 32.0/9.0, 0, 0, 0,
+	19372.0/6561.0, -25360.0/2187.0, 64448.0/6561.0, -212.0/729.0, 0, 0,
+	9017.0/3168.0, -355.0/33.0, 46732.0/5247.0, 49.0/176.0, -5103.0/18656.0, 0,
+	35.0/384.0, 0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0
+};
+const double DP5_Tableau::gamma[DP5_Tableau::n] = {
+	35.0/384.0, 0, 500.0/1113.0, 125.0/192.0, -2187.0/6784.0, 11.0/84.0, 0
+};
+const double DP5_Tableau::delta[DP5_Tableau::n] = {
+	71.0/57600.0, 0, -71.0/16695.0, 71.0/1920.0, -17253.0/339200.0, 22.0/525.0, -1.0/40.0
+};
+
+// Fehlberg 7(8), 13 stages: the RK8 tableau, with the RK7 solution from the
+// first 11 stages as the embedded solution
+const double RK87_Tableau::delta[RK87_Tableau::n] = {
+	-41.0/840.0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -41.0/840.0, 41.0/840.0, 41.0/840.0
+};
+
+// ===========================================================================
+// Analytic 2-body propagation
+// ===========================================================================
+
+// ---------------------------------------------------------------------------
+// Stumpff functions c2(z), c3(z)
+// ---------------------------------------------------------------------------
+
+static void Stumpff (double z, double &c2, double &c3)
+{
+	if (z > 1e-3) {
+		double sz = sqrt(z);
+		c2 = (1.0 - cos(sz))/z;
+		c3 = (sz - sin(sz))/(z*sz);
+	} else if (z < -1e-3) {
+		double sz = sqrt(-z);
+		c2 = (cosh(sz) - 1.0)/(-z);
+		c3 = (sinh(sz) - sz)/(-z*sz);
+	} else {
+		c2 = (1.0 - z*(1.0 - z*(1.0 - z/56.0)/30.0)/12.0)/2.0;
+		c3 = (1.0 - z*(1.0 - z*(1.0 - z/72.0)/42.0)/20.0)/6.0;
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Propagate the 2-body state (r,v) across interval dt (which may be negative)
+// using universal variables, for elliptic and hyperbolic orbits
+// ---------------------------------------------------------------------------
+
+void KeplerDrift (Vector &r, Vector &v, double mu, double dt)
+{
+	const int maxit = 50;
+	const double eps = 1e-14;
+
+	double smu = sqrt(mu);
+	double r0 = r.length();
+	double rv = dotp (r, v)/smu;
+	double alpha = 2.0/r0 - dotp (v, v)/mu; // inverse semi-major axis
+
+	if (alpha > 0.0) { // elliptic: propagate modulo the orbit period
+		double T = Pi2/(alpha*sqrt(alpha)*smu);
+		if (fabs (dt) > T) dt = fmod (dt, T);
+	}
+
+	// solve the universal Kepler equation for x (Laguerre-Conway iteration)
+	double x = smu*dt/r0, x2, z, c2, c3, F, dF, ddF;
+	for (int i = 0; i < maxit; i++) {
+		x2 = x*x;
+		z = alpha*x2;
+		Stumpff (z, c2, c3);
+		F   = rv*x2*c2 + (1.0-alpha*r0)*x2*x*c3 + r0*x - smu*dt;
+		dF  = rv*x*(1.0-z*c3) + (1.0-alpha*r0)*x2*c2 + r0;
+		ddF = rv*(1.0-z*c2) + (1.0-alpha*r0)*x*(1.0-z*c3);
+		double disc = fabs (16.0*dF*dF - 20.0*F*ddF);
+		double dx = 5.0*F/(dF + (dF > 0.0 ? 1.0:-1.0)*sqrt(disc));
+		x -= dx;
+		if (fabs (dx) <= eps*(1.0+fabs(x))) break;
+	}
+	x2 = x*x;
+	z = alpha*x2;
+	Stumpff (z, c2, c3);
+
+	// Lagrange coefficients
+	double f = 1.0 - x2*c2/r0;
+	double g = dt - x2*x*c3/smu;
+	Vector r1 (r*f + v*g);
+	double r1n = r1.length();
+	double fd = smu/(r1n*r0) * x*(z*c3 - 1.0);
+	double gd = 1.0 - x2*c2/r1n;
+	v = r*fd + v*gd;
+	r = r1;
+}
+
+// ===========================================================================
+// Dense output
+// ===========================================================================
+
+void HermiteInterpolate (const Vector &p0, const Vector &v0, const Vector &a0,
+	const Vector &p1, const Vector &v1, const Vector &a1, double h, double t,
+	Vector &pos, Vector &vel)
+{
+	double t2 = t*t, t3 = t2*t, t4 = t3*t, t5 = t4*t;
+	double h0 = 1.0 - 10.0*t3 + 15.0*t4 - 6.0*t5;
+	double h1 = t - 6.0*t3 + 8.0*t4 - 3.0*t5;
+	double h2 = 0.5*(t2 - 3.0*t3 + 3.0*t4 - t5);
+	double h3 = 0.5*(t3 - 2.0*t4 + t5);
+	double h4 = -4.0*t3 + 7.0*t4 - 3.0*t5;
+	double h5 = 10.0*t3 - 15.0*t4 + 6.0*t5;
+	double d0 = -30.0*t2 + 60.0*t3 - 30.0*t4;
+	double d1 = 1.0 - 18.0*t2 + 32.0*t3 - 15.0*t4;
+	double d2 = t - 4.5*t2 + 6.0*t3 - 2.5*t4;
+	double d3 = 1.5*t2 - 4.0*t3 + 2.5*t4;
+	double d4 = -12.0*t2 + 28.0*t3 - 15.0*t4;
+	double d5 = -d0;
+	pos = p0*h0 + p1*h5 + (v0*h1 + v1*h4)*h + (a0*h2 + a1*h3)*(h*h);
+	vel = (p0*d0 + p1*d5)/h + v0*d1 + v1*d4 + (a0*d2 + a1*d3)*h;
+}
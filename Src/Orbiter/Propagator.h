@@ -0,0 +1,344 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// Propagator.h
+// Integration parameters, step drivers and analytic 2-body propagation
+// shared by the body state propagators (BodyIntegrator.cpp) and by the
+// propagator benchmark (Utils/propbench). Depends only on the vector library.
+// =======================================================================
+
+#ifndef __PROPAGATOR_H
+#define __PROPAGATOR_H
+
+#include "Vecmat.h"
+
+// ===========================================================================
+// Runge-Kutta integration parameters (RK5-RK8)
+// Used by the driver routines in BodyIntegrator.cpp. Each tableau is a separate type, so
+// that the driver can be instantiated with the stage count and coefficients
+// fixed at compile time.
+// (Note that RK2 and RK4 are implemented directly without using the driver
+// routines)
+// ===========================================================================
+
+// ---------------------------------------------------------------------------
+// RK5 6-stage parameters
+// ---------------------------------------------------------------------------
+
+struct RK5_Tableau {
+	enum { n = 6 };                         // number of stages
+	static const double alpha[n-1];         // stage time fractions
+	static const double beta[(n-1)*(n-1)];  // stage coefficients (one row per stage)
+	static const double gamma[n];           // output weights
+};
+
+// ---------------------------------------------------------------------------
+// RK6 8-stage parameters
+// ---------------------------------------------------------------------------
+
+struct RK6_Tableau {
+	enum { n = 8 };                         // number of stages
+	static const double alpha[n-1];         // stage time fractions
+	static const double beta[(n-1)*(n-1)];  // stage coefficients (one row per stage)
+	static const double gamma[n];           // output weights
+};
+
+// ---------------------------------------------------------------------------
+// RK7 11-stage parameters
+// ---------------------------------------------------------------------------
+
+struct RK7_Tableau {
+	enum { n = 11 };                        // number of stages
+	static const double alpha[n-1];         // stage time fractions
+	static const double beta[(n-1)*(n-1)];  // stage coefficients (one row per stage)
+	static const double gamma[n];           // output weights
+};
+
+// ---------------------------------------------------------------------------
+// RK8 13-stage parameters
+// ---------------------------------------------------------------------------
+
+struct RK8_Tableau {
+	enum { n = 13 };                        // number of stages
+	static const double alpha[n-1];         // stage time fractions
+	static const double beta[(n-1)*(n-1)];  // stage coefficients (one row per stage)
+	static const double gamma[n];           // output weights
+};
+
+// ---------------------------------------------------------------------------
+// Embedded pairs for the adaptive propagators
+// delta: weights of the error estimate (difference between the propagating
+// solution and the embedded lower-order solution)
+// ---------------------------------------------------------------------------
+
+// Dormand-Prince 5(4), 7 stages. The last stage is evaluated at the new state
+// ("first same as last")
+struct DP5_Tableau {
+	enum { n = 7, order = 5, fsal = 1 };
+	static const double alpha[n-1];
+	static const double beta[(n-1)*(n-1)];
+	static const double gamma[n];
+	static const double delta[n];
+};
+
+// Fehlberg 7(8), 13 stages: the RK8 tableau, with the RK7 solution from the
+// first 11 stages as the embedded solution
+struct RK87_Tableau: public RK8_Tableau {
+	enum { order = 7, fsal = 0 };
+	static const double delta[n];
+};
+
+// ===========================================================================
+// Analytic 2-body propagation
+// ===========================================================================
+
+// Propagate the 2-body state (r,v) around a central mass with gravitational
+// parameter mu across interval dt (which may be negative), using universal
+// variables, for elliptic and hyperbolic orbits
+void KeplerDrift (Vector &r, Vector &v, double mu, double dt);
+
+// ===========================================================================
+// Dense output
+// ===========================================================================
+
+// Quintic Hermite interpolation of position and velocity at fraction t (0..1)
+// of a step of length h, from the positions, velocities and accelerations
+// at the start (p0,v0,a0) and end (p1,v1,a1) of the step
+void HermiteInterpolate (const Vector &p0, const Vector &v0, const Vector &a0,
+	const Vector &p1, const Vector &v1, const Vector &a1, double h, double t,
+	Vector &pos, Vector &vel);
+
+// ===========================================================================
+// Step drivers for linear+angular state vectors
+// Templates over the tableau type RK and the body type B, which provides
+// the moments at intermediate states:
+//   void GetIntermediateMoments (Vector &acc, Vector &tau, const StateVectors &s,
+//        double tfrac, double dt);
+//   Vector EulerInv_full (const Vector &tau, const Vector &omega) const;
+// A step of length h starts at fraction tfrac of the frame interval, and
+// covers fraction hfrac of it. The stage buffers are sized at compile time
+// and kept on the stack, so the drivers are re-entrant.
+// ===========================================================================
+
+// Linear+angular state of a body during a frame update. Position and
+// velocity are propagated as increments to a base state, to limit
+// rounding errors.
+struct LinAngState {
+	StateVectors &s;           // current state
+	Vector &acc, &arot;        // linear and angular acceleration at s
+	const Vector &pos0, &vel0; // base position and velocity
+	Vector &dpos, &dvel;       // position and velocity increments
+};
+
+// Intermediate states s and linear and angular accelerations a, d at the
+// stages of an RK step. Stage terms with zero coefficients are skipped, and
+// the rotation matrix of each stage is only rebuilt once all terms have
+// been added.
+template<class RK, class B>
+void RKStages_LinAng (B &body, const LinAngState &st, double h, double tfrac, double hfrac,
+	StateVectors *s, Vector *a, Vector *d)
+{
+	const int n = RK::n;
+	const double *beta = RK::beta;
+	const StateVectors &s1 = st.s;
+	int i, j;
+	double bh;
+	Vector tau;
+
+	s[0].Set (s1.vel, s1.pos, s1.omega, s1.Q);
+	a[0].Set (st.acc);
+	d[0].Set (st.arot);
+
+	for (i = 1; i < n; i++) {
+		StateVectors &si = s[i];
+		si.vel.Set (s1.vel);
+		si.pos.Set (s1.pos);
+		si.omega.Set (s1.omega);
+		si.Q.Set (s1.Q);
+		for (j = 0; j < i; j++) {
+			if (beta[j]) {
+				bh = beta[j]*h;
+				si.vel   += a[j] * bh;
+				si.pos   += s[j].vel * bh;
+				si.omega += d[j] * bh;
+				si.Q.Rotate (s[j].omega * bh);
+			}
+		}
+		si.R.Set (si.Q);
+		body.GetIntermediateMoments (a[i], tau, si, tfrac+RK::alpha[i-1]*hfrac, h);
+		d[i].Set (body.EulerInv_full (tau, si.omega));
+		beta += n-1;
+	}
+}
+
+// Runge-Kutta step (RK5-RK8). Adds the position and velocity increments, and
+// updates the angular state. The new position, velocity and accelerations
+// are left to the caller.
+template<class RK, class B>
+void RKStep_LinAng (B &body, LinAngState &st, double h, double tfrac, double hfrac)
+{
+	const int n = RK::n;
+	StateVectors s[n];
+	Vector a[n];             // linear acceleration
+	Vector d[n];             // angular acceleration
+	double bh;
+
+	RKStages_LinAng<RK> (body, st, h, tfrac, hfrac, s, a, d);
+	for (int i = 0; i < n; i++) {
+		if (RK::gamma[i]) {
+			bh = RK::gamma[i]*h;
+			st.dvel += a[i]       * bh;
+			st.dpos += s[i].vel   * bh;
+			st.s.Q.Rotate (s[i].omega * bh);
+			st.s.omega += d[i]    * bh;
+		}
+	}
+}
+
+// Step of an embedded Runge-Kutta pair. Updates the state like RKStep_LinAng,
+// and also sets the new position, velocity and accelerations. Returns the
+// local error estimate, divided by the position error tolerance scale
+// (<= 1: step acceptable)
+template<class RK, class B>
+double RKEStep_LinAng (B &body, LinAngState &st, double h, double tfrac, double hfrac, double scale)
+{
+	const int n = RK::n;
+	StateVectors s[n];
+	Vector a[n];             // linear acceleration
+	Vector d[n];             // angular acceleration
+	Vector tau, perr, verr;
+	double bh;
+
+	RKStages_LinAng<RK> (body, st, h, tfrac, hfrac, s, a, d);
+	for (int i = 0; i < n; i++) {
+		if (RK::gamma[i]) {
+			bh = RK::gamma[i]*h;
+			st.dvel += a[i]       * bh;
+			st.dpos += s[i].vel   * bh;
+			st.s.Q.Rotate (s[i].omega * bh);
+			st.s.omega += d[i]    * bh;
+		}
+		if (RK::delta[i]) {
+			bh = RK::delta[i]*h;
+			verr += a[i]     * bh;
+			perr += s[i].vel * bh;
+		}
+	}
+
+	// moments at the new state
+	st.s.pos = st.pos0 + st.dpos;
+	st.s.vel = st.vel0 + st.dvel;
+	st.s.R.Set (st.s.Q);
+	if (RK::fsal) {
+		st.acc.Set (a[n-1]);
+		st.arot.Set (d[n-1]);
+	} else {
+		body.GetIntermediateMoments (st.acc, tau, st.s, tfrac+hfrac, h);
+		st.arot.Set (body.EulerInv_full (tau, st.s.omega));
+	}
+
+	double ep = perr.length(), ev = verr.length()*h;
+	return (ep > ev ? ep : ev) / scale;
+}
+
+// Adaptive step size control for the embedded pairs. Propagates the state
+// across a frame interval T in sub-steps of at most T/nmin, each sized to
+// keep the local error estimate within scale. hprop is the step size
+// proposal, carried over between frames (0: none). B also provides
+//   void AddDenseNode (double tfrac);
+// which is called after each accepted sub-step.
+// Returns the number of accepted sub-steps.
+template<class RK, class B>
+int AdaptiveFrame_LinAng (B &body, LinAngState &st, double T, int nmin, double &hprop, double scale)
+{
+	const double safety = 0.9;  // safety factor for step size proposals
+	const double fmin = 0.2;    // max. step size reduction per step
+	const double fmax = 5.0;    // max. step size increase per step
+	const int nmax = nmin*100;  // hard limit for number of sub-steps
+
+	double iT = 1.0/T;
+	double hmax = T/nmin, hmin = T/nmax;
+	double t = 0.0, h = (hprop > 0.0 && hprop < hmax ? hprop : hmax);
+	double hlast, err, fac;
+	int nstep = 0;
+	bool last;
+
+	Vector dpos0, dvel0, omega0, acc0, arot0;
+	Quaternion Q0;
+
+	do {
+		last = (t+h >= T*(1.0-1e-10));
+		hlast = h;
+		if (last) h = T-t; // truncate final step to the frame interval
+
+		dpos0 = st.dpos, dvel0 = st.dvel;
+		omega0 = st.s.omega, Q0 = st.s.Q;
+		acc0 = st.acc, arot0 = st.arot;
+
+		err = RKEStep_LinAng<RK> (body, st, h, t*iT, h*iT, scale);
+		fac = (err > 0.0 ? safety*pow (err, -1.0/RK::order) : fmax);
+		if (fac < fmin) fac = fmin;
+		else if (fac > fmax) fac = fmax;
+
+		if (err > 1.0 && h > hmin) { // reject step and retry with smaller step size
+			st.dpos = dpos0, st.dvel = dvel0;
+			st.s.omega = omega0, st.s.Q = Q0;
+			st.s.pos = st.pos0 + st.dpos;
+			st.s.vel = st.vel0 + st.dvel;
+			st.acc = acc0, st.arot = arot0;
+			h *= fac;
+			if (h < hmin) h = hmin;
+			last = false;
+			continue;
+		}
+
+		t += h;
+		nstep++;
+		body.AddDenseNode (t*iT);
+		h *= fac;
+		if (h > hmax) h = hmax;
+		if (last && h < hlast) h = hlast; // don't let a truncated final step reduce the proposal
+	} while (!last);
+
+	hprop = h;
+	return nstep;
+}
+
+// 4th order Wisdom-Holman step: Yoshida composition of three 2nd order
+// kick-drift-kick maps. The linear state pos, vel is propagated relative
+// to a central mass with gravitational parameter mu (KeplerDrift), and the
+// perturbation acceleration accp and the angular acceleration arot are
+// applied as kicks. The angular state of s is propagated with a leapfrog
+// scheme. On entry, accp and arot must contain the accelerations at the
+// start of the step. B provides
+//   void GetIntermediateMoments_WH (Vector &accp, Vector &tau, double tfrac, double dt);
+// which returns the perturbation and torque at the current state, so pos,
+// vel and s must be the body's own state vectors.
+template<class B>
+void WH4Step_LinAng (B &body, Vector &pos, Vector &vel, Vector &accp, StateVectors &s, Vector &arot,
+	double mu, double h, double tfrac, double hfrac)
+{
+	static const double b = 1.25992104989487319066654436028;      // 2^1/3
+	static const double a = 2 - b;
+	static const double x0 = -b / a;
+	static const double x1 = 1. / a;
+	static const double d4[3] = {x1, x0, x1};
+	double sec = 0.0;
+	Vector tau;
+
+	for (int i = 0; i < 3; i++) {
+		double hi = h*d4[i], hi05 = hi*0.5;
+		vel += accp*hi05;
+		s.omega += arot*hi05;
+		KeplerDrift (pos, vel, mu, hi);
+		s.Q.Rotate (s.omega*hi);
+		sec += d4[i];
+		body.GetIntermediateMoments_WH (accp, tau, tfrac+sec*hfrac, h);
+		arot.Set (body.EulerInv_full (tau, s.omega));
+		vel += accp*hi05;
+		s.omega += arot*hi05;
+	}
+}
+
+#endif // !__PROPAGATOR_H
@@ -7,13 +7,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <io.h>
+#include <set>
+#include <string>
 #include "Orbiter.h"
 #include "Config.h"
+#include "IndexedStream.h"
 #include "Psys.h"
 #include "Astro.h"
 #include "Element.h"
 #include "Vessel.h"
 #include "SuperVessel.h"
+#include "JobMgr.h"
+#include "VesselGrid.h"
+#include "GravField.h"
 #include "Log.h"
 
 using namespace std;
@@ -36,12 +42,31 @@ PlanetarySystem::PlanetarySystem (char *fname)
 	labellist    = 0;
 	nlabellist   = 0;
 	labelpath = 0;
+	vgrid = new VesselGrid (1e6); TRACENEW // cell size: max. transponder range
+	jobmgr = 0;
+	jobvessel = 0;
+	njobvessel = njobvesselbuf = 0;
+	int nthread = g_pOrbiter->Cfg()->CfgPhysicsPrm.nPhysicsThread;
+	if (!nthread) nthread = JobManager::DefaultThreadCount();
+	if (nthread > 1) {
+		jobmgr = new JobManager (nthread); TRACENEW
+		LOGOUT("Concurrent vessel updates: %d threads", nthread);
+	}
 	Read (fname);
 }
 
 PlanetarySystem::~PlanetarySystem ()
 {
 	Clear ();
+	delete vgrid;
+	if (jobmgr) {
+		delete jobmgr;
+		jobmgr = 0;
+	}
+	if (njobvesselbuf) {
+		delete []jobvessel;
+		njobvesselbuf = 0;
+	}
 }
 
 void PlanetarySystem::Clear ()
@@ -96,12 +121,64 @@ void PlanetarySystem::Clear ()
 	}
 }
 
+// Queue the meshes named in a vessel class configuration (and its base
+// classes) for preloading
+
+static void PreloadClassMeshes (ifstream &cfg, int depth = 0)
+{
+	char cbuf[256];
+	if (depth < 8 && GetItemString (cfg, "BaseClass", cbuf)) {
+		IndexedIfstream basef (g_pOrbiter->ConfigPath (cbuf));
+		if (basef) PreloadClassMeshes (basef, depth+1);
+	}
+	if (GetItemString (cfg, "MeshName", cbuf))
+		g_pOrbiter->meshmanager.PreloadMesh (cbuf);
+}
+
+// Scan the vessel list of a scenario, and queue the meshes of all vessel
+// classes for preloading, so that they are parsed on the mesh manager's
+// worker threads while the vessels are created one by one.
+// Leaves the stream at its current position.
+
+static void PreloadVesselMeshes (ifstream &ifs)
+{
+	char cbuf[256], path[256], *pc, *pd;
+	set<string> cls;
+	streampos pos = ifs.tellg();
+
+	for (;;) {
+		if (!ifs.getline (cbuf, 256)) break;
+		pc = trim_string (cbuf);
+		if (!_stricmp (pc, "END_SHIPS")) break;
+		for (pd = pc; *pd != '\0' && *pd != ':'; pd++);
+		if (*pd) *pd++ = '\0';
+		else pd = pc;
+		if (cls.insert (pd).second) {
+			// class config search as in Vessel::OpenConfigFile
+			IndexedIfstream cfg;
+			strcpy (path, "Vessels\\");
+			strncat (path, pd, 240);
+			cfg.open (g_pOrbiter->ConfigPath (path));
+			if (!cfg.good()) {
+				cfg.clear();
+				cfg.open (g_pOrbiter->ConfigPath (path+8));
+			}
+			if (cfg.good()) PreloadClassMeshes (cfg);
+		}
+		// skip the vessel state
+		while (ifs.getline (cbuf, 256) && _stricmp (trim_string (cbuf), "END"));
+	}
+	ifs.clear();
+	ifs.seekg (pos);
+}
+
 void PlanetarySystem::InitState (const char *fname)
 {
 	char cbuf[256], *pc, *pd;
 	ifstream ifs (fname);
 	if (!ifs) return;
 	if (FindLine (ifs, "BEGIN_SHIPS")) {
+		PreloadVesselMeshes (ifs);
 		for (;;) {
 			if (!ifs.getline (cbuf, 256)) break;
 			pc = trim_string (cbuf);
@@ -529,6 +606,7 @@ int PlanetarySystem::AddVessel (Vessel *_vessel)
 	vessel = tmp;
 	vessel[nvessel] = _vessel;
 	AddBody (_vessel); // register in general list
+	vgrid->Invalidate();
 	g_bForceUpdate = true;
 	return nvessel++;
 }
@@ -550,10 +628,29 @@ bool PlanetarySystem::DelVessel (Vessel *_vessel, Body *_alt_cam_tgt)
 	delete []vessel;
 	vessel = tmp;
 	nvessel--;
+	vgrid->Invalidate();
 	g_bForceUpdate = true;
 	return true;
 }
 
+Vessel *PlanetarySystem::ClosestVessel (const Vector &gpos, const Vessel *exclude)
+{
+	if (!vgrid->Valid()) vgrid->Build (vessel, nvessel);
+	return vgrid->Closest (gpos, exclude);
+}
+
+DWORD PlanetarySystem::VesselsInRange (const Vector &gpos, double range, Vessel **&list)
+{
+	if (!vgrid->Valid()) vgrid->Build (vessel, nvessel);
+	return vgrid->InRange (gpos, range, list);
+}
+
+double PlanetarySystem::MaxVesselSize ()
+{
+	if (!vgrid->Valid()) vgrid->Build (vessel, nvessel);
+	return vgrid->MaxSize();
+}
+
 void PlanetarySystem::AddSuperVessel (SuperVessel *sv)
 {
 	SuperVessel **tmp = new SuperVessel*[nsupervessel+1]; TRACENEW
@@ -604,11 +701,13 @@ void PlanetarySystem::DockVessels (Vessel *vessel1, Vessel *vessel2, int port1,
 	} else {                 // add vessel1 into sv2
 		sv2->Add (vessel2, port2, vessel1, port1, mixmoments);
 	}
+	vgrid->Invalidate(); // docking can move the vessels
 }
 
 void PlanetarySystem::UndockVessel (SuperVessel *sv, Vessel *_vessel, int port, double vsep)
 {
 	sv->Detach (_vessel, port, vsep);
+	vgrid->Invalidate(); // separation moves the vessels
 	if (!sv->nVessel()) {
 		// remove supervessel from list
 		DWORD i, j, k;
@@ -745,7 +844,19 @@ Vector SingleGacc_perturbation (const Vector &rpos, const CelestialBody *body)
 
 	Vector dg;
 
-	if (body->UseComplexGravity() && body->nJcoeff() > 0) {
+	if (body->UseComplexGravity() && body->GravField()) {
+
+		// spherical harmonic field model, evaluated in the body frame
+		// (mapped from the left-handed local frame to x=prime meridian, z=north)
+		const GravityField *gf = body->GravField();
+		Vector loc (tmul (body->GRot(), -rpos));
+		int deg = gf->Degree (loc.length());
+		if (deg >= 2) {
+			Vector a (gf->Acc (Vector (loc.x, loc.z, loc.y), deg));
+			dg = mul (body->GRot(), Vector (a.x, a.z, a.y));
+		}
+
+	} else if (body->UseComplexGravity() && body->nJcoeff() > 0) {
 
 		const double eps = 1e-10; // perturbation limit
 		double d  = rpos.length();
@@ -944,21 +1055,76 @@ Vector PlanetarySystem::GetMomentumFlux (const Vector &gpos) const
 void PlanetarySystem::Update (bool force)
 {
 	DWORD i;
+	vgrid->Invalidate();
 	for (i = 0; i < nbody; i++) body[i]->BeginStateUpdate ();
 	for (i = 0; i < nstar; i++) star[i]->RelTrueAndBaryState();
 	for (i = 0; i < nstar; i++) star[i]->AbsTrueState();
 	for (i = 0; i < ngrav; i++) grav[i]->Update (force);
 	for (i = 0; i < nvessel; i++) vessel[i]->UpdateBodyForces ();
+	if (jobmgr && !force) UpdateConcurrent ();
 	for (i = 0; i < nsupervessel; i++) supervessel[i]->Update (force);
 	for (i = 0; i < nvessel; i++) vessel[i]->Update (force);
 }
 
+void PlanetarySystem::UpdateConcurrent ()
+{
+	// Only the dynamic state propagation of vessels that don't access shared
+	// resources is performed on the job threads. It only reads the s0 states
+	// of other objects, so the results don't depend on the processing order.
+	// The remaining update steps (and all other vessels) are processed by the
+	// serial update loops.
+	DWORD i, nmax = nsupervessel + nvessel;
+	if (nmax > njobvesselbuf) {
+		if (njobvesselbuf) delete []jobvessel;
+		jobvessel = new VesselBase*[njobvesselbuf = nmax]; TRACENEW
+	}
+	njobvessel = 0;
+	for (i = 0; i < nsupervessel; i++)
+		if (supervessel[i]->CanUpdateConcurrently (false))
+			jobvessel[njobvessel++] = supervessel[i];
+	for (i = 0; i < nvessel; i++)
+		if (vessel[i]->CanUpdateConcurrently (false))
+			jobvessel[njobvessel++] = vessel[i];
+	if (njobvessel > 1)
+		jobmgr->ParallelFor (njobvessel, UpdateVessel_Job, this);
+	else if (njobvessel)
+		jobvessel[0]->UpdateConcurrent (false);
+}
+
+void PlanetarySystem::UpdateVessel_Job (void *context, DWORD idx)
+{
+	PlanetarySystem *psys = (PlanetarySystem*)context;
+	psys->jobvessel[idx]->UpdateConcurrent (false);
+}
+
 void PlanetarySystem::FinaliseUpdate ()
 {
 	DWORD i;
 	for (i = 0; i < nbody; i++) body[i]->EndStateUpdate ();
+	vgrid->Invalidate();
 	for (i = 0; i < nsupervessel; i++) supervessel[i]->PostUpdate ();
 	for (i = 0; i < nvessel; i++) vessel[i]->PostUpdate ();
+	if (g_pOrbiter->Cfg()->CfgDebugPrm.bStateChecksum)
+		LOGOUT("State checksum: t=%0.4f, n=%d, chk=%08X", td.SimT0, nvessel, StateChecksum());
+}
+
+DWORD PlanetarySystem::StateChecksum () const
+{
+	// FNV-1a hash over the raw state vector data of all vessels
+	DWORD i, j, chk = 2166136261u;
+	for (i = 0; i < nvessel; i++) {
+		const StateVectors *s = vessel[i]->s0;
+		const double *d[4] = {s->pos.data, s->vel.data, s->Q.data, s->omega.data};
+		const int nd[4] = {3, 3, 4, 3};
+		for (j = 0; j < 4; j++) {
+			const BYTE *b = (const BYTE*)d[j];
+			for (int k = 0; k < nd[j]*(int)sizeof(double); k++) {
+				chk ^= b[k];
+				chk *= 16777619u;
+			}
+		}
+	}
+	return chk;
 }
 
 void PlanetarySystem::Timejump ()
@@ -969,6 +1135,7 @@ void PlanetarySystem::Timejump ()
 	for (i = 0; i < nstar; i++) star[i]->AbsTrueState();
 	for (i = 0; i < ngrav; i++) grav[i]->Update (true);
 	for (i = 0; i < nbody; i++) body[i]->EndStateUpdate ();
+	vgrid->Invalidate();
 
 	for (i = 0; i < nvessel; i++)
 		vessel[i]->Timejump(g_pOrbiter->tjump.dt, g_pOrbiter->tjump.mode);
@@ -17,6 +17,9 @@
 
 class Vessel;
 class SuperVessel;
+class VesselBase;
+class JobManager;
+class VesselGrid;
 #ifdef NETCONNECT
 class OrbiterConnect;
 #endif
@@ -68,6 +71,18 @@ public:
 	inline Vessel *GetVessel (DWORD i) const { return vessel[i]; }
 	// Return pointer to vessel by name or index, or 0 if not present
 
+	Vessel *ClosestVessel (const Vector &gpos, const Vessel *exclude);
+	// Returns the vessel closest to global position gpos, excluding 'exclude'
+	// (NULL if no other vessel exists)
+
+	DWORD VesselsInRange (const Vector &gpos, double range, Vessel **&list);
+	// Returns the number of vessels within distance 'range' of global position
+	// gpos, and the list of vessels in 'list', in descending order of their
+	// index in the vessel list. The list is only valid until the next call.
+
+	double MaxVesselSize ();
+	// Returns the radius of the largest vessel in the system
+
 	bool isObject (const Body *obj) const;
 	// returns true if obj is a registered object
 
@@ -120,6 +135,11 @@ public:
 
 	void FinaliseUpdate ();
 
+	DWORD StateChecksum () const;
+	// Returns a checksum over the current state vectors of all vessels.
+	// Used for verifying that concurrent and serial vessel updates produce
+	// identical results.
+
 	void Timejump ();
 	// Discontinuous step
 
@@ -226,6 +246,22 @@ private:
 	SuperVessel **supervessel;
 	// List of spacecraft groups (composite vessels)
 
+	VesselGrid *vgrid;
+	// Spatial index over vessel positions for proximity queries. Rebuilt on
+	// demand after the vessel list or the vessel states have changed.
+
+	JobManager *jobmgr;
+	// Threads for concurrent vessel state propagation (NULL for serial updates)
+
+	VesselBase **jobvessel;
+	DWORD njobvessel, njobvesselbuf;
+	// List of vessels and vessel groups propagated concurrently in the current step
+
+	void UpdateConcurrent ();
+	// Propagate the states of all eligible vessels on the job threads
+
+	static void UpdateVessel_Job (void *context, DWORD idx);
+
 	void OutputLoadStatus (const char *bname);
 
 	void AddBody (Body *_body);
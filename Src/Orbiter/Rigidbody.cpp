@@ -18,8 +18,10 @@
 #include "Celbody.h"
 #include "Psys.h"
 #include "Element.h"
+#include "Propagator.h"
 #include "Astro.h"
 #include "Log.h"
+#include "IndexedStream.h"
 
 using namespace std;
 
@@ -34,7 +36,8 @@ extern char DBG_MSG[256];
 bool       RigidBody::bDistmass = false;
 bool       RigidBody::bGPerturb = false;
 int        RigidBody::nPropLevel = 1;
-RigidBody::PROPMODE RigidBody::PropMode[MAX_PROP_LEVEL] = {&RigidBody::RK2_LinAng, 0, 0.0, 0.0, 0.0, 0.0};
+RigidBody::PROPMODE RigidBody::PropMode[MAX_PROP_LEVEL] = {&RigidBody::RK2_LinAng, 0, 0, 0.0, 0.0, 0.0, 0.0};
+double     RigidBody::PropTol = 1e-10;
 
 const double gfielddata_updt_interval = 60.0;
 
@@ -55,7 +58,7 @@ RigidBody::RigidBody (double _mass, double _size, const Vector &_pmi): Body (_ma
 RigidBody::RigidBody (char *fname): Body (fname)
 {
 	SetDefaultCaps ();
-	ifstream ifs (g_pOrbiter->ConfigPath (fname));
+	IndexedIfstream ifs (g_pOrbiter->ConfigPath (fname));
 	if (ifs) ReadGenericCaps (ifs);
 }
 
@@ -80,11 +83,15 @@ void RigidBody::SetDefaultCaps ()
 	bDistmass = g_pOrbiter->Cfg()->CfgPhysicsPrm.bDistributedMass;
 	bGPerturb = g_pOrbiter->Cfg()->CfgPhysicsPrm.bNonsphericalGrav;
 	bOrbitStabilised = false;
+	bOrbitSymplectic = false;
 	bIgnoreGravTorque = false;
 	tidaldamp = 0.0;
 	PropLevel = 0;
 	PropSubMax = g_pOrbiter->Cfg()->CfgPhysicsPrm.PropSubMax;
 	nPropSubsteps = 1;
+	adapt_h = 0.0;
+	dense_t1 = -1e10;
+	ndense_req = 0;
 	gfielddata.ngrav = 0;
 	gfielddata.updt = -1e10; // invalidate
 }
@@ -135,6 +142,7 @@ void RigidBody::SetupPropagationModes ()
 		PropMode[i].tlim = g_pOrbiter->Cfg()->CfgPhysicsPrm.PropTLim[i];
 		PropMode[i].alim = g_pOrbiter->Cfg()->CfgPhysicsPrm.PropALim[i];
 		PropMode[i].propidx = g_pOrbiter->Cfg()->CfgPhysicsPrm.PropMode[i];
+		PropMode[i].apropagator = 0;
 		switch (PropMode[i].propidx) {
 		case PROP_RK2:  PropMode[i].propagator = &RigidBody::RK2_LinAng;  break;
 		case PROP_RK4:  PropMode[i].propagator = &RigidBody::RK4_LinAng;  break;
@@ -146,11 +154,14 @@ void RigidBody::SetupPropagationModes ()
 		case PROP_SY4:  PropMode[i].propagator = &RigidBody::SY4_LinAng;  break;
 		case PROP_SY6:  PropMode[i].propagator = &RigidBody::SY6_LinAng;  break;
 		case PROP_SY8:  PropMode[i].propagator = &RigidBody::SY8_LinAng;  break;
+		case PROP_DP5:  PropMode[i].apropagator = &RigidBody::DP5_LinAng;  PropMode[i].propagator = &RigidBody::RK5_LinAng; break;
+		case PROP_RK87: PropMode[i].apropagator = &RigidBody::RK87_LinAng; PropMode[i].propagator = &RigidBody::RK8_LinAng; break;
 		default:        PropMode[i].propagator = &RigidBody::RK4_LinAng;  break;
 		}
 	}
 	PropMode[nPropLevel-1].tlim = 1e20;
 	PropMode[nPropLevel-1].alim = 1e20;
+	PropTol = g_pOrbiter->Cfg()->CfgPhysicsPrm.PropTol;
 }
 
 // =======================================================================
@@ -204,16 +215,51 @@ void RigidBody::Update (bool force)
 			gfielddata.updt = td.SimT0 + gfielddata_updt_interval;
 		}
 
-		// First check if we should do a stabilised state update
-		if (bCanUpdateStabilised &&
-			ostep > g_pOrbiter->Cfg()->CfgPhysicsPrm.Stabilise_SLimit &&
-			g_psys->GetGravityContribution (cbody, cpos+cbody->GPos()) > 1-g_pOrbiter->Cfg()->CfgPhysicsPrm.Stabilise_PLimit) {
+		const CFG_PHYSICSPRM &prm = g_pOrbiter->Cfg()->CfgPhysicsPrm;
+		bOrbitSymplectic = false;
+
+		// First check if we can do a symplectic update of an unpowered orbit
+		// (an alternative to the stabilised update, so subject to the same conditions)
+		if (cbody && prm.bSymplecticWarp && bCanUpdateStabilised &&
+			ostep > prm.Stabilise_SLimit &&
+			CanUpdateSymplectic() &&
+			g_psys->GetGravityContribution (cbody, cpos+cbody->GPos()) > 1-prm.Stabilise_PLimit) {
+
+			// substeps from the orbit step target for perturbation integration
+			nPropSubsteps = max (1, min (prm.PPropSubMax, (int)ceil (ostep/prm.PPropSubLimit)));
+			double dt = td.SimDT/nPropSubsteps;
+
+			// Update linear state with the Wisdom-Holman method in cbody-relative frame
+			s1->Set (*s0);
+			cpos = s0->pos - cbody->s0->pos;
+			cvel = s0->vel - cbody->s0->vel;
+			GetIntermediateMoments_WH (acc_pert, tau, 0, dt);
+			arot.Set (EulerInv_full (tau, s1->omega));
+			ResetDense ();
+			for (i = 0; i < nPropSubsteps; i++) {
+				WH4_LinAng (dt, nPropSubsteps, i);
+				double tfrac = (i+1.0)/nPropSubsteps;
+				s1->pos.Set (cpos + cbody->InterpolatePosition (tfrac));
+				s1->vel.Set (cvel + cbody->s0->vel + (cbody->s1->vel - cbody->s0->vel)*tfrac);
+				AddDenseNode (tfrac);
+			}
+			FlushRPos();
+			FlushRVel();
+			s1->R.Set (s1->Q);
+			el_valid = bOrbitStabilised = false;
+			bOrbitSymplectic = true;
+
+		// Otherwise check if we should do a stabilised state update
+		} else if (bCanUpdateStabilised &&
+			ostep > prm.Stabilise_SLimit &&
+			g_psys->GetGravityContribution (cbody, cpos+cbody->GPos()) > 1-prm.Stabilise_PLimit) {
 
 			nPropSubsteps = 1; // for now
 			double dt = td.SimDT/nPropSubsteps;
 
 			// Update linear state with Encke's method
 			s1->Set (*s0);
+			ResetDense ();
 			if (!bOrbitStabilised) {
 				FlushRPos();
 				FlushRVel();
@@ -229,6 +275,7 @@ void RigidBody::Update (bool force)
 			FlushRVel();
 			s1->R.Set (s1->Q);
 			GetIntermediateMoments (acc, tau, *s1, 1, dt);
+			AddDenseNode (1.0);
 			el_valid = bOrbitStabilised = true;
 
 		} else { // do a dynamic state vector integration
@@ -238,19 +285,26 @@ void RigidBody::Update (bool force)
 			do {
 				// Select propagator
 				SetPropagator (PropLevel, nPropSubsteps);
-				double dt = td.SimDT/nPropSubsteps;
 
 				// Perform step propagation with sub-steps
 				s1->Set (*s0);
 				acc = acc0, arot = arot0;
 				rpos_add = rpos_add0, rvel_add = rvel_add0;
-				for (i = 0; i < nPropSubsteps; i++) {
-					((*this).*(PropMode[PropLevel].propagator)) (dt, nPropSubsteps, i);
-					s1->pos = rpos_base + rpos_add;
-					s1->vel = rvel_base + rvel_add;
-					s1->R.Set (s1->Q);
-					GetIntermediateMoments (acc, tau, *s1, (i+1.0)/nPropSubsteps, dt);
-					arot.Set (EulerInv_full (tau, s1->omega));
+				ResetDense ();
+				if (PropMode[PropLevel].apropagator) {
+					// adaptive sub-steps: nPropSubsteps is the minimum
+					nPropSubsteps = ((*this).*(PropMode[PropLevel].apropagator)) (nPropSubsteps);
+				} else {
+					double dt = td.SimDT/nPropSubsteps;
+					for (i = 0; i < nPropSubsteps; i++) {
+						((*this).*(PropMode[PropLevel].propagator)) (dt, nPropSubsteps, i);
+						s1->pos = rpos_base + rpos_add;
+						s1->vel = rvel_base + rvel_add;
+						s1->R.Set (s1->Q);
+						GetIntermediateMoments (acc, tau, *s1, (i+1.0)/nPropSubsteps, dt);
+						arot.Set (EulerInv_full (tau, s1->omega));
+						AddDenseNode ((i+1.0)/nPropSubsteps);
+					}
 				}
 			} while (!ValidateStateUpdate (s1));
 			//s1->R.Set (s1->Q);
@@ -296,6 +350,57 @@ void RigidBody::Update (bool force)
 
 // =======================================================================
 
+void RigidBody::RequestDenseOutput (bool request)
+{
+	if (request) ndense_req++;
+	else if (ndense_req) ndense_req--;
+}
+
+// =======================================================================
+
+void RigidBody::ResetDense ()
+{
+	if (!ndense_req) return; // nobody is interested
+	dense.clear();
+	dense_t1 = td.SimT1;
+	AddDenseNode (0.0);
+}
+
+// =======================================================================
+
+void RigidBody::AddDenseNode (double tfrac)
+{
+	if (!ndense_req) return;
+	DENSENODE node = {tfrac, s1->pos, s1->vel, acc};
+	dense.push_back (node);
+}
+
+// =======================================================================
+
+bool RigidBody::DenseState (double tfrac, Vector &pos, Vector &vel) const
+{
+	DWORD n = (DWORD)dense.size();
+	if (n < 2 || dense_t1 != td.SimT1) return false; // no dense output for the current frame
+
+	// find the sub-step containing tfrac
+	DWORD i0 = 0, i1 = n-1, im;
+	while (i1-i0 > 1) {
+		im = (i0+i1)/2;
+		if (dense[im].tfrac <= tfrac) i0 = im;
+		else                          i1 = im;
+	}
+	const DENSENODE &n0 = dense[i0];
+	const DENSENODE &n1 = dense[i1];
+
+	// quintic Hermite interpolation from positions, velocities and accelerations
+	// at the sub-step boundaries
+	HermiteInterpolate (n0.pos, n0.vel, n0.acc, n1.pos, n1.vel, n1.acc,
+		(n1.tfrac-n0.tfrac)*td.SimDT, (tfrac-n0.tfrac)/(n1.tfrac-n0.tfrac), pos, vel);
+	return true;
+}
+
+// =======================================================================
+
 void RigidBody::ScanGFieldSources (const PlanetarySystem *psys)
 {
 	psys->ScanGFieldSources (&s0->pos, this, &gfielddata);
@@ -398,6 +503,23 @@ void RigidBody::GetIntermediateMoments_pert (Vector &acc, Vector &tau,
 
 // =======================================================================
 
+void RigidBody::GetIntermediateMoments_WH (Vector &accp, Vector &tau, double tfrac, double dt)
+{
+	static const Vector zero(0,0,0);
+	StateVectors state;
+	Vector gvel (cvel + cbody->s0->vel + (cbody->s1->vel - cbody->s0->vel)*tfrac);
+	state.Set (gvel, cpos + cbody->InterpolatePosition (tfrac), s1->omega, s1->Q);
+	GetIntermediateMoments (acc, tau, state, tfrac, dt);
+
+	// remove the point mass term of cbody, and the acceleration of the
+	// cbody-relative frame
+	double r = cpos.length();
+	accp = acc + cpos * (Ggrav * cbody->Mass() / (r*r*r))
+		- g_psys->GaccRel (zero, cbody, tfrac, cbody, &gfielddata);
+}
+
+// =======================================================================
+
 Vector RigidBody::GetPertAcc (const PertIntData &data, const Vector &pos, double tfrac)
 {
 	// acceleration perturbation: difference of the perturbation fields
@@ -518,12 +640,13 @@ void RigidBody::SetDynamicUpdate (bool dynamic)
 const char *RigidBody::PropagatorStr (DWORD idx, bool verbose) {
 	static char *ShortPropModeStr[NPROP_METHOD] = {
 		"RK2", "RK4", "RK5", "RK6", "RK7", "RK8",
-		"SY2", "SY4", "SY6", "SY8"
+		"SY2", "SY4", "SY6", "SY8", "DP5", "RK87"
 	};
 	static char *LongPropModeStr[NPROP_METHOD] = {
 		"Runge-Kutta, 2nd order (RK2)", "Runge-Kutta, 4th order (RK4)", "Runge-Kutta, 5th order (RK5)", "Runge-Kutta, 6th order (RK6)",
 		"Runge-Kutta, 7th order (RK7)", "Runge-Kutta, 8th order (RK8)",
-		"Symplectic, 2nd order (SY2)", "Symplectic, 4th order (SY4)", "Symplectic, 6th order (SY6)", "Symplectic, 8th order (SY8)"
+		"Symplectic, 2nd order (SY2)", "Symplectic, 4th order (SY4)", "Symplectic, 6th order (SY6)", "Symplectic, 8th order (SY8)",
+		"Adaptive Dormand-Prince 5(4) (DP5)", "Adaptive Runge-Kutta-Fehlberg 7(8) (RK87)"
 	};
 	return (idx < NPROP_METHOD ? (verbose ? LongPropModeStr[idx] : ShortPropModeStr[idx]) : "unknown");
 }
@@ -531,6 +654,7 @@ const char *RigidBody::PropagatorStr (DWORD idx, bool verbose) {
 const char *RigidBody::CurPropagatorStr (bool verbose) const
 {
 	if (!bDynamicPosVel) return "none";
+	else if (bOrbitSymplectic) return (verbose ? "Wisdom-Holman, 4th order (WH4)" : "WH4");
 	else return PropagatorStr (PropMode[PropLevel].propidx, verbose);
 }
 
@@ -17,8 +17,10 @@
 #define __RIGIDBODY_H
 
 #include "Body.h"
+#include <vector>
 
 class RigidBody;
+struct LinAngState;
 
 // =======================================================================
 // typdefs
@@ -53,6 +55,9 @@ typedef void (*AngPropagator)(RigidBody*,const AngIntData&); // angular time pro
 typedef void (RigidBody::*LinAngPropagator)(double, int, int);
 // state propagator function template
 
+typedef int (RigidBody::*AdaptiveLinAngPropagator)(int);
+// adaptive state propagator function template
+
 // =======================================================================
 
 class RigidBody: public Body {
@@ -108,6 +113,17 @@ public:
 
 	virtual bool ValidateStateUpdate (StateVectors *s) { return true; }
 
+	virtual bool CanUpdateSymplectic () const { return false; }
+	// Returns true if the body is currently subject to gravitational forces
+	// only, so that its orbit can be propagated with the symplectic
+	// Wisdom-Holman method at large time steps
+
+	void GetIntermediateMoments_WH (Vector &accp, Vector &tau, double tfrac, double dt);
+	// Returns the cbody-relative acceleration accp, excluding the point mass term
+	// of cbody, and torque tau, at time SimT0+tfrac*SimDT and step size dt, for
+	// the cbody-relative state cpos/cvel and the angular state of s1.
+	// Also sets the global acceleration (member acc).
+
 	virtual Vector GetPertAcc (const PertIntData &data, const Vector &pos, double tfrac);
 	// returns the gravity perturbation (on top of the spherical gravity field
 	// from cbody) at relative position pos, at fractional time tfrac within
@@ -157,6 +173,19 @@ public:
 	// Returns the number of subdivisions of the current frame interval
 	// for the dynamic state integrator
 
+	bool DenseState (double tfrac, Vector &pos, Vector &vel) const;
+	// Interpolated global position and velocity at fractional time tfrac (0..1)
+	// of the current frame interval, from the sub-step states of the dynamic
+	// state integrator (quintic Hermite interpolation). Only valid after the body
+	// has been updated for the current frame. Returns false if no dense output
+	// is available (e.g. bodies without dynamic state updates, or no consumer
+	// registered with RequestDenseOutput before the update)
+
+	void RequestDenseOutput (bool request);
+	// Registers (request=true) or releases (request=false) a consumer of the
+	// dense output. The sub-step states are only recorded while at least one
+	// consumer is registered.
+
 	const char *RotationModel () const;
 	// Returns a string describing the rotation model used
 
@@ -213,6 +242,10 @@ protected:
 	// Indicates if the current step was updated by "orbit stabilisation",
 	// i.e. Encke's method.
 
+	bool bOrbitSymplectic;
+	// Indicates if the current step was updated by the symplectic
+	// Wisdom-Holman propagator
+
 	bool bIgnoreGravTorque;
 	// flag for suppressing gravity-gradient torque (to avoid numerical instability)
 
@@ -223,7 +256,7 @@ protected:
 	Vector pcpos;      // refbody-relative position at previous step
 	Vector pmi;        // principal moments of inertia tensor
 	Vector arot;       // current angular acceleration
-	Vector acc_pert;   // current acceleration excluding gravity from primary point mass (for Encke state integration, only valid during stabilised updates)
+	Vector acc_pert;   // current acceleration excluding gravity from primary point mass (for Encke and Wisdom-Holman state integration, only valid during stabilised updates)
 	Vector torque;     // current torque of CG
 	double tidaldamp;  // damping factor for tidal torque
 	double ostep;      // time step in terms of fractional orbit (approx.)
@@ -233,6 +266,22 @@ protected:
 
 	GFieldData gfielddata;  // used for dynamic grav updates
 
+	struct DENSENODE {      // sub-step state for dense output
+		double tfrac;          // fractional frame time
+		Vector pos, vel, acc;  // global position, velocity, acceleration
+	};
+	std::vector<DENSENODE> dense; // sub-step states of the current frame
+	double dense_t1;              // frame end time to which the dense output refers
+	int ndense_req;               // number of registered dense output consumers
+
+	void ResetDense ();
+	// start a new dense output list with the initial state of the current frame
+	// (no-op without dense output consumers)
+
+	void AddDenseNode (double tfrac);
+	// add the current s1 position and velocity, and acceleration acc, to the
+	// dense output list
+
 private:
 	static void SetupPropagationModes ();
 	// set up the dynamic time propagation modes
@@ -241,7 +290,7 @@ private:
 	// Dynamic integrators for linear and angular state vectors
 	// Implemented in BodyIntegrator.cpp
 
-	void RKdrv_LinAng (double h, int nsub, int isub, int n, const double *alpha, const double *beta, const double *gamma); // RK engine for RK5-8, linear+angular
+	template<class RK> void RKdrv_LinAng (double h, int nsub, int isub); // RK engine for RK5-8, linear+angular, for tableau RK
 	void RK2_LinAng (double h, int nsub, int isub);  // RK2, linear+angular
 	void RK4_LinAng (double h, int nsub, int isub);  // RK4, linear+angular
 	void RK5_LinAng (double h, int nsub, int isub);  // RK5, linear+angular
@@ -253,6 +302,11 @@ private:
 	void SY6_LinAng (double h, int nsub, int isub);  // symplectic, order 6, linear+angular
 	void SY8_LinAng (double h, int nsub, int isub);  // symplectic, order 8, linear+angular
 
+	// Adaptive integrators (embedded pairs with step size control)
+	template<class RK> int Adaptive_LinAng (int nmin); // step size control for embedded pair RK
+	int DP5_LinAng (int nmin);   // Dormand-Prince 5(4), linear+angular
+	int RK87_LinAng (int nmin);  // Fehlberg 7(8), linear+angular
+
 	// Propagators for 2-body orbit perturbations
 	//void RK2_LinAng_Encke (double h, int nsub, int isub);
 
@@ -263,10 +317,14 @@ private:
 
 	void Encke ();
 
+	// Symplectic propagator for unpowered orbits
+	void WH4_LinAng (double h, int nsub, int isub); // Wisdom-Holman, 4th order composition, linear+angular
+
 	// -----------------------------------------------------------------------
 
 	static struct PROPMODE {
 		LinAngPropagator propagator;
+		AdaptiveLinAngPropagator apropagator; // adaptive propagator (NULL for fixed-step methods)
 		int propidx;  // propagator method index
 		double ttgt;  // time step target [s]
 		double atgt;  // angular step target [rad]
@@ -277,6 +335,8 @@ private:
 	int PropLevel;         // current propagator stage
 	int PropSubMax;        // upper limit for number of subsamples
 	int nPropSubsteps;     // current number of subsamples
+	double adapt_h;        // sub-step size proposal for adaptive propagators [s]
+	static double PropTol; // relative local error tolerance for adaptive propagators
 
 	friend Vector Call_EulerInv_full (RigidBody *body, const Vector &tau, const Vector &omega)
 	{ return body->EulerInv_full (tau, omega); }
@@ -284,6 +344,9 @@ private:
 	{ return body->EulerInv_simple (tau, omega); }
 	friend Vector Call_EulerInv_zero (RigidBody *body, const Vector &tau, const Vector &omega)
 	{ return body->EulerInv_zero (tau, omega); }
+
+	template<class RK, class B> friend int AdaptiveFrame_LinAng (B &body, LinAngState &st,
+		double T, int nmin, double &hprop, double scale); // records dense output nodes
 };
 
 #endif // !__RIGIDBODY_H
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include "Vstar.h"
 #include "VBase.h"
 #include "CSphereMgr.h"
+#include "tilemgr2.h"
 #include "Log.h"
 #include "D3dmath.h"
 #include "resource.h"
@@ -1514,6 +1515,10 @@ void Scene::Render (D3DRECT* vp_rect)
 
 	// End the scene.
 	dev->EndScene();
+
+	// all tile managers have updated their quadtrees, so the tiles
+	// not used in this frame can be evicted
+	TileManager2Base::EnforceMemoryBudget();
 }
 
 void Scene::RenderVesselShadows ()
@@ -679,25 +679,10 @@ void SuperVessel::Update (bool force)
 
 	} else if (fstatus == FLIGHTSTATUS_FREEFLIGHT) {
 
-		// Collect vessel thrust and atmospheric forces
-		Flin.Set (0,0,0);
-		Amom.Set (0,0,0);
-		for (i = 0; i < nv; i++) {
-			Vessel *v = vlist[i].vessel;
-			Vector vAmom (mul (vlist[i].rrot, v->Amom_add));
-			Vector vFlin (mul (vlist[i].rrot, v->Flin_add));
-			Amom += vAmom + crossp (vFlin, vlist[i].rpos-cg);
-			Flin += vFlin;
-		}
-
-		RigidBody::Update (force);
-
-		// update state parameters for all sub-vessels
-		for (i = 0; i < nv; i++) {
-			ComponentStateVectors (s1, vlist[i].vessel->s1, i);
-			vlist[i].vessel->arot.Set (tmul (vlist[i].rrot, arot));
-			vlist[i].vessel->el_valid = false;
-		}
+		if (bConcurrentUpdate)
+			bConcurrentUpdate = false; // already propagated by UpdateConcurrent
+		else
+			UpdateFreeflight (force);
 
 	} else if (fstatus == FLIGHTSTATUS_LANDED) {
 
@@ -729,6 +714,46 @@ void SuperVessel::Update (bool force)
 	cvel = s1->vel - cbody->s1->vel;
 }
 
+bool SuperVessel::CanUpdateConcurrently (bool force) const
+{
+	return (!vlist[0].vessel->bFRplayback && fstatus == FLIGHTSTATUS_FREEFLIGHT &&
+		ConcurrentUpdateSafe (force));
+}
+
+void SuperVessel::UpdateConcurrent (bool force)
+{
+	// Only the dynamic state propagation is performed here. Proxy and
+	// surface parameter updates are handled by Update on the main thread.
+	ResetMassAndCG();
+	UpdateFreeflight (force);
+	bConcurrentUpdate = true;
+}
+
+void SuperVessel::UpdateFreeflight (bool force)
+{
+	DWORD i;
+
+	// Collect vessel thrust and atmospheric forces
+	Flin.Set (0,0,0);
+	Amom.Set (0,0,0);
+	for (i = 0; i < nv; i++) {
+		Vessel *v = vlist[i].vessel;
+		Vector vAmom (mul (vlist[i].rrot, v->Amom_add));
+		Vector vFlin (mul (vlist[i].rrot, v->Flin_add));
+		Amom += vAmom + crossp (vFlin, vlist[i].rpos-cg);
+		Flin += vFlin;
+	}
+
+	RigidBody::Update (force);
+
+	// update state parameters for all sub-vessels
+	for (i = 0; i < nv; i++) {
+		ComponentStateVectors (s1, vlist[i].vessel->s1, i);
+		vlist[i].vessel->arot.Set (tmul (vlist[i].rrot, arot));
+		vlist[i].vessel->el_valid = false;
+	}
+}
+
 void SuperVessel::PostUpdate ()
 {
 	VesselBase::PostUpdate ();
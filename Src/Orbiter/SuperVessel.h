@@ -122,6 +122,10 @@ public:
 	void Update (bool force);
 	// per-frame update of supervessel parameters
 
+	bool CanUpdateConcurrently (bool force) const;
+	void UpdateConcurrent (bool force);
+	// concurrent update of the supervessel (see PlanetarySystem::Update)
+
 	void PostUpdate ();
 
 	bool AddSurfaceForces (Vector *F, Vector *M,
@@ -179,6 +183,9 @@ private:
 	// re-calculates superstructure mass and centre of gravity.
 	// Shifts global position to reflect CG change
 
+	void UpdateFreeflight (bool force);
+	// dynamic state propagation of the freeflying superstructure and its components
+
 	void ResetSize();
 
 	void CalcPMI();
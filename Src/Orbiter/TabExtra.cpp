@@ -342,7 +342,8 @@ char *ExtraPropagation::Description ()
 
 int ExtraDynamics::PropId[NPROP_METHOD] = {
 	PROP_RK2, PROP_RK4, PROP_RK5, PROP_RK6, PROP_RK7, PROP_RK8,
-	PROP_SY2, PROP_SY4, PROP_SY6, PROP_SY8
+	PROP_SY2, PROP_SY4, PROP_SY6, PROP_SY8,
+	PROP_DP5, PROP_RK87
 };
 
 char *ExtraDynamics::Name ()
@@ -778,7 +779,7 @@ char *ExtraStabilisation::Name ()
 
 char *ExtraStabilisation::Description ()
 {
-	static char *desc = "Select the parameters that determine the conditions when Orbiter switches between dynamic and stabilised state updates.";
+	static char *desc = "Select the parameters that determine the conditions when Orbiter switches between dynamic and stabilised state updates, and whether unpowered orbits are propagated with a symplectic method.";
 	return desc;
 }
 
@@ -803,6 +804,7 @@ void ExtraStabilisation::SetDialog (HWND hWnd, const CFG_PHYSICSPRM &prm)
 {
 	char cbuf[256];
 	SendDlgItemMessage (hWnd, IDC_STAB_ENABLE, BM_SETCHECK, prm.bOrbitStabilise ? BST_CHECKED : BST_UNCHECKED, 0);
+	SendDlgItemMessage (hWnd, IDC_STAB_SYMPLECTIC, BM_SETCHECK, prm.bSymplecticWarp ? BST_CHECKED : BST_UNCHECKED, 0);
 	sprintf (cbuf, "%0.4g", prm.Stabilise_PLimit*100.0);
 	SetWindowText (GetDlgItem (hWnd, IDC_EDIT1), cbuf);
 	sprintf (cbuf, "%0.4g", prm.Stabilise_SLimit*100.0);
@@ -849,6 +851,7 @@ bool ExtraStabilisation::StoreParams (HWND hWnd)
 	} else cfg->CfgPhysicsPrm.PPropStepLimit = val*0.01;
 
 	cfg->CfgPhysicsPrm.bOrbitStabilise = (SendDlgItemMessage (hWnd, IDC_STAB_ENABLE, BM_GETCHECK, 0, 0) == BST_CHECKED);
+	cfg->CfgPhysicsPrm.bSymplecticWarp = (SendDlgItemMessage (hWnd, IDC_STAB_SYMPLECTIC, BM_GETCHECK, 0, 0) == BST_CHECKED);
 	cfg->CfgPhysicsPrm.Stabilise_PLimit = plimit * 0.01;
 	cfg->CfgPhysicsPrm.Stabilise_SLimit = slimit * 0.01;
 	return true;
@@ -862,6 +865,7 @@ void ExtraStabilisation::ToggleEnable (HWND hWnd)
 		EnableWindow (GetDlgItem (hWnd, i), bstab);
 	for (i = IDC_STATIC1; i <= IDC_STATIC13; i++)
 		EnableWindow (GetDlgItem (hWnd, i), bstab);
+	EnableWindow (GetDlgItem (hWnd, IDC_STAB_SYMPLECTIC), bstab); // symplectic propagation replaces the stabilised update
 }
 
 bool ExtraStabilisation::OpenHelp (HWND hWnd)
@@ -5,6 +5,7 @@
 #include "Texture.h"
 #include "Log.h"
 #include "OGraphics.h"
+#include <algorithm>
 
 // =======================================================================
 // Externals
@@ -31,6 +32,10 @@ static HRESULT BltToUncompressedSurface (LPDIRECTDRAW7 pDD, DDSURFACEDESC2 ddsd,
     DDPIXELFORMAT ddpf, LPDIRECTDRAWSURFACE7 pddsDXT, 
     LPDIRECTDRAWSURFACE7* ppddsNewSurface);
 
+static void PrepareSurfaceDesc (DDSURFACEDESC2 *pddsd, DWORD flags = 0);
+
+static HRESULT WriteDDSSurface (LPDIRECTDRAWSURFACE7 pdds, const BYTE *data, DWORD ndata);
+
 // =======================================================================
 // class TextureManager2
 // =======================================================================
@@ -269,22 +274,7 @@ HRESULT ReadDDSSurface (FILE *file, LPDIRECTDRAW7 pDD,
 
 	// Read the surface description
 	fread (pddsd, sizeof(DDSURFACEDESC2), 1, file);
-
-	// Mask/set surface caps appropriately for the application
-	if ((framework->GetDeviceMemType() == DDSCAPS_VIDEOMEMORY) && !(flags&1))
-		pddsd->ddsCaps.dwCaps2 |= DDSCAPS2_TEXTUREMANAGE;
-	else
-		pddsd->ddsCaps.dwCaps |= DDSCAPS_SYSTEMMEMORY;
-
-	// this should only be set for textures which will never be
-	// locked for dynamic modification
-	pddsd->ddsCaps.dwCaps2 |= DDSCAPS2_OPAQUE;
-
-    if (!bLoadMip) { // remove mipmap parameters if not requested
-        pddsd->dwMipMapCount = 0;
-        pddsd->dwFlags &= ~DDSD_MIPMAPCOUNT;
-        pddsd->ddsCaps.dwCaps &= ~(DDSCAPS_MIPMAP | DDSCAPS_COMPLEX);
-    }
+	PrepareSurfaceDesc (pddsd, flags);
 
 	// Clear unwanted flags
 	pddsd->dwFlags &= (~DDSD_PITCH);
@@ -341,6 +331,91 @@ LFail:
 	return hr;
 }
 
+// =======================================================================
+// Mask/set the surface caps of a DDS surface description read from a file
+// appropriately for the application
+// flags: bit 0 set: force creation in system memory
+//        bit 2 set: do not load mipmaps, even if they are present
+
+void PrepareSurfaceDesc (DDSURFACEDESC2 *pddsd, DWORD flags)
+{
+	CD3DFramework7 *framework = g_pOrbiter->GetInlineGraphicsClient()->GetFramework();
+	bool bLoadMip = ((flags&4) == 0 && framework->SupportsMipmaps());
+
+	if ((framework->GetDeviceMemType() == DDSCAPS_VIDEOMEMORY) && !(flags&1))
+		pddsd->ddsCaps.dwCaps2 |= DDSCAPS2_TEXTUREMANAGE;
+	else
+		pddsd->ddsCaps.dwCaps |= DDSCAPS_SYSTEMMEMORY;
+
+	// this should only be set for textures which will never be
+	// locked for dynamic modification
+	pddsd->ddsCaps.dwCaps2 |= DDSCAPS2_OPAQUE;
+
+    if (!bLoadMip) { // remove mipmap parameters if not requested
+        pddsd->dwMipMapCount = 0;
+        pddsd->dwFlags &= ~DDSD_MIPMAPCOUNT;
+        pddsd->ddsCaps.dwCaps &= ~(DDSCAPS_MIPMAP | DDSCAPS_COMPLEX);
+    }
+}
+
+// =======================================================================
+// Copy DDS surface data (top level followed by the mipmaps, as stored in
+// the file) into surface pdds and its attached mipmaps. If data is NULL,
+// the surface is filled with a neutral placeholder pattern instead.
+
+HRESULT WriteDDSSurface (LPDIRECTDRAWSURFACE7 pdds, const BYTE *data, DWORD ndata)
+{
+	HRESULT              hr;
+	LPDIRECTDRAWSURFACE7 pddsAttached = NULL;
+	DDSURFACEDESC2       ddsd;
+	BYTE                 pattern[16];
+	DWORD                npattern, nrow, rowsize, yp, i, n;
+	LONG                 pitch;
+
+	pdds->AddRef();
+	while (TRUE) {
+		ZeroMemory (&ddsd, sizeof (DDSURFACEDESC2));
+		ddsd.dwSize = sizeof (DDSURFACEDESC2);
+
+		if (FAILED (hr = pdds->Lock (NULL, &ddsd, DDLOCK_WAIT, NULL))) {
+			LOGOUT_DDERR(hr);
+			pdds->Release();
+			return hr;
+		}
+		if (ddsd.dwFlags & DDSD_LINEARSIZE) {
+			nrow = 1, rowsize = ddsd.dwLinearSize, pitch = 0;
+		} else {
+			nrow = ddsd.dwHeight, rowsize = ddsd.dwWidth * ddsd.ddpfPixelFormat.dwRGBBitCount / 8, pitch = ddsd.lPitch;
+		}
+		npattern = (data ? 0 : DDSFillPattern (ddsd.ddpfPixelFormat, pattern));
+		BYTE *pbDest = (BYTE*)ddsd.lpSurface;
+		for (yp = 0; yp < nrow; yp++) {
+			if (data) {
+				n = min (rowsize, ndata);
+				memcpy (pbDest, data, n);
+				data += n, ndata -= n;
+			} else if (npattern) {
+				for (i = 0; i+npattern <= rowsize; i += npattern)
+					memcpy (pbDest+i, pattern, npattern);
+			}
+			pbDest += pitch;
+		}
+		pdds->Unlock (NULL);
+
+		ddsd.ddsCaps.dwCaps = DDSCAPS_TEXTURE | DDSCAPS_MIPMAP | DDSCAPS_COMPLEX;
+		ddsd.ddsCaps.dwCaps2 = 0;
+		ddsd.ddsCaps.dwCaps3 = 0;
+		ddsd.ddsCaps.dwCaps4 = 0;
+
+		if (FAILED (pdds->GetAttachedSurface (&ddsd.ddsCaps, &pddsAttached)))
+			break; // end of mipmap chain
+		pdds->Release();
+		pdds = pddsAttached;
+	}
+	pdds->Release();
+	return S_OK;
+}
+
 // =======================================================================
 // Read a compressed DDS surface from a memory buffer
 
@@ -970,6 +1045,41 @@ BOOL g_bSupportsMipmaps = FALSE; // should be set from device caps
 BOOL g_bMipTexture = FALSE;
 CHAR g_strDiskPixelFormat[20];
 
+// =======================================================================
+// Open a texture file in the same way as Orbiter::OpenTextureFile, and
+// return its path
+
+static FILE *FindTextureFile (const char *name, std::string &path)
+{
+	FILE *ftex = 0;
+	char *pch = g_pOrbiter->HTexPath (name, ""); // first try high-resolution directory
+	if (!pch || !(ftex = fopen (pch, "rb"))) {
+		pch = g_pOrbiter->TexPath (name, "");    // try standard texture directory
+		ftex = fopen (pch, "rb");
+	}
+	LOGOUT_FINE("Texture load: %s", pch);
+	if (ftex) path = pch;
+	return ftex;
+}
+
+// =======================================================================
+// Texture data size for a surface description
+
+static DWORD SurfaceSize (const DDSURFACEDESC2 &ddsd)
+{
+	DWORD size;
+	if (ddsd.dwFlags & DDSD_LINEARSIZE) {
+		size = ddsd.dwLinearSize;
+	} else {
+		size = ddsd.dwWidth * ddsd.dwHeight;
+		if (ddsd.ddpfPixelFormat.dwFlags & DDPF_RGB) {
+			size *= ddsd.ddpfPixelFormat.dwRGBBitCount;
+			size /= 8;
+		}
+	}
+	return size;
+}
+
 // =======================================================================
 // class TextureManager
 
@@ -983,23 +1093,34 @@ TextureManager::TextureManager (LPDIRECT3DDEVICE7 _dev, int _maxsize)
 	maxsize = _maxsize;
 	ntex = nactive = 0;
 	texturepath[0] = '\0';
+	nthread = 0;
+	bRunThread = true;
+	nstream = nsync = ncomplete = 0;
+	InitializeCriticalSection (&cs);
+	InitializeConditionVariable (&queue_cv);
 }
 
 TextureManager::~TextureManager ()
 {
 	Clear();
+	StopThreads();
 	delete []pfp;
+	if (nstream || nsync)
+		LOGOUT ("TextureManager: %d textures streamed (%d completed on demand), %d loaded synchronously", nstream, ncomplete, nsync);
+	DeleteCriticalSection (&cs);
 }
 
 void TextureManager::UnsetDevice ()
 {
 	TextureRec *r;
 	for (r = rec0; r; r = r->next) {
+		CancelJob (r);
 		if (r->tex) r->tex->Release();
 		r->tex = 0;
         ZeroMemory (&r->ddsd, sizeof(DDSURFACEDESC2));
 		r->size = 0;
 	}
+	texmap.clear();
 	alloc_size = 0;
 	dev = 0;
 }
@@ -1020,6 +1141,7 @@ void TextureManager::SetDevice (LPDIRECT3DDEVICE7 _dev)
 			r->ddsd = new_rec.ddsd;
 			r->size = new_rec.size;
 			alloc_size += r->size;
+			texmap[r->tex] = r;
 		}
 	}
 }
@@ -1037,7 +1159,9 @@ LPDIRECTDRAWSURFACE7 TextureManager::AcquireTexture (const char *fname, bool unc
 
 	if (!(tex = FindRec (fname))) {
 		TextureRec *new_rec = new TextureRec; TRACENEW
-		if (SUCCEEDED (LoadTexture (fname, *new_rec, uncompress))) {
+		if (SUCCEEDED (uncompress ? LoadTexture (fname, *new_rec, true) : StreamTexture (fname, *new_rec))) {
+			if (new_rec->job) nstream++;
+			else              nsync++;
 			tex = AddRec (new_rec);
 		} else {
 			LOGOUT_WARN("Texture not found: %s\nSkipping.", fname);
@@ -1047,46 +1171,86 @@ LPDIRECTDRAWSURFACE7 TextureManager::AcquireTexture (const char *fname, bool unc
 	return tex;
 }
 
-bool TextureManager::IncRefCount (LPDIRECTDRAWSURFACE7 tex)
+void TextureManager::Update ()
 {
-	TextureRec *r;
-	for (r = rec0; r; r = r->next) {
-		if (r->tex == tex) {
-			r->active++;
-			return true;
-		}
+	std::deque<TextureJob*> ready;
+	EnterCriticalSection (&cs);
+	ready.swap (done);
+	LeaveCriticalSection (&cs);
+
+	for (size_t i = 0; i < ready.size(); i++)
+		FinishJob (ready[i]);
+}
+
+void TextureManager::Complete (LPDIRECTDRAWSURFACE7 tex)
+{
+	std::unordered_map<LPDIRECTDRAWSURFACE7,TextureRec*>::iterator it = texmap.find (tex);
+	if (it == texmap.end() || !it->second->job) return;
+	TextureRec *r = it->second;
+	TextureJob *job = r->job;
+
+	// use the decoded data if the job is waiting for Update
+	EnterCriticalSection (&cs);
+	std::deque<TextureJob*>::iterator dit = std::find (done.begin(), done.end(), job);
+	bool decoded = (dit != done.end());
+	if (decoded) done.erase (dit);
+	LeaveCriticalSection (&cs);
+
+	// otherwise decode the file on the calling thread
+	if (!decoded) {
+		std::string path = job->path;
+		CancelJob (r);
+		job = new TextureJob; TRACENEW
+		job->rec = r;
+		job->path = path;
+		job->hr = ReadDDSImage (path.c_str(), job->img);
 	}
-	return false;
+	FinishJob (job);
+	ncomplete++;
 }
 
-bool TextureManager::DecRefCount (LPDIRECTDRAWSURFACE7 tex)
+void TextureManager::FinishJob (TextureJob *job)
 {
-	TextureRec *r;
-	for (r = rec0; r; r = r->next) {
-		if (r->tex == tex) {
-			if (r->active) {
-				r->active--;
-				return true;
-			} else {
-				return false;
-			}
-		}
+	TextureRec *r = job->rec;
+	if (r) {
+		r->job = 0;
+		const DDSURFACEDESC2 &ddsd = job->img.ddsd;
+		if (FAILED (job->hr))
+			LOGOUT_WARN("Texture could not be read: %s", r->fname);
+		else if (ddsd.dwWidth != r->ddsd.dwWidth || ddsd.dwHeight != r->ddsd.dwHeight ||
+			memcmp (&ddsd.ddpfPixelFormat, &r->ddsd.ddpfPixelFormat, sizeof(DDPIXELFORMAT)))
+			LOGOUT_WARN("Texture modified while loading: %s", r->fname);
+		else if (r->tex && job->img.data.size())
+			WriteDDSSurface (r->tex, &job->img.data[0], (DWORD)job->img.data.size());
 	}
-	return false;
+	delete job;
+}
+
+bool TextureManager::IncRefCount (LPDIRECTDRAWSURFACE7 tex)
+{
+	std::unordered_map<LPDIRECTDRAWSURFACE7,TextureRec*>::iterator it = texmap.find (tex);
+	if (it == texmap.end()) return false;
+	it->second->active++;
+	return true;
+}
+
+bool TextureManager::DecRefCount (LPDIRECTDRAWSURFACE7 tex)
+{
+	std::unordered_map<LPDIRECTDRAWSURFACE7,TextureRec*>::iterator it = texmap.find (tex);
+	if (it == texmap.end() || !it->second->active) return false;
+	it->second->active--;
+	return true;
 }
 
 bool TextureManager::ReleaseTexture (LPDIRECTDRAWSURFACE7 tex)
 {
-	TextureRec *r;
-	for (r = rec0; r; r = r->next) {
-		if (r->tex == tex) {
-			if (r->active) {
-				if (--(r->active) == 0) nactive--;
-			}
-			return true;
-		}
+	std::unordered_map<LPDIRECTDRAWSURFACE7,TextureRec*>::iterator it = texmap.find (tex);
+	if (it == texmap.end()) return false;
+	TextureRec *r = it->second;
+	if (r->active) {
+		if (--(r->active) == 0) nactive--;
 	}
-	return false;
+	return true;
 }
 
 bool TextureManager::DeallocRec ()
@@ -1105,12 +1269,15 @@ void TextureManager::DeallocRec (TextureRec *_rec)
 	else            rec0 = _rec->next;
 	if (_rec->next) _rec->next->prev = _rec->prev;
 	else            recN = _rec->prev;
+	recmap.erase (_rec->fname);
+	if (_rec->tex) texmap.erase (_rec->tex);
 
 	// deallocate record
+	CancelJob (_rec);
 	if (_rec->active) nactive--;
 	ntex--;
 	alloc_size -= _rec->size;
-	_rec->tex->Release();
+	if (_rec->tex) _rec->tex->Release();
 	delete _rec;
 }
 
@@ -1127,6 +1294,8 @@ LPDIRECTDRAWSURFACE7 TextureManager::AddRec (TextureRec *_rec)
 	if (rec0) rec0->prev = _rec;
 	else      recN = _rec;
 	rec0 = _rec;
+	recmap[_rec->fname] = _rec;
+	texmap[_rec->tex] = _rec;
 	alloc_size += _rec->size;
 	ntex++;
 	nactive++;
@@ -1141,27 +1310,25 @@ LPDIRECTDRAWSURFACE7 TextureManager::AddRec (TextureRec *_rec)
 
 LPDIRECTDRAWSURFACE7 TextureManager::FindRec (const char *fname)
 {
-	TextureRec *r;
-	for (r = rec0; r; r = r->next) {
-		if (!strcmp (r->fname, fname)) {
-			// texture found, move to beginning of list
-			// to mark as most recently accessed
-			if (r->prev) {
-				r->prev->next = r->next;
-				if (r->next) r->next->prev = r->prev;
-				else         recN = r->prev;
-				r->next = rec0;
-				r->prev = 0;
-				rec0->prev = r;
-				rec0 = r;
-			}
-			if (!r->active)
-				nactive++;
-			r->active++;
-			return r->tex;
-		}
+	std::unordered_map<std::string,TextureRec*>::iterator it = recmap.find (fname);
+	if (it == recmap.end()) return 0;
+
+	// texture found, move to beginning of list
+	// to mark as most recently accessed
+	TextureRec *r = it->second;
+	if (r->prev) {
+		r->prev->next = r->next;
+		if (r->next) r->next->prev = r->prev;
+		else         recN = r->prev;
+		r->next = rec0;
+		r->prev = 0;
+		rec0->prev = r;
+		rec0 = r;
 	}
-	return 0;
+	if (!r->active)
+		nactive++;
+	r->active++;
+	return r->tex;
 }
 
 bool TextureManager::PixelFormatMatch (DDPIXELFORMAT ddpf, DDPIXELFORMAT &match)
@@ -1280,17 +1447,137 @@ HRESULT TextureManager::LoadTexture (const char *fname, TextureRec &rec, bool un
 		rec.tex = pDDSDXTTop;
     }
 	strcpy (rec.fname, fname);
-	if (rec.ddsd.dwFlags & DDSD_LINEARSIZE) {
-		rec.size = rec.ddsd.dwLinearSize;
+	rec.size = SurfaceSize (rec.ddsd);
+	rec.job = 0;
+
+    return S_OK;
+}
+
+HRESULT TextureManager::StreamTexture (const char *fname, TextureRec &rec)
+{
+	HRESULT              hr;
+	BYTE                 hdr[DDS_HEADERSIZE];
+	DDPIXELFORMAT        ddpfBestMatch;
+	std::string          path;
+	FILE                 *file;
+
+	LPDIRECTDRAW7        pDD = g_pOrbiter->GetInlineGraphicsClient()->GetDirectDraw();
+
+	// Read the surface description from the file header
+	if ((file = FindTextureFile (fname, path)) == NULL) return E_FAIL;
+	hr = (fread (hdr, DDS_HEADERSIZE, 1, file) ? ParseDDSHeader (hdr, DDS_HEADERSIZE, rec.ddsd) : E_FAIL);
+	fclose (file);
+	if (FAILED (hr)) {
+		LOGOUT_ERR("Invalid DDS header: %s", path.c_str());
+		return hr;
+	}
+
+	// Textures the renderer doesn't support in their file format are
+	// uncompressed on the calling thread
+	if (!PixelFormatMatch (rec.ddsd.ddpfPixelFormat, ddpfBestMatch) ||
+		rec.ddsd.ddpfPixelFormat.dwFourCC != ddpfBestMatch.dwFourCC)
+		return LoadTexture (fname, rec);
+
+	// Create the surface with its final size and format as placeholder
+	PrepareSurfaceDesc (&rec.ddsd);
+	rec.ddsd.dwFlags &= ~(DDSD_PITCH | DDSD_LINEARSIZE);
+	if (FAILED (hr = pDD->CreateSurface (&rec.ddsd, &rec.tex, NULL))) {
+		LOGOUT_DDERR(hr);
+		return hr;
+	}
+	WriteDDSSurface (rec.tex, NULL, 0);
+	strcpy (rec.fname, fname);
+	rec.size = SurfaceSize (rec.ddsd);
+
+	// Queue the file for decoding
+	TextureJob *job = new TextureJob; TRACENEW
+	job->rec = &rec;
+	job->path = path;
+	job->hr = E_FAIL;
+	rec.job = job;
+	EnterCriticalSection (&cs);
+	queue.push_back (job);
+	if (!nthread) StartThreads();
+	WakeConditionVariable (&queue_cv);
+	LeaveCriticalSection (&cs);
+
+	return S_OK;
+}
+
+void TextureManager::CancelJob (TextureRec *_rec)
+{
+	if (!_rec->job) return;
+	EnterCriticalSection (&cs);
+	std::deque<TextureJob*>::iterator it = std::find (queue.begin(), queue.end(), _rec->job);
+	if (it != queue.end()) {
+		queue.erase (it);
+		delete _rec->job;
 	} else {
-		rec.size = rec.ddsd.dwWidth * rec.ddsd.dwHeight;
-		if (rec.ddsd.ddpfPixelFormat.dwFlags & DDPF_RGB) {
-			rec.size *= rec.ddsd.ddpfPixelFormat.dwRGBBitCount;
-			rec.size /= 8;
+		_rec->job->rec = 0; // being decoded, or waiting for Update, which deletes it
+	}
+	LeaveCriticalSection (&cs);
+	_rec->job = 0;
+}
+
+void TextureManager::StartThreads ()
+{
+	// leave one processor to the render thread
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	nthread = max (1, min (MAXTEXTHREAD, (int)si.dwNumberOfProcessors-1));
+	DWORD id;
+	for (int i = 0; i < nthread; i++)
+		hThread[i] = CreateThread (NULL, 65536, Decode_ThreadProc, this, 0, &id);
+	LOGOUT ("TextureManager: %d decode thread(s)", nthread);
+}
+
+void TextureManager::StopThreads ()
+{
+	int i;
+	if (nthread) {
+		EnterCriticalSection (&cs);
+		bRunThread = false;
+		WakeAllConditionVariable (&queue_cv);
+		LeaveCriticalSection (&cs);
+		if (WaitForMultipleObjects (nthread, hThread, TRUE, 1000) == WAIT_TIMEOUT) {
+			for (i = 0; i < nthread; i++)
+				TerminateThread (hThread[i], 0);
+			LOGOUT_WARN ("TextureManager: Wait for decode thread timed out.");
 		}
+		for (i = 0; i < nthread; i++)
+			CloseHandle (hThread[i]);
+		nthread = 0;
 	}
+	// discard the jobs not copied into their surfaces
+	for (i = 0; i < (int)queue.size(); i++) delete queue[i];
+	for (i = 0; i < (int)done.size(); i++) delete done[i];
+	queue.clear();
+	done.clear();
+}
 
-    return S_OK;
+DWORD WINAPI TextureManager::Decode_ThreadProc (void *data)
+{
+	TextureManager *tm = (TextureManager*)data;
+
+	EnterCriticalSection (&tm->cs);
+	while (tm->bRunThread) {
+		if (tm->queue.empty()) {
+			SleepConditionVariableCS (&tm->queue_cv, &tm->cs, INFINITE);
+			continue;
+		}
+		TextureJob *job = tm->queue.front();
+		tm->queue.pop_front();
+		LeaveCriticalSection (&tm->cs);
+
+		// read and parse the file without the device; the surface
+		// data are copied by Update on the render thread
+		job->hr = ReadDDSImage (job->path.c_str(), job->img);
+
+		EnterCriticalSection (&tm->cs);
+		tm->done.push_back (job);
+	}
+	LeaveCriticalSection (&tm->cs);
+	return 0;
 }
 
 
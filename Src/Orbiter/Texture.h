@@ -8,8 +8,13 @@
 #include <windows.h>
 #include <d3d.h>
 #include <stdio.h>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include "DDSImage.h"
 
 #define MAXFMT 6 // max number of different pixel formats
+#define MAXTEXTHREAD 4 // max number of texture decode threads
 
 struct RAWDDS {
 	DDSURFACEDESC2 ddsd;
@@ -131,15 +136,25 @@ void FillSurface (LPDIRECTDRAWSURFACE7 surf, DWORD col);
 
 // EVERYTHING BELOW IS OBSOLETE
 
+struct TextureJob;
+
 struct TextureRec {
 	char fname[256];            // texture name
 	DWORD active;               // texture reference count
 	LPDIRECTDRAWSURFACE7 tex;   // texture handle
 	DDSURFACEDESC2 ddsd;        // surface properties
 	DWORD size;                 // texture data size
+	TextureJob *job;            // pending decode job (0 if the surface contents are loaded)
 	TextureRec *prev, *next;
 };
 
+struct TextureJob {
+	TextureRec *rec;            // record receiving the surface data (0 if deallocated)
+	std::string path;           // texture file path
+	DDSImage img;               // decoded texture
+	HRESULT hr;                 // decode result
+};
+
 struct PixelFormatPair {
 	DDPIXELFORMAT pixelfmt;
 	DDPIXELFORMAT bestmatch;
@@ -166,6 +181,23 @@ public:
 	// path to texture directory
 
 	LPDIRECTDRAWSURFACE7 AcquireTexture (const char *fname, bool uncompress = false);
+	// Return the texture handle for texture file fname. Textures not yet in
+	// the list are returned at once as a placeholder surface of the final
+	// size and format, filled with neutral grey, while the file is decoded
+	// on a worker thread. Its contents are copied into the surface by Update,
+	// or by Complete if the surface is needed before then.
+	// Textures that must be uncompressed (uncompress=true, or a pixel format
+	// not supported by the device) are loaded synchronously.
+
+	void Update ();
+	// Copy the textures decoded by the worker threads into their surfaces.
+	// Must be called regularly (once per frame) by the render thread.
+
+	void Complete (LPDIRECTDRAWSURFACE7 tex);
+	// If texture tex is still being streamed, load its contents now. Must be
+	// called before a surface is handed out to code which may read it or
+	// draw on it, since Update would otherwise overwrite the placeholder
+	// contents later.
 
 	bool IncRefCount (LPDIRECTDRAWSURFACE7 tex);
 	// Increment reference counter for texture tex
@@ -200,6 +232,21 @@ private:
 	LPDIRECTDRAWSURFACE7 FindRec (const char *fname);
 	HRESULT LoadTexture (const char *fname, TextureRec &rec, bool uncompress = false);
 
+	HRESULT StreamTexture (const char *fname, TextureRec &rec);
+	// Create the surface for texture fname from the file header and queue
+	// the file for decoding. Falls back to LoadTexture if the texture needs
+	// to be uncompressed.
+
+	void CancelJob (TextureRec *_rec);
+	// discard the pending decode job of record _rec
+
+	void FinishJob (TextureJob *job);
+	// copy the decoded texture of job into its surface and delete the job
+
+	void StartThreads ();
+	void StopThreads ();
+	static DWORD WINAPI Decode_ThreadProc (void *data);
+
 	bool DeallocRec ();
 	// Deallocate last inactive record in the buffer
 	// return value is true if an inactive record was found
@@ -211,13 +258,24 @@ private:
 	// return the best match for pixel format ddpf in match
 
 	LPDIRECT3DDEVICE7 dev;
-	TextureRec *rec0, *recN;
+	TextureRec *rec0, *recN;  // record list, most recently accessed first
+	std::unordered_map<std::string,TextureRec*> recmap;         // texture name -> record
+	std::unordered_map<LPDIRECTDRAWSURFACE7,TextureRec*> texmap; // texture handle -> record
 	PixelFormatPair *pfp;
 	int npfp, pfp_buflen;
 	int ntex, nactive;  // number of textures in list/active textures
 	int maxsize;     // maximum texture allocation size
 	int alloc_size;  // current texture allocation size
 	char texturepath[256];
+
+	std::deque<TextureJob*> queue;   // jobs waiting for a decode thread
+	std::deque<TextureJob*> done;    // decoded jobs waiting for Update
+	CRITICAL_SECTION cs;             // protects queue and done
+	CONDITION_VARIABLE queue_cv;     // signalled when jobs are queued
+	HANDLE hThread[MAXTEXTHREAD];
+	int nthread;
+	bool bRunThread;
+	int nstream, nsync, ncomplete;   // statistics: textures streamed, loaded synchronously, completed on demand
 };
 
 #endif // !__TEXTURE_H
\ No newline at end of file
@@ -24,6 +24,7 @@
 #include "Vessel.h"
 #include "Supervessel.h"
 #include "Config.h"
+#include "IndexedStream.h"
 #include "Camera.h"
 #include "Pane.h"
 #include "Panel2D.h"
@@ -38,6 +39,7 @@
 #include "Util.h"
 #include "elevmgr.h"
 #include <fstream>
+#include <algorithm>
 #include <iomanip>
 #include <stdio.h>
 #include <stdlib.h>
@@ -87,7 +89,7 @@ Vessel::Vessel (const PlanetarySystem *psys, const char *_name, const char *_cla
 	classname = new char[strlen(_classname)+1]; TRACENEW
 	strcpy (classname, _classname);
 
-	ifstream classf;
+	IndexedIfstream classf;
 	if (!OpenConfigFile (classf))
 		g_pOrbiter->TerminateOnError(); // PANIC!
 
@@ -122,7 +124,7 @@ Vessel::Vessel (const PlanetarySystem *psys, const char *_name, const char *_cla
 	classname = new char[strlen(_classname)+1]; TRACENEW
 	strcpy (classname, _classname);
 
-	ifstream classf;
+	IndexedIfstream classf;
 	if (!OpenConfigFile (classf))
 		g_pOrbiter->TerminateOnError(); // PANIC!
 
@@ -165,7 +167,7 @@ Vessel::Vessel (const PlanetarySystem *psys, const char *_name, const char *_cla
 	classname = new char[strlen(_classname)+1]; TRACENEW
 	strcpy (classname, _classname);
 
-	ifstream classf;
+	IndexedIfstream classf;
 	if (!OpenConfigFile (classf))
 		g_pOrbiter->TerminateOnError(); // PANIC!
 
@@ -287,7 +289,6 @@ void Vessel::SetDefaultState ()
 	undock_t            = -1000;
 	proxyvessel         = 0;
 	supervessel         = 0;
-	scanvessel          = 0;
 	attmode             = 1;
 	ctrlsurfmode        = 0;
 	for (i = 0; i < 6; i++)
@@ -432,7 +433,7 @@ void Vessel::ReadGenericCaps (ifstream &ifs)
 
 	// recursively read base class specs
 	if (GetItemString (ifs, "BaseClass", cbuf)) {
-		ifstream basef (g_pOrbiter->ConfigPath (cbuf));
+		IndexedIfstream basef (g_pOrbiter->ConfigPath (cbuf));
 		if (basef) ReadGenericCaps (basef);
 	}
 
@@ -923,6 +924,21 @@ void Vessel::GetIntermediateMoments_pert (Vector &acc, Vector &tau,
 
 // ==============================================================
 
+bool Vessel::CanUpdateSymplectic () const
+{
+	if (attach || supervessel || bFRplayback || fstatus != FLIGHTSTATUS_FREEFLIGHT)
+		return false;
+	if (bThrustEngaged || sp.is_in_atm || SurfaceProximity ())
+		return false;
+	if (Flin_add.x || Flin_add.y || Flin_add.z) // aerodynamic, radiation or user forces
+		return false;
+	for (DWORD i = 0; i < ncattach; i++)
+		if (cattach[i]->mate) return false;
+	return true;
+}
+
+// ==============================================================
+
 Vector Vessel::GetTorque () const
 {
 	static Vector F(0,0,0);
@@ -4105,14 +4121,10 @@ bool Vessel::AddSurfaceForces (Vector *F, Vector *M, const StateVectors *s, doub
 
 	int i, j;
 	double alt, tdymin;
-	static int *tidx = new int[3];
-	static double *tdy = new double[3];
-	static double *fn = new double[3];
-	static double *flng = new double[3];
-	static double *flat = new double[3];
-	static DWORD ntdy = 3;
-
-	static StateVectors ls; // local state
+	int *tidx;
+	double *tdy, *fn, *flng, *flat, *tdlng, *tdlat, *tdrad, *tdelev;
+
+	StateVectors ls; // local state
 	StateVectors ps = proxybody->InterpolateState (tfrac); // intermediate planet state; should probably be passed in as function argument
 	SurfParam surfp; // intermediate surface parameters; should probably be passed in as function argument
 
@@ -4142,32 +4154,37 @@ bool Vessel::AddSurfaceForces (Vector *F, Vector *M, const StateVectors *s, doub
 	Matrix T (s->R); // transformation vessel local -> planet local
 	T.tpremul (ps.R);
 
-	if (ntdy < ntouchdown_vtx) {
-		ntdy = ntouchdown_vtx;
-		delete []tidx;
-		tidx = new int[ntdy];
-		delete []tdy;
-		tdy = new double[ntdy];
-		delete []fn;
-		fn = new double[ntdy];
-		delete []flng;
-		flng = new double[ntdy];
-		delete []flat;
-		flat = new double[ntdy];
+	if (tdwork_idx.size() < ntouchdown_vtx) {
+		tdwork_idx.resize (ntouchdown_vtx);
+		tdwork.resize (8*ntouchdown_vtx);
 	}
-
-	ElevationManager *emgr = ((Planet*)proxybody)->ElevMgr();
-	int reslvl;
-	if (emgr) reslvl = (int)(32.0-log(max(alt,100))*LOG2);
+	tidx   = tdwork_idx.data();
+	tdy    = tdwork.data();
+	fn     = tdy    + ntouchdown_vtx;
+	flng   = fn     + ntouchdown_vtx;
+	flat   = flng   + ntouchdown_vtx;
+	tdlng  = flat   + ntouchdown_vtx;
+	tdlat  = tdlng  + ntouchdown_vtx;
+	tdrad  = tdlat  + ntouchdown_vtx;
+	tdelev = tdrad  + ntouchdown_vtx;
 
 	Vector shift = tmul(ps.R, s->pos - ps.pos);
 	for (i = 0; i < ntouchdown_vtx; i++) {
 		Vector p (mul (T, touchdown_vtx[i].pos) + shift);
-		double lng, lat, rad, elev = 0.0;
-		proxybody->LocalToEquatorial (p, lng, lat, rad);
-		if (emgr)
-			elev = emgr->Elevation (lat, lng, reslvl, &etile);
-		tdy[i] = rad - elev - proxybody->Size();
+		proxybody->LocalToEquatorial (p, tdlng[i], tdlat[i], tdrad[i]);
+	}
+
+	// touchdown point elevations in a single query
+	ElevationManager *emgr = ((Planet*)proxybody)->ElevMgr();
+	if (emgr) {
+		int reslvl = (int)(32.0-log(max(alt,100))*LOG2);
+		emgr->ElevationBatch ((int)ntouchdown_vtx, tdlat, tdlng, reslvl, &etile, tdelev);
+	} else {
+		for (i = 0; i < ntouchdown_vtx; i++) tdelev[i] = 0.0;
+	}
+
+	for (i = 0; i < ntouchdown_vtx; i++) {
+		tdy[i] = tdrad[i] - tdelev[i] - proxybody->Size();
 		if (!i || tdy[i] < tdymin) {
 			tdymin = tdy[i];
 		}
@@ -4539,6 +4556,8 @@ void Vessel::Update (bool force)
 		if (!supervessel) {
 			if (bFRplayback) {
 				FRecorder_Play();          // update from playback stream
+			} else if (bConcurrentUpdate) {
+				bConcurrentUpdate = false; // already propagated by UpdateConcurrent
 			} else {
 				RigidBody::Update (force); // standard dynamic update
 			}
@@ -4746,6 +4765,21 @@ void Vessel::Update (bool force)
 	UpdateAttachments();
 }
 
+bool Vessel::CanUpdateConcurrently (bool force) const
+{
+	return (!attach && !supervessel && !bFRplayback &&
+		fstatus == FLIGHTSTATUS_FREEFLIGHT && ConcurrentUpdateSafe (force));
+}
+
+void Vessel::UpdateConcurrent (bool force)
+{
+	// Only the dynamic state propagation is performed here. Surface
+	// interaction, comms, module callbacks and attachments are handled
+	// by Update on the main thread.
+	RigidBody::Update (force);
+	bConcurrentUpdate = true;
+}
+
 void Vessel::UpdatePassive ()
 {
 	StateVectors *s = (s1 ? s1:s0); // hack - this should really only be called during update phase
@@ -4806,32 +4840,56 @@ void Vessel::PostUpdate ()
 	if (fstatus == FLIGHTSTATUS_FREEFLIGHT && td.SimT1 > undock_t+1.0) {
 
 		// check for vessel-vessel docking
-		// check one vessel per frame (this may not be enough if universe is densely
-		// populated. Instead there should be a list of vessels, sorted into 2 or 3 distance
-		// bins (eg < 10km, <1000km, rest) and 1 vessel per *bin* should be checked)
+		// All vessels within capture range are retrieved from the vessel proximity index
+		// and checked at every frame, in order of increasing distance. The check stops at
+		// the first docking event, since docking can move the vessels involved.
 
 		if (ndock) {
-			if (++scanvessel >= g_psys->nVessel()) scanvessel = 0;
-			Vessel *v = g_psys->GetVessel(scanvessel);
-			if (v != this && v->ndock && v->proxybody == proxybody) {
-				double dst = s0->pos.dist (v->GPos());
-
-				if ((dst < 1.5 * (size + v->Size()) || (dst < size + v->Size() + 1e3))) { // valid candidate
-					Vector dref, gref, vref;
-					for (j = 0; j < ndock; j++) { // loop over my own docks
+			Vessel **vlist;
+			DWORD i, nv;
+			double range = 1.5 * (size + g_psys->MaxVesselSize()) + 1e3; // upper limit for capture range
+			nv = g_psys->VesselsInRange (s0->pos, range, vlist);
+			dockcand.clear();
+			for (i = 0; i < nv; i++) {
+				Vessel *v = vlist[i];
+				if (v != this && v->ndock && v->proxybody == proxybody) {
+					double dst = s0->pos.dist (v->GPos());
+					if ((dst < 1.5 * (size + v->Size()) || (dst < size + v->Size() + 1e3))) { // valid candidate
+						DockCandidate dc = {dst, v};
+						dockcand.push_back (dc);
+					}
+				}
+			}
+			std::stable_sort (dockcand.begin(), dockcand.end());
+
+			if (dockcand.size()) {
+				Vector dref, gref, vref;
+				bool docked = false;
+
+				// update information about closest dock in range of our dock 0
+				if (closedock.vessel && closedock.vessel->ndock && closedock.dock < closedock.vessel->ndock) {
+					dref.Set (tmul (closedock.vessel->GRot(), mul (s0->R, dock[0]->ref) + s0->pos - closedock.vessel->GPos()));
+					closedock.dist = dref.dist (closedock.vessel->dock[closedock.dock]->ref);
+				} else {
+					closedock.dist = 1e50;
+				}
+
+				for (i = 0; i < dockcand.size(); i++) {
+					Vessel *v = dockcand[i].vessel;
+					for (j = 0; j < ndock && !docked; j++) { // loop over my own docks
 						if (dock[j]->mate) continue; // dock already busy
 						if (dockmode == 0) { // legacy docking mode
 							if (dotp (s0->vel - v->GVel(), mul (s0->R, dock[j]->dir)) < -0.01) continue; // moving away from dock
-							for (k = 0; k < v->ndock; k++) { // loop over other vessel's docks
+							for (k = 0; k < v->ndock && !docked; k++) { // loop over other vessel's docks
 								if (v->dock[k]->mate) continue; // dock already busy
 								dref.Set (tmul (v->GRot(), mul (s0->R, dock[j]->ref) + s0->pos - v->GPos()));
 								double d = dref.dist (v->dock[k]->ref);
 								if (d < MIN_DOCK_DIST) {
-									Dock (v, j, k);
+									docked = !Dock (v, j, k);
 								}
 							}
 						} else { // new docking mode
-							for (k = 0; k < v->ndock; k++) { // loop over other vessel's docks
+							for (k = 0; k < v->ndock && !docked; k++) { // loop over other vessel's docks
 								if (v->dock[k]->mate) continue; // dock already busy
 								gref.Set (mul (s0->R, dock[j]->ref) + s0->pos);            // my dock in global frame
 								vref.Set (mul (v->GRot(), v->dock[k]->ref) + v->GPos()); // target dock in global frame
@@ -4841,19 +4899,13 @@ void Vessel::PostUpdate ()
 									if (dotp (s0->vel - v->GVel(), vref-gref) >= 0) { // on approach
 										dock[j]->pending = v;
 									} else if (dock[j]->pending == v) {
-										Dock (v, j, k);
+										docked = !Dock (v, j, k);
 									}
 								}
 							}
 						}
 					}
-					// update information about closest dock in range of our dock 0
-					if (closedock.vessel && closedock.vessel->ndock && closedock.dock < closedock.vessel->ndock) {
-						dref.Set (tmul (closedock.vessel->GRot(), mul (s0->R, dock[0]->ref) + s0->pos - closedock.vessel->GPos()));
-						closedock.dist = dref.dist (closedock.vessel->dock[closedock.dock]->ref);
-					} else {
-						closedock.dist = 1e50;
-					}
+					if (docked) break;
 					for (k = 0; k < v->ndock; k++) {
 						if (v->dock[k]->mate) continue;
 						dref.Set (tmul (v->GRot(), mul (s0->R, dock[0]->ref) + s0->pos - v->GPos()));
@@ -5018,19 +5070,8 @@ void Vessel::UpdateProxies ()
 {
 	VesselBase::UpdateProxies ();
 
-	int i;
-	double dist2, proxydist2;
-
 	// check for closest vessel
-	proxyvessel = 0;
-	for (i = g_psys->nVessel()-1, proxydist2 = 1e100; i >= 0; i--) {
-		Vessel *vessel = g_psys->GetVessel(i);
-		if (vessel == this) continue;
-		if ((dist2 = s0->pos.dist2 (vessel->GPos())) < proxydist2) {
-			proxydist2 = dist2;
-			proxyvessel = vessel;
-		}
-	}
+	proxyvessel = g_psys->ClosestVessel (s0->pos, this);
 }
 
 void Vessel::UpdateReceiverStatus (DWORD idx)
@@ -5099,34 +5140,35 @@ void Vessel::UpdateReceiverStatus (DWORD idx)
 	}
 
 	// scan for vessel-mounted XPDR and IDS transmitters
-	for (i = g_psys->nVessel()-1; i >= 0; i--) {
-		Vessel *vessel = g_psys->GetVessel(i);
+	Vessel **vlist;
+	DWORD nv = g_psys->VesselsInRange (s0->pos, 1e6, vlist); // max XPDR range 1000 km
+	for (m = 0; m < nv; m++) {
+		Vessel *vessel = vlist[m];
 		if (vessel == this) continue;
-		if ((dist2 = s0->pos.dist2 (vessel->GPos())) < 1e12) { // max XPDR range 1000 km
-
-			for (n = n0; n < n1; n++) {
-				if (vessel->xpdr && vessel->xpdr->GetStep() == nav[n].step) {
-					sig = vessel->xpdr->FieldStrength (s0->pos);
-					if (sig > 0.9 && sig > navsig[n]) {
-						navsig[n] =  sig;
-						nav[n].sender = vessel->xpdr;
-					}
+		dist2 = s0->pos.dist2 (vessel->GPos());
+
+		for (n = n0; n < n1; n++) {
+			if (vessel->xpdr && vessel->xpdr->GetStep() == nav[n].step) {
+				sig = vessel->xpdr->FieldStrength (s0->pos);
+				if (sig > 0.9 && sig > navsig[n]) {
+					navsig[n] =  sig;
+					nav[n].sender = vessel->xpdr;
 				}
 			}
+		}
 
-			if (dist2 < 1e10) { // max IDS range 100 km
-				for (j = (int)vessel->nDock()-1; j >= 0; j--) {
-					const PortSpec *ps = vessel->GetDockParams (j);
-					if (ps->ids) {
-						for (n = n0; n < n1; n++)
-							if (ps->ids->GetStep() == nav[n].step) {
-								sig = ps->ids->FieldStrength (s0->pos);
-								if (sig > 0.9 && sig > navsig[n]) {
-									navsig[n] = sig;
-									nav[n].sender = ps->ids;
-								}
+		if (dist2 < 1e10) { // max IDS range 100 km
+			for (j = (int)vessel->nDock()-1; j >= 0; j--) {
+				const PortSpec *ps = vessel->GetDockParams (j);
+				if (ps->ids) {
+					for (n = n0; n < n1; n++)
+						if (ps->ids->GetStep() == nav[n].step) {
+							sig = ps->ids->FieldStrength (s0->pos);
+							if (sig > 0.9 && sig > navsig[n]) {
+								navsig[n] = sig;
+								nav[n].sender = ps->ids;
 							}
-					}
+						}
 				}
 			}
 		}
@@ -5859,7 +5901,7 @@ bool Vessel::Read (ifstream &scn)
 
 bool Vessel::EditorModule (char *cbuf) const
 {
-	ifstream classf;
+	IndexedIfstream classf;
 	if (!OpenConfigFile (classf)) return false;
 	return GetItemString (classf, "EditorModule", cbuf);
 }
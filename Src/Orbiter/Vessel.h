@@ -310,6 +310,10 @@ public:
 	void GetIntermediateMoments_pert (Vector &acc, Vector &tau,
 		const StateVectors &state_rel, double tfrac, double dt, const CelestialBody *cbody);
 
+	bool CanUpdateSymplectic () const;
+	// Returns true if the vessel is in free flight without thrust, atmospheric,
+	// surface or user-defined forces, and without attachments
+
 	Vector GetTorque () const;
 	// Returns mass-normalised torque at state s0.
 
@@ -998,6 +1002,8 @@ public:
 	// Keyboard handler for buffered keys
 
 	void Update (bool force = false);
+	bool CanUpdateConcurrently (bool force) const;
+	void UpdateConcurrent (bool force);
 	void UpdatePassive ();
 	void UpdateAttachments();
 	void UpdateBodyForces ();
@@ -1486,6 +1492,8 @@ private:
 
 	double E0_comp;              // compression energy due to surface impact at current time step
 	mutable double E_comp;       // compression energy due to surface impact after last AddSurfaceForces call
+	mutable std::vector<double> tdwork; // AddSurfaceForces work arrays for the touchdown points
+	mutable std::vector<int> tdwork_idx; // (per vessel, since vessels are updated concurrently)
 
 	double vd_forw, vd_back, vd_vert, vd_side;  // resistance constants against translation in atmosphere
 
@@ -1510,7 +1518,13 @@ private:
 	Base    *landtgt;         // landing target (base)
 	int   lstatus;            // landing/docking comms status (0=no contact, 1=contact,
 	DWORD nport;              // allocated landing pad/docking port no (>=0, (DWORD)-1=none)
-	UINT  scanvessel;         // next vessel to check for docking event
+
+	struct DockCandidate {    // vessel within docking capture range
+		double dist;             // distance between vessel centres
+		Vessel *vessel;
+		bool operator< (const DockCandidate &dc) const { return dist < dc.dist; }
+	};
+	std::vector<DockCandidate> dockcand; // docking candidates of the current frame, sorted by distance
 
 	mutable bool surfprm_valid;
 	bool pyp_valid;
@@ -1610,7 +1624,8 @@ public:
 	// Flight recorder routines (should be a class!)
 
 private:
-	std::ifstream *FRatc_stream;
+	std::istream *FRatc_stream;
+	// articulation event stream (text file, or text records of the binary stream)
 
 	bool bRequestPlayback;
 	bool bFRplayback;
@@ -1623,7 +1638,10 @@ private:
 	// Last saved flight status
 
 	char *FRfname;
-	// flight record file name
+	// flight record file name (binary stream)
+
+	int FRstream;
+	// binary stream handle of the recording session (see FRecWriter), or -1
 
 	FRecord *frec;
 	int nfrec;
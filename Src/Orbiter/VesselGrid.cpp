@@ -0,0 +1,236 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// VesselGrid.cpp
+// Spatial index over vessel global positions for proximity queries
+// =======================================================================
+
+#include <algorithm>
+#include <functional>
+#include "VesselGrid.h"
+#include "Vessel.h"
+#include "Log.h"
+
+// -----------------------------------------------------------------------
+// sort order for grid entries: by cell, then by descending vessel index
+
+struct EntryLess {
+	template<class E> bool operator() (const E &a, const E &b) const {
+		if (a.ix != b.ix) return a.ix < b.ix;
+		if (a.iy != b.iy) return a.iy < b.iy;
+		if (a.iz != b.iz) return a.iz < b.iz;
+		return a.idx > b.idx;
+	}
+};
+
+// =======================================================================
+
+VesselGrid::VesselGrid (double _cellsize)
+{
+	cellsize  = _cellsize;
+	icellsize = 1.0/cellsize;
+	valid = false;
+	maxsize = 0.0;
+	vlist = 0;
+	entry = 0;
+	nentry = nentrybuf = 0;
+	cell = 0;
+	ncellbuf = 0;
+	result = 0;
+	hitidx = 0;
+	nresultbuf = 0;
+}
+
+// -----------------------------------------------------------------------
+
+VesselGrid::~VesselGrid ()
+{
+	if (nentrybuf) delete []entry;
+	if (ncellbuf)  delete []cell;
+	if (nresultbuf) {
+		delete []result;
+		delete []hitidx;
+	}
+}
+
+// -----------------------------------------------------------------------
+
+int VesselGrid::CellIdx (double x) const
+{
+	double c = floor (x*icellsize);
+	if      (c < -1e9) c = -1e9; // clamp to integer range
+	else if (c >  1e9) c =  1e9;
+	return (int)c;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD VesselGrid::Hash (int ix, int iy, int iz)
+{
+	return ((DWORD)ix * 73856093u) ^ ((DWORD)iy * 19349663u) ^ ((DWORD)iz * 83492791u);
+}
+
+// -----------------------------------------------------------------------
+
+void VesselGrid::Build (Vessel *const *vessel, DWORD nvessel)
+{
+	DWORD i, j, h, mask;
+
+	maxsize = 0.0;
+	if (nvessel > nentrybuf) {
+		if (nentrybuf) delete []entry;
+		entry = new ENTRY[nentrybuf = nvessel]; TRACENEW
+	}
+	for (i = 0; i < nvessel; i++) {
+		const Vector &p = vessel[i]->GPos();
+		entry[i].ix = CellIdx (p.x);
+		entry[i].iy = CellIdx (p.y);
+		entry[i].iz = CellIdx (p.z);
+		entry[i].idx = i;
+		entry[i].vessel = vessel[i];
+		if (vessel[i]->Size() > maxsize) maxsize = vessel[i]->Size();
+	}
+	nentry = nvessel;
+	vlist = vessel;
+	std::sort (entry, entry+nentry, EntryLess());
+
+	// hash table with at least twice as many slots as populated cells
+	for (h = 16; h < 2*nentry; h *= 2);
+	if (h > ncellbuf) {
+		if (ncellbuf) delete []cell;
+		cell = new CELL[ncellbuf = h]; TRACENEW
+	}
+	memset (cell, 0, ncellbuf*sizeof(CELL));
+	mask = ncellbuf-1;
+
+	for (i = 0; i < nentry; i = j) {
+		const ENTRY &e = entry[i];
+		for (j = i+1; j < nentry && entry[j].ix == e.ix && entry[j].iy == e.iy && entry[j].iz == e.iz; j++);
+		for (h = Hash (e.ix, e.iy, e.iz) & mask; cell[h].e1; h = (h+1) & mask);
+		cell[h].ix = e.ix;
+		cell[h].iy = e.iy;
+		cell[h].iz = e.iz;
+		cell[h].e0 = i;
+		cell[h].e1 = j;
+	}
+	valid = true;
+}
+
+// -----------------------------------------------------------------------
+
+const VesselGrid::CELL *VesselGrid::FindCell (int ix, int iy, int iz) const
+{
+	if (!nentry) return NULL;
+	DWORD mask = ncellbuf-1;
+	for (DWORD h = Hash (ix, iy, iz) & mask; cell[h].e1; h = (h+1) & mask)
+		if (cell[h].ix == ix && cell[h].iy == iy && cell[h].iz == iz)
+			return cell+h;
+	return NULL;
+}
+
+// -----------------------------------------------------------------------
+
+void VesselGrid::ScanCell (int ix, int iy, int iz, const Vector &gpos, const Vessel *exclude,
+	double &dist2, Vessel *&vessel, DWORD &idx) const
+{
+	const CELL *c = FindCell (ix, iy, iz);
+	if (!c) return;
+	for (DWORD i = c->e0; i < c->e1; i++) {
+		const ENTRY &e = entry[i];
+		if (e.vessel == exclude) continue;
+		double d2 = gpos.dist2 (e.vessel->GPos());
+		if (d2 < dist2 || (d2 == dist2 && e.idx > idx)) { // ties go to the higher index
+			dist2 = d2;
+			vessel = e.vessel;
+			idx = e.idx;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+
+Vessel *VesselGrid::Closest (const Vector &gpos, const Vessel *exclude) const
+{
+	const int kmax = 2; // max. search radius [cells] before reverting to a full scan
+
+	int k, dx, dy, dz;
+	int cx = CellIdx (gpos.x), cy = CellIdx (gpos.y), cz = CellIdx (gpos.z);
+	double dist2 = 1e100;
+	Vessel *vessel = NULL;
+	DWORD i, idx = 0;
+
+	// search shells of cells of increasing radius around gpos. Any vessel outside
+	// shell k is at least k cell sizes away
+	for (k = 0; k <= kmax; k++) {
+		for (dx = -k; dx <= k; dx++)
+			for (dy = -k; dy <= k; dy++) {
+				int dzstep = (abs(dx) == k || abs(dy) == k ? 1 : 2*k); // interior: only the shell faces
+				for (dz = -k; dz <= k; dz += (k ? dzstep : 1))
+					ScanCell (cx+dx, cy+dy, cz+dz, gpos, exclude, dist2, vessel, idx);
+			}
+		if (vessel && dist2 <= (k*cellsize)*(k*cellsize))
+			return vessel;
+	}
+
+	// sparse neighbourhood: check all vessels
+	for (i = 0; i < nentry; i++) {
+		const ENTRY &e = entry[i];
+		if (e.vessel == exclude) continue;
+		double d2 = gpos.dist2 (e.vessel->GPos());
+		if (d2 < dist2 || (d2 == dist2 && e.idx > idx)) {
+			dist2 = d2;
+			vessel = e.vessel;
+			idx = e.idx;
+		}
+	}
+	return vessel;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD VesselGrid::InRange (const Vector &gpos, double range, Vessel **&list)
+{
+	DWORD i, n = 0;
+	double range2 = range*range;
+
+	// grow the result buffer to hold all vessels, so no checks are needed below
+	if (nentry > nresultbuf) {
+		if (nresultbuf) {
+			delete []result;
+			delete []hitidx;
+		}
+		result = new Vessel*[nresultbuf = nentry]; TRACENEW
+		hitidx = new DWORD[nresultbuf]; TRACENEW
+	}
+
+	// range of cells overlapping the bounding box of the query sphere
+	int ix0 = CellIdx (gpos.x-range), ix1 = CellIdx (gpos.x+range);
+	int iy0 = CellIdx (gpos.y-range), iy1 = CellIdx (gpos.y+range);
+	int iz0 = CellIdx (gpos.z-range), iz1 = CellIdx (gpos.z+range);
+	double ncell = (ix1-ix0+1.0)*(iy1-iy0+1.0)*(iz1-iz0+1.0);
+
+	if (ncell < (double)nentry) {
+		int ix, iy, iz;
+		for (ix = ix0; ix <= ix1; ix++)
+			for (iy = iy0; iy <= iy1; iy++)
+				for (iz = iz0; iz <= iz1; iz++) {
+					const CELL *c = FindCell (ix, iy, iz);
+					if (c) {
+						for (i = c->e0; i < c->e1; i++)
+							if (gpos.dist2 (entry[i].vessel->GPos()) < range2)
+								hitidx[n++] = entry[i].idx;
+					}
+				}
+	} else { // query box covers more cells than there are vessels
+		for (i = 0; i < nentry; i++)
+			if (gpos.dist2 (entry[i].vessel->GPos()) < range2)
+				hitidx[n++] = entry[i].idx;
+	}
+
+	std::sort (hitidx, hitidx+n, std::greater<DWORD>());
+	for (i = 0; i < n; i++)
+		result[i] = vlist[hitidx[i]];
+	list = result;
+	return n;
+}
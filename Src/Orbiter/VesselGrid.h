@@ -0,0 +1,88 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// VesselGrid.h
+// Spatial index over vessel global positions for proximity queries
+// (closest vessel, transponder and docking IDS scans).
+// Vessels are sorted into a hashed uniform grid, so that range queries
+// only need to visit the cells overlapping the query sphere.
+// =======================================================================
+
+#ifndef __VESSELGRID_H
+#define __VESSELGRID_H
+
+#include <windows.h>
+#include "Vecmat.h"
+
+class Vessel;
+
+class VesselGrid {
+public:
+	VesselGrid (double cellsize);
+	// cellsize: grid cell edge length [m]. Should be of the order of the
+	// most common query range.
+
+	~VesselGrid ();
+
+	inline bool Valid () const { return valid; }
+	inline void Invalidate () { valid = false; }
+	// The grid must be invalidated whenever the vessel list or the vessel
+	// positions change
+
+	void Build (Vessel *const *vessel, DWORD nvessel);
+	// Sort the vessels into the grid cells according to their current global
+	// positions. The vessel list must remain valid until the grid is invalidated.
+
+	inline double MaxSize () const { return maxsize; }
+	// Largest vessel radius at the time the grid was built
+
+	Vessel *Closest (const Vector &gpos, const Vessel *exclude) const;
+	// Returns the vessel closest to gpos, excluding 'exclude'
+	// (NULL if no other vessel exists)
+
+	DWORD InRange (const Vector &gpos, double range, Vessel **&list);
+	// Returns the number of vessels within distance 'range' of gpos, and the
+	// list of vessels in 'list', in descending order of their vessel index.
+	// The list is only valid until the next call.
+
+private:
+	struct ENTRY {      // grid entry for a single vessel
+		int ix, iy, iz;    // cell index
+		DWORD idx;         // vessel index
+		Vessel *vessel;
+	};
+	struct CELL {       // hash table entry for a populated cell
+		int ix, iy, iz;    // cell index
+		DWORD e0, e1;      // range of entries in the cell (e1 = 0: empty slot)
+	};
+
+	int CellIdx (double x) const;
+	// cell index for coordinate x
+
+	static DWORD Hash (int ix, int iy, int iz);
+
+	const CELL *FindCell (int ix, int iy, int iz) const;
+	// returns the hash table entry for a cell, or NULL if the cell is empty
+
+	void ScanCell (int ix, int iy, int iz, const Vector &gpos, const Vessel *exclude,
+		double &dist2, Vessel *&vessel, DWORD &idx) const;
+	// check the vessels in a cell against the current closest candidate
+
+	double cellsize, icellsize;
+	bool valid;
+	double maxsize;       // largest vessel radius
+	Vessel *const *vlist; // vessel list the grid was built from
+
+	ENTRY *entry;       // vessel entries, sorted by cell
+	DWORD nentry, nentrybuf;
+
+	CELL *cell;         // open-addressing hash table of populated cells
+	DWORD ncellbuf;     // hash table size (power of 2)
+
+	Vessel **result;    // result buffer for range queries
+	DWORD *hitidx;      // vessel indices found by range queries
+	DWORD nresultbuf;
+};
+
+#endif // !__VESSELGRID_H
@@ -196,6 +196,7 @@ void VesselBase::SetDefaultState ()
 	proxybase = 0;
 	bDynamicGroundContact = true;
 	bSurfaceContact = false;
+	bConcurrentUpdate = false;
 	LandingTest.testing = false;
 	proxyT    = -(double)rand()*100.0/(double)RAND_MAX - 1.0;
 	// distribute update times
@@ -239,6 +240,23 @@ void VesselBase::PostUpdate ()
 
 // =======================================================================
 
+bool VesselBase::ConcurrentUpdateSafe (bool force) const
+{
+	// gravity source list rescans randomise their update times
+	if (force || !gfielddata.ngrav) return false;
+
+	// surface parameters and ground contact forces are only evaluated below
+	// SurfParam's altitude limit, but they access the planet's elevation cache
+	if (proxybody) {
+		const double alt_max = 1e5;
+		double dst = s0->vel.dist (proxybody->s0->vel) * td.SimDT;
+		if (sp.alt0 < alt_max + 2.0*(size + dst)) return false;
+	}
+	return true;
+}
+
+// =======================================================================
+
 void VesselBase::UpdateSurfParams ()
 {
 	sp.Set (s1 ? *s1 : *s0, proxybody->s1 ? *proxybody->s1 : *proxybody->s0, proxybody, &etile, &windp);
@@ -89,6 +89,15 @@ public:
 
 	virtual void PostUpdate ();
 
+	virtual bool CanUpdateConcurrently (bool force) const { return false; }
+	// Returns true if the dynamic state propagation for the current step can be
+	// performed on a job thread, concurrently with that of other vessels
+
+	virtual void UpdateConcurrent (bool force) {}
+	// Perform the dynamic state propagation on a job thread. The remainder of
+	// the state update is performed by the subsequent call to Update on the
+	// main thread.
+
 	inline CelestialBody *ProxyBody() { return proxybody; }
 	inline Planet *ProxyPlanet() { return proxyplanet; }
 	inline const Planet *ProxyPlanet() const { return proxyplanet; }
@@ -171,6 +180,11 @@ protected:
 
 	virtual const VesselBase *GetSuperStructure () const { return NULL; }
 
+	bool ConcurrentUpdateSafe (bool force) const;
+	// Returns true if the dynamic state propagation for the current step doesn't
+	// access any shared resources: no gravity source rescan (random update times),
+	// and sufficiently far from the surface to avoid the elevation cache
+
 	virtual void SetPropagator (int &plevel, int &nstep) const;
 	// set timestep propagator parameters; overrides defaults during ground contact
 
@@ -199,6 +213,7 @@ protected:
 	Planet *proxyplanet;         // closest 'landable' object (planet or moon)
 	Base *proxybase;             // closest surface base
 	bool bSurfaceContact;        // signal vessel is in contact with planet surface
+	bool bConcurrentUpdate;      // state propagation for the current step was performed by UpdateConcurrent
 
 	SurfParam sp;      // ship parameters concerning planet surface
 	Matrix land_rot;   // rotates ship's local into planet's local coords so that grot = grot(planet) * land_rot
@@ -3,7 +3,52 @@
 
 #include "ZTreeMgr.h"
 #include "zlib.h"
-#include "util.h"
+#ifdef TREE_LZ4
+#include "lz4.h"
+#endif
+#ifdef TREE_ZSTD
+#include "zstd.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Archives larger than this are not mapped in 32-bit processes, to avoid
+// exhausting the address space
+static const __int64 MAXMAP32 = (__int64)256 << 20;
+
+// Size of version 1 file headers, which have no codec field
+static const DWORD TREEHDR_V1_SIZE = 48;
+
+// Spread the lower 28 bits of a tile coordinate to the even bit positions
+// (for Morton keys)
+static inline __int64 SpreadBits(DWORD x)
+{
+	__int64 v = x & 0x0fffffff;
+	v = (v | (v << 16)) & 0x0000ffff0000ffffLL;
+	v = (v | (v <<  8)) & 0x00ff00ff00ff00ffLL;
+	v = (v | (v <<  4)) & 0x0f0f0f0f0f0f0f0fLL;
+	v = (v | (v <<  2)) & 0x3333333333333333LL;
+	v = (v | (v <<  1)) & 0x5555555555555555LL;
+	return v;
+}
+
+// Multiplicative hash of a node key into a table of 2^(64-shift) slots
+static inline DWORD HashKey(__int64 key, int shift)
+{
+	return (DWORD)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> shift);
+}
+
+// Header of pooled data buffers, preceding the data
+struct POOLBUF {
+	DWORD size;  // buffer capacity [bytes]
+	DWORD pad[3];
+};
 
 // =======================================================================
 // File header for compressed tree files
@@ -14,19 +59,32 @@ TreeFileHeader::TreeFileHeader ()
 	magic[1] = 'X';
 	magic[2] = 1;
 	magic[3] = 0;
-	size = sizeof(TreeFileHeader);
+	size = TREEHDR_V1_SIZE;
 	flags = 0;
 	nodeCount = 0;
 	dataOfs = size;
 	dataLength = 0;
 	rootPos1 = rootPos2 = rootPos3 = rootPos4[0] = rootPos4[1] = (DWORD)-1;
+	codec = TREE_CODEC_ZLIB;
+	reserved = 0;
+}
+
+// -----------------------------------------------------------------------
+
+void TreeFileHeader::SetCodec(DWORD _codec)
+{
+	// zlib archives keep the version 1 header, so that older readers can
+	// still use them
+	codec = _codec;
+	magic[2] = (codec == TREE_CODEC_ZLIB ? 1 : 2);
+	size = (codec == TREE_CODEC_ZLIB ? TREEHDR_V1_SIZE : sizeof(TreeFileHeader));
 }
 
 // -----------------------------------------------------------------------
 
 size_t TreeFileHeader::fwrite(FILE *f)
 {
-	return ::fwrite(this, sizeof(TreeFileHeader), 1, f);
+	return ::fwrite(this, size, 1, f);
 }
 
 // -----------------------------------------------------------------------
@@ -35,10 +93,13 @@ bool TreeFileHeader::fread(FILE *f)
 {
 	BYTE buf[4];
 	DWORD sz, flags;
-	if (::fread(buf, 1, 4, f) < 4 || memcmp(buf, magic, 4))
+	if (::fread(buf, 1, 4, f) < 4 || memcmp(buf, magic, 2) || buf[2] < 1 || buf[2] > 2 || buf[3])
 		return false;
-	if (::fread(&sz, sizeof(DWORD), 1, f) != 1 || sz != size)
+	DWORD hsize = (buf[2] == 1 ? TREEHDR_V1_SIZE : sizeof(TreeFileHeader));
+	if (::fread(&sz, sizeof(DWORD), 1, f) != 1 || sz != hsize)
 		return false;
+	magic[2] = buf[2];
+	size = sz;
 	::fread(&flags, sizeof(DWORD), 1, f);
 	::fread(&dataOfs, sizeof(DWORD), 1, f);
 	::fread(&dataLength, sizeof(__int64), 1, f);
@@ -47,6 +108,11 @@ bool TreeFileHeader::fread(FILE *f)
 	::fread(&rootPos2, sizeof(DWORD), 1, f);
 	::fread(&rootPos3, sizeof(DWORD), 1, f);
 	::fread(rootPos4, sizeof(DWORD), 2, f);
+	codec = TREE_CODEC_ZLIB;
+	if (buf[2] >= 2) {
+		::fread(&codec, sizeof(DWORD), 1, f);
+		::fread(&reserved, sizeof(DWORD), 1, f);
+	}
 	return true;
 }
 
@@ -85,9 +151,9 @@ size_t TreeTOC::fread(DWORD size, FILE *f)
 // =======================================================================
 // ZTreeMgr class: manage a single layer tree for a planet
 
-ZTreeMgr *ZTreeMgr::CreateFromFile(const char *PlanetPath, Layer _layer)
+ZTreeMgr *ZTreeMgr::CreateFromFile(const char *PlanetPath, Layer _layer, bool mapped)
 {
-	ZTreeMgr *mgr = new ZTreeMgr(PlanetPath, _layer);
+	ZTreeMgr *mgr = new ZTreeMgr(PlanetPath, _layer, mapped);
 	if (!mgr->TOC().size()) {
 		delete mgr;
 		mgr = 0;
@@ -97,13 +163,28 @@ ZTreeMgr *ZTreeMgr::CreateFromFile(const char *PlanetPath, Layer _layer)
 
 // -----------------------------------------------------------------------
 
-ZTreeMgr::ZTreeMgr(const char *PlanetPath, Layer _layer)
+ZTreeMgr::ZTreeMgr(const char *PlanetPath, Layer _layer, bool mapped)
 {
 	path = new char[strlen(PlanetPath)+1];
 	strcpy(path, PlanetPath);
 	layer = _layer;
-	treef = 0;
-	OpenArchive();
+#ifdef _WIN32
+	hFile = INVALID_HANDLE_VALUE;
+	hMap = NULL;
+	InitializeCriticalSection(&pool_cs);
+#else
+	fd = -1;
+	pthread_mutex_init(&pool_cs, NULL);
+#endif
+	base = 0;
+	flen = 0;
+	npool = 0;
+	codec = TREE_CODEC_ZLIB;
+	nodekey = NULL;
+	hashtab = NULL;
+	hashmask = 0;
+	hashshift = 64;
+	OpenArchive(mapped);
 }
 
 // -----------------------------------------------------------------------
@@ -111,23 +192,38 @@ ZTreeMgr::ZTreeMgr(const char *PlanetPath, Layer _layer)
 ZTreeMgr::~ZTreeMgr()
 {
 	delete []path;
-	if (treef) fclose(treef);
+	CloseArchive();
+	ClearIndex();
+	for (DWORD i = 0; i < npool; i++)
+		delete []pool[i];
+#ifdef _WIN32
+	DeleteCriticalSection(&pool_cs);
+#else
+	pthread_mutex_destroy(&pool_cs);
+#endif
 }
 
 // -----------------------------------------------------------------------
 
-bool ZTreeMgr::OpenArchive()
+bool ZTreeMgr::OpenArchive(bool mapped)
 {
 	const char *name[6] = { "Surf", "Mask", "Elev", "Elev_mod", "Label", "Cloud" };
 	char fname[256];
+#ifdef _WIN32
 	sprintf (fname, "%s\\Archive\\%s.tree", path, name[layer]);
-	treef = fopen(fname, "rb");
+#else
+	sprintf (fname, "%s/Archive/%s.tree", path, name[layer]);
+#endif
+
+	// header and table of contents
+	FILE *treef = fopen(fname, "rb");
 	if (!treef) return false;
 
 	TreeFileHeader tfh;
-	if (!tfh.fread(treef)) {
-		fclose(treef);
-		treef = 0;
+	bool ok = tfh.fread(treef) && toc.fread(tfh.nodeCount, treef) == tfh.nodeCount;
+	fclose(treef);
+	if (!ok) {
+		toc.ntree = 0;
 		return false;
 	}
 	rootPos1 = tfh.rootPos1;
@@ -136,15 +232,160 @@ bool ZTreeMgr::OpenArchive()
 	for (int i = 0; i < 2; i++)
 		rootPos4[i] = tfh.rootPos4[i];
 	dofs = (__int64)tfh.dataOfs;
-
-	if (!toc.fread(tfh.nodeCount, treef)) {
-		fclose(treef);
-		treef = 0;
+	toc.totlength = tfh.dataLength;
+	codec = tfh.codec;
+	if (!CodecSupported(codec)) {
+		toc.ntree = 0;
 		return false;
 	}
-	toc.totlength = tfh.dataLength;
+	BuildIndex();
+
+	// node data access
+#ifdef _WIN32
+	hFile = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+	LARGE_INTEGER size;
+	if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &size)) {
+		CloseArchive();
+		toc.ntree = 0;
+		return false;
+	}
+	flen = size.QuadPart;
+	if (sizeof(void*) < 8 && flen > MAXMAP32) mapped = false;
+	if (mapped && (hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL))) {
+		if (!(base = (const BYTE*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0))) {
+			CloseHandle(hMap);
+			hMap = NULL;
+		}
+	}
+#else
+	struct stat st;
+	if ((fd = open(fname, O_RDONLY)) < 0 || fstat(fd, &st)) {
+		CloseArchive();
+		toc.ntree = 0;
+		return false;
+	}
+	flen = (__int64)st.st_size;
+	if (sizeof(void*) < 8 && flen > MAXMAP32) mapped = false;
+	if (mapped) {
+		void *p = mmap(NULL, (size_t)flen, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED) base = (const BYTE*)p;
+	}
+#endif
+	return true;
+}
+
+// -----------------------------------------------------------------------
 
+void ZTreeMgr::CloseArchive()
+{
+#ifdef _WIN32
+	if (base) UnmapViewOfFile(base);
+	if (hMap) CloseHandle(hMap);
+	if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+	hMap = NULL;
+	hFile = INVALID_HANDLE_VALUE;
+#else
+	if (base) munmap((void*)base, (size_t)flen);
+	if (fd >= 0) close(fd);
+	fd = -1;
+#endif
+	base = 0;
+}
+
+// -----------------------------------------------------------------------
+
+bool ZTreeMgr::ReadRaw(__int64 ofs, BYTE *buf, DWORD size)
+{
+#ifdef _WIN32
+	// The handle is opened for overlapped access, so that concurrent
+	// reads aren't serialised on the file object
+	OVERLAPPED ov;
+	DWORD nread = 0;
+	memset(&ov, 0, sizeof(OVERLAPPED));
+	ov.Offset = (DWORD)ofs;
+	ov.OffsetHigh = (DWORD)(ofs >> 32);
+	if (!(ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return false;
+	BOOL ok = ReadFile(hFile, buf, size, &nread, &ov);
+	if (!ok && GetLastError() == ERROR_IO_PENDING)
+		ok = GetOverlappedResult(hFile, &ov, &nread, TRUE);
+	CloseHandle(ov.hEvent);
+	return ok && nread == size;
+#else
+	while (size) {
+		ssize_t n = pread(fd, buf, size, (off_t)ofs);
+		if (n <= 0) return false;
+		buf += n, ofs += n, size -= (DWORD)n;
+	}
 	return true;
+#endif
+}
+
+// -----------------------------------------------------------------------
+
+__int64 ZTreeMgr::NodeKey(int lvl, int ilat, int ilng)
+{
+	return ((__int64)lvl << 56) | (SpreadBits(ilat) << 1) | SpreadBits(ilng);
+}
+
+// -----------------------------------------------------------------------
+
+void ZTreeMgr::BuildIndex()
+{
+	ClearIndex();
+	DWORD i, n = toc.size();
+	if (!n) return;
+
+	// hash table with a load factor of at most 0.5
+	DWORD nhash = 1;
+	for (hashshift = 64; nhash < 2*n && nhash < 0x80000000; nhash <<= 1)
+		hashshift--;
+	hashmask = nhash-1;
+	hashtab = new DWORD[nhash];
+	memset(hashtab, 0xff, nhash*sizeof(DWORD));
+	nodekey = new __int64[n];
+	for (i = 0; i < n; i++) nodekey[i] = -1;
+
+	// walk the level-4 quadtrees
+	struct NODEPOS { DWORD idx; int lvl, ilat, ilng; };
+	NODEPOS *stack = new NODEPOS[3*n+2];
+	int nstack = 0;
+	for (i = 0; i < 2; i++) {
+		if (rootPos4[i] < n) {
+			NODEPOS np = { rootPos4[i], 4, 0, (int)i };
+			stack[nstack++] = np;
+		}
+	}
+	while (nstack) {
+		NODEPOS np = stack[--nstack];
+		if (nodekey[np.idx] != -1) continue; // corrupt TOC: node referenced twice
+		__int64 key = NodeKey(np.lvl, np.ilat, np.ilng);
+		nodekey[np.idx] = key;
+		DWORD h = HashKey(key, hashshift);
+		while (hashtab[h] != (DWORD)-1) h = (h+1) & hashmask;
+		hashtab[h] = np.idx;
+		for (int c = 0; c < 4; c++) {
+			DWORD cidx = toc[np.idx].child[c];
+			if (cidx < n && nodekey[cidx] == -1) {
+				NODEPOS cp = { cidx, np.lvl+1, np.ilat*2 + c/2, np.ilng*2 + c%2 };
+				stack[nstack++] = cp;
+			}
+		}
+	}
+	delete []stack;
+}
+
+// -----------------------------------------------------------------------
+
+void ZTreeMgr::ClearIndex()
+{
+	if (nodekey) delete []nodekey;
+	if (hashtab) delete []hashtab;
+	nodekey = NULL;
+	hashtab = NULL;
+	hashmask = 0;
+	hashshift = 64;
 }
 
 // -----------------------------------------------------------------------
@@ -154,14 +395,12 @@ DWORD ZTreeMgr::Idx(int lvl, int ilat, int ilng)
 	if (lvl <= 4) {
 		return (lvl == 1 ? rootPos1 : lvl == 2 ? rootPos2 : lvl == 3 ? rootPos3 : rootPos4[ilng]);
 	} else {
-		int plvl = lvl-1;
-		int pilat = ilat/2;
-		int pilng = ilng/2;
-		DWORD pidx = Idx(plvl, pilat, pilng);
-		if (pidx == (DWORD)-1)
-			return pidx;
-		int cidx = ((ilat&1) << 1) + (ilng&1);
-		return toc[pidx].child[cidx];
+		if (!hashtab) return (DWORD)-1;
+		__int64 key = NodeKey(lvl, ilat, ilng);
+		DWORD h = HashKey(key, hashshift);
+		for (DWORD idx; (idx = hashtab[h]) != (DWORD)-1; h = (h+1) & hashmask)
+			if (nodekey[idx] == key) return idx;
+		return (DWORD)-1;
 	}
 }
 
@@ -175,39 +414,171 @@ DWORD ZTreeMgr::ReadData(DWORD idx, BYTE **outp)
 	if (!esize) // node doesn't have data, but has descendants with data
 		return 0;
 
-	if (_fseeki64(treef, toc[idx].pos+dofs, SEEK_SET))
+	BYTE *ebuf = AllocBuffer(esize);
+	DWORD ndata = ReadData(idx, ebuf, esize);
+
+	if (!ndata) {
+		FreeBuffer(ebuf);
+		ebuf = 0;
+	}
+	*outp = ebuf;
+	return ndata;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD ZTreeMgr::ReadData(DWORD idx, BYTE *buf, DWORD bufsize)
+{
+	if (idx >= toc.size()) return 0; // sanity check
+
+	DWORD esize = NodeSizeInflated(idx);
+	if (!esize || esize > bufsize)
 		return 0;
 
 	DWORD zsize = NodeSizeDeflated(idx);
-	BYTE *zbuf = new BYTE[zsize];	
-	fread(zbuf, 1, zsize, treef);
+	__int64 ofs = toc[idx].pos+dofs;
+	if (ofs < dofs || ofs+zsize > flen)
+		return 0;
 
-	BYTE *ebuf = new BYTE[esize];
+	if (base) // inflate straight from the mapped file
+		return Inflate(base+ofs, zsize, buf, esize);
 
-	DWORD ndata = Inflate(zbuf, zsize, ebuf, esize);
+	BYTE *zbuf = new BYTE[zsize];
+	DWORD ndata = (ReadRaw(ofs, zbuf, zsize) ? Inflate(zbuf, zsize, buf, esize) : 0);
 	delete []zbuf;
+	return ndata;
+}
 
-	if (!ndata) {
-		delete []ebuf;
-		ebuf = 0;
+// -----------------------------------------------------------------------
+
+bool ZTreeMgr::Prefetch(DWORD idx)
+{
+	if (idx >= toc.size()) return false; // sanity check
+
+	DWORD zsize = NodeSizeDeflated(idx);
+	__int64 ofs = toc[idx].pos+dofs;
+	if (!zsize || ofs < dofs || ofs+zsize > flen)
+		return false;
+
+	if (base) { // touch the mapped pages
+		const volatile BYTE *p = base+ofs;
+		BYTE sum = 0;
+		for (DWORD i = 0; i < zsize; i += 4096) sum += p[i];
+		sum += p[zsize-1];
+		return true;
+	}
+
+	BYTE *zbuf = AllocBuffer(zsize);
+	bool ok = ReadRaw(ofs, zbuf, zsize);
+	FreeBuffer(zbuf);
+	return ok;
+}
+
+// -----------------------------------------------------------------------
+
+bool ZTreeMgr::CodecSupported(DWORD codec)
+{
+	switch (codec) {
+	case TREE_CODEC_ZLIB:
+		return true;
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4:
+		return true;
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
 	}
-	*outp = ebuf;
-	return ndata;
 }
 
 // -----------------------------------------------------------------------
 
 DWORD ZTreeMgr::Inflate(const BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp)
 {
-	DWORD ndata = noutp;
-	if (uncompress (outp, &ndata, inp, ninp) != Z_OK)
+	switch (codec) {
+	case TREE_CODEC_ZLIB: {
+		uLongf ndata = noutp;
+		if (uncompress (outp, &ndata, inp, ninp) != Z_OK)
+			return 0;
+		return (DWORD)ndata;
+		}
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4: {
+		int ndata = LZ4_decompress_safe ((const char*)inp, (char*)outp, (int)ninp, (int)noutp);
+		return (ndata > 0 ? (DWORD)ndata : 0);
+		}
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD: {
+		size_t ndata = ZSTD_decompress (outp, noutp, inp, ninp);
+		return (ZSTD_isError (ndata) ? 0 : (DWORD)ndata);
+		}
+#endif
+	default:
 		return 0;
-	return ndata;
+	}
+}
+
+// -----------------------------------------------------------------------
+
+BYTE *ZTreeMgr::AllocBuffer(DWORD size)
+{
+	// Tiles of a layer mostly have the same size, so a released buffer of
+	// similar capacity is reused if there is one
+	BYTE *block = 0;
+#ifdef _WIN32
+	EnterCriticalSection(&pool_cs);
+#else
+	pthread_mutex_lock(&pool_cs);
+#endif
+	for (DWORD i = 0; i < npool; i++) {
+		DWORD cap = ((POOLBUF*)pool[i])->size;
+		if (cap >= size && cap/2 <= size) {
+			block = pool[i];
+			pool[i] = pool[--npool];
+			break;
+		}
+	}
+#ifdef _WIN32
+	LeaveCriticalSection(&pool_cs);
+#else
+	pthread_mutex_unlock(&pool_cs);
+#endif
+	if (!block) {
+		block = new BYTE[sizeof(POOLBUF)+size];
+		((POOLBUF*)block)->size = size;
+	}
+	return block + sizeof(POOLBUF);
+}
+
+// -----------------------------------------------------------------------
+
+void ZTreeMgr::FreeBuffer(BYTE *buf)
+{
+	BYTE *block = buf - sizeof(POOLBUF);
+#ifdef _WIN32
+	EnterCriticalSection(&pool_cs);
+#else
+	pthread_mutex_lock(&pool_cs);
+#endif
+	if (npool < NPOOL) {
+		pool[npool++] = block;
+		block = 0;
+	}
+#ifdef _WIN32
+	LeaveCriticalSection(&pool_cs);
+#else
+	pthread_mutex_unlock(&pool_cs);
+#endif
+	delete []block;
 }
 
 // -----------------------------------------------------------------------
 
 void ZTreeMgr::ReleaseData(BYTE *data)
 {
-	delete []data;
-}
\ No newline at end of file
+	if (data) FreeBuffer(data);
+}
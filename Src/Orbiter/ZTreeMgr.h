@@ -10,7 +10,20 @@
 #define __ZTREEMGR_H
 
 #include <iostream>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <stdint.h>
+#include <pthread.h>
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef int64_t __int64;
+#endif
+
+// Compression codecs for node data
+#define TREE_CODEC_ZLIB 0
+#define TREE_CODEC_LZ4  1
+#define TREE_CODEC_ZSTD 2
 
 // =======================================================================
 // Tree node structure
@@ -29,14 +42,17 @@ struct TreeNode {
 
 // =======================================================================
 // File header for compressed tree files
+// Version 1 headers end after rootPos4, and imply zlib compression.
+// Version 2 headers add the codec field.
 
 class TreeFileHeader {
 	friend class ZTreeMgr;
 
 public:
 	TreeFileHeader();
-	size_t TreeFileHeader::fwrite(FILE *f);
-	bool TreeFileHeader::fread(FILE *f);
+	void SetCodec(DWORD _codec);
+	size_t fwrite(FILE *f);
+	bool fread(FILE *f);
 
 private:
 	BYTE magic[4];      // file ID and version
@@ -49,6 +65,8 @@ private:
 	DWORD rootPos2;     // index of level-2 tile ((DWORD)-1 for not present)
 	DWORD rootPos3;     // index of level-3 tile ((DWORD)-1 for not present)
 	DWORD rootPos4[2];  // index of the level-4 tiles (quadtree roots; (DWORD)-1 for not present)
+	DWORD codec;        // compression codec (TREE_CODEC_xxx; version 2 only)
+	DWORD reserved;     // (version 2 only)
 };
 
 // =======================================================================
@@ -79,42 +97,104 @@ private:
 
 // =======================================================================
 // ZTreeMgr class: manage a single layer tree for a planet
+// The archive is memory-mapped, and tiles are inflated directly from the
+// mapped range. If the archive can't be mapped (e.g. it doesn't fit into
+// the address space of a 32-bit process), node data are fetched with
+// positioned reads instead. Either way, ReadData doesn't modify any shared
+// state other than the buffer pool, so several threads can read tiles from
+// the same archive concurrently.
 
 class ZTreeMgr {
 public:
 	enum Layer { LAYER_SURF, LAYER_MASK, LAYER_ELEV, LAYER_ELEVMOD, LAYER_LABEL, LAYER_CLOUD };
-	static ZTreeMgr *CreateFromFile(const char *PlanetPath, Layer _layer);
-	ZTreeMgr(const char *PlanetPath, Layer _layer);
+	static ZTreeMgr *CreateFromFile(const char *PlanetPath, Layer _layer, bool mapped = true);
+	ZTreeMgr(const char *PlanetPath, Layer _layer, bool mapped = true);
 	~ZTreeMgr();
 	const TreeTOC &TOC() const { return toc; }
+	bool Mapped() const { return base != 0; }
 
 	DWORD Idx(int lvl, int ilat, int ilng);
 	// return the array index of an arbitrary tile ((DWORD)-1: not present)
+	// Tiles below level 4 are looked up in the node index, in constant time.
 
 	DWORD ReadData(DWORD idx, BYTE **outp);
+	// Inflate the node data into a buffer from the pool. The buffer must be
+	// returned with ReleaseData.
 
 	inline DWORD ReadData(int lvl, int ilat, int ilng, BYTE **outp)
 	{ return ReadData(Idx(lvl, ilat, ilng), outp); }
 
+	DWORD ReadData(DWORD idx, BYTE *buf, DWORD bufsize);
+	// Inflate the node data into a caller-provided buffer, which must hold at
+	// least NodeSizeInflated(idx) bytes. Returns the inflated size, or 0 if
+	// the node has no data or the buffer is too small.
+
 	void ReleaseData(BYTE *data);
 
+	bool Prefetch(DWORD idx);
+	// Read the compressed node data into the file cache, without inflating
+	// them, so that a later ReadData doesn't wait for the disk. Returns
+	// false if the node has no data.
+
+	DWORD Codec() const { return codec; }
+	static bool CodecSupported(DWORD codec);
+	// true if archives compressed with codec can be read by this build
+
 	inline DWORD NodeSizeDeflated(DWORD idx) const { return toc.NodeSizeDeflated(idx); }
 	inline DWORD NodeSizeInflated(DWORD idx) const { return toc.NodeSizeInflated(idx); }
 
+	static __int64 NodeKey(int lvl, int ilat, int ilng);
+	// Morton-encoded key of a tile: level in the top bits, followed by
+	// the interleaved bits of ilat and ilng. Unique across all levels, so
+	// it can also be used to identify tiles outside the manager.
+
 protected:
-	bool OpenArchive();
+	bool OpenArchive(bool mapped);
+	void CloseArchive();
+	bool ReadRaw(__int64 ofs, BYTE *buf, DWORD size);
 	DWORD Inflate(const BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp);
 
+	void BuildIndex();
+	// Build the hash index of the nodes of the level-4 quadtrees from the TOC
+	void ClearIndex();
+
+	BYTE *AllocBuffer(DWORD size);
+	void FreeBuffer(BYTE *buf);
+
 private:
 	char *path;
 	Layer layer;
-	FILE *treef;
+#ifdef _WIN32
+	HANDLE hFile;      // archive file
+	HANDLE hMap;       // file mapping object
+#else
+	int fd;            // archive file
+#endif
+	const BYTE *base;  // start of mapped archive (0 if not mapped)
+	__int64 flen;      // archive file size
 	TreeTOC toc;
 	DWORD rootPos1;    // index of level-1 tile ((DWORD)-1 for not present)
 	DWORD rootPos2;    // index of level-2 tile ((DWORD)-1 for not present)
 	DWORD rootPos3;    // index of level-3 tile ((DWORD)-1 for not present)
 	DWORD rootPos4[2]; // index of the level-4 tiles (quadtree roots; (DWORD)-1 for not present)
 	__int64 dofs;
+	DWORD codec;       // compression codec (TREE_CODEC_xxx)
+
+	// node index: open-addressing hash table of TOC indices, keyed by NodeKey
+	__int64 *nodekey;  // key of each TOC entry (-1: not in a level-4 quadtree)
+	DWORD *hashtab;    // TOC indices ((DWORD)-1: empty slot)
+	DWORD hashmask;    // hash table size - 1 (power of 2)
+	int hashshift;     // 64 - log2(hash table size)
+
+	// pool of released data buffers for reuse
+	enum { NPOOL = 8 };
+	BYTE *pool[NPOOL];
+	DWORD npool;
+#ifdef _WIN32
+	CRITICAL_SECTION pool_cs;
+#else
+	pthread_mutex_t pool_cs;
+#endif
 };
 
 #endif // !__ZTREEMGR_H
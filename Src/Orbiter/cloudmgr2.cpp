@@ -15,6 +15,7 @@
 extern Orbiter *g_pOrbiter;
 extern Camera *g_camera;
 extern TextureManager2 *g_texmanager2;
+extern TimeData td;
 
 // =======================================================================
 // =======================================================================
@@ -78,6 +79,7 @@ void CloudTile::Load ()
 		// create rectangular patch
 		mesh = CreateMesh_quadpatch (res, res, 0, 1.0, mean_elev, &texrange, shift_origin, &vtxshift);
 	}
+	SetMemSize (MEMSTAT_CLOUD, (owntex ? TextureSize (tex) : 0) + MeshSize (mesh));
 }
 
 // -----------------------------------------------------------------------
@@ -153,6 +155,7 @@ void TileManager2<CloudTile>::Render (LPDIRECT3DDEVICE7 dev, MATRIX4 &dwmat, VPl
 	// update the tree
 	for (i = 0; i < 2; i++)
 		ProcessNode (tiletree+i);
+	UpdateConvergence ();
 
 	// render the tree
 	dVERIFY (dev->SetTextureStageState (0, D3DTSS_ADDRESS, D3DTADDRESS_CLAMP), "LPDIRECT3DDEVICE7::SetTextureStageState failed");
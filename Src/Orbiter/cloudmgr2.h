@@ -19,6 +19,9 @@ public:
 	CloudTile (TileManager2Base *_mgr, int _lvl, int _ilat, int _ilng);
 	~CloudTile ();
 
+	static const char *LayerName () { return "Cloud"; }
+	// layer name for log output
+
 	inline void SetNode (QuadTreeNode<CloudTile> *_node) { node = _node; }
 	// Register the tile to a quad tree node
 
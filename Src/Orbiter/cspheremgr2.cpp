@@ -11,6 +11,7 @@ extern Camera *g_camera;
 extern TextureManager2 *g_texmanager2;
 extern DWORD g_vtxcount;
 extern DWORD g_tilecount;
+extern TimeData td;
 
 CsphereTile::CsphereTile(TileManager2Base *_mgr, int _lvl, int _ilat, int _ilng)
 	: Tile(_mgr, _lvl, _ilat, _ilng)
@@ -63,6 +64,7 @@ void CsphereTile::Load()
 	else {
 		mesh = CreateMesh_quadpatch(res, res, 0, 1.0, mean_elev, &texrange, shift_origin, &vtxshift);
 	}
+	SetMemSize(MEMSTAT_CSPHERE, (owntex ? TextureSize(tex) : 0) + MeshSize(mesh));
 }
 
 void CsphereTile::Render()
@@ -86,6 +88,7 @@ void TileManager2Base::ProcessNode(QuadTreeNode<CsphereTile> *node)
 
 	Tile *tile = node->Entry();
 	tile->SetState(Tile::ForRender);
+	tile->tlast = td.SysT0;
 	int lvl = tile->lvl;
 	int ilng = tile->ilng;
 	int ilat = tile->ilat;
@@ -99,14 +102,16 @@ void TileManager2Base::ProcessNode(QuadTreeNode<CsphereTile> *node)
 		if (lvl == 0)
 			bstepdown = false;
 		else {
-			node->DelChildren();
+			ReleaseChildren(node);
 			tile->SetState(Tile::Invisible);
 			return;
 		}
 	}
 
+	double prio = 0.0;
 	if (bstepdown) {
 		bstepdown = (lvl < tgtres);
+		prio = tgtres - lvl; // load priority of the subtiles
 	}
 
 	if (bstepdown) {
@@ -115,15 +120,16 @@ void TileManager2Base::ProcessNode(QuadTreeNode<CsphereTile> *node)
 		for (idx = 0; idx < 4; idx++) {
 			QuadTreeNode<CsphereTile> *child = node->Child(idx);
 			if (!child)
-				child = LoadChildNode(node, idx);
-			else if (child->Entry()->state == Tile::Invalid) {
+				child = LoadChildNode(node, idx, prio);
+			else if (child->Entry()->state == Tile::Invalid || child->Entry()->state == Tile::InQueue) {
 				if (bTileLoadThread)
-					loader->LoadTileAsync(child->Entry());
+					loader->LoadTileAsync(child->Entry(), prio); // queue, or renew the request
 				else {
 					child->Entry()->Load();
 					child->Entry()->state = Tile::Inactive;
 				}
 			}
+			child->Entry()->tlast = td.SysT0; // requested subtiles are in use
 			Tile::TileState state = child->Entry()->state;
 			if (!(state & TILE_VALID))
 				subcomplete = false;
@@ -134,10 +140,11 @@ void TileManager2Base::ProcessNode(QuadTreeNode<CsphereTile> *node)
 				ProcessNode(node->Child(i));
 			return;
 		}
+		nshort++;
 	}
 
 	if (!bstepdown)
-		node->DelChildren();
+		ReleaseChildren(node);
 }
 
 // ============================================================================
@@ -151,6 +158,7 @@ TileManager2<CsphereTile>::TileManager2(const char *name, int _maxres, int _grid
 
 	// Initialise the compressed packed tile archives
 	ntreeMgr = 0;
+	prefetch = NULL;
 	LoadZTrees();
 
 	// Load the low-res full-sphere tiles
@@ -199,6 +207,7 @@ void CsphereManager::Render(LPDIRECT3DDEVICE7 dev, MATRIX4 &dwmat, VPlanet *vbod
 
 	for (i = 0; i < 2; i++)
 		ProcessNode(tiletree + i);
+	UpdateConvergence();
 
 	for (i = 0; i < 2; i++)
 		RenderNode(tiletree + i);
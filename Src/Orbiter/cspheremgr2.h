@@ -17,6 +17,9 @@ public:
 	CsphereTile(TileManager2Base *_mgr, int _lvl, int _ilat, int _ilng);
 	~CsphereTile();
 
+	static const char *LayerName () { return "Csphere"; }
+	// layer name for log output
+
 	inline void SetNode(CsphereNode *_node) { node = _node; }
 
 protected:
@@ -5,6 +5,9 @@
 #include "Celbody.h"
 #include "Planet.h"
 #include "Orbiter.h"
+#include "Log.h"
+#include "Memstat.h"
+#include <emmintrin.h>
 
 static int elev_grid = 256;
 static int elev_stride = elev_grid+3;
@@ -31,6 +34,206 @@ struct ELEVFILEHEADER { // file header for patch elevation data file
 
 #pragma pack(pop)
 
+static const double retire_grace = 2.0; // delay before evicted tiles are freed [s]
+static const double trim_idle = 10.0;   // min. time since last query for eviction under memory pressure [s]
+static const int fallback_depth = 3;    // ancestor levels requested along with a pending tile
+static double qpc_us = 0.0;             // performance counter ticks -> us
+
+// =======================================================================
+// ElevTileData
+
+ElevTileData::~ElevTileData ()
+{
+	if (data) {
+		MemStat::TileAlloc (MEMSTAT_ELEV, -(LONG64)(elev_stride*elev_stride*sizeof(INT16)));
+		delete []data;
+	}
+}
+
+void ElevTileData::Release (ElevTileData *t)
+{
+	if (!InterlockedDecrement (&t->refcount) && t->orphaned)
+		delete t;
+}
+
+// =======================================================================
+// ElevationTile
+
+ElevationTile &ElevationTile::operator= (ElevationTile &&t)
+{
+	if (this != &t) {
+		if (ref) ElevTileData::Release (ref);
+		data = t.data;
+		ref = t.ref;
+		pending = t.pending;
+		lvl = t.lvl, tgtlvl = t.tgtlvl;
+		latmin = t.latmin, latmax = t.latmax;
+		lngmin = t.lngmin, lngmax = t.lngmax;
+		emin = t.emin, emax = t.emax;
+		last_access = t.last_access;
+		lat0 = t.lat0, lng0 = t.lng0;
+		celldiag = t.celldiag;
+		nmlidx = t.nmlidx;
+		normal = t.normal;
+		t.data = 0; // t no longer holds the reference
+		t.ref = 0;
+		t.pending = false;
+	}
+	return *this;
+}
+
+// =======================================================================
+// ElevTileCache
+
+static inline int ShardIdx (int lvl, int ilat, int ilng)
+{
+	DWORD h = (DWORD)lvl*0x9E3779B1u ^ (DWORD)ilat*0x85EBCA6Bu ^ (DWORD)ilng*0xC2B2AE35u;
+	return (int)((h ^ (h >> 16)) % ElevTileCache::NSHARD);
+}
+
+ElevTileCache::ElevTileCache ()
+{
+	for (int i = 0; i < NSHARD; i++) {
+		InitializeCriticalSection (&shard[i].cs);
+		for (int j = 0; j < NSLOT; j++)
+			shard[i].slot[j] = 0;
+	}
+	InitializeCriticalSection (&retire_cs);
+}
+
+ElevTileCache::~ElevTileCache ()
+{
+	// Tiles still referenced by ElevationTile entries are deleted
+	// with their last reference
+	ElevTileData *t;
+	for (int i = 0; i < NSHARD; i++) {
+		for (int j = 0; j < NSLOT; j++)
+			if (t = shard[i].slot[j]) {
+				t->orphaned = true;
+				ElevTileData::Release (t);
+			}
+		DeleteCriticalSection (&shard[i].cs);
+	}
+	for (size_t i = 0; i < retired.size(); i++) {
+		t = retired[i];
+		InterlockedIncrement (&t->refcount);
+		t->orphaned = true;
+		ElevTileData::Release (t);
+	}
+	DeleteCriticalSection (&retire_cs);
+}
+
+ElevTileData *ElevTileCache::Find (int lvl, int ilat, int ilng)
+{
+	Shard &s = shard[ShardIdx (lvl, ilat, ilng)];
+	for (int i = 0; i < NSLOT; i++) {
+		ElevTileData *t = s.slot[i];
+		if (t && t->lvl == lvl && t->ilat == ilat && t->ilng == ilng) {
+			InterlockedIncrement (&t->refcount);
+			t->last_access = td.SysT0;
+			return t;
+		}
+	}
+	return 0;
+}
+
+ElevTileData *ElevTileCache::Insert (int lvl, int ilat, int ilng, bool *created)
+{
+	Shard &s = shard[ShardIdx (lvl, ilat, ilng)];
+	ElevTileData *t;
+	int i, ifree = -1;
+
+	*created = false;
+	EnterCriticalSection (&s.cs);
+	for (i = 0; i < NSLOT; i++) {
+		if (!(t = s.slot[i])) {
+			if (ifree < 0) ifree = i;
+		} else if (t->lvl == lvl && t->ilat == ilat && t->ilng == ilng) { // inserted by another thread
+			InterlockedIncrement (&t->refcount);
+			t->last_access = td.SysT0;
+			LeaveCriticalSection (&s.cs);
+			return t;
+		}
+	}
+	if (ifree < 0) { // evict the least recently used tile only referenced by the cache
+		double tmin = 1e100;
+		for (i = 0; i < NSLOT; i++) {
+			t = s.slot[i];
+			if (t->refcount == 1 && t->state != ELEVTILE_PENDING && t->last_access < tmin)
+				tmin = t->last_access, ifree = i;
+		}
+		if (ifree >= 0) {
+			t = s.slot[ifree];
+			s.slot[ifree] = 0;
+			t->retire_t = td.SysT0;
+			EnterCriticalSection (&retire_cs);
+			retired.push_back (t);
+			LeaveCriticalSection (&retire_cs);
+			ElevTileData::Release (t);
+		}
+	}
+	if (ifree >= 0) {
+		t = new ElevTileData; TRACENEW
+		t->data = 0;
+		t->lvl = lvl, t->ilat = ilat, t->ilng = ilng;
+		t->state = ELEVTILE_PENDING;
+		t->claimed = 0;
+		t->refcount = 2; // cache + caller
+		t->last_access = td.SysT0;
+		t->retire_t = -1.0;
+		t->orphaned = false;
+		InterlockedExchangePointer ((PVOID volatile*)&s.slot[ifree], t); // publish
+		*created = true;
+	} else {
+		t = 0; // all tiles in use
+	}
+	LeaveCriticalSection (&s.cs);
+	return t;
+}
+
+int ElevTileCache::Trim (double tidle)
+{
+	ElevTileData *t;
+	int i, j, n = 0;
+	double tmin = td.SysT0 - tidle;
+
+	for (i = 0; i < NSHARD; i++) {
+		Shard &s = shard[i];
+		EnterCriticalSection (&s.cs);
+		for (j = 0; j < NSLOT; j++) {
+			t = s.slot[j];
+			if (t && t->refcount == 1 && t->state != ELEVTILE_PENDING && t->last_access < tmin) {
+				s.slot[j] = 0;
+				t->retire_t = td.SysT0;
+				EnterCriticalSection (&retire_cs);
+				retired.push_back (t);
+				LeaveCriticalSection (&retire_cs);
+				ElevTileData::Release (t);
+				n++;
+			}
+		}
+		LeaveCriticalSection (&s.cs);
+	}
+	return n;
+}
+
+void ElevTileCache::Collect ()
+{
+	EnterCriticalSection (&retire_cs);
+	for (size_t i = 0; i < retired.size();) {
+		ElevTileData *t = retired[i];
+		if (!t->refcount && td.SysT0 - t->retire_t > retire_grace) {
+			delete t;
+			retired[i] = retired.back();
+			retired.pop_back();
+		} else i++;
+	}
+	LeaveCriticalSection (&retire_cs);
+}
+
+// =======================================================================
+// ElevationManager
+
 ElevationManager::ElevationManager (const CelestialBody *_cbody)
 : cbody(_cbody)
 {
@@ -52,15 +255,67 @@ ElevationManager::ElevationManager (const CelestialBody *_cbody)
 		for (int i = 0; i < 2; i++)
 			treeMgr[i] = 0;
 	}
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency (&freq);
+	qpc_us = 1e6/(double)freq.QuadPart;
+	nquery = nfallback = nload = steplatency = maxlatency = 0;
+	InitializeCriticalSection (&queue_cs);
+	InitializeCriticalSection (&load_cs);
+	InitializeConditionVariable (&load_cv);
+	hLoadThread = hLoadEvent = NULL;
+	bRunLoader = false;
+	cache = new ElevTileCache; TRACENEW
+
+	// the level-0 tiles are loaded up front and never evicted
+	for (int i = 0; i < 2; i++) {
+		root[i] = 0;
+		if (mode) {
+			bool created;
+			if (root[i] = cache->Insert (0, 0, i, &created))
+				LoadTile (root[i], true);
+		}
+	}
 }
 
 ElevationManager::~ElevationManager ()
 {
-	for (int i = 0; i < 2; i++)
+	int i;
+	LogStats ();
+	if (hLoadThread) {
+		bRunLoader = false;
+		SetEvent (hLoadEvent);
+		WaitForSingleObject (hLoadThread, INFINITE);
+		CloseHandle (hLoadThread);
+		CloseHandle (hLoadEvent);
+	}
+	for (i = 0; i < (int)queue.size(); i++)
+		ElevTileData::Release (queue[i]);
+	for (i = 0; i < 2; i++)
+		if (root[i])
+			ElevTileData::Release (root[i]);
+	delete cache;
+	DeleteCriticalSection (&queue_cs);
+	DeleteCriticalSection (&load_cs);
+	for (i = 0; i < 2; i++)
 		if (treeMgr[i])
 			delete treeMgr[i];
 }
 
+void ElevationManager::EndStep () const
+{
+	// Only called from the main thread, so maxlatency needs no interlocked update
+	LONG us = InterlockedExchange (&steplatency, 0);
+	if (us > maxlatency) maxlatency = us;
+}
+
+void ElevationManager::LogStats () const
+{
+	if (nquery)
+		LOGOUT("ElevationManager %s: %d queries, %d coarse stand-ins, %d tiles loaded, worst-case query time per time step %0.3f ms",
+			cbody->Name(), nquery, nfallback, nload, maxlatency*1e-3);
+}
+
 bool ElevationManager::TileIdx (double lat, double lng, int lvl, int *ilat, int *ilng) const
 {
 	int nlat = 1 << lvl;
@@ -254,6 +509,121 @@ bool ElevationManager::LoadElevationTile_mod (int lvl, int ilat, int ilng, doubl
 	return false;
 }
 
+ElevTileData *ElevationManager::AcquireTile (double lat, double lng, int reqlvl, bool wait, bool *complete) const
+{
+	ElevTileData *t;
+	int lvl, ilat, ilng, plvl = -1;
+	bool created;
+
+	*complete = true;
+	for (lvl = reqlvl; lvl >= 0; lvl--) {
+		TileIdx (lat, lng, lvl, &ilat, &ilng);
+		if (!(t = cache->Find (lvl, ilat, ilng))) {
+			// Below a pending tile, the ancestors down to fallback_depth levels
+			// are requested as well, so that a close stand-in becomes available
+			// quickly. Further down, only loaded tiles are used.
+			if (!*complete && lvl < plvl-fallback_depth) continue;
+			if (!(t = cache->Insert (lvl, ilat, ilng, &created))) { // no free slot - try again later
+				if (*complete) plvl = lvl, *complete = false;
+				continue;
+			}
+			if (created) {
+				if (wait && *complete) LoadTile (t, true);
+				else QueueLoad (t);
+			}
+		}
+		if (t->state == ELEVTILE_PENDING && wait && *complete)
+			LoadTile (t, true);
+		if (t->state == ELEVTILE_READY)
+			return t;
+		if (t->state == ELEVTILE_PENDING && *complete)
+			plvl = lvl, *complete = false;
+		ElevTileData::Release (t); // pending, or no data at this level
+	}
+	return 0;
+}
+
+void ElevationManager::LoadTile (ElevTileData *t, bool wait) const
+{
+	if (!InterlockedExchange (&t->claimed, 1)) {
+		INT16 *data = LoadElevationTile (t->lvl+4, t->ilat, t->ilng, elev_res);
+		if (data)
+			LoadElevationTile_mod (t->lvl+4, t->ilat, t->ilng, elev_res, data); // load modifications
+		t->data = data;
+		if (data)
+			MemStat::TileAlloc (MEMSTAT_ELEV, elev_stride*elev_stride*sizeof(INT16));
+		EnterCriticalSection (&load_cs);
+		InterlockedExchange (&t->state, data ? ELEVTILE_READY : ELEVTILE_EMPTY);
+		LeaveCriticalSection (&load_cs);
+		WakeAllConditionVariable (&load_cv);
+		InterlockedIncrement (&nload);
+	} else if (wait) {
+		EnterCriticalSection (&load_cs);
+		while (t->state == ELEVTILE_PENDING)
+			SleepConditionVariableCS (&load_cv, &load_cs, INFINITE);
+		LeaveCriticalSection (&load_cs);
+	}
+}
+
+void ElevationManager::QueueLoad (ElevTileData *t) const
+{
+	InterlockedIncrement (&t->refcount); // reference held by the queue
+	EnterCriticalSection (&queue_cs);
+	if (!hLoadThread) {
+		DWORD id;
+		bRunLoader = true;
+		hLoadEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+		hLoadThread = CreateThread (NULL, 32768, Load_ThreadProc, (void*)this, 0, &id);
+	}
+	queue.push_back (t);
+	LeaveCriticalSection (&queue_cs);
+	SetEvent (hLoadEvent);
+}
+
+DWORD WINAPI ElevationManager::Load_ThreadProc (void *data)
+{
+	const ElevationManager *emgr = (const ElevationManager*)data;
+	std::vector<ElevTileData*> job;
+	int i;
+
+	while (emgr->bRunLoader) {
+		WaitForSingleObject (emgr->hLoadEvent, 1000);
+		EnterCriticalSection (&emgr->queue_cs);
+		job.swap (emgr->queue);
+		LeaveCriticalSection (&emgr->queue_cs);
+		for (i = (int)job.size()-1; i >= 0; i--) { // most recent requests first
+			if (emgr->bRunLoader)
+				emgr->LoadTile (job[i], false);
+			ElevTileData::Release (job[i]);
+		}
+		job.clear();
+		if (MemStat::TileBudgetExceeded())
+			emgr->cache->Trim (trim_idle);
+		emgr->cache->Collect ();
+	}
+	return 0;
+}
+
+static void AssignTile (ElevationTile *t, ElevTileData *data, int tgtlvl, bool pending)
+{
+	t->Clear();
+	if (data) {
+		int nlat = 1 << data->lvl;
+		int nlng = 2 << data->lvl;
+		t->ref = data;
+		t->data = data->data;
+		t->lvl = data->lvl;
+		t->tgtlvl = tgtlvl;
+		t->pending = pending;
+		t->latmin = (0.5-(double)(data->ilat+1)/double(nlat))*Pi;
+		t->latmax = (0.5-(double)data->ilat/double(nlat))*Pi;
+		t->lngmin = (double)data->ilng/(double)nlng*Pi2 - Pi;
+		t->lngmax = (double)(data->ilng+1)/(double)nlng*Pi2 - Pi;
+		// still need to store emin and emax
+	}
+	t->lat0 = t->lng0 = t->nmlidx = -1;
+}
+
 double ElevationManager::Elevation (double lat, double lng, int reqlvl, std::vector<ElevationTile> *tilecache, Vector *normal, int *reslvl) const
 {
 	double e = 0.0;
@@ -261,8 +631,10 @@ double ElevationManager::Elevation (double lat, double lng, int reqlvl, std::vec
 	reqlvl = (reqlvl ? min (max(0,reqlvl-7), maxlvl) : maxlvl);
 
 	if (mode) {
-		static ElevationTile local_tile;
+		LARGE_INTEGER c0, c1;
+		QueryPerformanceCounter (&c0);
 
+		ElevationTile local_tile;
 		ElevationTile *tile;
 		int ntile = 0;
 		if (tilecache) {
@@ -275,146 +647,286 @@ double ElevationManager::Elevation (double lat, double lng, int reqlvl, std::vec
 			ntile = 1;
 		}
 
-		int i, lvl, ilat, ilng;
-		ElevationTile *t = 0;
+		bool sync = !g_pOrbiter->SessionActive(); // scenario setup: no need for stand-ins
+		ElevationTile *t = GetTile (lat, lng, reqlvl, tile, ntile, sync);
+		if (t->pending)
+			InterlockedIncrement (&nfallback);
+
+		if (t->data) {
+			int lat0, lng0;
+			e = TileElevation (t, lat, lng, normal, &lat0, &lng0);
+			t->last_access = td.SysT0;
+			t->lat0 = lat0;
+			t->lng0 = lng0;
+			if (reslvl) *reslvl = t->lvl+7;
+		}
 
-		for (i = 0; i < ntile; i++) {
-			if (tile[i].data &&
-				reqlvl == tile[i].tgtlvl &&
+		if (!sync) { // query time accumulated over the time step
+			QueryPerformanceCounter (&c1);
+			InterlockedExchangeAdd (&steplatency, (LONG)((c1.QuadPart-c0.QuadPart)*qpc_us));
+		}
+		InterlockedIncrement (&nquery);
+	}
+	return e*elev_res;
+}
+
+ElevationTile *ElevationManager::GetTile (double lat, double lng, int reqlvl, ElevationTile *tile, int ntile, bool sync) const
+{
+	// Tiles are looked up in the caller's tile cache first, then in the
+	// shared cache. Missing tiles are loaded in the background, and the
+	// best loaded ancestor (at worst a level-0 tile) is used in the
+	// meantime, also for a cold caller cache and calls without a cache.
+	// Only with sync (during scenario setup) does a cold caller cache
+	// wait for the target tile.
+	int i;
+	bool complete, cold = true;
+	ElevationTile *t = 0;
+	ElevTileData *d;
+
+	for (i = 0; i < ntile; i++) {
+		if (tile[i].data) {
+			cold = false;
+			if (reqlvl == tile[i].tgtlvl &&
 				lat >= tile[i].latmin && lat <= tile[i].latmax &&
 				lng >= tile[i].lngmin && lng <= tile[i].lngmax) {
 					t = tile+i;
 					break;
 				}
 		}
-		if (!t) { // correct tile not in list - need to load from file
-			t = tile;  // find oldest tile
-			for (i = 1; i < ntile; i++) 
-				if (tile[i].last_access < t->last_access)
-					t = tile+i;
-
-			if (t->data) {
-				delete []t->data;
-				t->data = 0;
-			}
-			for (lvl = reqlvl; lvl >= 0; lvl--) {
-				TileIdx (lat, lng, lvl, &ilat, &ilng);
-				t->data = LoadElevationTile (lvl+4, ilat, ilng, elev_res);
-				if (t->data) {
-					LoadElevationTile_mod (lvl+4, ilat, ilng, elev_res, t->data); // load modifications
-					int nlat = 1 << lvl;
-					int nlng = 2 << lvl;
-					t->lvl = lvl;
-					t->tgtlvl = reqlvl;
-					t->latmin = (0.5-(double)(ilat+1)/double(nlat))*Pi;
-					t->latmax = (0.5-(double)ilat/double(nlat))*Pi;
-					t->lngmin = (double)ilng/(double)nlng*Pi2 - Pi;
-					t->lngmax = (double)(ilng+1)/(double)nlng*Pi2 - Pi;
-					// still need to store emin and emax
-					break;
-				}
+	}
+	if (t && t->pending) { // stand-in tile: check if a better one has been loaded
+		if (d = AcquireTile (lat, lng, reqlvl, false, &complete)) {
+			if (d->lvl > t->lvl) AssignTile (t, d, reqlvl, !complete);
+			else {
+				t->pending = !complete;
+				ElevTileData::Release (d);
 			}
-			t->lat0 = t->lng0 = t->nmlidx = -1;
 		}
+	}
+	if (!t) { // correct tile not in list - get it from the shared cache
+		t = tile;  // find oldest tile
+		for (i = 1; i < ntile; i++) 
+			if (tile[i].last_access < t->last_access)
+				t = tile+i;
+		d = AcquireTile (lat, lng, reqlvl, cold && sync, &complete);
+		AssignTile (t, d, reqlvl, !complete);
+	}
+	return t;
+}
 
-		if (t->data) {
-			INT16 *elev_base = t->data+elev_stride+1; // strip padding
-			double latidx = (lat-t->latmin) * elev_grid/(t->latmax-t->latmin);
-			double lngidx = (lng-t->lngmin) * elev_grid/(t->lngmax-t->lngmin);
-			int lat0 = (int)latidx;
-			int lng0 = (int)lngidx;
-			INT16 *eptr = elev_base + lat0*elev_stride + lng0;
-			if (mode == 1) { // linear interpolation
-				bool tri;
-				double w_lat = latidx-lat0;
-				double w_lng = lngidx-lng0;
+double ElevationManager::TileElevation (const ElevationTile *t, double lat, double lng, Vector *normal, int *plat0, int *plng0) const
+{
+	INT16 *elev_base = t->data+elev_stride+1; // strip padding
+	double e, latidx = (lat-t->latmin) * elev_grid/(t->latmax-t->latmin);
+	double lngidx = (lng-t->lngmin) * elev_grid/(t->lngmax-t->lngmin);
+	int lat0 = (int)latidx;
+	int lng0 = (int)lngidx;
+	INT16 *eptr = elev_base + lat0*elev_stride + lng0;
+	if (mode == 1) { // linear interpolation
+		double w_lat = latidx-lat0;
+		double w_lng = lngidx-lng0;
 
-				double e01 = eptr[0]*(1.0-w_lng) + eptr[1]*w_lng;
-				double e02 = eptr[elev_stride]*(1.0-w_lng) + eptr[elev_stride+1]*w_lng;
-				e = e01*(1.0-w_lat) + e02*w_lat;
-
-				if (normal) {
-					double dlat = (t->latmax-t->latmin)/elev_grid;
-					double dlng = (t->lngmax-t->lngmin)/elev_grid;
-					double dz = dlat * cbody->Size();
-					double dx = dlng * cbody->Size() * cos(lat);
-					double nx01 = eptr[1]-eptr[0];
-					double nx02 = eptr[elev_stride+1]-eptr[elev_stride];
-					double nx = w_lat*nx02 + (1.0-w_lat)*nx01;
-					Vector vnx(dx,nx,0);
-					double nz01 = eptr[elev_stride]-eptr[0];
-					double nz02 = eptr[elev_stride+1]-eptr[1];
-					double nz = w_lng*nz02 + (1.0-w_lng)*nz01;
-					Vector vnz(0,nz,dz);
-					*normal = crossp(vnz,vnx).unit();
-				}
-			} else { // cubic spline interpolation
-				double a_m1, a_0, a_p1, a_p2, b_m1, b_0, b_p1, b_p2;
-				double tlat = latidx-lat0;
-				double tlng = lngidx-lng0;
-				a_m1 = eptr[-elev_stride-1];
-				a_0  = eptr[-elev_stride];
-				a_p1 = eptr[-elev_stride+1];
-				a_p2 = eptr[-elev_stride+2];
-				b_m1 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
-					tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
-					tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
-				a_m1 = eptr[-1];
-				a_0  = eptr[0];
-				a_p1 = eptr[1];
-				a_p2 = eptr[2];
-				b_0 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
-					tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
-					tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
-				a_m1 = eptr[elev_stride-1];
-				a_0  = eptr[elev_stride];
-				a_p1 = eptr[elev_stride+1];
-				a_p2 = eptr[elev_stride+2];
-				b_p1 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
-					tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
-					tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
-				a_m1 = eptr[2*elev_stride-1];
-				a_0  = eptr[2*elev_stride];
-				a_p1 = eptr[2*elev_stride+1];
-				a_p2 = eptr[2*elev_stride+2];
-				b_p2 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
-					tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
-					tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
-				e =	0.5 * (2.0*b_0 + tlat*(-b_m1+b_p1) +
-					tlat*tlat*(2.0*b_m1-5.0*b_0+4.0*b_p1-b_p2) +
-					tlat*tlat*tlat*(-b_m1+3.0*b_0-3.0*b_p1+b_p2));
-				if (normal) {
-					double dlat = (t->latmax-t->latmin)/elev_grid;
-					double dlng = (t->lngmax-t->lngmin)/elev_grid;
-					double dz = dlat * cbody->Size();
-					double dx = dlng * cbody->Size() * cos(lat);
-					double dex00 = 0.5*(eptr[1]-eptr[-1]);
-					double dex01 = 0.5*(eptr[2]-eptr[0]);
-					double dex10 = 0.5*(eptr[elev_stride+1]-eptr[elev_stride-1]);
-					double dex11 = 0.5*(eptr[elev_stride+2]-eptr[elev_stride]);
-					double dez00 = 0.5*(eptr[elev_stride]-eptr[-elev_stride]);
-					double dez01 = 0.5*(eptr[elev_stride*2]-eptr[0]);
-					double dez10 = 0.5*(eptr[elev_stride+1]-eptr[-elev_stride+1]);
-					double dez11 = 0.5*(eptr[elev_stride*2+1]-eptr[1]);
-					double w1_lat = latidx - lat0;
-					double w0_lat = 1.0-w1_lat;
-					double w1_lng = lngidx - lng0;
-					double w0_lng = 1.0-w1_lng;
-					double dex = (dex00+dex10)*0.5*w0_lng + (dex01+dex11)*0.5*w1_lng;
-					double dez = (dez00+dez10)*0.5*w0_lat + (dez01+dez11)*0.5*w1_lat;
-					normal->x = -dex;
-					normal->z = -dez;
-					normal->y = 0.5*(dx+dz);
-					normal->unify();
-				}
-			}
-			t->last_access = td.SysT0;
-			t->lat0 = lat0;
-			t->lng0 = lng0;
-			if (reslvl) *reslvl = t->lvl+7;
+		double e01 = eptr[0]*(1.0-w_lng) + eptr[1]*w_lng;
+		double e02 = eptr[elev_stride]*(1.0-w_lng) + eptr[elev_stride+1]*w_lng;
+		e = e01*(1.0-w_lat) + e02*w_lat;
+
+		if (normal) {
+			double dlat = (t->latmax-t->latmin)/elev_grid;
+			double dlng = (t->lngmax-t->lngmin)/elev_grid;
+			double dz = dlat * cbody->Size();
+			double dx = dlng * cbody->Size() * cos(lat);
+			double nx01 = eptr[1]-eptr[0];
+			double nx02 = eptr[elev_stride+1]-eptr[elev_stride];
+			double nx = w_lat*nx02 + (1.0-w_lat)*nx01;
+			Vector vnx(dx,nx,0);
+			double nz01 = eptr[elev_stride]-eptr[0];
+			double nz02 = eptr[elev_stride+1]-eptr[1];
+			double nz = w_lng*nz02 + (1.0-w_lng)*nz01;
+			Vector vnz(0,nz,dz);
+			*normal = crossp(vnz,vnx).unit();
+		}
+	} else { // cubic spline interpolation
+		double a_m1, a_0, a_p1, a_p2, b_m1, b_0, b_p1, b_p2;
+		double tlat = latidx-lat0;
+		double tlng = lngidx-lng0;
+		a_m1 = eptr[-elev_stride-1];
+		a_0  = eptr[-elev_stride];
+		a_p1 = eptr[-elev_stride+1];
+		a_p2 = eptr[-elev_stride+2];
+		b_m1 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
+			tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
+			tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
+		a_m1 = eptr[-1];
+		a_0  = eptr[0];
+		a_p1 = eptr[1];
+		a_p2 = eptr[2];
+		b_0 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
+			tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
+			tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
+		a_m1 = eptr[elev_stride-1];
+		a_0  = eptr[elev_stride];
+		a_p1 = eptr[elev_stride+1];
+		a_p2 = eptr[elev_stride+2];
+		b_p1 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
+			tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
+			tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
+		a_m1 = eptr[2*elev_stride-1];
+		a_0  = eptr[2*elev_stride];
+		a_p1 = eptr[2*elev_stride+1];
+		a_p2 = eptr[2*elev_stride+2];
+		b_p2 = 0.5 * (2.0*a_0 + tlng*(-a_m1+a_p1) +
+			tlng*tlng*(2.0*a_m1-5.0*a_0+4.0*a_p1-a_p2) +
+			tlng*tlng*tlng*(-a_m1+3.0*a_0-3.0*a_p1+a_p2));
+		e =	0.5 * (2.0*b_0 + tlat*(-b_m1+b_p1) +
+			tlat*tlat*(2.0*b_m1-5.0*b_0+4.0*b_p1-b_p2) +
+			tlat*tlat*tlat*(-b_m1+3.0*b_0-3.0*b_p1+b_p2));
+		if (normal) {
+			double dlat = (t->latmax-t->latmin)/elev_grid;
+			double dlng = (t->lngmax-t->lngmin)/elev_grid;
+			double dz = dlat * cbody->Size();
+			double dx = dlng * cbody->Size() * cos(lat);
+			double dex00 = 0.5*(eptr[1]-eptr[-1]);
+			double dex01 = 0.5*(eptr[2]-eptr[0]);
+			double dex10 = 0.5*(eptr[elev_stride+1]-eptr[elev_stride-1]);
+			double dex11 = 0.5*(eptr[elev_stride+2]-eptr[elev_stride]);
+			double dez00 = 0.5*(eptr[elev_stride]-eptr[-elev_stride]);
+			double dez01 = 0.5*(eptr[elev_stride*2]-eptr[0]);
+			double dez10 = 0.5*(eptr[elev_stride+1]-eptr[-elev_stride+1]);
+			double dez11 = 0.5*(eptr[elev_stride*2+1]-eptr[1]);
+			double w1_lat = latidx - lat0;
+			double w0_lat = 1.0-w1_lat;
+			double w1_lng = lngidx - lng0;
+			double w0_lng = 1.0-w1_lng;
+			double dex = (dex00+dex10)*0.5*w0_lng + (dex01+dex11)*0.5*w1_lng;
+			double dez = (dez00+dez10)*0.5*w0_lat + (dez01+dez11)*0.5*w1_lat;
+			normal->x = -dex;
+			normal->z = -dez;
+			normal->y = 0.5*(dx+dz);
+			normal->unify();
 		}
 	}
-	return e*elev_res;
+	*plat0 = lat0;
+	*plng0 = lng0;
+	return e;
+}
+
+// SSE2 helpers for TileElevationBatch. The operations follow the scalar
+// code in TileElevation, so that both give identical results.
+
+static inline __m128d Gather (const INT16 *const *eptr, int ofs)
+{
+	return _mm_set_pd ((double)eptr[1][ofs], (double)eptr[0][ofs]);
+}
+
+static inline __m128d Cubic (__m128d t, __m128d a_m1, __m128d a_0, __m128d a_p1, __m128d a_p2)
+{
+	// 0.5 * (2 a_0 + t (-a_m1+a_p1) + t^2 (2 a_m1-5 a_0+4 a_p1-a_p2) + t^3 (-a_m1+3 a_0-3 a_p1+a_p2))
+	const __m128d c2 = _mm_set1_pd (2.0), c3 = _mm_set1_pd (3.0), c4 = _mm_set1_pd (4.0), c5 = _mm_set1_pd (5.0);
+	__m128d n_m1 = _mm_xor_pd (a_m1, _mm_set1_pd (-0.0));
+	__m128d t2 = _mm_mul_pd (t, t);
+	__m128d t3 = _mm_mul_pd (t2, t);
+	__m128d p = _mm_add_pd (_mm_mul_pd (c2, a_0), _mm_mul_pd (t, _mm_add_pd (n_m1, a_p1)));
+	p = _mm_add_pd (p, _mm_mul_pd (t2, _mm_sub_pd (_mm_add_pd (_mm_sub_pd (_mm_mul_pd (c2, a_m1), _mm_mul_pd (c5, a_0)), _mm_mul_pd (c4, a_p1)), a_p2)));
+	p = _mm_add_pd (p, _mm_mul_pd (t3, _mm_add_pd (_mm_sub_pd (_mm_add_pd (n_m1, _mm_mul_pd (c3, a_0)), _mm_mul_pd (c3, a_p1)), a_p2)));
+	return _mm_mul_pd (_mm_set1_pd (0.5), p);
+}
+
+void ElevationManager::TileElevationBatch (const ElevationTile *t, int n, const double *lat, const double *lng, double *elev) const
+{
+	const INT16 *elev_base = t->data+elev_stride+1; // strip padding
+	const INT16 *eptr[2];
+	double w_lat[2], w_lng[2];
+	int i, k, lat0, lng0;
+
+	// two points per iteration: grid lookup in scalar code, interpolation in SSE2
+	for (i = 0; i+2 <= n; i += 2) {
+		for (k = 0; k < 2; k++) {
+			double latidx = (lat[i+k]-t->latmin) * elev_grid/(t->latmax-t->latmin);
+			double lngidx = (lng[i+k]-t->lngmin) * elev_grid/(t->lngmax-t->lngmin);
+			lat0 = (int)latidx;
+			lng0 = (int)lngidx;
+			eptr[k] = elev_base + lat0*elev_stride + lng0;
+			w_lat[k] = latidx-lat0;
+			w_lng[k] = lngidx-lng0;
+		}
+		__m128d wlat = _mm_loadu_pd (w_lat);
+		__m128d wlng = _mm_loadu_pd (w_lng);
+		__m128d e;
+		if (mode == 1) { // linear interpolation
+			__m128d one = _mm_set1_pd (1.0);
+			__m128d vlng = _mm_sub_pd (one, wlng);
+			__m128d e01 = _mm_add_pd (_mm_mul_pd (Gather (eptr, 0), vlng), _mm_mul_pd (Gather (eptr, 1), wlng));
+			__m128d e02 = _mm_add_pd (_mm_mul_pd (Gather (eptr, elev_stride), vlng), _mm_mul_pd (Gather (eptr, elev_stride+1), wlng));
+			e = _mm_add_pd (_mm_mul_pd (e01, _mm_sub_pd (one, wlat)), _mm_mul_pd (e02, wlat));
+		} else { // cubic spline interpolation
+			__m128d b_m1 = Cubic (wlng, Gather (eptr, -elev_stride-1), Gather (eptr, -elev_stride), Gather (eptr, -elev_stride+1), Gather (eptr, -elev_stride+2));
+			__m128d b_0  = Cubic (wlng, Gather (eptr, -1), Gather (eptr, 0), Gather (eptr, 1), Gather (eptr, 2));
+			__m128d b_p1 = Cubic (wlng, Gather (eptr, elev_stride-1), Gather (eptr, elev_stride), Gather (eptr, elev_stride+1), Gather (eptr, elev_stride+2));
+			__m128d b_p2 = Cubic (wlng, Gather (eptr, 2*elev_stride-1), Gather (eptr, 2*elev_stride), Gather (eptr, 2*elev_stride+1), Gather (eptr, 2*elev_stride+2));
+			e = Cubic (wlat, b_m1, b_0, b_p1, b_p2);
+		}
+		_mm_storeu_pd (elev+i, e);
+	}
+	for (; i < n; i++)
+		elev[i] = TileElevation (t, lat[i], lng[i], 0, &lat0, &lng0);
+}
+
+void ElevationManager::ElevationBatch (int n, const double *lat, const double *lng, int reqlvl, std::vector<ElevationTile> *tilecache, double *elev, Vector *normal) const
+{
+	int i, j, k, lat0, lng0;
+	reqlvl = (reqlvl ? min (max(0,reqlvl-7), maxlvl) : maxlvl);
+
+	if (!mode) {
+		for (i = 0; i < n; i++) elev[i] = 0.0;
+		if (normal)
+			for (i = 0; i < n; i++) normal[i].Set (0,1,0);
+		return;
+	}
+
+	LARGE_INTEGER c0, c1;
+	QueryPerformanceCounter (&c0);
+
+	ElevationTile local_tile;
+	ElevationTile *tile;
+	int ntile = 0;
+	if (tilecache) {
+		tile = tilecache->data();
+		ntile = tilecache->size();
+	}
+
+	if (!ntile) {
+		tile = &local_tile;
+		ntile = 1;
+	}
+
+	bool sync = !g_pOrbiter->SessionActive();
+	for (i = 0; i < n; i = j) {
+		ElevationTile *t = GetTile (lat[i], lng[i], reqlvl, tile, ntile, sync);
+		if (!t->data) {
+			elev[i] = 0.0;
+			if (normal) normal[i].Set (0,1,0); // flat surface
+			j = i+1;
+			continue;
+		}
+		// following points in the same tile
+		for (j = i+1; j < n && lat[j] >= t->latmin && lat[j] <= t->latmax && lng[j] >= t->lngmin && lng[j] <= t->lngmax; j++);
+		if (t->pending)
+			InterlockedExchangeAdd (&nfallback, j-i);
+		TileElevationBatch (t, j-i, lat+i, lng+i, elev+i);
+		if (normal) {
+			for (k = i; k < j; k++)
+				TileElevation (t, lat[k], lng[k], normal+k, &lat0, &lng0);
+		}
+		t->last_access = td.SysT0;
+	}
+	for (i = 0; i < n; i++)
+		elev[i] *= elev_res;
+
+	if (!sync) {
+		QueryPerformanceCounter (&c1);
+		InterlockedExchangeAdd (&steplatency, (LONG)((c1.QuadPart-c0.QuadPart)*qpc_us));
+	}
+	InterlockedExchangeAdd (&nquery, n);
 }
 
 void ElevationManager::ElevationGrid (int ilat, int ilng, int lvl, int pilat, int pilng, int plvl, INT16* pelev, INT16 *elev, double *emean) const
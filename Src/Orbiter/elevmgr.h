@@ -8,14 +8,44 @@
 #include "vecmat.h"
 #include "ZTreeMgr.h"
 #include <vector>
+#include <utility>
 
 class CelestialBody;
 
+#define ELEVTILE_PENDING 0 // tile requested, not yet loaded
+#define ELEVTILE_READY   1 // tile data available
+#define ELEVTILE_EMPTY   2 // no data for this tile
+
+// Elevation tile data, shared by the tile caches of all callers
+// through reference counting. The data are immutable once the
+// tile state is ELEVTILE_READY.
+struct ElevTileData {
+	INT16 *data;             // elevation grid, or 0 if not (yet) available
+	int lvl, ilat, ilng;     // tile index (lvl relative to the quadtree root + 4)
+	volatile LONG state;     // ELEVTILE_xxx
+	volatile LONG claimed;   // set by the thread loading the tile
+	volatile LONG refcount;  // references held by the cache, the loader and ElevationTile entries
+	double last_access;      // system time of last access [s]
+	double retire_t;         // system time of removal from the cache [s] (< 0: cached)
+	bool orphaned;           // cache has been destroyed: delete with the last reference
+	~ElevTileData();
+	static void Release (ElevTileData *t);
+};
+
+// Entry of a caller's tile cache. Holds a reference to the shared tile
+// data, so it can not be copied. It can be moved, so that the caches can
+// be kept in std::vector containers.
 struct ElevationTile {
-	ElevationTile() { data = 0; last_access = 0.0; }
-	~ElevationTile() { if (data) delete []data; }
-	void Clear() { if (data) { delete[]data; data = 0; } last_access = 0.0; }
+	ElevationTile() { data = 0; ref = 0; pending = false; last_access = 0.0; }
+	ElevationTile (const ElevationTile&) = delete;
+	ElevationTile (ElevationTile &&t) { ref = 0; *this = std::move (t); }
+	~ElevationTile() { if (ref) ElevTileData::Release (ref); }
+	ElevationTile &operator= (const ElevationTile&) = delete;
+	ElevationTile &operator= (ElevationTile &&t);
+	void Clear() { if (ref) { ElevTileData::Release (ref); ref = 0; } data = 0; pending = false; last_access = 0.0; }
 	INT16 *data;
+	ElevTileData *ref;  // shared tile data
+	bool pending;       // coarser stand-in while the tile at the target level is loading
 	int lvl, tgtlvl;
 	double latmin, latmax;
 	double lngmin, lngmax;
@@ -27,11 +57,63 @@ struct ElevationTile {
 	Vector normal;
 };
 
+// =======================================================================
+// Sharded cache of elevation tiles. Lookups scan the slots of a shard
+// without locking. Insertion and eviction (least recently used tile not
+// referenced outside the cache) lock the shard. Evicted tiles are freed
+// after a grace period, so that concurrent lookups remain valid.
+
+class ElevTileCache {
+public:
+	ElevTileCache ();
+	~ElevTileCache ();
+
+	ElevTileData *Find (int lvl, int ilat, int ilng);
+	// Returns the referenced cache entry for a tile, or 0 if not cached
+
+	ElevTileData *Insert (int lvl, int ilat, int ilng, bool *created);
+	// Returns the referenced cache entry for a tile, creating a pending
+	// entry if required. Returns 0 if the shard has no evictable slot.
+
+	void Collect ();
+	// Free evicted tiles without references after the grace period
+
+	int Trim (double tidle);
+	// Evict the tiles only referenced by the cache that haven't been
+	// accessed for tidle seconds. Returns the number of evicted tiles.
+
+	enum { NSHARD = 16, NSLOT = 16 };
+
+private:
+	struct Shard {
+		CRITICAL_SECTION cs;
+		ElevTileData * volatile slot[NSLOT];
+	} shard[NSHARD];
+	std::vector<ElevTileData*> retired;
+	CRITICAL_SECTION retire_cs;
+};
+
 class ElevationManager {
 public:
 	ElevationManager (const CelestialBody *_cbody);
 	~ElevationManager();
 	double Elevation (double lat, double lng, int reqlvl=0, std::vector<ElevationTile> *tilecache = 0, Vector *normal=0, int *lvl=0) const;
+
+	/**
+	* \brief Elevations for a list of surface points
+	* \param n number of points
+	* \param lat latitudes [rad] (n values)
+	* \param lng longitudes [rad] (n values)
+	* \param reqlvl requested resolution level (see \ref Elevation)
+	* \param tilecache caller's tile cache
+	* \param [out] elev elevations [m] (n values)
+	* \param [out] normal if != 0, receives surface normals (n values). Points
+	*   without elevation data receive the flat surface normal (0,1,0).
+	* \note Equivalent to calling \ref Elevation for each point, but consecutive
+	*   points in the same tile share the tile lookup, and are interpolated in
+	*   pairs with SSE2. Points should be ordered so that neighbours are adjacent.
+	*/
+	void ElevationBatch (int n, const double *lat, const double *lng, int reqlvl, std::vector<ElevationTile> *tilecache, double *elev, Vector *normal=0) const;
 	/**
 	* \brief Synthesize an elevation tile by interpolating from the parent
 	* \param ilat latitude index of target tile
@@ -47,11 +129,43 @@ public:
 	*/
 	void ElevationGrid (int ilat, int ilng, int lvl, int pilat, int pilng, int plvl, INT16* pelev, INT16 *elev, double *emean=0) const;
 
+	void EndStep () const;
+	// Called once per time step to update the worst-case query time per step
+
+	void LogStats () const;
+	// Write query statistics (tile misses, fallbacks, worst-case query time per step) to the log
+
 protected:
 	bool TileIdx (double lat, double lng, int lvl, int *ilat, int *ilng) const;
 	INT16 *LoadElevationTile (int lvl, int ilat, int ilng, double tgt_res) const;
 	bool ElevationManager::LoadElevationTile_mod (int lvl, int ilat, int ilng, double tgt_res, INT16 *elev) const;
 
+	ElevationTile *GetTile (double lat, double lng, int reqlvl, ElevationTile *tile, int ntile, bool sync) const;
+	// Returns the entry of the caller's tile cache for lat/lng, updated from the
+	// shared cache if required. If sync is true and no caller tile holds data,
+	// the target tile is loaded synchronously instead of using a stand-in.
+
+	double TileElevation (const ElevationTile *t, double lat, double lng, Vector *normal, int *lat0, int *lng0) const;
+	// Interpolated elevation (in units of elev_res) and optional normal at lat/lng
+	// in tile t. lat0 and lng0 receive the grid cell.
+
+	void TileElevationBatch (const ElevationTile *t, int n, const double *lat, const double *lng, double *elev) const;
+	// Interpolated elevations (in units of elev_res) of n points in tile t
+
+	ElevTileData *AcquireTile (double lat, double lng, int reqlvl, bool wait, bool *complete) const;
+	// Returns the referenced tile with the highest available resolution at or
+	// below reqlvl covering lat/lng. Missing tiles are queued for the loader. If
+	// wait is true, the tile at the target level is loaded synchronously.
+	// complete is set to false if the returned tile is a coarser stand-in for a
+	// tile that is still pending.
+
+	void LoadTile (ElevTileData *t, bool wait) const;
+	// Load tile data unless claimed by another thread. If wait is true, waits
+	// for the other thread to finish (signalled through load_cv).
+
+	void QueueLoad (ElevTileData *t) const;
+	static DWORD WINAPI Load_ThreadProc (void *data);
+
 private:
 	const CelestialBody *cbody;
 	int maxlvl;
@@ -59,6 +173,19 @@ private:
 	double elev_res;  // elevation resolution [m]
 	DWORD tilesource; // bit 1: try loading from cache, bit 2: try loading from archive
 	ZTreeMgr *treeMgr[5];
+
+	ElevTileCache *cache;
+	ElevTileData *root[2];             // level-0 tiles, kept as a last-resort fallback
+	mutable CRITICAL_SECTION queue_cs; // protects the load queue
+	mutable std::vector<ElevTileData*> queue; // tiles waiting for the loader
+	mutable HANDLE hLoadThread, hLoadEvent;
+	mutable volatile bool bRunLoader;
+	mutable CRITICAL_SECTION load_cs;  // protects tile state changes for load_cv
+	mutable CONDITION_VARIABLE load_cv; // signalled when a tile has been loaded
+
+	// statistics
+	mutable volatile LONG nquery, nfallback, nload;
+	mutable volatile LONG steplatency, maxlatency; // query time in the current step, max. over all steps [us]
 };
 
 #endif // !__ELEVMGR_H
\ No newline at end of file
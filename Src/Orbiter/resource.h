@@ -338,6 +338,7 @@
 #define IDC_EXT_TEXT                    1231
 #define IDC_EXT_LIST                    1232
 #define IDC_STAB_ENABLE                 1240
+#define IDC_STAB_SYMPLECTIC             1403
 #define IDC_EXT_OPEN                    1243
 #define IDC_EDIT10                      1244
 #define IDC_EDIT11                      1245
@@ -459,7 +460,7 @@
 #define _APS_3D_CONTROLS                     1
 #define _APS_NEXT_RESOURCE_VALUE        295
 #define _APS_NEXT_COMMAND_VALUE         40037
-#define _APS_NEXT_CONTROL_VALUE         1403
+#define _APS_NEXT_CONTROL_VALUE         1404
 #define _APS_NEXT_SYMED_VALUE           102
 #endif
 #endif
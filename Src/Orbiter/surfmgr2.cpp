@@ -20,6 +20,7 @@ extern Camera *g_camera;
 extern TextureManager2 *g_texmanager2;
 extern DWORD g_vtxcount;
 extern DWORD g_tilecount;
+extern TimeData td;
 extern DWORD VB_MemFlag; // dodgy
 extern char DBG_MSG[256];
 
@@ -47,6 +48,22 @@ struct ELEVFILEHEADER { // file header for patch elevation data file
 // =======================================================================
 // Utility functions
 
+// Elevation loads of a tile are serialised, since the loader threads can
+// request the data of the same ancestor tile at the same time. The tiles
+// share a small set of locks.
+
+static CRITICAL_SECTION *ElevLock (const SurfTile *tile)
+{
+	static struct ElevLocks {
+		CRITICAL_SECTION cs[16];
+		ElevLocks () { for (int i = 0; i < 16; i++) InitializeCriticalSection (cs+i); }
+		~ElevLocks () { for (int i = 0; i < 16; i++) DeleteCriticalSection (cs+i); }
+	} locks;
+	return locks.cs + (((size_t)tile >> 6) & 15);
+}
+
+// -----------------------------------------------------------------------
+
 static void VtxInterpolate (VERTEX_2TEX &res, const VERTEX_2TEX &a, const VERTEX_2TEX &b, double w)
 {
 	float w1 = (float)w;
@@ -93,6 +110,9 @@ void SurfTile::Load ()
 	DWORD flag = (bLoadMip ? 0:4);
 	char path[256];
 
+	if (smgr->prefetch && lvl >= 0)
+		smgr->prefetch->RegisterLoad (lvl, ilat, ilng);
+
 	// Load surface texture
 	ok = false;
 	owntex = true;
@@ -154,6 +174,8 @@ void SurfTile::Load ()
 		double bb_excess = mgr->Cbody()->BBExcess();
 		mesh = CreateMesh_quadpatch (res, res, elev, mgr->Cbody()->ElevationResolution(), 0.0, &texrange, shift_origin, &vtxshift, bb_excess);
 	}
+	SetMemSize (MEMSTAT_SURF, (owntex ? TextureSize (tex) : 0) + MeshSize (mesh));
+	SetMemSize (MEMSTAT_MASK, owntex ? TextureSize (ltex) : 0);
 
 	static const DWORD label_enable = PLN_ENABLE|PLN_LMARK;
 	if ((g_pOrbiter->Cfg()->CfgVisHelpPrm.flagPlanetarium & label_enable) == label_enable)
@@ -349,46 +371,63 @@ bool SurfTile::LoadElevationData ()
 	// in each. It also has a caching effect: Once the relevant ancestor has loaded its elevation data on request of
 	// a descendant, any siblings' requests can be served directly without further disk I/O.
 
+	// The data are built in a local buffer and published in 'elev' last,
+	// so a thread that finds 'elev' set also sees 'has_elevfile' and the
+	// data. Threads requesting the data while they are being loaded wait
+	// for the load to finish instead of loading them again.
+
 	if (elev) return true; // already present
 
-	has_elevfile = false;
 	int mode = mgr->Cprm().elevMode;
 	if (!mode) return false;
 
+	CRITICAL_SECTION *cs = ElevLock (this);
+	EnterCriticalSection (cs);
+	if (elev) { // loaded by another thread while we were waiting
+		LeaveCriticalSection (cs);
+		return true;
+	}
+
 	int ndat = TILE_ELEVSTRIDE*TILE_ELEVSTRIDE;
-	elev = ReadElevationFile (mgr->Cbody()->Name(), lvl+4, ilat, ilng, mgr->Cbody()->ElevationResolution());
-	if (elev) {
+	INT16 *e = ReadElevationFile (mgr->Cbody()->Name(), lvl+4, ilat, ilng, mgr->Cbody()->ElevationResolution());
+	if (e) {
 
 		bool elev_exaggerate = false; // for now
 		double elev_exaggerate_factor = 3.0; // for now
 		if (elev_exaggerate)
 			for (int i = 0; i < ndat; i++)
-				elev[i] = (INT16)(elev[i] * elev_exaggerate_factor);
+				e[i] = (INT16)(e[i] * elev_exaggerate_factor);
 		has_elevfile = true;
 
 	} else if (lvl > 0) {
 		// get interpolated nodal values from the elevation manager
 		const ElevationManager *emgr = mgr->Cbody()->ElevMgr();
-		if (!emgr) return false;
 		int plvl = lvl-1;;
 		int pilat = ilat >> 1;
 		int pilng = ilng >> 1;
 		INT16 *pelev = 0;
 		QuadTreeNode<SurfTile> *parent = node->Parent();
-		for (; plvl >= 0; plvl--) {
-			if (parent && parent->Entry()->has_elevfile) {
-				pelev = parent->Entry()->elev;
+		for (; emgr && plvl >= 0; plvl--) {
+			// ancestors can be loading their data on another thread, see above
+			if (parent && (pelev = parent->Entry()->elev) && parent->Entry()->has_elevfile)
 				break;
-			}
+			pelev = 0;
 			parent = parent->Parent();
 			pilat >>= 1;
 			pilng >>= 1;
 		}
-		if (!pelev) return false;
-		elev = new INT16[ndat];
-		emgr->ElevationGrid (ilat, ilng, lvl, pilat, pilng, plvl, pelev, elev);
+		if (pelev) {
+			e = new INT16[ndat];
+			emgr->ElevationGrid (ilat, ilng, lvl, pilat, pilng, plvl, pelev, e);
+		}
+	}
+	if (e) {
+		SetMemSize (MEMSTAT_ELEV, ndat*sizeof(INT16));
+		MemoryBarrier();
+		elev = e;
 	}
-	return (elev != 0);
+	LeaveCriticalSection (cs);
+	return (e != 0);
 }
 
 // -----------------------------------------------------------------------
@@ -873,12 +912,15 @@ void SurfTile::FixLatitudeBoundary (const SurfTile *nbr, bool keep_corner)
 
 void SurfTile::CreateLabels()
 {
-	if (!label) label = TileLabel::Create(this);
+	if (!label) {
+		label = TileLabel::Create(this);
+		if (label) SetMemSize (MEMSTAT_LABEL, label->MemSize());
+	}
 }
 
 void SurfTile::DeleteLabels()
 {
-	if (label) { delete label; label = 0; }
+	if (label) { delete label; label = 0; SetMemSize (MEMSTAT_LABEL, 0); }
 }
 
 // =======================================================================
@@ -952,6 +994,7 @@ void TileManager2<SurfTile>::Render (LPDIRECT3DDEVICE7 dev, MATRIX4 &dwmat, VPla
 	// update the tree
 	for (i = 0; i < 2; i++)
 		ProcessNode (tiletree+i);
+	UpdateConvergence ();
 
 	// render the tree
 	for (i = 0; i < 2; i++)
@@ -965,6 +1008,10 @@ void TileManager2<SurfTile>::Render (LPDIRECT3DDEVICE7 dev, MATRIX4 &dwmat, VPla
 
 	loader->ReleaseMutex ();
 
+	// queue the tiles expected along the camera trajectory
+	if (prefetch)
+		prefetch->Update (prm.maxlvl, ResolutionBias());
+
 	//if (reset_clipping) {
 	//	if (rprm.bFog)
 	//		dev->SetRenderState (D3DRENDERSTATE_FOGDENSITY, *((LPDWORD)(&fogfactor)));
@@ -1055,6 +1102,13 @@ void TileManager2<SurfTile>::LoadZTrees()
 		treeMgr[2] = ZTreeMgr::CreateFromFile(cbuf, ZTreeMgr::LAYER_ELEV);
 		treeMgr[3] = ZTreeMgr::CreateFromFile(cbuf, ZTreeMgr::LAYER_ELEVMOD);
 		treeMgr[4] = ZTreeMgr::CreateFromFile(cbuf, ZTreeMgr::LAYER_LABEL);
+
+		// predictive prefetch of the surface, mask and elevation layers
+		double tahead = g_pOrbiter->Cfg()->CfgPRenderPrm.PrefetchTime;
+		if (tahead > 0.0 && treeMgr[0]) {
+			ZTreeMgr *pftree[4] = { treeMgr[0], cprm.bSpecular || cprm.bLights ? treeMgr[1] : NULL, treeMgr[2], treeMgr[3] };
+			prefetch = new TilePrefetcher (cbody, pftree, 4, tahead);
+		}
 	} else {
 		for (int i = 0; i < ntreeMgr; i++)
 			treeMgr[i] = 0;
@@ -19,6 +19,9 @@ public:
 	SurfTile (TileManager2Base *_mgr, int _lvl, int _ilat, int _ilng);
 	~SurfTile ();
 
+	static const char *LayerName () { return "Surf"; }
+	// layer name for log output
+
 	inline void SetNode (QuadTreeNode<SurfTile> *_node) { node = _node; }
 	// Register the tile to a quad tree node
 
@@ -58,9 +61,9 @@ private:
 	double GetMeanElevation (const INT16 *elev) const;
 
 	LPDIRECTDRAWSURFACE7 ltex;	// landmask/nightlight texture, if applicable
-	INT16 *elev;				// elevation data [m] (8x subsampled)
+	INT16 * volatile elev;		// elevation data [m] (8x subsampled). Set once the data are complete
 	mutable INT16 *ggelev;		// pointer to my elevation data in the great-grandparent
-	bool has_elevfile;			// true if the elevation data for this tile were read from file
+	bool has_elevfile;			// true if the elevation data for this tile were read from file (valid if elev is set)
 
 	TileLabel *label;			// surface labels associated with this tile
 };
@@ -55,6 +55,14 @@ TileLabel::~TileLabel()
 	}
 }
 
+DWORD TileLabel::MemSize() const
+{
+	DWORD size = sizeof(TileLabel) + (nbuf + nrenderbuf) * sizeof(TLABEL*);
+	for (DWORD i = 0; i < nlabel; i++)
+		size += sizeof(TLABEL) + (label[i]->label ? strlen(label[i]->label)+1 : 0);
+	return size;
+}
+
 bool TileLabel::Read()
 {
 	char path[256], texpath[256];
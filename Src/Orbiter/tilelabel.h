@@ -16,6 +16,9 @@ public:
 	~TileLabel();
 	void Render(oapi::Sketchpad *skp, oapi::Font **labelfont, int *fontidx);
 
+	DWORD MemSize() const;
+	// Memory used by the label lists [bytes]
+
 	struct TLABEL {
 		TLABEL() { labeltype = 0; label = 0; }
 		~TLABEL() { if(label) delete[] label; }
@@ -9,7 +9,14 @@
 #include "Util.h"
 #include "Log.h"
 #include "OGraphics.h"
+#include "Element.h"
 #include <math.h>
+#include <algorithm>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define TILEMESH_SSE2 // vectorised patch mesh generation
+#include <emmintrin.h>
+#endif
 
 static TEXCRDRANGE2 fullrange = {0,1,0,1};
 
@@ -24,6 +31,135 @@ extern char DBG_MSG[256];
 // =======================================================================
 // =======================================================================
 
+PATCHTEMPLATE *PatchTemplateCache::tpl[MAXPATCHTEMPLATE] = {0};
+int PatchTemplateCache::ntpl = 0;
+DWORD PatchTemplateCache::tcount = 0;
+int PatchTemplateCache::nhit = 0;
+int PatchTemplateCache::nmiss = 0;
+CRITICAL_SECTION PatchTemplateCache::cs;
+
+void PatchTemplateCache::Init ()
+{
+	InitializeCriticalSection (&cs);
+	ntpl = 0;
+	tcount = 0;
+	nhit = nmiss = 0;
+}
+
+// -----------------------------------------------------------------------
+
+void PatchTemplateCache::Cleanup ()
+{
+	for (int i = 0; i < ntpl; i++)
+		Delete (tpl[i]);
+	ntpl = 0;
+	DeleteCriticalSection (&cs);
+	if (nhit+nmiss)
+		LOGOUT ("PatchTemplateCache: %d of %d patch meshes built from cached latitude band templates", nhit, nhit+nmiss);
+}
+
+// -----------------------------------------------------------------------
+
+const PATCHTEMPLATE *PatchTemplateCache::Acquire (int lvl, int ilat, int grdlat, int grdlng)
+{
+	int i, ilru = -1;
+	PATCHTEMPLATE *t = NULL;
+
+	EnterCriticalSection (&cs);
+	tcount++;
+	for (i = 0; i < ntpl; i++) {
+		if (tpl[i]->lvl == lvl && tpl[i]->ilat == ilat && tpl[i]->grdlat == grdlat && tpl[i]->grdlng == grdlng) {
+			t = tpl[i];
+			break;
+		}
+		if (!tpl[i]->nref && (ilru < 0 || tpl[i]->tlast < tpl[ilru]->tlast))
+			ilru = i;
+	}
+	if (t) {
+		nhit++;
+	} else {
+		nmiss++;
+		t = Create (lvl, ilat, grdlat, grdlng);
+		if (ntpl < MAXPATCHTEMPLATE) {
+			tpl[ntpl++] = t;
+		} else if (ilru >= 0) { // replace the least recently used template
+			Delete (tpl[ilru]);
+			tpl[ilru] = t;
+		} else {                // all cached templates are in use
+			t->nref = -1;
+		}
+	}
+	if (t->nref >= 0) {
+		t->nref++;
+		t->tlast = tcount;
+	}
+	LeaveCriticalSection (&cs);
+	return t;
+}
+
+// -----------------------------------------------------------------------
+
+void PatchTemplateCache::Release (const PATCHTEMPLATE *tpl)
+{
+	PATCHTEMPLATE *t = (PATCHTEMPLATE*)tpl;
+
+	EnterCriticalSection (&cs);
+	if (t->nref > 0) t->nref--;
+	else if (t->nref < 0) Delete (t); // not cached
+	LeaveCriticalSection (&cs);
+}
+
+// -----------------------------------------------------------------------
+
+PATCHTEMPLATE *PatchTemplateCache::Create (int lvl, int ilat, int grdlat, int grdlng)
+{
+	int i, j;
+	int nlng = (lvl >= 0 ? 2 << lvl : 1);
+	int nlat = (lvl >= 0 ? 1 << lvl : 1);
+	double lat, lng, minlng = 0;
+
+	PATCHTEMPLATE *t = new PATCHTEMPLATE;
+	t->lvl = lvl;
+	t->ilat = ilat;
+	t->grdlat = grdlat;
+	t->grdlng = grdlng;
+	t->maxlat = Pi * (0.5 - (double)ilat / (double)nlat);
+	t->minlat = t->maxlat - Pi / (double)nlat;
+	t->maxlng = Pi2/(double)nlng;
+	t->clat0 = cos(t->minlat), t->slat0 = sin(t->minlat);
+	t->clng0 = cos(minlng),    t->slng0 = sin(minlng);
+	t->clat1 = cos(t->maxlat), t->slat1 = sin(t->maxlat);
+	t->clng1 = cos(t->maxlng), t->slng1 = sin(t->maxlng);
+
+	t->clat = new double[2*(grdlat+1)];
+	t->slat = t->clat + grdlat+1;
+	for (i = 0; i <= grdlat; i++) {
+		lat = t->minlat + (t->maxlat-t->minlat) * (double)i/(double)grdlat;
+		t->slat[i] = sin(lat), t->clat[i] = cos(lat);
+	}
+	t->clng = new double[2*(grdlng+1)];
+	t->slng = t->clng + grdlng+1;
+	for (j = 0; j <= grdlng; j++) {
+		lng = minlng + (t->maxlng-minlng) * (double)j/(double)grdlng;
+		t->slng[j] = sin(lng), t->clng[j] = cos(lng);
+	}
+	t->nref = 0;
+	t->tlast = 0;
+	return t;
+}
+
+// -----------------------------------------------------------------------
+
+void PatchTemplateCache::Delete (PATCHTEMPLATE *tpl)
+{
+	delete []tpl->clat;
+	delete []tpl->clng;
+	delete tpl;
+}
+
+// =======================================================================
+// =======================================================================
+
 Tile::Tile (TileManager2Base *_mgr, int _lvl, int _ilat, int _ilng)
 : mgr(_mgr), lvl(_lvl), ilat(_ilat), ilng(_ilng)
 {
@@ -35,6 +171,9 @@ Tile::Tile (TileManager2Base *_mgr, int _lvl, int _ilat, int _ilng)
 	lngnbr_lvl = latnbr_lvl = dianbr_lvl = _lvl;
 	state = Invalid;
 	cnt = Centre();
+	tlast = 0.0;
+	for (int i = 0; i < MEMSTAT_NLAYER; i++)
+		memsize[i] = 0;
 }
 
 // -----------------------------------------------------------------------
@@ -43,6 +182,47 @@ Tile::~Tile ()
 {
 	if (mesh) delete mesh;
 	if (tex && owntex) tex->Release();
+	for (int i = 0; i < MEMSTAT_NLAYER; i++)
+		if (memsize[i]) MemStat::TileAlloc (i, -(LONG64)memsize[i]);
+}
+
+// -----------------------------------------------------------------------
+
+void Tile::SetMemSize (int layer, DWORD size)
+{
+	MemStat::TileAlloc (layer, (LONG64)size - (LONG64)memsize[layer]);
+	memsize[layer] = size;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD Tile::TextureSize (LPDIRECTDRAWSURFACE7 tex)
+{
+	if (!tex) return 0;
+	DDSURFACEDESC2 ddsd;
+	memset (&ddsd, 0, sizeof(ddsd));
+	ddsd.dwSize = sizeof(ddsd);
+	if (tex->GetSurfaceDesc (&ddsd) != DD_OK) return 0;
+	DWORD size = ddsd.dwWidth * ddsd.dwHeight;
+	if (ddsd.ddpfPixelFormat.dwFlags & DDPF_FOURCC) {
+		if (ddsd.ddpfPixelFormat.dwFourCC == MAKEFOURCC('D','X','T','1'))
+			size /= 2; // 4 bits per pixel; 8 bits for the other DXT formats
+	} else
+		size *= ddsd.ddpfPixelFormat.dwRGBBitCount/8;
+	if ((ddsd.dwFlags & DDSD_MIPMAPCOUNT) && ddsd.dwMipMapCount > 1)
+		size += size/3;
+	return size;
+}
+
+// -----------------------------------------------------------------------
+
+DWORD Tile::MeshSize (const VBMESH *mesh)
+{
+	if (!mesh) return 0;
+	DWORD size = sizeof(VBMESH) + mesh->nv*sizeof(VERTEX_2TEX) + mesh->ni*sizeof(WORD);
+	if (mesh->vtx) size += mesh->nv*sizeof(VERTEX_2TEX); // vertex copy in system memory
+	if (mesh->bbvtx) size += 8*sizeof(VECTOR4);
+	return size;
 }
 
 // -----------------------------------------------------------------------
@@ -53,7 +233,8 @@ bool Tile::PreDelete ()
 	case Loading:
 		return false;                // locked
 	case InQueue:
-		mgr->loader->Unqueue (this); // remove from load queue
+		if (!mgr->loader->Unqueue (this)) // remove from load queue
+			return state != Loading;      // picked up by a load thread in the meantime
 		// fall through
 	default:
 		return true;
@@ -156,11 +337,10 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 	int nlat = (lvl >= 0 ? 1 << lvl : 1);
 	bool north = (ilat < nlat/2);
 
-	double lat, slat, clat, lng, slng, clng, eradius, dx, dy;
-	double maxlat = Pi * (0.5 - (double)ilat / (double)nlat);
-	double minlat = maxlat - Pi / (double)nlat;
-	double minlng = 0;
-	double maxlng = Pi2/(double)nlng;
+	// the trigonometric terms of the grid are shared by the latitude band
+	const PATCHTEMPLATE *tpl = PatchTemplateCache::Acquire (lvl, ilat, grdlat, grdlng);
+
+	double slat, clat, slng, clng, eradius, dx, dy;
 	double radius = (mgr->Cbody() ? mgr->Cbody()->Size() : 1.0);
 	Vector pos, tpos, nml;
 	if (!range) range = &fullrange;
@@ -176,10 +356,10 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 	// from (minlng,minlat) corner to (maxlng,minlat) corner (origin is halfway between)
 	// y-axis points from local origin to middle between (minlng,maxlat) and (maxlng,maxlat)
 	// bounding box is created in this system and then transformed back to planet coords.
-	double clat0 = cos(minlat), slat0 = sin(minlat);
-	double clng0 = cos(minlng), slng0 = sin(minlng);
-	double clat1 = cos(maxlat), slat1 = sin(maxlat);
-	double clng1 = cos(maxlng), slng1 = sin(maxlng);
+	double clat0 = tpl->clat0, slat0 = tpl->slat0;
+	double clng0 = tpl->clng0, slng0 = tpl->slng0;
+	double clat1 = tpl->clat1, slat1 = tpl->slat1;
+	double clng1 = tpl->clng1, slng1 = tpl->slng1;
 	Vector ex(clat0*clng1 - clat0*clng0, 0, clat0*slng1 - clat0*slng0); ex.unify();
 	Vector ey(0.5*(clng0+clng1)*(clat1-clat0), slat1-slat0, 0.5*(slng0+slng1)*(clat1-clat0)); ey.unify();
 	Vector ez(crossp (ey, ex));
@@ -202,14 +382,60 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 
 	// create the vertices
 	for (i = n = 0; i <= grdlat; i++) {
-		lat = minlat + (maxlat-minlat) * (double)i/(double)grdlat;
-		slat = sin(lat), clat = cos(lat);
-		for (j = 0; j <= grdlng; j++) {
-			lng = minlng + (maxlng-minlng) * (double)j/(double)grdlng;
-			slng = sin(lng), clng = cos(lng);
+		slat = tpl->slat[i], clat = tpl->clat[i];
+		const INT16 *erow = (elev ? elev + (i+1)*TILE_ELEVSTRIDE + 1 : 0);
+		j = 0;
+#ifdef TILEMESH_SSE2
+		// two grid columns at a time
+		const __m128d vclat = _mm_set1_pd (clat), vslat = _mm_set1_pd (slat);
+		const __m128d vrad = _mm_set1_pd (radius + globelev), vscale = _mm_set1_pd (elev_scale);
+		const __m128d vdx = _mm_set1_pd (dx), vdy = _mm_set1_pd (dy);
+		const __m128d pfx = _mm_set1_pd (pref.x), pfy = _mm_set1_pd (pref.y), pfz = _mm_set1_pd (pref.z);
+		__m128d bbmin[3], bbmax[3];
+		for (; j < grdlng; j += 2, n += 2) {
+			__m128d er = vrad; // radius including node elevation
+			if (erow) er = _mm_add_pd (er, _mm_mul_pd (_mm_set_pd ((double)erow[j+1], (double)erow[j]), vscale));
+			__m128d nx = _mm_mul_pd (vclat, _mm_loadu_pd (tpl->clng+j));
+			__m128d nz = _mm_mul_pd (vclat, _mm_loadu_pd (tpl->slng+j));
+			__m128d px = _mm_mul_pd (nx, er), py = _mm_mul_pd (vslat, er), pz = _mm_mul_pd (nz, er);
+			__m128d qx = _mm_sub_pd (px, pfx), qy = _mm_sub_pd (py, pfy), qz = _mm_sub_pd (pz, pfz);
+			__m128d t[3];
+			for (int k = 0; k < 3; k++) {
+				const double *r = R.data + 3*k;
+				t[k] = _mm_add_pd (_mm_add_pd (_mm_mul_pd (_mm_set1_pd (r[0]), qx), _mm_mul_pd (_mm_set1_pd (r[1]), qy)),
+					_mm_mul_pd (_mm_set1_pd (r[2]), qz));
+				if (!j) bbmin[k] = bbmax[k] = t[k];
+				else bbmin[k] = _mm_min_pd (bbmin[k], t[k]), bbmax[k] = _mm_max_pd (bbmax[k], t[k]);
+			}
+			float fp[3][4], fn[3][4];
+			_mm_storeu_ps (fp[0], _mm_cvtpd_ps (_mm_sub_pd (px, vdx)));
+			_mm_storeu_ps (fp[1], _mm_cvtpd_ps (_mm_sub_pd (py, vdy)));
+			_mm_storeu_ps (fp[2], _mm_cvtpd_ps (pz));
+			_mm_storeu_ps (fn[0], _mm_cvtpd_ps (nx));
+			_mm_storeu_ps (fn[1], _mm_cvtpd_ps (vslat));
+			_mm_storeu_ps (fn[2], _mm_cvtpd_ps (nz));
+			for (int k = 0; k < 2; k++) {
+				vtx[n+k].x = fp[0][k]; vtx[n+k].nx = fn[0][k];
+				vtx[n+k].y = fp[1][k]; vtx[n+k].ny = fn[1][k];
+				vtx[n+k].z = fp[2][k]; vtx[n+k].nz = fn[2][k];
+			}
+		}
+		if (j) { // merge the bounding box lanes
+			for (int k = 0; k < 3; k++) {
+				double mn[2], mx[2];
+				_mm_storeu_pd (mn, bbmin[k]);
+				_mm_storeu_pd (mx, bbmax[k]);
+				if (!i) tpmin.data[k] = mn[0], tpmax.data[k] = mx[0];
+				else tpmin.data[k] = min (tpmin.data[k], mn[0]), tpmax.data[k] = max (tpmax.data[k], mx[0]);
+				tpmin.data[k] = min (tpmin.data[k], mn[1]), tpmax.data[k] = max (tpmax.data[k], mx[1]);
+			}
+		}
+#endif
+		for (; j <= grdlng; j++, n++) {
+			clng = tpl->clng[j], slng = tpl->slng[j];
 
 			eradius = radius + globelev; // radius including node elevation
-			if (elev) eradius += (double)elev[(i+1)*TILE_ELEVSTRIDE + j+1]*elev_scale;
+			if (erow) eradius += (double)erow[j]*elev_scale;
 			nml.Set (clat*clng, slat, clat*slng);
 			pos.Set (nml*eradius);
 			tpos = mul (R, pos-pref);
@@ -227,7 +453,12 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 			vtx[n].x = D3DVAL(pos.x - dx); vtx[n].nx = D3DVAL(nml.x);
 			vtx[n].y = D3DVAL(pos.y - dy); vtx[n].ny = D3DVAL(nml.y);
 			vtx[n].z = D3DVAL(pos.z);      vtx[n].nz = D3DVAL(nml.z);
+		}
+	}
 
+	// texture coordinates
+	for (i = n = 0; i <= grdlat; i++) {
+		for (j = 0; j <= grdlng; j++, n++) {
 			vtx[n].tu0 = D3DVAL((c1*j)/grdlng+c2); // overlap to avoid seams
 			vtx[n].tv0 = D3DVAL(grdlat-i)/D3DVAL(grdlat);
 			vtx[n].tu1 = vtx[n].tu0 * TEX2_MULTIPLIER;
@@ -236,7 +467,6 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 			// map texture coordinates to subrange
 			vtx[n].tu0 = vtx[n].tu0*turange + range->tumin;
 			vtx[n].tv0 = vtx[n].tv0*tvrange + range->tvmin;
-			n++;
 		}
 	}
 
@@ -300,21 +530,50 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 		dy = radius * Pi/(nlat*grdlat);  // y-distance between vertices
 		ny_x = shade_exaggerate*dy;
 		for (i = n = 0; i <= grdlat; i++) {
-			lat = minlat + (maxlat-minlat) * (double)i/(double)grdlat;
-			slat = sin(lat), clat = cos(lat);
-			dz = radius * Pi2*cos(lat) / (nlng*grdlng); // z-distance between vertices on unit sphere
+			slat = tpl->slat[i], clat = tpl->clat[i];
+			dz = radius * Pi2*clat / (nlng*grdlng); // z-distance between vertices on unit sphere
 			dydz = dy*dz;
 			nz_x = shade_exaggerate*dz;
-			for (j = 0; j <= grdlng; j++) {
-				lng = minlng + (maxlng-minlng) * (double)j/(double)grdlng;
-				slng = sin(lng), clng = cos(lng);
+			double ey_scale = dz*elev_scale, ez_scale = dy*elev_scale;
+			j = 0;
+#define QUICK_NORMALS
+#if defined(TILEMESH_SSE2) && defined(QUICK_NORMALS)
+			// two grid columns at a time
+			const __m128d vclat = _mm_set1_pd (clat), vslat = _mm_set1_pd (slat);
+			const __m128d vnx = _mm_set1_pd (2.0*dydz), vey = _mm_set1_pd (ey_scale), vez = _mm_set1_pd (ez_scale);
+			const __m128d one = _mm_set1_pd (1.0);
+			for (; j < grdlng; j += 2, n += 2) {
+				const INT16 *e0 = elev + (i+1)*TILE_ELEVSTRIDE + (j+1);
+				const INT16 *e1 = e0+1;
+				__m128d ny = _mm_mul_pd (vey, _mm_set_pd ((double)(e1[-TILE_ELEVSTRIDE]-e1[TILE_ELEVSTRIDE]), (double)(e0[-TILE_ELEVSTRIDE]-e0[TILE_ELEVSTRIDE])));
+				__m128d nz = _mm_mul_pd (vez, _mm_set_pd ((double)(e1[-1]-e1[1]), (double)(e0[-1]-e0[1])));
+				__m128d ilen = _mm_div_pd (one, _mm_sqrt_pd (_mm_add_pd (_mm_add_pd (_mm_mul_pd (vnx, vnx), _mm_mul_pd (ny, ny)), _mm_mul_pd (nz, nz))));
+				__m128d nx = _mm_mul_pd (vnx, ilen);
+				ny = _mm_mul_pd (ny, ilen);
+				nz = _mm_mul_pd (nz, ilen);
+				// rotate into place
+				__m128d rx = _mm_sub_pd (_mm_mul_pd (nx, vclat), _mm_mul_pd (ny, vslat));
+				__m128d ry = _mm_add_pd (_mm_mul_pd (nx, vslat), _mm_mul_pd (ny, vclat));
+				__m128d cl = _mm_loadu_pd (tpl->clng+j), sl = _mm_loadu_pd (tpl->slng+j);
+				float fn[3][4];
+				_mm_storeu_ps (fn[0], _mm_cvtpd_ps (_mm_sub_pd (_mm_mul_pd (rx, cl), _mm_mul_pd (nz, sl))));
+				_mm_storeu_ps (fn[1], _mm_cvtpd_ps (ry));
+				_mm_storeu_ps (fn[2], _mm_cvtpd_ps (_mm_add_pd (_mm_mul_pd (rx, sl), _mm_mul_pd (nz, cl))));
+				for (int k = 0; k < 2; k++) {
+					vtx[n+k].nx = fn[0][k];
+					vtx[n+k].ny = fn[1][k];
+					vtx[n+k].nz = fn[2][k];
+				}
+			}
+#endif
+			for (; j <= grdlng; j++, n++) {
+				clng = tpl->clng[j], slng = tpl->slng[j];
 				en = (i+1)*TILE_ELEVSTRIDE + (j+1);
 
-#define QUICK_NORMALS
 #ifdef QUICK_NORMALS
 				// This version avoids the normalisation of the 4 intermediate face normals
 				// It's faster and doesn't seem to make much difference
-				Vector nml(2.0*dydz, dz*elev_scale*(elev[en-TILE_ELEVSTRIDE]-elev[en+TILE_ELEVSTRIDE]), dy*elev_scale*(elev[en-1]-elev[en+1]));
+				Vector nml(2.0*dydz, ey_scale*(elev[en-TILE_ELEVSTRIDE]-elev[en+TILE_ELEVSTRIDE]), ez_scale*(elev[en-1]-elev[en+1]));
 				nml.unify();
 #else
 				double dy_dezp = -dy*(elev[en+1]-elev[en]);
@@ -327,6 +586,7 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 				Vector nm4(dydz, dz_deym, dy_dezm); nm4.unify();
 				Vector nml = nm1+nm2+nm3+nm4; nml.unify();
 #endif
+
 				// rotate into place
 				nx1 = nml.x*clat - nml.y*slat;
 				ny1 = nml.x*slat + nml.y*clat;
@@ -334,7 +594,6 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 				vtx[n].nx = (float)(nx1*clng - nz1*slng);
 				vtx[n].ny = (float)(ny1);
 				vtx[n].nz = (float)(nx1*slng + nz1*clng);
-				n++;
 			}
 		}
 	}
@@ -377,6 +636,8 @@ VBMESH *Tile::CreateMesh_quadpatch (int grdlat, int grdlng, INT16 *elev, double
 	mesh->bbvtx[6] = MakeVECTOR4 (tmul (R, Vector(tpmin.x, tpmax.y, tpmax.z)) + pref);
 	mesh->bbvtx[7] = MakeVECTOR4 (tmul (R, Vector(tpmax.x, tpmax.y, tpmax.z)) + pref);
 
+	PatchTemplateCache::Release (tpl);
+
 	mesh->MapVertices (TileManager2Base::D3d(), TileManager2Base::Dev(), VB_MemFlag); // TODO
 	return mesh;
 }
@@ -724,122 +985,334 @@ VBMESH *Tile::CreateMesh_hemisphere (int grd, INT16 *elev, double globelev)
 
 bool TileLoader::bRunThread = true;
 int TileLoader::nqueue = 0;
-int TileLoader::queue_in = 0;
-int TileLoader::queue_out = 0;
-HANDLE TileLoader::hLoadMutex = 0;
+int TileLoader::nload = 0;
+int TileLoader::ncancel = 0;
+CRITICAL_SECTION TileLoader::load_cs;
+CONDITION_VARIABLE TileLoader::load_cv;
 struct TileLoader::QUEUEDESC TileLoader::queue[MAXQUEUE2] = {0};
 
 TileLoader::TileLoader ()
 {
 	bRunThread = true;
-	nqueue = queue_in = queue_out = 0;
+	nqueue = nload = ncancel = 0;
+	InitializeCriticalSection (&load_cs);
+	InitializeConditionVariable (&load_cv);
+
+	// leave one processor to the render thread
+	SYSTEM_INFO si;
+	GetSystemInfo (&si);
+	nthread = max (1, min (MAXLOADTHREAD2, (int)si.dwNumberOfProcessors-1));
 	DWORD id;
-	hLoadMutex = CreateMutex (0, FALSE, NULL);
-	hLoadThread = CreateThread (NULL, 32768, Load_ThreadProc, this, 0, &id);
+	for (int i = 0; i < nthread; i++)
+		hLoadThread[i] = CreateThread (NULL, 32768, Load_ThreadProc, this, 0, &id);
+	LOGOUT ("TileLoader: %d load thread(s)", nthread);
 }
 
 // -----------------------------------------------------------------------
 
 TileLoader::~TileLoader ()
 {
+	int i;
+	EnterCriticalSection (&load_cs);
 	bRunThread = false;
-	if (WaitForSingleObject (hLoadThread, 1000) == WAIT_TIMEOUT) {
-		TerminateThread (hLoadThread, 0);
+	WakeAllConditionVariable (&load_cv);
+	LeaveCriticalSection (&load_cs);
+	if (WaitForMultipleObjects (nthread, hLoadThread, TRUE, 1000) == WAIT_TIMEOUT) {
+		for (i = 0; i < nthread; i++)
+			TerminateThread (hLoadThread[i], 0);
 		LOGOUT_WARN ("TileLoader: Wait for load thread timed out.");
 	}
-	CloseHandle (hLoadThread);
-	CloseHandle (hLoadMutex);
+	for (i = 0; i < nthread; i++)
+		CloseHandle (hLoadThread[i]);
+	DeleteCriticalSection (&load_cs);
+	LOGOUT ("TileLoader: %d tiles loaded, %d stale requests cancelled", nload, ncancel);
 }
 
 // -----------------------------------------------------------------------
 
-bool TileLoader::LoadTileAsync (Tile *tile)
+bool TileLoader::LoadTileAsync (Tile *tile, double prio)
 {
-	// Note: the queue should probably be sorted according to tile level
-
-	int i, j;
-
-	// Check if request is already present
-	for (i = 0; i < nqueue; i++) {
-		j = (i+queue_out) % MAXQUEUE2;
-		if (queue[j].tile == tile)
-			return false;
-	}
-
-	if (nqueue == MAXQUEUE2) { // queue full
-		int maxlvl, maxlvl_idx = 0;
-		for (i = 1, maxlvl = queue[0].tile->lvl; i < nqueue; i++)
-			if (queue[i].tile->lvl > maxlvl)
-				maxlvl = queue[i].tile->lvl, maxlvl_idx = i;
-		if (maxlvl > tile->lvl) { // replace the highest level queued tile (load from lowest to highest)
-			queue[maxlvl_idx].tile->state = Tile::Invalid;
-			queue[maxlvl_idx].tile = tile;
+	int i, minprio_idx;
+	bool queued = false;
+
+	EnterCriticalSection (&load_cs);
+
+	// The caller tests the tile state without the lock, so a load thread may
+	// have taken the tile off the queue since. Only renew requests that are
+	// still queued, only queue tiles that are neither queued nor loaded, and
+	// leave tiles that are being loaded alone.
+	if (tile->state == Tile::InQueue) { // renew the request
+		for (i = 0; i < nqueue; i++)
+			if (queue[i].tile == tile) {
+				queue[i].prio = prio;
+				queue[i].t = td.SysT0;
+				break;
+			}
+	} else if (tile->state == Tile::Invalid) {
+		if (nqueue == MAXQUEUE2) { // queue full
+			for (i = 1, minprio_idx = 0; i < nqueue; i++)
+				if (queue[i].prio < queue[minprio_idx].prio)
+					minprio_idx = i;
+			if (queue[minprio_idx].prio < prio) { // replace the lowest priority request
+				queue[minprio_idx].tile->state = Tile::Invalid;
+				queue[minprio_idx] = queue[--nqueue];
+			}
+		}
+		if (nqueue < MAXQUEUE2) { // add tile to load queue
+			QUEUEDESC *qd = queue+nqueue;
+			qd->tile = tile;
+			qd->prio = prio;
+			qd->t = td.SysT0;
 			tile->state = Tile::InQueue;
+			nqueue++;
+			WakeConditionVariable (&load_cv);
+			queued = true;
 		} else {
 			tile->state = Tile::Invalid;
 		}
-		return false;
 	}
 
-	// add tile to load queue
-	QUEUEDESC *qd = queue+queue_in;
-	qd->tile = tile;
-	tile->state = Tile::InQueue;
-	nqueue++;
-	queue_in = (queue_in+1) % MAXQUEUE2;
-	return true;
+	LeaveCriticalSection (&load_cs);
+	return queued;
 }
 
 // -----------------------------------------------------------------------
 
 bool TileLoader::Unqueue (Tile *tile)
 {
-	if (tile->state != Tile::InQueue) return false;
+	bool found = false;
+
+	EnterCriticalSection (&load_cs);
+	if (tile->state == Tile::InQueue) {
+		for (int i = 0; i < nqueue; i++) {
+			if (queue[i].tile == tile) {
+				queue[i] = queue[--nqueue];
+				found = true;
+				break;
+			}
+		}
+	}
+	LeaveCriticalSection (&load_cs);
+	return found;
+}
+
+// -----------------------------------------------------------------------
+
+Tile *TileLoader::NextRequest ()
+{
+	const double tstale = 1.0; // requests not renewed within this time [s] are discarded
+	int i, maxprio_idx = -1;
 
-	int i, j;
 	for (i = 0; i < nqueue; i++) {
-		j = (queue_out+i) % MAXQUEUE2;
-		if (queue[j].tile == tile) {
-			if (i) queue[j].tile = queue[queue_out].tile;
-			queue_out = (queue_out+1) % MAXQUEUE2;
-			nqueue--;
-			return true;
+		if (td.SysT0 - queue[i].t > tstale) {
+			queue[i].tile->state = Tile::Invalid; // requested again if it comes back into view
+			queue[i--] = queue[--nqueue];
+			ncancel++;
+		} else if (maxprio_idx < 0 || queue[i].prio > queue[maxprio_idx].prio) {
+			maxprio_idx = i;
 		}
 	}
-	return false;
+	if (maxprio_idx < 0) return NULL;
+
+	Tile *tile = queue[maxprio_idx].tile;
+	queue[maxprio_idx] = queue[--nqueue];
+	return tile;
 }
 
 // -----------------------------------------------------------------------
 
 DWORD WINAPI TileLoader::Load_ThreadProc (void *data)
 {
-	const int tile_packet_size = 8; // max number of tiles to process from queue
-	DWORD idle = 1000/g_pOrbiter->Cfg()->CfgPRenderPrm.LoadFrequency;
-	Tile *tile[tile_packet_size];
-	int nload, i;
+	Tile *tile;
 
+	EnterCriticalSection (&load_cs);
 	while (bRunThread) {
-		WaitForMutex ();
-		for (nload = 0; nqueue > 0 && nload < tile_packet_size; nload++) {
-			tile[nload] = queue[queue_out].tile;
-			tile[nload]->state = Tile::Loading; // lock tile and its ancestor tree
-			queue_out = (queue_out+1) % MAXQUEUE2; // remove from queue
-			nqueue--;
+		if (!(tile = NextRequest ())) {
+			SleepConditionVariableCS (&load_cv, &load_cs, INFINITE);
+			continue;
 		}
-		ReleaseMutex ();
+		tile->state = Tile::Loading; // lock tile and its ancestor tree
+		LeaveCriticalSection (&load_cs);
 
-		if (nload) {
-			for (i = 0; i < nload; i++)
-				tile[i]->Load(); // load/create the tile
+		tile->Load(); // load/create the tile
 
-			WaitForMutex ();
-			for (i = 0; i < nload; i++)
-				tile[i]->state = Tile::Inactive; // unlock tile
-			ReleaseMutex ();
-		} else {
-			Sleep (idle);
+		EnterCriticalSection (&load_cs);
+		tile->state = Tile::Inactive; // unlock tile
+		nload++;
+	}
+	LeaveCriticalSection (&load_cs);
+	return 0;
+}
+
+// =======================================================================
+// =======================================================================
+
+TilePrefetcher::TilePrefetcher (const Planet *_cbody, ZTreeMgr **_treeMgr, int _ntree, double _tahead)
+{
+	cbody = _cbody;
+	ntree = min (_ntree, 4);
+	for (int i = 0; i < ntree; i++)
+		treeMgr[i] = _treeMgr[i];
+	tahead = _tahead;
+	tupdate = 0.0;
+	nreq = nfetch = 0;
+	nload = nhit = ndata = 0;
+	InitializeCriticalSection (&cs);
+	InitializeConditionVariable (&cv);
+
+	// the prefetch thread must not compete with the tile loaders and the render thread
+	DWORD id;
+	bRunThread = true;
+	hThread = CreateThread (NULL, 32768, Prefetch_ThreadProc, this, CREATE_SUSPENDED, &id);
+	SetThreadPriority (hThread, THREAD_PRIORITY_BELOW_NORMAL);
+	ResumeThread (hThread);
+}
+
+// -----------------------------------------------------------------------
+
+TilePrefetcher::~TilePrefetcher ()
+{
+	EnterCriticalSection (&cs);
+	bRunThread = false;
+	WakeConditionVariable (&cv);
+	LeaveCriticalSection (&cs);
+	if (WaitForSingleObject (hThread, 1000) == WAIT_TIMEOUT) {
+		TerminateThread (hThread, 0);
+		LOGOUT_WARN ("TilePrefetcher: Wait for prefetch thread timed out.");
+	}
+	CloseHandle (hThread);
+	DeleteCriticalSection (&cs);
+}
+
+// -----------------------------------------------------------------------
+
+void TilePrefetcher::Update (int maxlvl, double bias)
+{
+	static const double res_scale = 1.1; // resolution scale with distance (as in ProcessNode)
+	static const int npred = 4;          // number of predicted positions
+
+	if (td.SysT0 < tupdate) return;
+	tupdate = td.SysT0 + 0.25;
+
+	const Body *tgt = g_camera->Target();
+	if (!tgt) return;
+
+	// Extrapolate the trajectory of the camera target from its osculating
+	// elements w.r.t. the planet. The camera keeps its offset from the target.
+	Vector cofs (*g_camera->GPosPtr() - tgt->GPos());
+	Elements el;
+	el.SetMasses (0.0, cbody->Mass());
+	el.Calculate (tgt->GPos()-cbody->GPos(), tgt->GVel()-cbody->GVel(), td.SimT0);
+
+	double R = cbody->Size();
+	double apr0 = g_camera->TanAperture() / g_pOrbiter->ViewH() * 1400.0;
+	double omega = (cbody->RotT() ? Pi2/cbody->RotT() : 0.0);
+	int i, j, k, lvl;
+
+	EnterCriticalSection (&cs);
+	for (i = 1; i <= npred; i++) {
+		double dt = tahead*td.Warp()*i/npred; // look-ahead in simulation time
+		Vector gpos (el.Pos (td.SimT0+dt) + cofs);
+		double lng, lat, rad;
+		cbody->LocalToEquatorial (tmul (cbody->GRot(), gpos), lng, lat, rad);
+		lng = posangle (lng - omega*dt + Pi) - Pi; // planet rotation over dt
+		double apr = max (0.0, rad-R)/R * apr0;
+		int tgtres = (apr < 1e-6 ? maxlvl : max (0, min (maxlvl, (int)(bias - log(apr)*res_scale))));
+
+		// the target tile and its neighbours, and the two levels above
+		for (lvl = max (0, tgtres-2); lvl <= tgtres; lvl++) {
+			int nlat = 1 << lvl;
+			int nlng = 2 << lvl;
+			int ilat = max (0, min (nlat-1, (int)((0.5-lat/Pi)*nlat)));
+			int ilng = (int)((lng/Pi2+0.5)*nlng);
+			for (j = -1; j <= 1; j++) {
+				if (ilat+j < 0 || ilat+j >= nlat) continue;
+				for (k = -1; k <= 1; k++)
+					Request (lvl, ilat+j, (ilng+k+nlng) % nlng);
+			}
 		}
 	}
+	LeaveCriticalSection (&cs);
+}
+
+// -----------------------------------------------------------------------
+
+void TilePrefetcher::Request (int lvl, int ilat, int ilng)
+{
+	// quadtree level 0 corresponds to archive level 4
+	__int64 key = ZTreeMgr::NodeKey (lvl+4, ilat, ilng);
+	__int64 i, i0 = max ((__int64)0, nreq-MAXPREFETCH);
+	for (i = i0; i < nreq; i++)
+		if (req[i % MAXPREFETCH].key == key) return;
+
+	PREFETCHDESC *pd = req + (nreq % MAXPREFETCH);
+	pd->key = key;
+	pd->lvl = lvl+4;
+	pd->ilat = ilat;
+	pd->ilng = ilng;
+	pd->bHit = false;
+	if (++nreq - nfetch > MAXPREFETCH)
+		nfetch = nreq - MAXPREFETCH; // overwritten before they were processed
+	WakeConditionVariable (&cv);
+}
+
+// -----------------------------------------------------------------------
+
+void TilePrefetcher::RegisterLoad (int lvl, int ilat, int ilng)
+{
+	__int64 key = ZTreeMgr::NodeKey (lvl+4, ilat, ilng);
+
+	EnterCriticalSection (&cs);
+	nload++;
+	__int64 i, i0 = max ((__int64)0, nreq-MAXPREFETCH);
+	for (i = i0; i < nfetch; i++) {
+		PREFETCHDESC *pd = req + (i % MAXPREFETCH);
+		if (pd->key == key) {
+			if (!pd->bHit) {
+				pd->bHit = true;
+				nhit++;
+			}
+			break;
+		}
+	}
+	LeaveCriticalSection (&cs);
+}
+
+// -----------------------------------------------------------------------
+
+void TilePrefetcher::LogStats (const char *name) const
+{
+	LOGOUT ("TilePrefetch %s: %d tiles prefetched, %d of %d tile loads prefetched (%0.1f%%)",
+		name, ndata, nhit, nload, nload ? 100.0*nhit/nload : 0.0);
+}
+
+// -----------------------------------------------------------------------
+
+DWORD WINAPI TilePrefetcher::Prefetch_ThreadProc (void *data)
+{
+	TilePrefetcher *pf = (TilePrefetcher*)data;
+	int i;
+
+	EnterCriticalSection (&pf->cs);
+	while (pf->bRunThread) {
+		if (pf->nfetch == pf->nreq) {
+			SleepConditionVariableCS (&pf->cv, &pf->cs, INFINITE);
+			continue;
+		}
+		__int64 ifetch = pf->nfetch;
+		PREFETCHDESC pd = pf->req[ifetch % MAXPREFETCH];
+		LeaveCriticalSection (&pf->cs);
+
+		bool found = false;
+		for (i = 0; i < pf->ntree; i++)
+			if (pf->treeMgr[i] && pf->treeMgr[i]->Prefetch (pf->treeMgr[i]->Idx (pd.lvl, pd.ilat, pd.ilng)))
+				found = true;
+
+		EnterCriticalSection (&pf->cs);
+		if (found) pf->ndata++;
+		if (pf->nfetch == ifetch) pf->nfetch++; // unless skipped by Request
+	}
+	LeaveCriticalSection (&pf->cs);
 	return 0;
 }
 
@@ -857,6 +1330,10 @@ TileManager2Base::configPrm TileManager2Base::cprm = {
 	0x0003              // tileLoadFlags
 };
 TileLoader *TileManager2Base::loader = NULL;
+std::vector<TileManager2Base*> TileManager2Base::mgrlist;
+double TileManager2Base::tbudget = -1.0;
+int TileManager2Base::nevict = 0;
+LONG64 TileManager2Base::nevictbyte = 0;
 double TileManager2Base::resolutionBias = 4.0;
 bool TileManager2Base::bTileLoadThread = false;
 
@@ -869,6 +1346,82 @@ TileManager2Base::TileManager2Base (const Planet *_cbody, int _maxres, int _grid
 	// set persistent parameters
 	prm.maxlvl = max (0, _maxres-4);
 	gridRes = _gridres;
+
+	// convergence statistics
+	nshort = 0;
+	tshort = -1.0;
+	nconverge = 0;
+	tconverge_sum = tconverge_max = 0.0;
+
+	mgrlist.push_back (this);
+}
+
+// -----------------------------------------------------------------------
+
+TileManager2Base::~TileManager2Base ()
+{
+	for (size_t i = 0; i < mgrlist.size(); i++)
+		if (mgrlist[i] == this) {
+			mgrlist.erase (mgrlist.begin()+i);
+			break;
+		}
+}
+
+// -----------------------------------------------------------------------
+
+void TileManager2Base::UpdateConvergence ()
+{
+	if (nshort) {
+		if (tshort < 0.0) tshort = td.SysT0;
+	} else if (tshort >= 0.0) {
+		double dt = td.SysT0 - tshort;
+		nconverge++;
+		tconverge_sum += dt;
+		if (dt > tconverge_max) tconverge_max = dt;
+		tshort = -1.0;
+	}
+	nshort = 0;
+}
+
+// -----------------------------------------------------------------------
+
+void TileManager2Base::LogStats (const char *name, const char *layer) const
+{
+	if (nconverge)
+		LOGOUT ("TileManager2 %s %s: target resolution reached %d times, mean %0.3f s, max %0.3f s",
+			name, layer, nconverge, tconverge_sum/nconverge, tconverge_max);
+}
+
+// -----------------------------------------------------------------------
+
+static bool CmpLastUsed (const Tile *t1, const Tile *t2)
+{
+	return t1->LastUsed() < t2->LastUsed();
+}
+
+void TileManager2Base::EnforceMemoryBudget ()
+{
+	if (td.SysT0 == tbudget) return; // already checked in this frame
+	tbudget = td.SysT0;
+	if (!loader || !MemStat::TileBudgetExceeded()) return;
+
+	// evict down to 7/8 of the budget, so that the tree walk isn't repeated every frame
+	LONG64 target = MemStat::TileBudget() - MemStat::TileBudget()/8;
+	std::vector<Tile*> cached;
+	size_t i;
+
+	loader->WaitForMutex();
+	for (i = 0; i < mgrlist.size(); i++)
+		mgrlist[i]->CollectCachedSubtrees (cached);
+	std::sort (cached.begin(), cached.end(), CmpLastUsed);
+	for (i = 0; i < cached.size() && MemStat::TileUsage() > target; i++) {
+		LONG64 mem = MemStat::TileUsage();
+		if (cached[i]->mgr->DeleteSubtree (cached[i])) {
+			nevict++;
+			nevictbyte += mem - MemStat::TileUsage();
+		}
+	}
+	loader->ReleaseMutex();
 }
 
 // -----------------------------------------------------------------------
@@ -886,6 +1439,7 @@ void TileManager2Base::CreateDeviceObjects (LPDIRECT3D7 _d3d, LPDIRECT3DDEVICE7
 	cprm.elevMode      = g_pOrbiter->Cfg()->CfgVisualPrm.ElevMode;
 	cprm.tileLoadFlags = g_pOrbiter->Cfg()->CfgPRenderPrm.TileLoadFlags;
 	loader = new TileLoader;
+	PatchTemplateCache::Init ();
 }
 
 // -----------------------------------------------------------------------
@@ -893,6 +1447,9 @@ void TileManager2Base::CreateDeviceObjects (LPDIRECT3D7 _d3d, LPDIRECT3DDEVICE7
 void TileManager2Base::DestroyDeviceObjects ()
 {
 	delete loader;
+	PatchTemplateCache::Cleanup ();
+	if (nevict)
+		LOGOUT ("TileManager2: %d cached subtrees evicted to meet the tile memory budget, %0.1f MB freed", nevict, nevictbyte/(1024.0*1024.0));
 }
 
 // -----------------------------------------------------------------------
@@ -9,9 +9,14 @@
 #include "VPlanet.h"
 #include "Spherepatch.h"
 #include "ZTreeMgr.h"
+#include "Memstat.h"
 #include "Log.h"
+#include <vector>
 
-#define MAXQUEUE2 20
+#define MAXQUEUE2 128    // max. number of queued tile load requests
+#define MAXLOADTHREAD2 4 // max. number of tile loader threads
+#define MAXPREFETCH 512  // max. number of recent tile prefetch requests
+#define MAXPATCHTEMPLATE 256 // max. number of cached patch templates
 
 #define TILE_VALID  0x0001
 #define TILE_ACTIVE 0x0002
@@ -28,6 +33,49 @@ typedef struct {
 
 // =======================================================================
 
+// Trigonometric terms of the vertex grid of a quadrilateral patch. Patches
+// are generated at longitude 0 and rotated into place by the world matrix,
+// so the grid only depends on the resolution level and latitude index, and
+// is shared by all patches of a latitude band.
+
+struct PATCHTEMPLATE {
+	int lvl, ilat;               // latitude band
+	int grdlat, grdlng;          // grid resolution
+	double minlat, maxlat;       // latitude range [rad]
+	double maxlng;               // longitude range [rad] (from 0)
+	double clat0, slat0, clat1, slat1; // cos and sin of minlat and maxlat
+	double clng0, slng0, clng1, slng1; // cos and sin of 0 and maxlng
+	double *clat, *slat;         // cos and sin of the grid row latitudes [grdlat+1]
+	double *clng, *slng;         // cos and sin of the grid column longitudes [grdlng+1]
+	int nref;                    // reference count (-1: not cached)
+	DWORD tlast;                 // last access (for LRU eviction)
+};
+
+class PatchTemplateCache {
+public:
+	static void Init ();
+	static void Cleanup ();
+
+	static const PATCHTEMPLATE *Acquire (int lvl, int ilat, int grdlat, int grdlng);
+	// returns the template for a latitude band, creating it if required.
+	// The template must be returned with Release.
+
+	static void Release (const PATCHTEMPLATE *tpl);
+
+protected:
+	static PATCHTEMPLATE *Create (int lvl, int ilat, int grdlat, int grdlng);
+	static void Delete (PATCHTEMPLATE *tpl);
+
+private:
+	static PATCHTEMPLATE *tpl[MAXPATCHTEMPLATE];
+	static int ntpl;
+	static DWORD tcount;         // access counter
+	static int nhit, nmiss;      // statistics
+	static CRITICAL_SECTION cs;
+};
+
+// =======================================================================
+
 class Tile {
 	friend class TileManager2Base;
 	friend class TileLoader;
@@ -38,6 +86,9 @@ public:
 
 	inline int Level() const { return lvl; }
 
+	inline double LastUsed() const { return tlast; }
+	// system time of the last quadtree pass including the tile
+
 	bool PreDelete();
 	// Prepare tile for deletion. Return false if tile is locked
 
@@ -94,6 +145,15 @@ protected:
 	VBMESH *CreateMesh_hemisphere (int grd, INT16 *elev=0, double globelev=0.0);
 	// Creates a hemisphere mesh for eastern or western hemisphere at resolution level 4
 
+	void SetMemSize (int layer, DWORD size);
+	// Registers the memory used by the tile for one of the MemStat tile layers
+
+	static DWORD TextureSize (LPDIRECTDRAWSURFACE7 tex);
+	// Estimated memory size of a texture, including the mipmap chain
+
+	static DWORD MeshSize (const VBMESH *mesh);
+	// Memory size of a tile mesh
+
 	TileManager2Base *mgr;		// the manager this tile is associated with
 	int lvl;					// tile resolution level
 	int ilat;					// latitude index
@@ -108,38 +168,110 @@ protected:
 	TileState state;			// tile load/active/render state flags
 	int lngnbr_lvl, latnbr_lvl, dianbr_lvl;	// neighbour levels to which edges have been adapted
 	mutable double mean_elev;	// mean tile elevation [m]
+	double tlast;				// system time of the last quadtree pass including the tile
+	DWORD memsize[MEMSTAT_NLAYER]; // memory registered with MemStat [bytes]
 };
 
 // =======================================================================
 
+// Loads tiles on a pool of worker threads. Requests are served in order of
+// priority. Requests that are not renewed by the tile manager (because the
+// tile has dropped out of view) are discarded.
+
 class TileLoader {
 	template<class T> friend class TileManager2;
 
 public:
 	TileLoader ();
 	~TileLoader ();
-	bool LoadTileAsync (Tile *tile);
+	bool LoadTileAsync (Tile *tile, double prio = 0.0);
+	// queue a tile for loading, or renew the request for a queued tile
+	// requests with higher priority are served first
 
 	bool Unqueue (Tile *tile);
-	// remove a tile from the load queue (caller must own hLoadMutex)
+	// remove a tile from the load queue (caller must own the loader mutex)
 
-	inline static DWORD WaitForMutex() { return ::WaitForSingleObject (hLoadMutex, INFINITE); }
-	inline static BOOL ReleaseMutex() { return ::ReleaseMutex (hLoadMutex); }
+	inline static DWORD WaitForMutex() { EnterCriticalSection (&load_cs); return WAIT_OBJECT_0; }
+	inline static BOOL ReleaseMutex() { LeaveCriticalSection (&load_cs); return TRUE; }
+
+protected:
+	static Tile *NextRequest ();
+	// remove the request with the highest priority from the queue, and
+	// discard stale requests (caller must own the loader mutex)
 
 private:
 	static struct QUEUEDESC {
 		Tile *tile;
-	} queue[MAXQUEUE2];
+		double prio;   // load priority
+		double t;      // system time of the latest request
+	} queue[MAXQUEUE2]; // unsorted
 
 	static bool bRunThread;
-	static int nqueue, queue_in, queue_out;
-	HANDLE hLoadThread;
-	static HANDLE hLoadMutex;
+	static int nqueue;
+	static int nload, ncancel; // statistics
+	int nthread;
+	HANDLE hLoadThread[MAXLOADTHREAD2];
+	static CRITICAL_SECTION load_cs;
+	static CONDITION_VARIABLE load_cv;
 	static DWORD WINAPI Load_ThreadProc (void*);
 };
 
 // =======================================================================
 
+// Predictive prefetch of surface tile data. The camera trajectory is
+// extrapolated a few seconds ahead, and the archive data of the tiles
+// around the predicted positions, at the resolution expected there, are
+// read into the file cache on a low-priority thread. When the tile
+// manager requests these tiles later, the loader doesn't wait for the disk.
+
+class TilePrefetcher {
+public:
+	TilePrefetcher (const Planet *_cbody, ZTreeMgr **_treeMgr, int _ntree, double _tahead);
+	// _treeMgr: archives to prefetch from (NULL entries are skipped)
+	// _tahead: look-ahead time [s]
+
+	~TilePrefetcher ();
+
+	void Update (int maxlvl, double bias);
+	// extrapolate the camera trajectory and queue the tiles along it
+	// maxlvl: max. quadtree level; bias: resolution bias of the tile manager
+
+	void RegisterLoad (int lvl, int ilat, int ilng);
+	// register a tile load by the tile manager, for the hit rate statistics
+
+	void LogStats (const char *name) const;
+
+protected:
+	void Request (int lvl, int ilat, int ilng);
+	// queue a tile for prefetching, unless it was requested recently
+	// (caller must own the prefetch mutex)
+
+private:
+	struct PREFETCHDESC {
+		__int64 key;      // ZTreeMgr::NodeKey of the archive tile
+		int lvl, ilat, ilng;
+		bool bHit;        // tile was loaded after prefetching
+	} req[MAXPREFETCH];   // ring buffer of recent requests
+	__int64 nreq;         // number of requests so far
+	__int64 nfetch;       // number of requests processed so far
+
+	const Planet *cbody;
+	ZTreeMgr *treeMgr[4]; // archives to prefetch from
+	int ntree;
+	double tahead;        // look-ahead time [s]
+	double tupdate;       // system time of next trajectory update
+	int nload, nhit;      // statistics: tiles loaded, and how many of them were prefetched
+	int ndata;            // statistics: prefetched tiles with archive data
+
+	bool bRunThread;
+	HANDLE hThread;
+	CRITICAL_SECTION cs;
+	CONDITION_VARIABLE cv;
+	static DWORD WINAPI Prefetch_ThreadProc (void *data);
+};
+
+// =======================================================================
+
 class TileManager2Base {
 	friend class Tile;
 	friend class CsphereTile;
@@ -177,6 +309,7 @@ public:
 	} prm;
 
 	TileManager2Base (const Planet *_cbody, int _maxres, int _gridres);
+	virtual ~TileManager2Base ();
 
 	static void CreateDeviceObjects (LPDIRECT3D7 _d3d, LPDIRECT3DDEVICE7 _dev);
 	static void DestroyDeviceObjects ();
@@ -203,6 +336,7 @@ public:
 	{ dVERIFY(dev->DrawIndexedPrimitiveVB (type, vbuf, vtx0, nvtx, idx, nidx, flags), "LPDIRECT3DDEVICE7::DrawIndexedPrimitiveVB failed"); } // should check for return type
 
 	static configPrm &Cprm() { return cprm; }
+	static double ResolutionBias() { return resolutionBias; }
 
 	inline const Planet *Cbody() const { return cbody; }
 	// Private member const access functions
@@ -224,18 +358,60 @@ public:
 
 	inline const int GridRes() const { return gridRes; }
 
+	static void EnforceMemoryBudget ();
+	// If the tile memory exceeds the MemStat budget, delete the least recently used
+	// cached subtrees of all tile managers until the memory is back within the budget.
+	// Called once per frame, after the quadtree passes of all managers, so that
+	// the subtrees rendered in the frame are marked as in use.
+
 protected:
 	virtual MATRIX4 WorldMatrix (int ilng, int nlng, int ilat, int nlat);
 	void SetWorldMatrix (const MATRIX4 &W);
 
 	template<class TileType>
-	QuadTreeNode<TileType> *LoadChildNode (QuadTreeNode<TileType> *node, int idx);
+	QuadTreeNode<TileType> *LoadChildNode (QuadTreeNode<TileType> *node, int idx, double prio = 0.0);
 	// loads one of the four subnodes of 'node', given by 'idx'
+	// prio: load priority for asynchronous loading
+
+	template<class TileType>
+	void ReleaseChildren (QuadTreeNode<TileType> *node);
+	// removes the subtree of 'node' from the active part of the quadtree. With a
+	// tile memory budget, the subtree is cached with DeactivateChildren, otherwise
+	// it is deleted
+
+	template<class TileType>
+	void DeactivateChildren (QuadTreeNode<TileType> *node);
+	// marks the subtree of 'node' inactive. The tiles remain cached until they are
+	// needed again, or evicted by EnforceMemoryBudget
+
+	template<class TileType>
+	void CollectCachedNodes (QuadTreeNode<TileType> *node, std::vector<Tile*> &list);
+	// appends the roots of the subtrees of 'node' not used in the current frame
+
+	virtual void CollectCachedSubtrees (std::vector<Tile*> &list) {}
+	// appends the roots of all cached subtrees of the manager
+
+	virtual bool DeleteSubtree (Tile *tile) { return false; }
+	// deletes a tile and its subtree. Returns false if a tile in the subtree is locked
+
+	void UpdateConvergence ();
+	// update the statistics of the time taken to reach the target resolution,
+	// after a pass over the quadtree
+
+	void LogStats (const char *name, const char *layer) const;
 
 	const Planet *cbody;			// the planet we are rendering
+	int nshort;                     // number of tiles rendered below target resolution in the current pass
+	double tshort;                  // system time at which the tree fell short of the target resolution (-1: at target)
+	int nconverge;                  // number of times the target resolution was reached
+	double tconverge_sum, tconverge_max; // time taken to reach the target resolution [s]
 
 	static TileLoader *loader;		// pointer to global tile loader
 	static configPrm cprm;
+	static std::vector<TileManager2Base*> mgrlist; // all tile managers, for memory budget enforcement
+	static double tbudget;          // system time of the last budget check
+	static int nevict;              // statistics: evicted subtrees
+	static LONG64 nevictbyte;       // statistics: memory freed by eviction
 
 private:
 	static LPDIRECT3D7 d3d;			// D3D instance
@@ -286,6 +462,7 @@ public:
 public:
 	ZTreeMgr **treeMgr;  // handle tiles in compressed archives
 	int ntreeMgr;
+	TilePrefetcher *prefetch; // predictive archive prefetch (NULL if disabled)
 
 protected:
 	TileType *globtile[3];              // full-sphere tiles for resolution levels 1-3
@@ -295,6 +472,9 @@ protected:
 
 	void LoadZTrees();
 
+	void CollectCachedSubtrees (std::vector<Tile*> &list);
+	bool DeleteSubtree (Tile *tile);
+
 private:
 	char *m_name;  // tileset name (e.g. planet name)
 };
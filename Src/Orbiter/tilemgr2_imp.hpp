@@ -5,6 +5,9 @@
 #define __TILEMGR2_IMP_HPP
 
 #include "tilemgr2.h"
+#include "Orbiter.h"
+
+extern TimeData td;
 
 // Implementation of template class TileManager2
 
@@ -39,7 +42,7 @@ QuadTreeNode<TileType> *TileManager2Base::FindNode (QuadTreeNode<TileType> root[
 // -----------------------------------------------------------------------
 
 template<class TileType>
-QuadTreeNode<TileType> *TileManager2Base::LoadChildNode (QuadTreeNode<TileType> *node, int idx)
+QuadTreeNode<TileType> *TileManager2Base::LoadChildNode (QuadTreeNode<TileType> *node, int idx, double prio)
 {
 	TileType *parent = node->Entry();
 	int lvl = parent->lvl+1;
@@ -48,7 +51,7 @@ QuadTreeNode<TileType> *TileManager2Base::LoadChildNode (QuadTreeNode<TileType>
 	TileType *tile = new TileType (this, lvl, ilat, ilng);
 	QuadTreeNode<TileType> *child = node->AddChild (idx, tile);
 	if (bTileLoadThread)
-		loader->LoadTileAsync (tile);
+		loader->LoadTileAsync (tile, prio);
 	else {
 		tile->Load ();
 		tile->state = Tile::Inactive;
@@ -66,6 +69,7 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 	Tile *tile = node->Entry();
 	tile->SetState (Tile::ForRender);
 	tile->SetEdgeState (false);
+	tile->tlast = td.SysT0;
 	int lvl = tile->lvl;
 	int ilng = tile->ilng;
 	int ilat = tile->ilat;
@@ -73,6 +77,7 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 	int nlat = 1 << lvl;
 	bool bstepdown = true;
 	double bias = resolutionBias;
+	double prio = 0.0;
 	if (ilat < nlat/6 || ilat >= nlat-nlat/6) { // lower resolution at the poles
 		bias -= 1.0;
 		if (ilat < nlat/12 || ilat >= nlat-nlat/12)
@@ -89,7 +94,7 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 		if (lvl == 0)
 			bstepdown = false;                // force render at lowest resolution
 		else {
-			node->DelChildren ();             // remove the sub-tree
+			ReleaseChildren (node);           // cache or remove the sub-tree
 			tile->SetState (Tile::Invisible);
 			return;                           // no need to continue
 		}
@@ -101,7 +106,7 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 		if (lvl == 0)
 			bstepdown = false;
 		else {
-			node->DelChildren ();             // remove the sub-tree
+			ReleaseChildren (node);           // cache or remove the sub-tree
 			tile->SetState (Tile::Invisible);
 			return;
 		}
@@ -123,6 +128,9 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 		if (adist > 0.5*amax) bias -= 2.0*(adist/amax-0.5); // reduce resolution for oblique tiles at the horizon
 		int tgtres = (apr < 1e-6 ? prm.maxlvl : max (0, min (prm.maxlvl, (int)(bias - log(apr)*res_scale))));
 		bstepdown = (lvl < tgtres);
+		// load priority of the subtiles: screen-space error in resolution levels,
+		// with closer tiles first for equal error
+		prio = (tgtres - lvl) - tdist/(1.0+tdist);
 	}
 
 	// Recursion to next level: subdivide into 2x2 patch
@@ -133,15 +141,16 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 		for (idx = 0; idx < 4; idx++) {
 			QuadTreeNode<TileType> *child = node->Child(idx);
 			if (!child)
-				child = LoadChildNode (node, idx);
-			else if (child->Entry()->state == Tile::Invalid) {
+				child = LoadChildNode (node, idx, prio);
+			else if (child->Entry()->state == Tile::Invalid || child->Entry()->state == Tile::InQueue) {
 				if (bTileLoadThread)
-					loader->LoadTileAsync (child->Entry());
+					loader->LoadTileAsync (child->Entry(), prio); // queue, or renew the request
 				else {
 					child->Entry()->Load();
 					child->Entry()->state = Tile::Inactive;
 				}
 			}
+			child->Entry()->tlast = td.SysT0; // requested subtiles are in use
 			Tile::TileState state = child->Entry()->state;
 			if (!(state & TILE_VALID))
 				subcomplete = false;
@@ -152,10 +161,49 @@ void TileManager2Base::ProcessNode (QuadTreeNode<TileType> *node)
 				ProcessNode (node->Child(i));
 			return; // otherwise render at current resolution until all subtiles are available
 		}
+		nshort++;
 	}
 
 	if (!bstepdown)
-		node->DelChildren ();
+		ReleaseChildren (node);
+}
+
+// -----------------------------------------------------------------------
+
+template<class TileType>
+void TileManager2Base::ReleaseChildren (QuadTreeNode<TileType> *node)
+{
+	if (MemStat::TileBudget()) DeactivateChildren (node);
+	else                       node->DelChildren (); // no budget: don't cache
+}
+
+// -----------------------------------------------------------------------
+
+template<class TileType>
+void TileManager2Base::DeactivateChildren (QuadTreeNode<TileType> *node)
+{
+	for (int i = 0; i < 4; i++) {
+		QuadTreeNode<TileType> *child = node->Child(i);
+		if (child && (child->Entry()->state & TILE_ACTIVE)) {
+			child->Entry()->state = Tile::Inactive;
+			DeactivateChildren (child);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+
+template<class TileType>
+void TileManager2Base::CollectCachedNodes (QuadTreeNode<TileType> *node, std::vector<Tile*> &list)
+{
+	// a tile is only included in a pass if its parent is, so the subtree of a
+	// tile not used in the current frame was last used at the same time or earlier
+	for (int i = 0; i < 4; i++) {
+		QuadTreeNode<TileType> *child = node->Child(i);
+		if (!child) continue;
+		if (child->Entry()->tlast < tbudget) list.push_back (child->Entry());
+		else CollectCachedNodes (child, list);
+	}
 }
 
 // -----------------------------------------------------------------------
@@ -214,6 +262,7 @@ TileManager2<TileType>::TileManager2 (const Planet *_cbody, int _maxres, int _gr
 
 	// Initialise the compressed packed tile archives
 	ntreeMgr = 0;
+	prefetch = NULL;
 	LoadZTrees();
 
 	// Load the low-res full-sphere tiles
@@ -240,17 +289,44 @@ TileManager2<TileType>::~TileManager2 ()
 	for (int i = 0; i < 3; i++)
 		delete globtile[i];
 
+	if (prefetch) {
+		prefetch->LogStats (m_name);
+		delete prefetch;
+	}
 	if (ntreeMgr) {
 		for (int i = 0; i < ntreeMgr; i++)
 			if (treeMgr[i]) delete treeMgr[i];
 		delete []treeMgr;
 	}
 
+	LogStats (m_name, TileType::LayerName());
 	delete[]m_name;
 }
 
 // -----------------------------------------------------------------------
 
+template<class TileType>
+void TileManager2<TileType>::CollectCachedSubtrees (std::vector<Tile*> &list)
+{
+	for (int i = 0; i < 2; i++)
+		CollectCachedNodes (tiletree+i, list);
+}
+
+// -----------------------------------------------------------------------
+
+template<class TileType>
+bool TileManager2<TileType>::DeleteSubtree (Tile *tile)
+{
+	QuadTreeNode<TileType> *node = static_cast<TileType*>(tile)->node;
+	QuadTreeNode<TileType> *parent = node->Parent();
+	for (int i = 0; i < 4; i++)
+		if (parent->Child(i) == node)
+			return parent->DelChild (i);
+	return false;
+}
+
+// -----------------------------------------------------------------------
+
 template<class TileType>
 void TileManager2<TileType>::SetRenderPrm(MATRIX4 &dwmat, double prerot, VPlanet *vbody, bool use_zbuf, const VPlanet::RenderPrm &prm)
 {
@@ -274,7 +350,7 @@ void TileManager2<TileType>::CheckCoverage (QuadTreeNode<TileType> *node,
 	if (t->Level() < maxlvl) {
 		bool has_children = false;
 		for (int i = 0; i < 4; i++) {
-			if (node->Child(i) && node->Child(i)->Entry() && node->Child(i)->Entry()->Tex()) {
+			if (node->Child(i) && node->Child(i)->Entry() && (node->Child(i)->Entry()->state & TILE_ACTIVE) && node->Child(i)->Entry()->Tex()) {
 				CheckCoverage (node->Child(i), latmin, latmax, lngmin, lngmax, maxlvl, tbuf, nt, nfound);
 				has_children = true;
 			}
@@ -0,0 +1,247 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// ==============================================================
+//                  ORBITER MODULE: EphemGen
+//                  Part of the ORBITER SDK
+//
+// EphemGen.cpp
+//
+// Offline generator for precomputed ephemeris files. At the start
+// of a simulation session, the ephemerides of the selected
+// celestial bodies are sampled from their modules over a span of
+// time and written as Chebyshev coefficient files, which can then
+// be served by the Chebeph celestial body module.
+//
+// Settings are read from Config\EphemGen.cfg:
+//   Bodies = <name> <name> ...  ; default: all bodies with ephemeris modules
+//   MJDStart = <mjd>            ; default: current simulation date
+//   MJDEnd = <mjd>              ; default: MJDStart + 100 years
+//   Tolerance = <m>             ; position tolerance, default: 0.1
+// Output: Config\<Name>\Data\Chebeph.bin
+// ==============================================================
+
+#define STRICT 1
+#define ORBITER_MODULE
+#include "Orbitersdk.h"
+#include "EphemFile.h"
+#include <stdio.h>
+
+#define NCOEFF 14 // coefficients per series
+
+// ==============================================================
+// The module interface class
+
+namespace oapi {
+
+class EphemGen: public Module {
+public:
+	EphemGen (HINSTANCE hDLL): Module (hDLL) {}
+	~EphemGen () {}
+	void clbkSimulationStart (RenderMode mode);
+};
+
+}; // namespace oapi
+
+using namespace oapi;
+
+static EphemGen *g_EphemGen = 0;
+
+// ==============================================================
+// Ephemeris sampling
+
+struct SAMPLER {
+	CELBODY *cb;
+	int ncomp;   // position components to store (3 or 6)
+	int flags;   // EPHEM_xxx flags of the module data
+};
+
+// Cartesian position [m] from polar ephemeris data (longitude, latitude,
+// radius [AU]), with the axis convention of CELBODY::Pol2Crt, which is not
+// accessible from outside the module
+static void Pol2Crt (const double *pol, double *crt)
+{
+	double rad = pol[2] * AU;
+	double xz  = rad * cos (pol[1]);
+	crt[0] = xz  * cos (pol[0]);
+	crt[2] = xz  * sin (pol[0]);
+	crt[1] = rad * sin (pol[1]);
+}
+
+// Cartesian true and barycentre positions from the module ephemeris
+static void Sample (SAMPLER &s, double mjd, double *pos)
+{
+	double ret[12];
+	memset (ret, 0, 12*sizeof(double));
+	s.flags = s.cb->clbkEphemeris (mjd, EPHEM_TRUEPOS | EPHEM_TRUEVEL | EPHEM_BARYPOS | EPHEM_BARYVEL, ret);
+	if (s.flags & EPHEM_POLAR) {
+		Pol2Crt (ret, pos);
+		Pol2Crt (ret+6, pos+3);
+	} else {
+		memcpy (pos, ret, 3*sizeof(double));
+		memcpy (pos+3, ret+6, 3*sizeof(double));
+	}
+}
+
+// Fit the series for the segment starting at mjd0 with length len [days]
+static void FitSegment (SAMPLER &s, double mjd0, double len, const double *node, double *cf)
+{
+	double f[6][NCOEFF], pos[6];
+	int i, j;
+	for (j = 0; j < NCOEFF; j++) {
+		Sample (s, mjd0 + 0.5*len*(node[j]+1.0), pos);
+		for (i = 0; i < s.ncomp; i++) f[i][j] = pos[i];
+	}
+	for (i = 0; i < s.ncomp; i++)
+		ChebFit (NCOEFF, f[i], cf+i*NCOEFF);
+}
+
+// Position error [m] of a segment fit at normalised argument x
+static double SegmentError (SAMPLER &s, double mjd0, double len, const double *cf, double x)
+{
+	double pos[6], p[6], v[6], d, err = 0.0;
+	Sample (s, mjd0 + 0.5*len*(x+1.0), pos);
+	ChebEval (NCOEFF, s.ncomp, cf, x, 1.0, p, v);
+	for (int i = 0; i < s.ncomp; i += 3) {
+		d = sqrt ((p[i]-pos[i])*(p[i]-pos[i]) + (p[i+1]-pos[i+1])*(p[i+1]-pos[i+1]) + (p[i+2]-pos[i+2])*(p[i+2]-pos[i+2]));
+		if (d > err) err = d;
+	}
+	return err;
+}
+
+// Max. position error of fits with segment length len, tested on
+// segments spread over the time span, halfway between the nodes
+static double FitError (SAMPLER &s, double mjd0, double mjd1, double len, const double *node)
+{
+	const int ntest = 8;
+	double cf[6*NCOEFF], t0, e, err = 0.0;
+	int i, j;
+	for (i = 0; i < ntest; i++) {
+		t0 = mjd0 + i*(mjd1-mjd0-len)/ntest;
+		FitSegment (s, t0, len, node, cf);
+		for (j = 0; j < 2*NCOEFF; j++)
+			if ((e = SegmentError (s, t0, len, cf, (j+0.5)/NCOEFF - 1.0)) > err) err = e;
+	}
+	return err;
+}
+
+static bool Generate (OBJHANDLE hBody, double mjd0, double mjd1, double tol)
+{
+	const double maxlen = 32.0;       // max. segment length [days]
+	const double minlen = 1.0/96.0;   // min. segment length [days]
+	char name[256], path[256];
+	double node[NCOEFF], cf[6*NCOEFF], pos[6], len, err, err0 = 0.0;
+	DWORD k;
+
+	oapiGetObjectName (hBody, name, 256);
+	SAMPLER s;
+	s.cb = oapiGetCelbodyInterface (hBody);
+	if (!s.cb || !s.cb->bEphemeris()) return false;
+	Sample (s, mjd0, pos);
+	if (!(s.flags & EPHEM_TRUEPOS)) return false;
+	s.ncomp = ((s.flags & EPHEM_BARYPOS) && !(s.flags & EPHEM_BARYISTRUE) ? 6 : 3);
+	ChebNodes (NCOEFF, node);
+
+	// segment length
+	for (len = maxlen;; len *= 0.5) {
+		err = FitError (s, mjd0, mjd1, len, node);
+		if (err <= tol) break;
+		if (len < maxlen && err > 0.25*err0) { // noise level of the sampled data reached
+			len *= 2.0;
+			break;
+		}
+		if (len <= minlen) break;
+		err0 = err;
+	}
+
+	EPHFILE_HEADER hdr;
+	memset (&hdr, 0, sizeof(hdr));
+	memcpy (hdr.magic, EPHFILE_MAGIC, 8);
+	hdr.version = EPHFILE_VERSION;
+	hdr.hdrsize = sizeof(EPHFILE_HEADER);
+	strncpy (hdr.name, name, 63);
+	hdr.mjd0 = mjd0;
+	hdr.seglen = len;
+	hdr.nseg = (DWORD)ceil ((mjd1-mjd0)/len);
+	hdr.ncoeff = NCOEFF;
+	hdr.ncomp = s.ncomp;
+	hdr.flags = s.flags & (EPHEM_BARYISTRUE | EPHEM_PARENTBARY);
+	hdr.tol = tol;
+
+	sprintf (path, "Config\\%s", name);
+	CreateDirectory (path, NULL);
+	strcat (path, "\\Data");
+	CreateDirectory (path, NULL);
+	strcat (path, "\\Chebeph.bin");
+	FILE *f = fopen (path, "wb");
+	if (!f) {
+		oapiWriteLogError ("EphemGen %s: Could not write %s", name, path);
+		return false;
+	}
+	fwrite (&hdr, sizeof(hdr), 1, f);
+
+	// Fit all segments. Each segment is checked at one point between
+	// the nodes, cycling through the test points.
+	DWORD t0 = GetTickCount();
+	for (k = 0, err = 0.0; k < hdr.nseg; k++) {
+		double t = mjd0 + k*len;
+		FitSegment (s, t, len, node, cf);
+		fwrite (cf, sizeof(double), s.ncomp*NCOEFF, f);
+		double e = SegmentError (s, t, len, cf, (k%(2*NCOEFF)+0.5)/NCOEFF - 1.0);
+		if (e > err) err = e;
+	}
+	hdr.maxerr = err;
+	fseek (f, 0, SEEK_SET);
+	fwrite (&hdr, sizeof(hdr), 1, f);
+	fclose (f);
+
+	oapiWriteLogV ("EphemGen %s: %s, %d segments of %0.3lf days, %0.2lf MB, max. error %0.2le m, %0.1lf s",
+		name, path, hdr.nseg, len, (hdr.hdrsize + (double)hdr.nseg*hdr.ncomp*NCOEFF*sizeof(double))/(1024.0*1024.0), err,
+		(GetTickCount()-t0)*1e-3);
+	return true;
+}
+
+// ==============================================================
+// EphemGen implementation
+
+void EphemGen::clbkSimulationStart (RenderMode mode)
+{
+	char bodies[1024] = "", *name;
+	double mjd0 = oapiGetSimMJD(), mjd1 = 0.0, tol = 0.1;
+	DWORD i;
+
+	FILEHANDLE hFile = oapiOpenFile ("EphemGen.cfg", FILE_IN, CONFIG);
+	if (hFile) {
+		oapiReadItem_string (hFile, "Bodies", bodies);
+		oapiReadItem_float (hFile, "MJDStart", mjd0);
+		oapiReadItem_float (hFile, "MJDEnd", mjd1);
+		oapiReadItem_float (hFile, "Tolerance", tol);
+		oapiCloseFile (hFile, FILE_IN);
+	}
+	if (mjd1 <= mjd0) mjd1 = mjd0 + 36525.0;
+
+	if (bodies[0]) {
+		for (name = strtok (bodies, " \t"); name; name = strtok (NULL, " \t")) {
+			OBJHANDLE hBody = oapiGetGbodyByName (name);
+			if (!hBody || !Generate (hBody, mjd0, mjd1, tol))
+				oapiWriteLogError ("EphemGen %s: No ephemeris module", name);
+		}
+	} else {
+		for (i = 0; i < oapiGetGbodyCount(); i++)
+			Generate (oapiGetGbodyByIndex (i), mjd0, mjd1, tol);
+	}
+}
+
+// ==============================================================
+// DLL entry and exit points
+
+DLLCLBK void InitModule (HINSTANCE hDLL)
+{
+	g_EphemGen = new EphemGen (hDLL);
+	oapiRegisterModule (g_EphemGen);
+}
+
+DLLCLBK void ExitModule (HINSTANCE hDLL)
+{
+	delete g_EphemGen;
+}
@@ -0,0 +1,63 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =========================================================================
+// WorkerGroup.h
+// Thread group for the planet texture tools (pltex, plsplit).
+// Runs jobs 0..njob-1 on a number of worker threads. The calling thread is
+// free to do other work (e.g. read the next bitmap band) until Wait returns.
+// =========================================================================
+
+#ifndef __WORKERGROUP_H
+#define __WORKERGROUP_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdio.h>
+
+class WorkerGroup {
+public:
+	WorkerGroup (int njob, std::function<void(int,int)> job, int nthread = 0): job(job), njob(njob), next(0)
+	{
+		// job(ijob, ithread) is called for each job index, with the index of the worker thread
+		// nthread: number of worker threads (0: one per processor), limited to njob
+		int i, n = NumThreads (nthread);
+		if (n > njob) n = njob;
+		if (n < 1) n = 1;
+		for (i = 0; i < n; i++)
+			thread.push_back (std::thread (&WorkerGroup::Run, this, i));
+	}
+	~WorkerGroup () { Wait(); }
+	void Wait ()
+	{
+		for (size_t i = 0; i < thread.size(); i++) thread[i].join();
+		thread.clear();
+	}
+	static int NumThreads (int nthread = 0)
+	{
+		// number of worker threads used for a requested number nthread (0: one per processor)
+		int n = (int)std::thread::hardware_concurrency();
+		return (nthread > 0 ? nthread : n > 0 ? n : 1);
+	}
+	static char *TmpId ()
+	{
+		// suffix for the temporary files of the calling thread: "_<ithread>" on a
+		// worker thread, so that each worker uses its own files, "" otherwise
+		static thread_local char id[8] = "";
+		return id;
+	}
+private:
+	void Run (int ithread)
+	{
+		sprintf (TmpId(), "_%02d", ithread);
+		for (int i; (i = next++) < njob;) job (i, ithread);
+	}
+	std::function<void(int,int)> job;
+	int njob;
+	std::atomic<int> next;
+	std::vector<std::thread> thread;
+};
+
+#endif // !__WORKERGROUP_H
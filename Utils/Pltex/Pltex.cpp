@@ -44,6 +44,12 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <chrono>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,6 +61,7 @@
 #include <windows.h>
 #include <math.h>
 #include <ddraw.h>
+#include "WorkerGroup.h"
 
 using namespace std;
 
@@ -109,6 +116,21 @@ struct PATCHDATA {
 	TILEFILESPEC *tfs;
 	int ntfs;
 	FILE *texf, *mtexf;
+	LONG row0;  // first bitmap row contained in img, limg and aimg
+};
+
+struct BANDDATA {  // bitmap rows supporting a level-8 latitude band
+	RGB *img, *limg;
+	Alpha *aimg;
+	LONG row0;     // first bitmap row
+};
+
+struct SUBTILEJOB {  // level-9+ subtree of a level-8 tile, generated by a worker thread
+	int idx;         // index of the level-8 tile
+	int which;       // hemisphere
+	double lat0, lat1, lng0, lng1; // area of the level-8 tile
+	PATCHDATA pd;    // tile descriptors, texture offsets and counters, relative to the job
+	char texname[32], mtexname[32]; // temporary texture files
 };
 
 struct MERGEDATA {
@@ -132,6 +154,16 @@ const int LevelH[10] = {0, PS/4, PS/2, PS, PS,   2*PS, 4*PS,  8*PS, 16*PS, 32*PS
 void CreateGlobalSurface ();
 void CreateLocalArea ();
 bool CreateSubPatch (double baselat0, double baselat1, double baselng0, double baselng1, int idx, PATCHDATA &pd, int lvl);
+bool CreateSubTile (double baselat0, double baselat1, double baselng0, double baselng1, int idx, int k, int j, PATCHDATA &pd, int lvl);
+void LoadBand (BANDDATA &bd, const PATCHDATA &pd, int which, int band);
+void FreeBand (BANDDATA &bd);
+void CreateSubTileJob (SUBTILEJOB &job, const PATCHDATA &base, const BANDDATA &bd, RGB *patch, RGB *lpatch, Alpha *apatch);
+void CommitSubTileJob (SUBTILEJOB &job, PATCHDATA &pd);
+void AppendFile (FILE *ftgt, const char *srcname);
+int MaxLocalLevel (LONG maph, double latrange);
+void WriteSyntheticMaps (const char *const *name, LONG w, LONG h);
+bool SameFile (const char *name1, const char *name2);
+void Benchmark (LONG w, LONG h, int lvl);
 void CreateCloudMap ();
 void MergeTextures ();
 void MergeTrees (MERGEDATA &md, DWORD idx1, DWORD idx2, DWORD idxm, bool baselvl);
@@ -156,9 +188,11 @@ void ExtractPatchRotatedRGBA (RGB *src, Alpha *asrc, LONG srcw, LONG srch, LONG
 void ExtractPatchRGBA (RGB *src, Alpha *asrc, LONG srcw, LONG srch, LONG x0, LONG y0, RGB *tgt, Alpha *atgt, LONG tgtw, LONG tgth, int which);
 
 void SamplePatch (RGB *img, LONG imgw, LONG imgh, double maplng0, double maplng1, double maplat0, double maplat1,
-				  RGB *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which);
+				  RGB *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which, LONG row0 = 0);
 void SampleAPatch (Alpha *img, LONG imgw, LONG imgh, double maplng0, double maplng1, double maplat0, double maplat1,
-				   Alpha *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which);
+				   Alpha *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which, LONG row0 = 0);
+// Sample a patch from a bitmap covering the given area. If img only contains a band of the bitmap,
+// row0 is the index of its first row, and imgh is the height of the full bitmap.
 
 DWORD CatDDS (FILE *dds, RGB *img, Alpha *aimg, LONG imgw, LONG imgh, bool force = false, bool mipmap = false);
 // Adds the specified texture with optional alpha channel to the texture file.
@@ -215,7 +249,8 @@ bool selective_alpha = false;
 int g_minres = 0, g_maxres = 0;
 double g_tol = 0.0;        // tolerance for suppressing opaque/transparent pixels in a tile
 double g_light_tol = 0.0;  // tolerance for suppressing light pixels in a tile
-int g_nsuppressed = 0;     // number of opacity/transparency suppressed tiles
+std::atomic<int> g_nsuppressed(0); // number of opacity/transparency suppressed tiles
+int g_nthread = 0;         // number of worker threads for high-resolution tiles (0: one per processor)
 
 const int nband = 8;
 const int np[8] = {6,12,18,24,28,30,32,32};
@@ -224,7 +259,8 @@ const int np[8] = {6,12,18,24,28,30,32,32};
 
 int main (int argc, char *argv[])
 {
-	int i;
+	int i, benchlvl = 0;
+	LONG benchw = 0, benchh = 0;
 	char task;
 
 	if (!_getcwd (g_cwd, 256)) FatalError ("Cannot get working directory");
@@ -246,6 +282,14 @@ int main (int argc, char *argv[])
 		case 'h':
 			sscanf (argv[++i], "%d", &g_maxres);
 			break;
+		case 't':
+			sscanf (argv[++i], "%d", &g_nthread);
+			break;
+		case 's': // benchmark: -s <width> <height> <level>
+			sscanf (argv[++i], "%ld", &benchw);
+			sscanf (argv[++i], "%ld", &benchh);
+			sscanf (argv[++i], "%d", &benchlvl);
+			break;
 		}
 	}
 
@@ -254,6 +298,11 @@ int main (int argc, char *argv[])
 	cout << "|        Build: " << __DATE__ << "      (c) 2001-2008 Martin Schweiger         |\n";
 	cout << "+-----------------------------------------------------------------------+\n\n";
 
+	if (benchlvl) {
+		Benchmark (benchw, benchh, benchlvl);
+		return 0;
+	}
+
 	for (;;) {
 		cout << "Select a task:\n\n";
 		cout << "(G) Create a global planetary surface texture (resolution level <= 8)\n";
@@ -981,14 +1030,7 @@ void CreateLocalArea ()
 	texf = fopen ("tmp_tile.tex", "wb");
 
 	// figure out max. resolution supported by bitmap
-	const double scl9 = 4096.0/180.0;
-	double scl = (double)maph/(latmax-latmin);
-	maxlvl = 8;
-	while (scl >= 2.0*scl9-eps) {
-		maxlvl++;
-		scl *= 0.5;
-	}
-	maxlvl = min (MAXLEVEL, maxlvl); // max. currently supported level
+	maxlvl = MaxLocalLevel (maph, latmax-latmin);
 	if (maxlvl < 9) FatalError ("Bitmap resolution insufficient for level 9");
 	if (maxlvl > 9) {
 		cout << endl << "The bitmaps support resolutions up to level " << maxlvl << ".\n";
@@ -1115,30 +1157,55 @@ void CreateLocalArea ()
 
 	} else { // local coverage
 
-		img = ReadBMP (fname, mapw, maph, bpp);
-		if (nlights) limg = ReadBMP (lname, mapw, maph, nbpp);
-		if (mixed) aimg = ReadBMPAlpha (aname, mapw, maph, abpp);
-		PATCHDATA pd = {0, img, patch, limg, lpatch, aimg, apatch, mapw, maph, maxlvl, mixed, skipwater, nlights, mipmap, landlimit, mixed_tol, light_tol,
-			latmin, latmax, lngmin, lngmax, ntile, ntot, sout, mout, sidx, midx, patchflag, tfs, ntfs, texf, mtexf};
-
-		for (which = HEMISPHERE_NORTH; which <= HEMISPHERE_SOUTH; which++) {
-			pd.which = which;
-			for (band = 0; band < nband; band++) { // level-8 latitude bands
-				for (i = 0; i < np[band]; i++) {   // level-8 longitude tiles
-					lat0 = (double)(nband-1-band)/(double)nband * 90.0;
-					lat1 = lat0 + 90.0/(double)nband;
-					lng0 = (double)i/(double)np[band] * 360.0 - 180.0;
-					lng1 = lng0 + 360.0/(double)np[band];
-					CreateSubPatch (lat0, lat1, lng0, lng1, idx, pd, 9);
-					idx++;
-					IncProgress();
-				}
+		// The level-8 latitude bands are processed in sequence, and only the bitmap
+		// rows supporting the current band are kept in memory. The subtrees of the
+		// level-8 tiles of a band are generated in parallel, each into its own
+		// temporary texture files, and then appended in the original order, so the
+		// output does not depend on the number of threads. The next band is read
+		// while the current one is processed.
+		PATCHDATA pd = {0, 0, 0, 0, 0, 0, 0, mapw, maph, maxlvl, mixed, skipwater, nlights, mipmap, landlimit, mixed_tol, light_tol,
+			latmin, latmax, lngmin, lngmax, ntile, ntot, sout, mout, sidx, midx, patchflag, tfs, ntfs, texf, mtexf, 0};
+		int b, nthread = WorkerGroup::NumThreads (g_nthread);
+		std::vector<RGB> tpatch(nthread*PS*PS), tlpatch(nthread*PS*PS); // per-thread patch buffers
+		std::vector<Alpha> tapatch(nthread*PS*PS);
+		std::vector<SUBTILEJOB> job;
+		BANDDATA bdata[2];
+		auto t0 = std::chrono::steady_clock::now();
+
+		LoadBand (bdata[0], pd, HEMISPHERE_NORTH, 0);
+		for (b = 0; b < 2*nband; b++) {
+			which = (b < nband ? HEMISPHERE_NORTH : HEMISPHERE_SOUTH);
+			band = b % nband;                  // level-8 latitude band
+			BANDDATA &bcur = bdata[b & 1];
+			job.resize (np[band]);
+			for (i = 0; i < np[band]; i++) {   // level-8 longitude tiles
+				SUBTILEJOB &jb = job[i];
+				jb.idx = idx+i;
+				jb.which = which;
+				jb.lat0 = (double)(nband-1-band)/(double)nband * 90.0;
+				jb.lat1 = jb.lat0 + 90.0/(double)nband;
+				jb.lng0 = (double)i/(double)np[band] * 360.0 - 180.0;
+				jb.lng1 = jb.lng0 + 360.0/(double)np[band];
+				sprintf (jb.texname, "tmp_job%03d.tex", i);
+				sprintf (jb.mtexname, "tmp_job%03d_lmask.tex", i);
+			}
+			WorkerGroup wg ((int)job.size(), [&](int ijob, int ithread) {
+				CreateSubTileJob (job[ijob], pd, bcur, tpatch.data() + ithread*PS*PS, tlpatch.data() + ithread*PS*PS, tapatch.data() + ithread*PS*PS);
+			}, nthread);
+			if (b+1 < 2*nband)
+				LoadBand (bdata[(b+1) & 1], pd, b+1 < nband ? HEMISPHERE_NORTH : HEMISPHERE_SOUTH, (b+1) % nband);
+			wg.Wait();
+			for (i = 0; i < (int)job.size(); i++)
+				CommitSubTileJob (job[i], pd);
+			FreeBand (bcur);
+			for (i = 0; i < np[band]; i++) {
+				idx++;
+				IncProgress();
 			}
 		}
 
-		delete []img;
-		if (limg) delete []limg;
-		if (aimg) delete []aimg;
+		double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		cout << "Generated level 9+ tiles in " << setprecision(1) << fixed << dt << " s (" << nthread << " threads)" << endl;
 		ntile = pd.ntile; sout = pd.sout; mout = pd.mout; tfs = pd.tfs;
 	}
 
@@ -1187,103 +1254,374 @@ void CreateLocalArea ()
 bool CreateSubPatch (double baselat0, double baselat1, double baselng0, double baselng1, int idx, PATCHDATA &pd, int lvl)
 {
 	int k, j;
-	DWORD patchflag = pd.patchflag;
-	DWORD tsize;
-	double lat0, lat1, lng0, lng1, nlat0, nlat1, nlng0, nlng1, transp, lights;
-	const double eps = 1e-8;
 	bool bIsTile = false;
 
 	for (k = 0; k < 2; k++) {      // patch latitude subdivision
 		for (j = 0; j < 2; j++) {  // patch longitude subdivision
-			bool bSubtile = false;
-			pd.ntot++;
-			nlat0 = lat0 = baselat0 + (baselat1-baselat0)*0.5*(1-k);
-			nlng0 = lng0 = baselng0 + (baselng1-baselng0)*0.5*j;
-			nlat1 = lat1 = lat0 + (baselat1-baselat0)*0.5;
-			nlng1 = lng1 = lng0 + (baselng1-baselng0)*0.5;
-			if (pd.which == HEMISPHERE_SOUTH) {
-				lat0 = -lat1;
-				lng0 = -lng1;
-				lat1 = lat0 + (baselat1-baselat0)*0.5;
-				lng1 = lng0 + (baselng1-baselng0)*0.5;
-			}
-			pd.tfs[idx].subidx[k*2+j] = 0; // no subtile by default
-
-			// check for partial coverage of patch within bitmap support
-			if (lat0 <= pd.latmax-eps && lat1 >= pd.latmin+eps && lng0 <= pd.lngmax-eps && lng1 >= pd.lngmin+eps) {
-
-				if (pd.ntile >= pd.ntfs) { // need to reallocate list of contents
-					TILEFILESPEC *tmp = new TILEFILESPEC[pd.ntfs+256];
-					memset (tmp, 0, (pd.ntfs+256)*sizeof(TILEFILESPEC));
-					memcpy (tmp, pd.tfs, pd.ntfs*sizeof(TILEFILESPEC));
-					delete []pd.tfs;
-					pd.tfs = tmp;
-					pd.ntfs += 256;
+			bool bSubtile = CreateSubTile (baselat0, baselat1, baselng0, baselng1, idx, k, j, pd, lvl);
+			bIsTile = bIsTile || bSubtile;
+		}
+	}
+	return bIsTile;
+}
+
+bool CreateSubTile (double baselat0, double baselat1, double baselng0, double baselng1, int idx, int k, int j, PATCHDATA &pd, int lvl)
+{
+	DWORD patchflag = pd.patchflag; // determined for each subtile
+	DWORD tsize;
+	double lat0, lat1, lng0, lng1, nlat0, nlat1, nlng0, nlng1, transp, lights;
+	const double eps = 1e-8;
+	bool bSubtile = false;
+
+	pd.ntot++;
+	nlat0 = lat0 = baselat0 + (baselat1-baselat0)*0.5*(1-k);
+	nlng0 = lng0 = baselng0 + (baselng1-baselng0)*0.5*j;
+	nlat1 = lat1 = lat0 + (baselat1-baselat0)*0.5;
+	nlng1 = lng1 = lng0 + (baselng1-baselng0)*0.5;
+	if (pd.which == HEMISPHERE_SOUTH) {
+		lat0 = -lat1;
+		lng0 = -lng1;
+		lat1 = lat0 + (baselat1-baselat0)*0.5;
+		lng1 = lng0 + (baselng1-baselng0)*0.5;
+	}
+	pd.tfs[idx].subidx[k*2+j] = 0; // no subtile by default
+
+	// check for partial coverage of patch within bitmap support
+	if (lat0 <= pd.latmax-eps && lat1 >= pd.latmin+eps && lng0 <= pd.lngmax-eps && lng1 >= pd.lngmin+eps) {
+
+		if (pd.ntile >= pd.ntfs) { // need to reallocate list of contents
+			TILEFILESPEC *tmp = new TILEFILESPEC[pd.ntfs+256];
+			memset (tmp, 0, (pd.ntfs+256)*sizeof(TILEFILESPEC));
+			memcpy (tmp, pd.tfs, pd.ntfs*sizeof(TILEFILESPEC));
+			delete []pd.tfs;
+			pd.tfs = tmp;
+			pd.ntfs += 256;
+		}
+		pd.tfs[pd.ntile].flags = 0;
+		pd.tfs[pd.ntile].sidx = (DWORD)-1;
+		pd.tfs[pd.ntile].midx = (DWORD)-1;
+		pd.tfs[pd.ntile].eidx = (DWORD)-1;
+		pd.tfs[idx].subidx[k*2+j] = pd.ntile;
+
+		// check for full coverage of patch within bitmap support
+		if (pd.latmin-eps <= lat0 && pd.latmax+eps >= lat1 && pd.lngmin-eps <= lng0 && pd.lngmax+eps >= lng1) {
+
+			bSubtile = true; // subtile is supported by bitmap coverage
+			SamplePatch (pd.img, pd.mapw, pd.maph, pd.lngmin, pd.lngmax, pd.latmin, pd.latmax, pd.patch, PS, PS, lng0, lng1, lat0, lat1, pd.which, pd.row0);
+			if (pd.mixed) {
+				SampleAPatch (pd.aimg, pd.mapw, pd.maph, pd.lngmin, pd.lngmax, pd.latmin, pd.latmax, pd.apatch, PS, PS, lng0, lng1, lat0, lat1, pd.which, pd.row0);
+				transp = (double)TransparentCount (pd.apatch, PS, PS)/(double)(PS*PS);
+				if (pd.skipwater && (transp < pd.landlimit)) {
+					pd.tfs[idx].subidx[k*2+j] = 0;
+					return false;
+				} else {
+					if (transp < pd.mixed_tol) patchflag = 2;
+					else if (1.0-transp < pd.mixed_tol) patchflag = 1;
+					else patchflag = 3;
 				}
-				pd.tfs[pd.ntile].flags = 0;
-				pd.tfs[pd.ntile].sidx = (DWORD)-1;
+			}
+			if (pd.nlights) {
+				SamplePatch (pd.limg, pd.mapw, pd.maph, pd.lngmin, pd.lngmax, pd.latmin, pd.latmax, pd.lpatch, PS, PS, lng0, lng1, lat0, lat1, pd.which, pd.row0);
+				lights = (double)BrightCount (pd.lpatch, PS, PS)/(double)(PS*PS);
+				if (lights >= pd.light_tol) patchflag |= 4;
+			}
+			tsize = CatDDS (pd.texf, pd.patch, 0, PS, PS, true, pd.mipmap);
+			pd.tfs[pd.ntile].sidx = pd.sidx;
+			pd.sidx += tsize;
+			//pd.tfs[pd.ntile].sidx = pd.sidx++;
+			if (((patchflag & 3) == 3) || (patchflag & 4)) {
+				if (!pd.mixed) // CatDDS inverts the alpha patch in place
+					memset (pd.apatch, 0, PS*PS*sizeof(Alpha));
+				ErodeLights (pd.lpatch, pd.apatch, PS, PS);
+				tsize = CatDDS (pd.mtexf, pd.lpatch, pd.apatch, PS, PS, true);
+				pd.tfs[pd.ntile].midx = pd.midx;
+				pd.midx += tsize;
+				//pd.tfs[pd.ntile].midx = pd.midx++;
+				pd.mout++;
+			} else {
 				pd.tfs[pd.ntile].midx = (DWORD)-1;
-				pd.tfs[pd.ntile].eidx = (DWORD)-1;
-				pd.tfs[idx].subidx[k*2+j] = pd.ntile;
-
-				// check for full coverage of patch within bitmap support
-				if (pd.latmin-eps <= lat0 && pd.latmax+eps >= lat1 && pd.lngmin-eps <= lng0 && pd.lngmax+eps >= lng1) {
-
-					bSubtile = true; // subtile is supported by bitmap coverage
-					SamplePatch (pd.img, pd.mapw, pd.maph, pd.lngmin, pd.lngmax, pd.latmin, pd.latmax, pd.patch, PS, PS, lng0, lng1, lat0, lat1, pd.which);
-					if (pd.mixed) {
-						SampleAPatch (pd.aimg, pd.mapw, pd.maph, pd.lngmin, pd.lngmax, pd.latmin, pd.latmax, pd.apatch, PS, PS, lng0, lng1, lat0, lat1, pd.which);
-						transp = (double)TransparentCount (pd.apatch, PS, PS)/(double)(PS*PS);
-						if (pd.skipwater && (transp < pd.landlimit)) {
-							pd.tfs[idx].subidx[k*2+j] = 0;
-							continue;
-						} else {
-							if (transp < pd.mixed_tol) patchflag = 2;
-							else if (1.0-transp < pd.mixed_tol) patchflag = 1;
-							else patchflag = 3;
-						}
-					}
-					if (pd.nlights) {
-						SamplePatch (pd.limg, pd.mapw, pd.maph, pd.lngmin, pd.lngmax, pd.latmin, pd.latmax, pd.lpatch, PS, PS, lng0, lng1, lat0, lat1, pd.which);
-						lights = (double)BrightCount (pd.lpatch, PS, PS)/(double)(PS*PS);
-						if (lights >= pd.light_tol) patchflag |= 4;
-					}
-					tsize = CatDDS (pd.texf, pd.patch, 0, PS, PS, true, pd.mipmap);
-					pd.tfs[pd.ntile].sidx = pd.sidx;
-					pd.sidx += tsize;
-					//pd.tfs[pd.ntile].sidx = pd.sidx++;
-					if (((patchflag & 3) == 3) || (patchflag & 4)) {
-						ErodeLights (pd.lpatch, pd.apatch, PS, PS);
-						tsize = CatDDS (pd.mtexf, pd.lpatch, pd.apatch, PS, PS, true);
-						pd.tfs[pd.ntile].midx = pd.midx;
-						pd.midx += tsize;
-						//pd.tfs[pd.ntile].midx = pd.midx++;
-						pd.mout++;
-					} else {
-						pd.tfs[pd.ntile].midx = (DWORD)-1;
-					}
-					pd.tfs[pd.ntile].flags = patchflag;
-					pd.sout++;
+			}
+			pd.tfs[pd.ntile].flags = patchflag;
+			pd.sout++;
 
-				}
-				pd.ntile++;
+		}
+		pd.ntile++;
 
-				// now recursively go down to higher resolutions
-				if (lvl < pd.maxlevel) {
-					bool bsub = CreateSubPatch (nlat0, nlat1, nlng0, nlng1, pd.ntile-1, pd, lvl+1);
-					bSubtile = bSubtile || bsub;
-				}
+		// now recursively go down to higher resolutions
+		if (lvl < pd.maxlevel) {
+			bool bsub = CreateSubPatch (nlat0, nlat1, nlng0, nlng1, pd.ntile-1, pd, lvl+1);
+			bSubtile = bSubtile || bsub;
+		}
 
-				if (!bSubtile) { // remove tile description
-					pd.tfs[idx].subidx[k*2+j] = 0;
-					pd.ntile--;
-				}
+		if (!bSubtile) { // remove tile description
+			pd.tfs[idx].subidx[k*2+j] = 0;
+			pd.ntile--;
+		}
+	}
+	return bSubtile;
+}
+
+void LoadBand (BANDDATA &bd, const PATCHDATA &pd, int which, int band)
+{
+	// Read the bitmap rows required for sampling the tiles of a level-8 latitude band
+	double lat0 = (double)(nband-1-band)/(double)nband * 90.0;
+	double lat1 = lat0 + 90.0/(double)nband;
+	if (which == HEMISPHERE_SOUTH) {
+		double tmp = lat0;
+		lat0 = -lat1;
+		lat1 = -tmp;
+	}
+	double y0 = (lat0-pd.latmin)/(pd.latmax-pd.latmin)*pd.maph;
+	double y1 = (lat1-pd.latmin)/(pd.latmax-pd.latmin)*pd.maph;
+	LONG row0 = max (0, (LONG)floor (y0-0.5)-1);
+	LONG row1 = min (pd.maph-1, (LONG)floor (y1-0.5)+2);
+	LONG mapw, maph;
+	WORD bpp;
+
+	bd.img = bd.limg = 0;
+	bd.aimg = 0;
+	bd.row0 = row0;
+	if (row1 < row0) return; // band not covered by the bitmap
+	bd.img = ReadBMP_band (g_fname, mapw, maph, bpp, row0, row1-row0+1);
+	if (pd.nlights) bd.limg = ReadBMP_band (g_lname, mapw, maph, bpp, row0, row1-row0+1);
+	if (pd.mixed) bd.aimg = ReadBMPAlpha_band (g_aname, mapw, maph, bpp, row0, row1-row0+1);
+}
 
-				bIsTile = bIsTile || bSubtile;
+void FreeBand (BANDDATA &bd)
+{
+	DeleteTargets (&bd.img, &bd.aimg, &bd.limg);
+}
+
+void CreateSubTileJob (SUBTILEJOB &job, const PATCHDATA &base, const BANDDATA &bd, RGB *patch, RGB *lpatch, Alpha *apatch)
+{
+	// Generate the subtree of a level-9 tile. Entry 0 of the job's descriptor
+	// list stands in for the level-8 parent.
+	PATCHDATA &pd = job.pd;
+	pd = base;
+	pd.which = job.which;
+	pd.img = bd.img;
+	pd.limg = bd.limg;
+	pd.aimg = bd.aimg;
+	pd.row0 = bd.row0;
+	pd.patch = patch;
+	pd.lpatch = lpatch;
+	pd.apatch = apatch;
+	pd.ntfs = 256;
+	pd.tfs = new TILEFILESPEC[pd.ntfs];
+	memset (pd.tfs, 0, pd.ntfs*sizeof(TILEFILESPEC));
+	pd.ntile = 1;
+	pd.ntot = pd.sout = pd.mout = pd.sidx = pd.midx = 0;
+	pd.texf = fopen (job.texname, "wb");
+	pd.mtexf = (base.mtexf ? fopen (job.mtexname, "wb") : 0);
+	if (!pd.texf || (base.mtexf && !pd.mtexf)) FatalError ("Could not open temporary texture file.");
+
+	CreateSubPatch (job.lat0, job.lat1, job.lng0, job.lng1, 0, pd, 9);
+
+	fclose (pd.texf);
+	if (pd.mtexf) fclose (pd.mtexf);
+}
+
+void CommitSubTileJob (SUBTILEJOB &job, PATCHDATA &pd)
+{
+	// Append the subtree generated by a job to the tile list and texture files,
+	// relocating its tile indices and texture offsets
+	PATCHDATA &jd = job.pd;
+	DWORD i, q, base = pd.ntile-1; // index offset for job entries
+
+	if (pd.ntile+jd.ntile-1 > pd.ntfs) { // need to reallocate list of contents
+		int ntfs = pd.ntfs + max (256, jd.ntile);
+		TILEFILESPEC *tmp = new TILEFILESPEC[ntfs];
+		memset (tmp, 0, ntfs*sizeof(TILEFILESPEC));
+		memcpy (tmp, pd.tfs, pd.ntfs*sizeof(TILEFILESPEC));
+		delete []pd.tfs;
+		pd.tfs = tmp;
+		pd.ntfs = ntfs;
+	}
+	for (q = 0; q < 4; q++)
+		pd.tfs[job.idx].subidx[q] = (jd.tfs[0].subidx[q] ? jd.tfs[0].subidx[q]+base : 0);
+	for (i = 1; i < (DWORD)jd.ntile; i++) {
+		TILEFILESPEC &tfs = pd.tfs[base+i];
+		tfs = jd.tfs[i];
+		for (q = 0; q < 4; q++)
+			if (tfs.subidx[q]) tfs.subidx[q] += base;
+		if (tfs.sidx != (DWORD)-1) tfs.sidx += pd.sidx;
+		if (tfs.midx != (DWORD)-1) tfs.midx += pd.midx;
+	}
+	pd.ntile += jd.ntile-1;
+	pd.ntot += jd.ntot;
+	pd.sout += jd.sout;
+	pd.mout += jd.mout;
+	pd.sidx += jd.sidx;
+	pd.midx += jd.midx;
+	delete []jd.tfs;
+
+	AppendFile (pd.texf, job.texname);
+	if (pd.mtexf) AppendFile (pd.mtexf, job.mtexname);
+}
+
+void AppendFile (FILE *ftgt, const char *srcname)
+{
+	// Append the contents of a temporary file to ftgt and delete it
+	const size_t bufsize = 1 << 20;
+	BYTE *buf = new BYTE[bufsize];
+	size_t n;
+	FILE *fsrc = fopen (srcname, "rb");
+	if (!fsrc) FatalError ("Could not open temporary texture file.");
+	while (n = fread (buf, 1, bufsize, fsrc))
+		fwrite (buf, 1, n, ftgt);
+	fclose (fsrc);
+	remove (srcname);
+	delete []buf;
+}
+
+int MaxLocalLevel (LONG maph, double latrange)
+{
+	// Highest resolution level supported by a bitmap of height maph
+	// covering latrange degrees of latitude
+	const double eps = 1e-8;
+	const double scl9 = 4096.0/180.0;
+	double scl = (double)maph/latrange;
+	int maxlvl = 8;
+	while (scl >= 2.0*scl9-eps) {
+		maxlvl++;
+		scl *= 0.5;
+	}
+	return min ((int)MAXLEVEL, maxlvl); // max. currently supported level
+}
+
+void WriteSyntheticMaps (const char *const *name, LONG w, LONG h)
+{
+	// Write a global surface map, land-water mask and city light map of
+	// size w x h, one row at a time. The coastlines are given by a sum of
+	// sine waves, and the surface and lights carry pixel noise, so the
+	// tiles are of all types and not trivially compressible.
+	const double pi = 3.14159265358979;
+	const int nwave = 4; // the last wave places the cities
+	const double flng[nwave] = {3, 11, 37, 53}, flat[nwave] = {2, 7, 23, 41}, amp[nwave-1] = {1.0, 0.5, 0.25};
+	BITMAPFILEHEADER bmfh;
+	BITMAPINFOHEADER bmih;
+	FILE *f[3];
+	LONG x, y;
+	int i, k;
+
+	// sin(a*lng + b*lat) = sin(a*lng)cos(b*lat) + cos(a*lng)sin(b*lat)
+	vector<double> csin(nwave*w), ccos(nwave*w);
+	for (x = 0; x < w; x++) {
+		double lng = ((x+0.5)/w*2.0 - 1.0) * pi;
+		for (k = 0; k < nwave; k++) {
+			csin[k*w+x] = sin (flng[k]*lng);
+			ccos[k*w+x] = cos (flng[k]*lng);
+		}
+	}
+	vector<RGB> row[3];
+	SetOutputHeader (bmfh, bmih, w, h);
+	for (i = 0; i < 3; i++) {
+		char cbuf[256];
+		sprintf (cbuf, "%s.bmp", name[i]);
+		if (!(f[i] = fopen (cbuf, "wb"))) FatalError ("Could not open synthetic bitmap file.");
+		fwrite (&bmfh, sizeof(BITMAPFILEHEADER), 1, f[i]);
+		fwrite (&bmih, sizeof(BITMAPINFOHEADER), 1, f[i]);
+		row[i].resize (w);
+	}
+	for (y = 0; y < h; y++) {  // bottom-up: row 0 is at latitude -90
+		double lat = ((y+0.5)/h - 0.5) * pi, rsin[nwave], rcos[nwave];
+		for (k = 0; k < nwave; k++) {
+			rsin[k] = sin (flat[k]*lat);
+			rcos[k] = cos (flat[k]*lat);
+		}
+		for (x = 0; x < w; x++) {
+			double land = 0.2;
+			for (k = 0; k < nwave-1; k++)
+				land += amp[k] * (csin[k*w+x]*rcos[k] + ccos[k*w+x]*rsin[k]);
+			bool city = (csin[(nwave-1)*w+x]*rsin[nwave-1] > 0.6);
+			DWORD n = ((DWORD)x*73856093u ^ (DWORD)y*19349663u) * 2654435761u >> 24;
+			RGB &s = row[0][x], &m = row[1][x], &l = row[2][x];
+			if (land > 0.0) {
+				s.r = (BYTE)(110 + n/8); s.g = (BYTE)(90 + n/8); s.b = (BYTE)(60 + n/16);
+				m.r = m.g = m.b = 0;
+				l.r = l.g = l.b = (city && (n & 3) ? (BYTE)(128 + n/2) : 0);
+			} else {
+				s.r = 20; s.g = (BYTE)(40 + n/16); s.b = (BYTE)(90 + n/16);
+				m.r = m.g = m.b = 255;
+				l.r = l.g = l.b = 0;
 			}
 		}
+		for (i = 0; i < 3; i++)
+			fwrite (row[i].data(), sizeof(RGB), w, f[i]);
 	}
-	return bIsTile;
+	for (i = 0; i < 3; i++)
+		fclose (f[i]);
+}
+
+bool SameFile (const char *name1, const char *name2)
+{
+	const size_t bufsize = 1 << 20;
+	BYTE *buf1 = new BYTE[bufsize], *buf2 = new BYTE[bufsize];
+	FILE *f1 = fopen (name1, "rb"), *f2 = fopen (name2, "rb");
+	bool same = (f1 && f2);
+	while (same) {
+		size_t n1 = fread (buf1, 1, bufsize, f1), n2 = fread (buf2, 1, bufsize, f2);
+		if (n1 != n2 || memcmp (buf1, buf2, n1)) same = false;
+		else if (!n1) break;
+	}
+	if (f1) fclose (f1);
+	if (f2) fclose (f2);
+	delete []buf1;
+	delete []buf2;
+	return same;
+}
+
+void Benchmark (LONG w, LONG h, int lvl)
+{
+	// Generate levels 9 to lvl of a synthetic global map of size w x h, once
+	// with a single worker thread and once with the -t thread count, report
+	// the wall-clock times, and check that both runs give the same output
+	static const char *name[3] = {"bench_surf", "bench_mask", "bench_lights"};
+	static const char *ext[3] = {"_tile.bin", "_tile.tex", "_tile_lmask.tex"};
+	char cbuf[256], cbuf2[256];
+	int i, run, nthread[2] = {1, WorkerGroup::NumThreads (g_nthread)};
+	double t[2];
+	bool same = true;
+
+	int maxlvl = MaxLocalLevel (h, 180.0);
+	if (w != 2*h) FatalError ("Benchmark bitmap width must be twice its height");
+	if (lvl < 9 || lvl > maxlvl) FatalError ("Benchmark level not supported by bitmap size");
+	cout << "Writing synthetic " << w << " x " << h << " bitmaps ..." << endl;
+	WriteSyntheticMaps (name, w, h);
+
+	for (run = 0; run < 2; run++) {
+		// answer the CreateLocalArea prompts: global coverage, land-water mask, city lights, mipmaps
+		ostringstream answer;
+		answer << "-180 180\n-90 90\nB\n" << name[1] << "\n0.2\nY\n1.0\nY\n" << name[2] << "\n0.1\n";
+		if (maxlvl > 9) answer << lvl << "\n";
+		answer << "Y\n";
+		istringstream in (answer.str());
+		streambuf *cinbuf = cin.rdbuf (in.rdbuf());
+		g_nthread = nthread[run];
+		strcpy (g_fname, name[0]);
+		auto t0 = chrono::steady_clock::now();
+		CreateLocalArea ();
+		t[run] = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		cin.rdbuf (cinbuf);
+		for (i = 0; i < 3; i++) {
+			sprintf (cbuf, "%s%s", name[0], ext[i]);
+			sprintf (cbuf2, "%s_run%d%s", name[0], run, ext[i]);
+			remove (cbuf2);
+			rename (cbuf, cbuf2);
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		sprintf (cbuf, "%s_run0%s", name[0], ext[i]);
+		sprintf (cbuf2, "%s_run1%s", name[0], ext[i]);
+		if (!SameFile (cbuf, cbuf2)) same = false;
+	}
+
+	cout << endl << "Levels 9-" << lvl << " of a " << w << " x " << h << " map:" << endl;
+	cout << setprecision(1) << fixed;
+	for (run = 0; run < 2; run++)
+		cout << setw(4) << nthread[run] << (nthread[run] == 1 ? " thread:  " : " threads: ") << setw(8) << t[run] << " s" << endl;
+	cout << "Speedup: " << setprecision(2) << t[0]/t[1] << endl;
+	cout << (same ? "Outputs are identical." : "Outputs differ!") << endl;
 }
 
 void SortTextures (char *rootname)
@@ -2100,7 +2438,7 @@ void ExtractPatchRotated (int nch, BYTE *src, LONG srcw, LONG srch, LONG x0, LON
 }
 
 void SamplePatch (RGB *img, LONG imgw, LONG imgh, double maplng0, double maplng1, double maplat0, double maplat1,
-				  RGB *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which)
+				  RGB *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which, LONG row0)
 {
 	const double eps = 1e-10;
 	LONG i, j;
@@ -2108,6 +2446,7 @@ void SamplePatch (RGB *img, LONG imgw, LONG imgh, double maplng0, double maplng1
 	double tgt_dlng = (tgtlng1-tgtlng0)/tgtw;
 	double x, y, lng, lat, latw0, latw1, lngw0, lngw1, sum;
 	int x0, x1, y0, y1, ch, idx;
+	RGB *line0, *line1;
 	for (j = 0; j < tgth; j++) {
 		lat = tgtlat0 + tgt_dlat * (j+0.5);
 		y = (lat-maplat0)/(maplat1-maplat0)*imgh;
@@ -2119,6 +2458,8 @@ void SamplePatch (RGB *img, LONG imgw, LONG imgh, double maplng0, double maplng1
 		} else {
 			y1 = y0+1; latw1 = y-0.5-y0; latw0 = 1.0-latw1;
 		}
+		line0 = img + (y0-row0)*imgw;
+		line1 = img + (y1-row0)*imgw;
 		for (i = 0; i < tgtw; i++) {
 			lng = tgtlng0 + tgt_dlng * (i+0.5);
 			x = (lng-maplng0)/(maplng1-maplng0)*imgw;
@@ -2135,10 +2476,10 @@ void SamplePatch (RGB *img, LONG imgw, LONG imgh, double maplng0, double maplng1
 			else
 				idx = tgtw*tgth - (j*tgtw+i) - 1;
 			for (ch = 0; ch < 3; ch++) {
-				sum =  img[y0*imgw+x0].data[ch] * latw0*lngw0;
-				sum += img[y0*imgw+x1].data[ch] * latw0*lngw1;
-				sum += img[y1*imgw+x0].data[ch] * latw1*lngw0;
-				sum += img[y1*imgw+x1].data[ch] * latw1*lngw1;
+				sum =  line0[x0].data[ch] * latw0*lngw0;
+				sum += line0[x1].data[ch] * latw0*lngw1;
+				sum += line1[x0].data[ch] * latw1*lngw0;
+				sum += line1[x1].data[ch] * latw1*lngw1;
 				tgt[idx].data[ch] = (int)(sum+0.5);
 			}
 		}
@@ -2146,7 +2487,7 @@ void SamplePatch (RGB *img, LONG imgw, LONG imgh, double maplng0, double maplng1
 }
 
 void SampleAPatch (Alpha *img, LONG imgw, LONG imgh, double maplng0, double maplng1, double maplat0, double maplat1,
-				   Alpha *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which)
+				   Alpha *tgt, LONG tgtw, LONG tgth, double tgtlng0, double tgtlng1, double tgtlat0, double tgtlat1, int which, LONG row0)
 {
 	const double eps = 1e-10;
 	LONG i, j;
@@ -2154,6 +2495,7 @@ void SampleAPatch (Alpha *img, LONG imgw, LONG imgh, double maplng0, double mapl
 	double tgt_dlng = (tgtlng1-tgtlng0)/tgtw;
 	double x, y, lng, lat, latw0, latw1, lngw0, lngw1, sum;
 	int x0, x1, y0, y1, idx;
+	Alpha *line0, *line1;
 	for (j = 0; j < tgth; j++) {
 		lat = tgtlat0 + tgt_dlat * (j+0.5);
 		y = (lat-maplat0)/(maplat1-maplat0)*imgh;
@@ -2165,6 +2507,8 @@ void SampleAPatch (Alpha *img, LONG imgw, LONG imgh, double maplng0, double mapl
 		} else {
 			y1 = y0+1; latw1 = y-0.5-y0; latw0 = 1.0-latw1;
 		}
+		line0 = img + (y0-row0)*imgw;
+		line1 = img + (y1-row0)*imgw;
 		for (i = 0; i < tgtw; i++) {
 			lng = tgtlng0 + tgt_dlng * (i+0.5);
 			x = (lng-maplng0)/(maplng1-maplng0)*imgw;
@@ -2180,10 +2524,10 @@ void SampleAPatch (Alpha *img, LONG imgw, LONG imgh, double maplng0, double mapl
 				idx = j*tgtw+i;
 			else
 				idx = tgtw*tgth - (j*tgtw+i) - 1;
-			sum =  img[y0*imgw+x0] * latw0*lngw0;
-			sum += img[y0*imgw+x1] * latw0*lngw1;
-			sum += img[y1*imgw+x0] * latw1*lngw0;
-			sum += img[y1*imgw+x1] * latw1*lngw1;
+			sum =  line0[x0] * latw0*lngw0;
+			sum += line0[x1] * latw0*lngw1;
+			sum += line1[x0] * latw1*lngw0;
+			sum += line1[x1] * latw1*lngw1;
 			tgt[idx] = (int)(sum+0.5);
 		}
 	}
@@ -2212,18 +2556,13 @@ void ErodeLights (RGB *limg, Alpha *aimg, LONG imgw, LONG imgh)
 
 DWORD CatDDS (FILE *texf, RGB *img, Alpha *aimg, LONG imgw, LONG imgh, bool force, bool mipmap)
 {
-	const char *bmpname  = "tmp.bmp";
-	const char *abmpname = "tmp_a.bmp";
-	const char *ddsname  = "tmp.dds";
+	char bmpname[32], abmpname[32], ddsname[32];
+	sprintf (bmpname, "tmp%s.bmp", WorkerGroup::TmpId());
+	sprintf (abmpname, "tmp%s_a.bmp", WorkerGroup::TmpId());
+	sprintf (ddsname, "tmp%s.dds", WorkerGroup::TmpId());
 
-	static RGB *rgbdummy = 0;
-	if (!img) {
-		if (!rgbdummy) {
-			rgbdummy = new RGB[PS*PS];
-			memset (rgbdummy, 0, sizeof(RGB)*PS*PS);
-		}
-		img = rgbdummy;
-	}
+	static RGB *rgbdummy = new RGB[PS*PS](); // black patch
+	if (!img) img = rgbdummy;
 
 	FILE *bmpf;
 	BITMAPFILEHEADER bmfh;
@@ -2561,8 +2900,7 @@ RGB *ReadBMP_band (char *fname, LONG &mapw, LONG &maph, WORD &bpp, LONG line0, L
 	switch (bpp) {
 	case 8: {
 		BYTE *line = new BYTE[mapw];
-		for (j = 0; j < line0; j++)
-			fread (line, 1, mapw, fbmp); // skip these lines
+		_fseeki64 (fbmp, bmfh.bfOffBits + (__int64)line0*mapw, SEEK_SET); // skip these lines
 		for (j = 0; j < nlines; j++) {
 			fread (line, 1, mapw, fbmp);
 			for (i = 0; i < mapw; i++) {
@@ -2575,8 +2913,7 @@ RGB *ReadBMP_band (char *fname, LONG &mapw, LONG &maph, WORD &bpp, LONG line0, L
 		}
 		break;
 	case 24:
-		for (j = 0; j < line0; j++)
-			fread (img, sizeof(RGB), mapw, fbmp); // skip these lines
+		_fseeki64 (fbmp, bmfh.bfOffBits + (__int64)line0*mapw*sizeof(RGB), SEEK_SET); // skip these lines
 		for (j = 0; j < nlines; j++)
 			fread (img+j*mapw, sizeof(RGB), mapw, fbmp);
 		break;
@@ -2677,8 +3014,7 @@ Alpha *ReadBMPAlpha_band (char *fname, LONG &mapw, LONG &maph, WORD &bpp, LONG l
 	switch (bpp) {
 	case 8: {
 		BYTE *line = new BYTE[mapw];
-		for (j = 0; j < line0; j++)
-			fread (line, 1, mapw, fbmp); // skip these lines
+		_fseeki64 (fbmp, bmfh.bfOffBits + (__int64)line0*mapw, SEEK_SET); // skip these lines
 		for (j = 0; j < nlines; j++) {
 			fread (line, 1, mapw, fbmp);
 			for (i = 0; i < mapw; i++) {
@@ -2688,16 +3024,16 @@ Alpha *ReadBMPAlpha_band (char *fname, LONG &mapw, LONG &maph, WORD &bpp, LONG l
 		delete []line;
 		}
 		break;
-	case 24:
-		RGB rgb;
-		for (j = 0; j < line0; j++)
+	case 24: {
+		RGB *line = new RGB[mapw];
+		_fseeki64 (fbmp, bmfh.bfOffBits + (__int64)line0*mapw*sizeof(RGB), SEEK_SET); // skip these lines
+		for (j = 0; j < nlines; j++) {
+			fread (line, sizeof(RGB), mapw, fbmp);
 			for (i = 0; i < mapw; i++)
-				fread (&rgb, sizeof(RGB), 1, fbmp); // skip these lines
-		for (j = 0; j < nlines; j++)
-			for (i = 0; i < mapw; i++) {
-				fread (&rgb, sizeof(RGB), 1, fbmp);
-				aimg[j*mapw+i] = rgb.b;
-			}
+				aimg[j*mapw+i] = line[i].b;
+		}
+		delete []line;
+		}
 		break;
 	default:
 		FatalError ("Unsupported source colour depth");
@@ -0,0 +1,338 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// cfgbench
+// Config lookup benchmark. Loads the vessel class configurations of all
+// vessels in a scenario as Orbiter does (opening the class file and its
+// base classes, and querying the generic vessel caps and all the items
+// defined in the files), once with the item scan of the previous parser
+// and once with IndexedIfstream. Reports the time of both, and checks
+// that both return identical results and leave the streams at identical
+// positions.
+//
+// Usage: cfgbench <orbiter root> <scenario> [-n <passes>]
+//        cfgbench -g <nvessel> <dir>
+//   <scenario>: scenario file path, relative to <orbiter root>
+//   -n: number of passes (default: 3)
+//   -g: write a test set of <nvessel> vessel classes to <dir>/Config/Vessels,
+//       and a scenario containing one vessel of each class to
+//       <dir>/Scenarios/CfgBench.scn
+//
+// Builds with the Utils tools, or standalone on Linux with
+//   g++ -O2 -D_stricmp=strcasecmp -D_strnicmp=strncasecmp -I../../Src/Orbiter cfgbench.cpp ../../Src/Orbiter/IndexedStream.cpp
+// =======================================================================
+
+#include "IndexedStream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#ifdef _WIN32
+#include <direct.h>
+#define MakeDir(path) _mkdir (path)
+#else
+#include <sys/stat.h>
+#define MakeDir(path) mkdir (path, 0755)
+#endif
+
+using namespace std;
+
+// generic vessel caps queried by Vessel and RigidBody for every vessel
+static const char *genericcap[] = {
+	"Module", "BaseClass", "Name", "Mass", "Size", "AlbedoRGB", "MeshName", "CollisionHull",
+	"Help", "EnableXPDR", "XPDR", "MaxFuel", "MaxMainThrust", "MaxRetroThrust", "MaxHoverThrust",
+	"MaxAttitudeThrust", "TouchdownPoints", "COG_OverGround", "CW", "CrossSections", "RotResistance",
+	"CameraOffset", "DockRef", "DockDir", "DockRot", "AttRefX00", "AttRefX01", "AttRefX10",
+	"AttRefX11", "AttRefY00", "AttRefY01", "AttRefY10", "AttRefY11", "AttRefZ00", "AttRefZ01",
+	"AttRefZ10", "AttRefZ11", "Inertia", "GravityGradientDamping", "EditorModule", 0
+};
+
+// sections queried by Vessel
+static const char *genericsec[] = { "BEGIN_DOCKLIST", "BEGIN_ATTACHMENT", 0 };
+
+// =======================================================================
+// Item and line scans of the previous parser (Config.cpp)
+
+static char *trim_string (char *cbuf)
+{
+	char *c;
+	for (c = cbuf; *c; c++) {
+		if (*c == ';') {
+			*c = '\0';
+			break;
+		}
+	}
+	for (--c; c >= cbuf; c--) {
+		if (*c == ' ' || *c == '\t') *c = '\0';
+		else break;
+	}
+	for (c = cbuf; *c; c++)
+		if (*c != ' ' && *c != '\t') return c;
+	return c;
+}
+
+static bool ScanItemString (istream &is, const char *label, char *val)
+{
+	char cbuf[512], *cl, *cv;
+	int i;
+
+	is.clear();
+	is.seekg (0, ios::beg);
+
+	while (is.getline (cbuf, 512)) {
+		cl = trim_string(cbuf);
+		if (!_stricmp(cl, "END_PARSE")) return false;
+
+		for (i = 0; cl[i] && cl[i] != '='; i++);
+		cv = (cl[i] ? cl+(i+1) : cl+i);
+		for (cl[i--] = '\0'; i >= 0 && (cl[i] == ' ' || cl[i] == '\t'); i--)
+			cl[i] = '\0';
+		if (!_stricmp (cl, label)) {
+			while (*cv == ' ' || *cv == '\t') cv++;
+			if (*cv) {
+				strcpy (val, cv);
+				return true;
+			} else {
+				return false;
+			}
+		}
+	}
+
+	is.clear();
+	return false;
+}
+
+static bool ScanLine (istream &is, const char *line)
+{
+	static char cbuf[1024];
+	bool ok = false;
+	is.seekg (0);
+	if (is.good()) {
+		int len = strlen(line);
+		for (;;) {
+			if (!is.getline (cbuf, 1024)) {
+				if (is.eof()) break;
+				else is.clear();
+			}
+			if (!_strnicmp (cbuf, line, len)) {
+				ok = true;
+				break;
+			}
+		}
+	}
+	if (!ok) {
+		is.clear();
+		is.seekg(0);
+	}
+	return ok;
+}
+
+// =======================================================================
+
+struct CLASSFILE {
+	string path;                     // class file path
+	vector<string> label;            // labels queried in this file
+};
+
+struct VESSELCFG {
+	vector<CLASSFILE> file;          // class file, followed by its base classes
+};
+
+static bool FileExists (const string &path)
+{
+	FILE *f = fopen (path.c_str(), "rt");
+	if (f) fclose (f);
+	return f != 0;
+}
+
+static string ConfigPath (const string &root, const string &name)
+{
+	string path = root + "/Config/" + name + ".cfg";
+	for (size_t i = 0; i < path.size(); i++)
+		if (path[i] == '\\') path[i] = '/';
+	return path;
+}
+
+// collect the class file of a vessel class and its base classes, with
+// all labels to be queried in each
+static bool SetupVessel (const string &root, const string &classname, VESSELCFG &vc)
+{
+	string path = ConfigPath (root, "Vessels/" + classname);
+	if (!FileExists (path)) path = ConfigPath (root, classname);
+	while (FileExists (path) && vc.file.size() < 16) {
+		CLASSFILE cf;
+		cf.path = path;
+		char cbuf[512], *cl;
+		int i;
+		for (i = 0; genericcap[i]; i++) cf.label.push_back (genericcap[i]);
+		ifstream ifs (path.c_str());
+		while (ifs.getline (cbuf, 512)) {
+			cl = trim_string (cbuf);
+			for (i = 0; cl[i] && cl[i] != '='; i++);
+			if (!cl[i]) continue;
+			for (cl[i--] = '\0'; i >= 0 && (cl[i] == ' ' || cl[i] == '\t'); i--) cl[i] = '\0';
+			cf.label.push_back (cl);
+		}
+		vc.file.push_back (cf);
+		ifstream cfg (path.c_str());
+		if (!ScanItemString (cfg, "BaseClass", cbuf)) break;
+		path = ConfigPath (root, cbuf);
+	}
+	return vc.file.size() > 0;
+}
+
+// =======================================================================
+// Query all items and sections of the class files of a vessel. If 'res' is
+// provided, the results and the stream states after each query are appended
+// to it for comparison.
+
+static bool GetItem (ifstream &ifs, const char *label, char *val) { return ScanItemString (ifs, label, val); }
+static bool GetItem (IndexedIfstream &ifs, const char *label, char *val) { return ifs.GetItemString (label, val); }
+static bool FindSection (ifstream &ifs, const char *line) { return ScanLine (ifs, line); }
+static bool FindSection (IndexedIfstream &ifs, const char *line) { return ifs.FindLine (line); }
+
+static void AddResult (string *res, bool found, const char *val, istream &is)
+{
+	if (!res) return;
+	*res += (found ? val : "-");
+	*res += ' ' + to_string ((int)is.rdstate()) + ' ' + to_string ((long long)is.tellg()) + '\n';
+	is.clear (is.rdstate() & ~ios::failbit); // undo tellg failure at EOF
+}
+
+template<class STREAM>
+static void LoadVessel (const VESSELCFG &vc, string *res)
+{
+	char cbuf[512];
+	for (size_t i = 0; i < vc.file.size(); i++) {
+		const CLASSFILE &cf = vc.file[i];
+		STREAM ifs (cf.path.c_str());
+		for (size_t j = 0; j < cf.label.size(); j++) {
+			bool found = GetItem (ifs, cf.label[j].c_str(), cbuf);
+			AddResult (res, found, cbuf, ifs);
+		}
+		for (size_t j = 0; genericsec[j]; j++) {
+			bool found = FindSection (ifs, genericsec[j]);
+			AddResult (res, found, "+", ifs);
+		}
+	}
+}
+
+// =======================================================================
+
+static int Generate (int nvessel, const string &dir)
+{
+	const char *subdir[4] = { "", "/Config", "/Config/Vessels", "/Scenarios" };
+	int i, j;
+	for (i = 0; i < 4; i++)
+		MakeDir ((dir + subdir[i]).c_str());
+	for (i = 0; i < nvessel; i++) {
+		char name[256];
+		sprintf (name, "%s/Config/Vessels/CfgBench%03d.cfg", dir.c_str(), i);
+		FILE *f = fopen (name, "wt");
+		if (!f) {
+			fprintf (stderr, "Could not write %s\n", name);
+			return 1;
+		}
+		fprintf (f, "; === Configuration file for vessel class CfgBench%03d ===\n", i);
+		fprintf (f, "ClassName = CfgBench%03d\nMeshName = CfgBench\nSize = %d.0\nMass = %d\n", i, 10+i%50, 1000+i);
+		fprintf (f, "Inertia = 10.0 12.0 8.0\nCrossSections = 20.0 30.0 15.0\nEnableXPDR = TRUE\nXPDR = %d\n", 400+i);
+		fprintf (f, "\n; === Module parameters ===\n");
+		for (j = 0; j < 60; j++)
+			fprintf (f, "Param%02d = %d %0.3f  ; module parameter %d\n", j, i+j, 0.5*j, j);
+		fprintf (f, "\n; === Docking ports ===\nBEGIN_DOCKLIST\n0 0 5   0 0 1   0 1 0\nEND_DOCKLIST\n");
+		fclose (f);
+	}
+	string scn = dir + "/Scenarios/CfgBench.scn";
+	FILE *f = fopen (scn.c_str(), "wt");
+	if (!f) {
+		fprintf (stderr, "Could not write %s\n", scn.c_str());
+		return 1;
+	}
+	fprintf (f, "BEGIN_DESC\nConfig lookup benchmark scenario with %d vessels\nEND_DESC\n\nBEGIN_SHIPS\n", nvessel);
+	for (i = 0; i < nvessel; i++)
+		fprintf (f, "Vessel%03d:CfgBench%03d\n  STATUS Orbiting Earth\n  RPOS %d 0 7000000\n  RVEL 0 7500 0\nEND\n", i, i, 100*i);
+	fprintf (f, "END_SHIPS\n");
+	fclose (f);
+	printf ("Wrote %d vessel classes and scenario %s\n", nvessel, scn.c_str());
+	return 0;
+}
+
+// =======================================================================
+
+int main (int argc, char *argv[])
+{
+	const char *root = 0, *scn = 0;
+	int i, npass = 3;
+
+	if (argc == 4 && !strcmp (argv[1], "-g"))
+		return Generate (atoi (argv[2]), argv[3]);
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "-n") && i < argc-1) npass = atoi (argv[++i]);
+		else if (!root) root = argv[i];
+		else scn = argv[i];
+	}
+	if (!root || !scn || npass < 1) {
+		fprintf (stderr, "Usage: cfgbench <orbiter root> <scenario> [-n <passes>]\n");
+		fprintf (stderr, "       cfgbench -g <nvessel> <dir>\n");
+		return 1;
+	}
+
+	// read the vessel list from the scenario
+	string scnpath = string(root) + "/" + scn;
+	ifstream ifs (scnpath.c_str());
+	if (!ifs) {
+		fprintf (stderr, "Could not open %s\n", scnpath.c_str());
+		return 1;
+	}
+	vector<VESSELCFG> vessel;
+	size_t nfile = 0, nlabel = 0;
+	char cbuf[1024];
+	if (ScanLine (ifs, "BEGIN_SHIPS")) {
+		while (ifs.getline (cbuf, 1024)) {
+			char *line = trim_string (cbuf);
+			if (!_strnicmp (line, "END_SHIPS", 9)) break;
+			char *classname = strchr (line, ':');
+			classname = (classname ? classname+1 : line);
+			VESSELCFG vc;
+			if (SetupVessel (root, classname, vc)) {
+				for (i = 0; i < (int)vc.file.size(); i++) nlabel += vc.file[i].label.size();
+				nfile += vc.file.size();
+				vessel.push_back (vc);
+			} else
+				fprintf (stderr, "No class file for %s\n", line);
+			while (ifs.getline (cbuf, 1024) && _strnicmp (trim_string (cbuf), "END", 3));
+		}
+	}
+	printf ("%d vessels, %d class files, %d item queries\n", (int)vessel.size(), (int)nfile, (int)nlabel);
+	if (!vessel.size()) return 1;
+
+	// check that both parsers return the same results
+	string res[2];
+	for (size_t j = 0; j < vessel.size(); j++) {
+		LoadVessel<ifstream> (vessel[j], &res[0]);
+		LoadVessel<IndexedIfstream> (vessel[j], &res[1]);
+	}
+	if (res[0] != res[1]) {
+		printf ("Results of the scan and indexed lookups are DIFFERENT\n");
+		return 1;
+	}
+	printf ("Results of the scan and indexed lookups are identical\n");
+
+	for (i = 0; i < npass; i++) {
+		double dt[2];
+		for (int k = 0; k < 2; k++) {
+			auto t0 = chrono::steady_clock::now();
+			for (size_t j = 0; j < vessel.size(); j++) {
+				if (k) LoadVessel<IndexedIfstream> (vessel[j], 0);
+				else   LoadVessel<ifstream> (vessel[j], 0);
+			}
+			dt[k] = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		}
+		printf ("pass %d: scan %0.3f s, indexed %0.3f s (x%0.1f)\n", i+1, dt[0], dt[1], dt[0]/dt[1]);
+	}
+	return 0;
+}
@@ -0,0 +1,198 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// frecconv
+// Flight recorder stream converter. Converts the binary vessel streams
+// (.frb) written by the flight recorder into the text streams (.pos, .att,
+// .atc) of earlier Orbiter versions, e.g. for inspection or editing, and
+// text streams into binary streams, which playback reads in preference
+// to the text streams.
+//
+// Usage: frecconv -t <recording dir>
+//        frecconv -b <recording dir>
+//        frecconv -s <nvessel> <nstep> <dir>
+//   -t: write the text streams for all binary streams in the directory
+//   -b: write the binary streams for all text streams in the directory
+//   -s: record <nstep> synthetic samples for <nvessel> vessels into <dir>,
+//       once appending each sample to the text streams as the previous
+//       recorder did, and once through FRecWriter. Reports the recording
+//       cost per time step of both, and checks that the binary streams
+//       convert into identical text streams.
+//   <recording dir>: e.g. Flights\<recording name>
+// =======================================================================
+
+#include "FRecStream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <io.h>
+#include <direct.h>
+#include <chrono>
+#include <iomanip>
+
+using namespace std;
+
+static double Now ()
+{
+	return chrono::duration<double> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// =======================================================================
+// Base names (path without extension) of all files with extension 'ext'
+// in directory 'dir'
+
+static void FindStreams (const char *dir, const char *ext, vector<string> &list)
+{
+	struct _finddata_t fd;
+	string pattern = string(dir) + "\\*." + ext;
+	intptr_t handle = _findfirst (pattern.c_str(), &fd);
+	if (handle == -1) return;
+	do {
+		if (fd.attrib & _A_SUBDIR) continue;
+		string name (fd.name);
+		list.push_back (string(dir) + "\\" + name.substr (0, name.size()-strlen(ext)-1));
+	} while (!_findnext (handle, &fd));
+	_findclose (handle);
+}
+
+// =======================================================================
+
+static int Convert (const char *dir, bool totext)
+{
+	vector<string> list;
+	int nfail = 0;
+	FindStreams (dir, totext ? FRECBIN_EXT : FRecStreamExt[FREC_POS], list);
+	for (size_t i = 0; i < list.size(); i++) {
+		const char *basename = list[i].c_str();
+		if (totext ? FRecBinToText (basename) : FRecTextToBin (basename)) {
+			printf ("Converted %s\n", basename);
+		} else {
+			printf ("Failed    %s\n", basename);
+			nfail++;
+		}
+	}
+	printf ("\n%d of %d vessel streams converted.\n", (int)list.size()-nfail, (int)list.size());
+	return nfail ? 1 : 0;
+}
+
+// =======================================================================
+// Synthetic recording benchmark
+
+// sample values of vessel v at step s
+static void Sample (int v, int s, double *pos, double *att)
+{
+	double simt = s*0.05;
+	double phi = 1e-3*v + 1.1e-3*s, tht = 0.1*sin (1e-2*v + 1e-4*s);
+	pos[0] = simt;
+	pos[1] = 6.771e6 + 10.0*v + 1e-2*s, pos[2] = phi, pos[3] = tht;
+	pos[4] = 0.01*sin (1e-3*s), pos[5] = 1.13e-3, pos[6] = 1e-5*cos (1e-2*v + 1e-4*s);
+	att[0] = simt;
+	att[1] = 1e-2*v, att[2] = sin (1e-3*s), att[3] = -0.5 + 1e-4*s;
+}
+
+static int Benchmark (int nvessel, int nstep, const char *dir)
+{
+	vector<double> pos(nvessel*FRECBIN_NPOS), att(nvessel*FRECBIN_NATT);
+	char fname[256];
+	int v, s, nfail = 0;
+	double t0, t1, t2;
+
+	_mkdir (dir);
+	string textdir = string(dir) + "\\text", bindir = string(dir) + "\\bin";
+	_mkdir (textdir.c_str());
+	_mkdir (bindir.c_str());
+
+	// previous recorder: open, append and close the stream for each sample
+	t0 = Now();
+	for (s = 0; s < nstep; s++) {
+		for (v = 0; v < nvessel; v++) {
+			double *p = &pos[v*FRECBIN_NPOS], *a = &att[v*FRECBIN_NATT];
+			Sample (v, s, p, a);
+			sprintf (fname, "%s\\V%04d.pos", textdir.c_str(), v);
+			ofstream ofs (fname, s ? ios::app : ios::trunc);
+			if (!s) ofs << "STARTMJD 51982.5\nREF Earth\nFRM ECLIPTIC\nCRD POLAR" << endl;
+			ofs << setprecision(10) << p[0] << ' ';
+			ofs << setprecision(12) << p[1] << ' ' << p[2] << ' ' << p[3] << ' ';
+			ofs << setprecision(10) << p[4] << ' ' << p[5] << ' ' << p[6] << endl;
+			ofs.close();
+			sprintf (fname, "%s\\V%04d.att", textdir.c_str(), v);
+			ofs.open (fname, s ? ios::app : ios::trunc);
+			if (!s) ofs << "STARTMJD 51982.5\nFRM ECLIPTIC" << endl;
+			ofs << setprecision(10) << a[0] << setprecision(6);
+			for (int i = 1; i < FRECBIN_NATT; i++) ofs << ' ' << a[i];
+			ofs << endl;
+		}
+	}
+	t1 = Now();
+	printf ("Text streams:   %8.2f us/step\n", (t1-t0)/nstep*1e6);
+
+	// binary streams through the writer thread
+	FRecWriter *writer = new FRecWriter;
+	vector<int> hstream(nvessel);
+	t0 = Now();
+	for (v = 0; v < nvessel; v++) {
+		sprintf (fname, "%s\\V%04d.%s", bindir.c_str(), v, FRECBIN_EXT);
+		hstream[v] = writer->OpenStream (fname, false);
+		writer->PutLine (hstream[v], FREC_POS, "STARTMJD 51982.5");
+		writer->PutLine (hstream[v], FREC_POS, "REF Earth");
+		writer->PutLine (hstream[v], FREC_POS, "FRM ECLIPTIC");
+		writer->PutLine (hstream[v], FREC_POS, "CRD POLAR");
+		writer->PutLine (hstream[v], FREC_ATT, "STARTMJD 51982.5");
+		writer->PutLine (hstream[v], FREC_ATT, "FRM ECLIPTIC");
+	}
+	for (s = 0; s < nstep; s++) {
+		for (v = 0; v < nvessel; v++) {
+			double *p = &pos[v*FRECBIN_NPOS], *a = &att[v*FRECBIN_NATT];
+			Sample (v, s, p, a);
+			writer->PutSample (hstream[v], FRECBIN_POS, p);
+			writer->PutSample (hstream[v], FRECBIN_ATT, a);
+		}
+	}
+	t1 = Now();
+	if (!writer->Close()) nfail++;
+	t2 = Now();
+	printf ("Binary streams: %8.2f us/step (%d records, %0.2f MB, %d waits for writer thread, %0.3f s final flush)\n",
+		(t1-t0)/nstep*1e6, writer->nRecord(), writer->nByte()/1048576.0, writer->nWait(), t2-t1);
+	delete writer;
+
+	// the binary streams must convert into the text streams
+	for (v = 0; v < nvessel; v++) {
+		sprintf (fname, "%s\\V%04d", bindir.c_str(), v);
+		if (!FRecBinToText (fname)) { nfail++; continue; }
+		for (int i = 0; i < 2; i++) {
+			string ftext = textdir + (fname + bindir.size()) + "." + FRecStreamExt[i];
+			string fbin = string(fname) + "." + FRecStreamExt[i];
+			ifstream f1 (ftext.c_str()), f2 (fbin.c_str());
+			string l1, l2;
+			bool eq = true;
+			while (eq) {
+				bool r1 = (bool)getline (f1, l1), r2 = (bool)getline (f2, l2);
+				if (r1 != r2 || (r1 && l1 != l2)) eq = false;
+				else if (!r1) break;
+			}
+			if (!eq) {
+				printf ("Stream mismatch: %s\n", fbin.c_str());
+				nfail++;
+			}
+		}
+	}
+	printf ("%s\n", nfail ? "Streams differ." : "Streams identical.");
+	return nfail ? 1 : 0;
+}
+
+// =======================================================================
+
+int main (int argc, char *argv[])
+{
+	if (argc == 3 && !strcmp (argv[1], "-t"))
+		return Convert (argv[2], true);
+	if (argc == 3 && !strcmp (argv[1], "-b"))
+		return Convert (argv[2], false);
+	if (argc == 5 && !strcmp (argv[1], "-s") && atoi (argv[2]) > 0 && atoi (argv[3]) > 0)
+		return Benchmark (atoi (argv[2]), atoi (argv[3]), argv[4]);
+
+	fprintf (stderr, "Usage: frecconv -t <recording dir>\n");
+	fprintf (stderr, "       frecconv -b <recording dir>\n");
+	fprintf (stderr, "       frecconv -s <nvessel> <nstep> <dir>\n");
+	return 1;
+}
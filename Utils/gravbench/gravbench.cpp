@@ -0,0 +1,245 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// gravbench
+// Benchmark of the spherical harmonic gravity field models (GravityField).
+// Evaluates the field at points in low orbit, truncated at degree 8, 20
+// and 70 (or the model degree, if lower), and reports the time per
+// evaluation and the largest error against the numerical gradient of the
+// potential, summed term by term with the standard Legendre recursion.
+// Also lists the degree cutoff (GravityField::Degree) at a number of
+// altitudes.
+//
+// Without a model file, a synthetic degree 70 model is used, with random
+// coefficients following Kaula's rule (RMS 1e-5/n^2 per coefficient) and
+// the radius and gravitational parameter of the Earth. The cost of an
+// evaluation does not depend on the coefficient values.
+//
+// Usage: gravbench [-f <model file>] [-k <evaluations>] [-t <tol>]
+//   -f: coefficient file in ICGEM (.gfc) format, or a plain list of
+//       "n m Cnm Snm" lines (e.g. Config/Earth/Data/EGM96.gfc)
+//   -k: number of evaluations per degree (default 200000)
+//   -t: relative acceleration threshold for the degree cutoff
+//       (GravityFieldTolerance, default 1e-10)
+// =======================================================================
+
+#include "GravField.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+static const double GMe = 3.986004415e14; // Earth gravitational parameter [m^3/s^2]
+static const double Re  = 6.3781363e6;    // Earth reference radius [m]
+
+static double Now ()
+{
+	return chrono::duration<double> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// uniform random number in [0,1)
+static double Rand1 ()
+{
+	return rand()/(RAND_MAX+1.0);
+}
+
+// =======================================================================
+// Reference potential, from a plain copy of the coefficients
+
+struct Model {
+	int nmax;
+	double GM, R;
+	vector<double> C, S;  // row-major, index n*(n+1)/2+m
+	inline int Idx (int n, int m) const { return n*(n+1)/2+m; }
+};
+
+// Read the coefficients (fully normalised only) with the file conventions
+// of GravityField::Load
+static bool ReadModel (const char *fname, int maxdeg, Model &mdl)
+{
+	FILE *f = fopen (fname, "rt");
+	if (!f) return false;
+	char line[512], *pc;
+	int n, m;
+	double c, s;
+	mdl.nmax = 0;
+	mdl.GM = GMe, mdl.R = Re;
+	mdl.C.assign ((maxdeg+1)*(maxdeg+2)/2, 0.0);
+	mdl.S.assign ((maxdeg+1)*(maxdeg+2)/2, 0.0);
+	while (fgets (line, 512, f)) {
+		for (pc = line; *pc; pc++) // Fortran-style exponents
+			if ((*pc == 'D' || *pc == 'd') && pc > line && pc[-1] >= '0' && pc[-1] <= '9') *pc = 'E';
+		for (pc = line; *pc == ' ' || *pc == '\t'; pc++);
+		if (!strncmp (pc, "gfc", 3)) {
+			if (sscanf (pc, "%*s%d%d%lf%lf", &n, &m, &c, &s) != 4) continue;
+		} else if (*pc >= '0' && *pc <= '9') {
+			if (sscanf (pc, "%d%d%lf%lf", &n, &m, &c, &s) != 4) continue;
+		} else {
+			if (!strncmp (pc, "earth_gravity_constant", 22) || !strncmp (pc, "gravity_constant", 16))
+				sscanf (pc, "%*s%lf", &mdl.GM);
+			else if (!strncmp (pc, "radius", 6))
+				sscanf (pc, "%*s%lf", &mdl.R);
+			else if (!strncmp (pc, "norm", 4) && strstr (pc+4, "unnormalized")) {
+				fclose (f);
+				return false;
+			}
+			continue;
+		}
+		if (n < 2 || n > maxdeg || m < 0 || m > n) continue;
+		mdl.C[mdl.Idx(n,m)] = c;
+		mdl.S[mdl.Idx(n,m)] = s;
+		if (n > mdl.nmax) mdl.nmax = n;
+	}
+	fclose (f);
+	return mdl.nmax >= 2;
+}
+
+// Potential of the terms of degree 2 to deg at p (body frame, z=north pole),
+// with the fully normalised associated Legendre functions from the standard
+// column recursion
+static double Potential (const Model &mdl, const Vector &p, int deg)
+{
+	double r = p.length();
+	double u = p.z/r, t = sqrt (1.0-u*u); // sin, cos of latitude
+	double lng = atan2 (p.y, p.x);
+	double q = mdl.R/r;
+	vector<double> P((deg+1)*(deg+2)/2);
+	double U = 0.0, Pmm = 1.0;
+	for (int m = 0; m <= deg; m++) {
+		if (m == 1)     Pmm = sqrt (3.0)*t;
+		else if (m > 1) Pmm *= sqrt ((2.0*m+1.0)/(2.0*m))*t;
+		P[mdl.Idx(m,m)] = Pmm;
+		if (m < deg) P[mdl.Idx(m+1,m)] = sqrt (2.0*m+3.0)*u*Pmm;
+		for (int n = m+2; n <= deg; n++) {
+			double a = sqrt ((2.0*n-1.0)*(2.0*n+1.0)/((n-m)*(double)(n+m)));
+			double b = sqrt ((2.0*n+1.0)*(n+m-1.0)*(n-m-1.0)/((n-m)*(double)(n+m)*(2.0*n-3.0)));
+			P[mdl.Idx(n,m)] = a*u*P[mdl.Idx(n-1,m)] - b*P[mdl.Idx(n-2,m)];
+		}
+	}
+	for (int n = 2; n <= deg; n++) {
+		double Un = 0.0;
+		for (int m = 0; m <= n; m++)
+			Un += P[mdl.Idx(n,m)] * (mdl.C[mdl.Idx(n,m)]*cos(m*lng) + mdl.S[mdl.Idx(n,m)]*sin(m*lng));
+		U += pow (q, n) * Un;
+	}
+	return mdl.GM/r * U;
+}
+
+// Acceleration as the central difference gradient of the potential
+static Vector GradPotential (const Model &mdl, const Vector &p, int deg)
+{
+	const double h = 10.0;
+	return Vector (
+		(Potential (mdl, p+Vector(h,0,0), deg) - Potential (mdl, p-Vector(h,0,0), deg)) / (2.0*h),
+		(Potential (mdl, p+Vector(0,h,0), deg) - Potential (mdl, p-Vector(0,h,0), deg)) / (2.0*h),
+		(Potential (mdl, p+Vector(0,0,h), deg) - Potential (mdl, p-Vector(0,0,h), deg)) / (2.0*h));
+}
+
+// =======================================================================
+
+// Write a synthetic model following Kaula's rule
+static bool WriteSyntheticModel (const char *fname, int nmax)
+{
+	FILE *f = fopen (fname, "wt");
+	if (!f) return false;
+	fprintf (f, "modelname              synthetic (Kaula's rule)\n");
+	fprintf (f, "earth_gravity_constant %0.10e\n", GMe);
+	fprintf (f, "radius                 %0.10e\n", Re);
+	fprintf (f, "max_degree             %d\n", nmax);
+	fprintf (f, "norm                   fully_normalized\n");
+	fprintf (f, "end_of_head =================================\n");
+	for (int n = 2; n <= nmax; n++)
+		for (int m = 0; m <= n; m++) {
+			double rms = 1e-5/((double)n*n)*sqrt(3.0); // uniform distribution in [-a,a]: rms a/sqrt(3)
+			double c = rms*(2.0*Rand1()-1.0);
+			double s = (m ? rms*(2.0*Rand1()-1.0) : 0.0);
+			if (n == 2 && m == 0) c = -4.84165e-4; // Earth oblateness
+			fprintf (f, "gfc %4d %4d %22.15e %22.15e\n", n, m, c, s);
+		}
+	fclose (f);
+	return true;
+}
+
+static void Usage ()
+{
+	fprintf (stderr, "Usage: gravbench [-f <model file>] [-k <evaluations>] [-t <tol>]\n");
+}
+
+int main (int argc, char *argv[])
+{
+	const char *fname = 0;
+	char tmpname[L_tmpnam];
+	long neval = 200000;
+	double tol = 1e-10;
+	const int npos = 1000;
+
+	for (int i = 1; i < argc; i++) {
+		if (i+1 < argc && !strcmp (argv[i], "-f")) fname = argv[++i];
+		else if (i+1 < argc && !strcmp (argv[i], "-k")) neval = atol (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-t")) tol = atof (argv[++i]);
+		else { Usage(); return 1; }
+	}
+	if (neval < 1 || tol <= 0) {
+		Usage(); return 1;
+	}
+
+	srand (1);
+	if (!fname) { // temporary file, removed after loading
+		if (!tmpnam (tmpname) || !WriteSyntheticModel (tmpname, 70)) {
+			fprintf (stderr, "Could not write the synthetic model\n");
+			return 1;
+		}
+		fname = tmpname;
+	}
+	GravityField gf;
+	Model mdl;
+	bool ok = gf.Load (fname, GRAVFIELD_MAXDEG, Re, GMe, tol) && ReadModel (fname, GRAVFIELD_MAXDEG, mdl);
+	if (fname == tmpname) remove (tmpname);
+	if (!ok) {
+		fprintf (stderr, "Could not read the model from %s\n", fname);
+		return 1;
+	}
+
+	// random points at 400 km altitude
+	vector<Vector> pos(npos);
+	for (int i = 0; i < npos; i++) {
+		double lng = Pi2*Rand1(), lat = asin (2.0*Rand1()-1.0), r = gf.RefRadius() + 4e5;
+		pos[i] = Vector (r*cos(lat)*cos(lng), r*cos(lat)*sin(lng), r*sin(lat));
+	}
+
+	if (fname == tmpname) fname = "synthetic";
+	printf ("Model %s: degree %d, R=%0.1f km\n\n", fname, gf.MaxDegree(), gf.RefRadius()*1e-3);
+	printf ("  %6s  %10s  %12s\n", "degree", "us/eval", "max rel.err");
+	static const int deg[3] = {8, 20, 70};
+	for (int k = 0; k < 3; k++) {
+		int d = min (deg[k], gf.MaxDegree());
+		if (k && d == min (deg[k-1], gf.MaxDegree())) break;
+
+		Vector sum;
+		double t0 = Now();
+		for (long i = 0; i < neval; i++)
+			sum += gf.Acc (pos[i%npos], d);
+		double us = (Now()-t0)*1e6/neval;
+
+		// error relative to the perturbation acceleration
+		double err = 0.0;
+		for (int i = 0; i < 100; i++) {
+			Vector a (gf.Acc (pos[i], d)), aref (GradPotential (mdl, pos[i], d));
+			double e = (a-aref).length()/aref.length();
+			if (e > err) err = e;
+		}
+		printf ("  %6d  %10.3f  %12.3e\n", d, us, err);
+		if (sum.x == 1.2345) printf ("\n"); // keep the evaluations
+	}
+
+	printf ("\nDegree cutoff at tolerance %g:\n", tol);
+	static const double alt[6] = {2e5, 4e5, 1e6, 4e6, 2e7, 3.6e7};
+	for (int i = 0; i < 6; i++)
+		printf ("  altitude %6.0f km: degree %d\n", alt[i]*1e-3, gf.Degree (gf.RefRadius()+alt[i]));
+	return 0;
+}
@@ -3,9 +3,25 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <time.h>
+#include <string>
+#include <vector>
+#include <chrono>
 #include "Mesh.h"
+#include "MeshBin.h"
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#include <psapi.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
 
 using namespace std;
 
@@ -13,6 +29,9 @@ struct Param {
 	char meshname[1024];
 	char outname[1024];
 	char suffix[256];
+	char binpath[1024];   // /B: mesh file or directory to compile into binary meshes
+	char benchpath[1024]; // /T: directory to benchmark
+	char benchmode[16];   // /M: benchmark pass run by a child process ("text" or "bin")
 };
 
 void PrintUsage()
@@ -24,6 +43,14 @@ void PrintUsage()
 	std::cout << "  <header file>: Output C header file name\n";
 	std::cout << "  <suffix>:      Variable name suffix\n\n";
 	std::cout << "Any parameters not provided on the command line are queried interactively.\n\n";
+	std::cout << "Usage: meshc /B <meshfile or directory>\n";
+	std::cout << "  Compiles the mesh file, or all mesh files in the directory and its\n";
+	std::cout << "  subdirectories, into binary meshes (." MESHBIN_EXT ") which Orbiter loads\n";
+	std::cout << "  in place of the mesh files as long as the mesh files are unchanged.\n\n";
+	std::cout << "Usage: meshc /T <directory>\n";
+	std::cout << "  Benchmarks loading all mesh files in the directory and its\n";
+	std::cout << "  subdirectories from the mesh files and from the binary meshes\n";
+	std::cout << "  (load time and peak memory).\n\n";
 }
 
 void ParseError()
@@ -38,6 +65,9 @@ void ParseArgs(int argc, char *argv[], Param *param)
 	param->meshname[0] = '\0';
 	param->outname[0] = '\0';
 	param->suffix[0] = '\0';
+	param->binpath[0] = '\0';
+	param->benchpath[0] = '\0';
+	param->benchmode[0] = '\0';
 
 	for (int i = 1; i < argc; i++) {
 		char *a = argv[i];
@@ -59,6 +89,22 @@ void ParseArgs(int argc, char *argv[], Param *param)
 				ParseError();
 			strcpy(param->suffix, argv[++i]);
 			break;
+		case 'B':
+			if (i == argc - 1)
+				ParseError();
+			strcpy(param->binpath, argv[++i]);
+			break;
+		case 'T':
+			if (i == argc - 1)
+				ParseError();
+			strcpy(param->benchpath, argv[++i]);
+			break;
+		case 'M':
+			if (i == argc - 1)
+				ParseError();
+			strncpy(param->benchmode, argv[++i], 15);
+			param->benchmode[15] = '\0';
+			break;
 		case 'H':
 			PrintUsage();
 			exit(0);
@@ -67,6 +113,181 @@ void ParseArgs(int argc, char *argv[], Param *param)
 }
 
 
+// Collect all mesh files in a directory tree (or the file itself)
+
+bool IsDirectory(const char *path)
+{
+#ifdef _WIN32
+	DWORD attr = GetFileAttributes(path);
+	return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return !stat(path, &st) && S_ISDIR(st.st_mode);
+#endif
+}
+
+bool IsMeshFile(const char *name)
+{
+	size_t n = strlen(name);
+	return n > 4 && !_strnicmp(name + n - 4, ".msh", 4);
+}
+
+void FindMeshes(const string &path, vector<string> &list)
+{
+	if (!IsDirectory(path.c_str())) {
+		list.push_back(path);
+		return;
+	}
+#ifdef _WIN32
+	_finddata_t fd;
+	intptr_t fh = _findfirst((path + "\\*").c_str(), &fd);
+	if (fh == -1) return;
+	do {
+		if (!strcmp(fd.name, ".") || !strcmp(fd.name, "..")) continue;
+		if (fd.attrib & _A_SUBDIR) FindMeshes(path + "\\" + fd.name, list);
+		else if (IsMeshFile(fd.name)) list.push_back(path + "\\" + fd.name);
+	} while (!_findnext(fh, &fd));
+	_findclose(fh);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (!dir) return;
+	while (dirent *de = readdir(dir)) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+		string name = path + "/" + de->d_name;
+		if (IsDirectory(name.c_str())) FindMeshes(name, list);
+		else if (IsMeshFile(de->d_name)) list.push_back(name);
+	}
+	closedir(dir);
+#endif
+}
+
+// Compile mesh files into binary meshes
+
+int CompileBinary(const char *path)
+{
+	vector<string> list;
+	FindMeshes(path, list);
+	int nfail = 0;
+	for (size_t i = 0; i < list.size(); i++) {
+		if (MeshBinCompile(list[i].c_str())) {
+			cout << "Compiled " << list[i] << " -> " << MeshBinName(list[i].c_str()) << endl;
+		} else {
+			cout << "Skipped " << list[i] << " (not a complete MSHX1 mesh, or write error)" << endl;
+			nfail++;
+		}
+	}
+	cout << endl << list.size() - nfail << " of " << list.size() << " mesh files compiled." << endl;
+	return 0;
+}
+
+// Benchmark: loads all meshes and keeps them in memory, like the mesh
+// manager. The text pass reads each mesh file with a stream and parses it
+// with the mesh file parser. The binary pass maps the binary mesh, checks
+// it against the mesh file (content hash) and copies the blocks into the
+// mesh arrays; meshes without an up to date binary are parsed as in the
+// text pass. Each pass runs in its own process so that the peak memory of
+// the process can be attributed to it.
+
+size_t PeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return pmc.PeakWorkingSetSize;
+#else
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (size_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+bool LoadText(const char *fname, MeshBinData &data)
+{
+	ifstream ifs(fname);
+	if (!ifs) return false;
+	ostringstream oss;
+	oss << ifs.rdbuf();
+	const string &src = oss.str();
+	return MeshBinParse(src.c_str(), src.size(), data);
+}
+
+bool LoadBinary(const char *fname, MeshBinData &data, bool &isbin)
+{
+	MeshBinFile bin;
+	if (!(isbin = (bin.Open(fname) == MeshBinFile::MESHBIN_OK)))
+		return LoadText(fname, data);
+	const MeshBinHeader &hdr = bin.Header();
+	data.grp.resize(hdr.nGrp);
+	for (DWORD g = 0; g < hdr.nGrp; g++) {
+		const MeshBinGroup &grp = bin.Group(g);
+		data.grp[g].spec = grp;
+		data.grp[g].vtx.assign(bin.Vtx(g), bin.Vtx(g) + grp.nVtx);
+		data.grp[g].idx.assign(bin.Idx(g), bin.Idx(g) + grp.nIdx);
+	}
+	data.mtrl.assign(&bin.Material(0), &bin.Material(0) + hdr.nMtrl);
+	data.tex.resize(hdr.nTex);
+	for (DWORD t = 0; t < hdr.nTex; t++) {
+		const char *name = bin.TextureName(t);
+		data.tex[t].name = (name ? name : "");
+		data.tex[t].flags = bin.Texture(t).flags;
+	}
+	return true;
+}
+
+int BenchmarkPass(const char *path, bool binary)
+{
+	const int npass = 5;
+	vector<string> list;
+	FindMeshes(path, list);
+	size_t peak0 = PeakMemory();
+	double t, tmin = 1e10;
+	int nload = 0, nbin = 0;
+	for (int pass = 0; pass < npass; pass++) {
+		vector<MeshBinData> mesh(list.size());
+		nload = nbin = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < list.size(); i++) {
+			bool ok, isbin = false;
+			if (binary) ok = LoadBinary(list[i].c_str(), mesh[i], isbin);
+			else ok = LoadText(list[i].c_str(), mesh[i]);
+			if (ok) nload++;
+			if (isbin) nbin++;
+		}
+		t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		if (t < tmin) tmin = t;
+	}
+	size_t peak1 = PeakMemory();
+	printf("%-6s: %d meshes loaded (%d from binary), best of %d: %8.2f ms, peak memory +%.2f MB\n",
+		binary ? "binary" : "text", nload, nbin, npass, tmin * 1e3, (peak1 - peak0) / 1048576.0);
+	return 0;
+}
+
+int Benchmark(const char *argv0, const char *path)
+{
+	vector<string> list;
+	FindMeshes(path, list);
+	cout << "Benchmarking " << list.size() << " mesh files in " << path << endl;
+	const char *mode[2] = { "text", "bin" };
+	for (int i = 0; i < 2; i++) {
+		cout.flush();
+#ifdef _WIN32
+		string qpath = string("\"") + path + "\"";
+		const char *args[] = { argv0, "/T", qpath.c_str(), "/M", mode[i], 0 };
+		if (_spawnv(_P_WAIT, argv0, args) != 0)
+			return 1;
+#else
+		pid_t pid = fork();
+		if (!pid) {
+			execl(argv0, argv0, "/T", path, "/M", mode[i], (char*)0);
+			_exit(1);
+		}
+		int status;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			return 1;
+#endif
+	}
+	return 0;
+}
 
 int main (int argc, char *argv[])
 {
@@ -76,12 +297,20 @@ int main (int argc, char *argv[])
 	Mesh mesh;
 	Param param;
 
+	ParseArgs(argc, argv, &param);
+
+	if (param.benchmode[0]) // benchmark pass started by Benchmark
+		return BenchmarkPass(param.benchpath, !strcmp(param.benchmode, "bin"));
+
 	cout << "+-----------------------------------------------------------------------+\n";
 	cout << "|                   meshc: Mesh compiler for ORBITER                    |\n";
 	cout << "|        Build: " << __DATE__ << "      (c) 2001-2018 Martin Schweiger         |\n";
 	cout << "+-----------------------------------------------------------------------+\n\n";
 
-	ParseArgs(argc, argv, &param);
+	if (param.benchpath[0])
+		return Benchmark(argv[0], param.benchpath);
+	if (param.binpath[0])
+		return CompileBinary(param.binpath);
 
 	if (!param.meshname[0]) {
 		cout << "Mesh file name:\n";
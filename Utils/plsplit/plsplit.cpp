@@ -9,6 +9,12 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +28,7 @@
 #include <ddraw.h>
 #include <shlobj.h>
 #include <wincodec.h>
+#include "WorkerGroup.h"
 
 using namespace std;
 
@@ -37,12 +44,18 @@ bool operator!= (const BGR &c1, const BGR &c2)
 
 typedef BYTE Alpha;
 
+struct BANDIMG { // source bitmap rows for a row of patches
+	BGR *img, *limg;
+	Alpha *aimg;
+};
+
 int PS = 512; // patch size: size of patch textures
 const char *dxtex = ".\\dxtex.exe";
 
 char g_cwd[256];
 double g_tol = 0.0;        // tolerance for suppressing opaque/transparent pixels in a tile
 int g_nsuppressed = 0;     // number of opacity/transparency suppressed tiles
+int g_nthread = 0;         // number of worker threads (0: one per processor)
 
 IWICImagingFactory *g_pIWICFactory;
 
@@ -55,12 +68,21 @@ BGR *ReadBMP (char *fname, LONG &mapw, LONG &maph, WORD &bpp);
 Alpha *ReadBMPAlpha (char *fname, LONG &mapw, LONG &maph, WORD &bpp);
 // Read water mask from blue channel of bitmap
 
+BGR *ReadBMP_band (char *fname, LONG line0, LONG nlines);
+// Read nlines rows of a BMP file, starting at row line0 (counted from the bottom of the
+// map, as stored in the file), into a BGR buffer
+
+Alpha *ReadBMPAlpha_band (char *fname, LONG line0, LONG nlines);
+// Read rows of a water mask from the blue channel of a bitmap
+
 BGR *ReadPNG (char *fname, LONG &mapw, LONG &maph, WORD &bpp);
 // Read bitmap PNG file into BGR buffer and return dimensions and max texture level
 
 DWORD WriteDDS (BGR *img, Alpha *aimg, LONG imgw, LONG imgh, const char *root,
 				const char *layer, int res, int ilng, int ilat, bool mipmap = false, bool binary_alpha = true);
 
+void PatchName (char *cbuf, const char *root, const char *layer, int lvl, int ilng, int ilat);
+
 void SetOutputHeader (BITMAPFILEHEADER &bmfh, BITMAPINFOHEADER &bmih, LONG w, LONG h);
 
 void FatalError (char *msg);
@@ -69,6 +91,7 @@ void SetProgress (int p);
 void IncProgress ();
 
 bool MakePath (const char *fname);
+void FreeBand (BANDIMG &bd);
 
 void SplitBitmap ();
 void SplitBitmap_cloud ();
@@ -80,6 +103,9 @@ int main (int argc, char *argv[])
 	if (!_getcwd (g_cwd, 256)) FatalError ("Cannot get working directory");
 	strcat (g_cwd, "\\");
 
+	for (int i = 1; i < argc-1; i++)
+		if (!strcmp (argv[i], "-t")) g_nthread = atoi (argv[++i]);
+
     // Create WIC factory for formatted image output
     HRESULT hr = CoCreateInstance (
         CLSID_WICImagingFactory,
@@ -255,6 +281,76 @@ Alpha *ReadBMPAlpha (char *fname, LONG &mapw, LONG &maph, WORD &bpp)
 
 // ==============================================================================
 
+BGR *ReadBMP_band (char *fname, LONG line0, LONG nlines)
+{
+	char *id;
+	FILE *fbmp;
+	BITMAPFILEHEADER bmfh;
+	BITMAPINFO *bmi;
+	LONG i, j, mapw;
+	BGR *img;
+
+	fbmp = fopen (fname, "rb");
+	if (!fbmp) FatalError ("Input file not found");
+	if (!fread (&bmfh, sizeof (BITMAPFILEHEADER), 1, fbmp))
+		FatalError ("Cannot read bitmap file header");
+	id = (char*)&bmfh.bfType;
+	if (id[0] != 'B' || id[1] != 'M') FatalError ("Wrong input file format");
+
+	BYTE *tmp = new BYTE[bmfh.bfOffBits];
+	fread (tmp, 1, bmfh.bfOffBits-sizeof(BITMAPFILEHEADER), fbmp);
+	bmi = (BITMAPINFO*)tmp;
+
+	if (line0 < 0 || line0+nlines > bmi->bmiHeader.biHeight) FatalError ("Error extracting bitmap band");
+	if (bmi->bmiHeader.biCompression != BI_RGB)
+		FatalError ("Cannot process compressed source bitmaps");
+
+	mapw = bmi->bmiHeader.biWidth;
+	img = new BGR[mapw*nlines];
+	switch (bmi->bmiHeader.biBitCount) {
+	case 8: {
+		BYTE *line = new BYTE[mapw];
+		_fseeki64 (fbmp, bmfh.bfOffBits + (__int64)line0*mapw, SEEK_SET);
+		for (j = 0; j < nlines; j++) {
+			fread (line, 1, mapw, fbmp);
+			for (i = 0; i < mapw; i++) {
+				img[j*mapw+i].r = bmi->bmiColors[line[i]].rgbRed;
+				img[j*mapw+i].g = bmi->bmiColors[line[i]].rgbGreen;
+				img[j*mapw+i].b = bmi->bmiColors[line[i]].rgbBlue;
+			}
+		}
+		delete []line;
+		}
+		break;
+	case 24:
+		_fseeki64 (fbmp, bmfh.bfOffBits + (__int64)line0*mapw*sizeof(BGR), SEEK_SET);
+		fread (img, sizeof(BGR), mapw*nlines, fbmp);
+		break;
+	default:
+		FatalError ("Unsupported source colour depth");
+	}
+	fclose(fbmp);
+	delete []tmp;
+	return img;
+}
+
+// ==============================================================================
+
+Alpha *ReadBMPAlpha_band (char *fname, LONG line0, LONG nlines)
+{
+	LONG i, n, mapw, maph;
+	WORD bpp;
+	ReadBMP_header (fname, mapw, maph, bpp);
+	BGR *img = ReadBMP_band (fname, line0, nlines);
+	Alpha *aimg = new Alpha[n = mapw*nlines];
+	for (i = 0; i < n; i++)
+		aimg[i] = img[i].b;
+	delete []img;
+	return aimg;
+}
+
+// ==============================================================================
+
 BGR *ReadPNG (char *fname, LONG &mapw, LONG &maph, WORD &bpp)
 {
 	HRESULT hr;
@@ -376,6 +472,15 @@ bool MakePath (const char *fname)
 
 // ==============================================================================
 
+void FreeBand (BANDIMG &bd)
+{
+	if (bd.img)  delete []bd.img,  bd.img = 0;
+	if (bd.limg) delete []bd.limg, bd.limg = 0;
+	if (bd.aimg) delete []bd.aimg, bd.aimg = 0;
+}
+
+// ==============================================================================
+
 template <typename T>
 void ExtractPatch (const T *img, T *patch, LONG py, LONG px, LONG mapw, LONG maph)
 {
@@ -422,24 +527,24 @@ bool PureDiffuse (const Alpha *apatch)
 
 // ==============================================================================
 
+void PatchName (char *cbuf, const char *root, const char *layer, int lvl, int ilng, int ilat)
+{
+	sprintf (cbuf, "%s\\%s\\%02d\\%06d\\%06d.dds", root, layer, lvl, ilat, ilng);
+}
+
+// ==============================================================================
+
 DWORD WriteDDS (BGR *img, Alpha *aimg, LONG imgw, LONG imgh, const char *root, const char *layer, int lvl, int ilng, int ilat,
 				bool mipmap, bool binary_alpha)
 {
-	const char *bmpname  = "tmp.bmp";
-	const char *abmpname = "tmp_a.bmp";
-	char ddsname[256];
-	sprintf (ddsname, "%s\\%s\\%02d\\%06d\\%06d.dds", root, layer, lvl, ilat, ilng);
+	char bmpname[32], abmpname[32], ddsname[256];
+	sprintf (bmpname, "tmp%s.bmp", WorkerGroup::TmpId());
+	sprintf (abmpname, "tmp%s_a.bmp", WorkerGroup::TmpId());
+	PatchName (ddsname, root, layer, lvl, ilng, ilat);
 	MakePath (ddsname);
-	cout << "Writing  patch  " << ddsname << endl;
 
-	static BGR *bgrdummy = 0;
-	if (!img) {
-		if (!bgrdummy) {
-			bgrdummy = new BGR[PS*PS];
-			memset (bgrdummy, 0, sizeof(BGR)*PS*PS);
-		}
-		img = bgrdummy;
-	}
+	static BGR *bgrdummy = new BGR[PS*PS](); // black patch
+	if (!img) img = bgrdummy;
 
 	FILE *bmpf;
 	BITMAPFILEHEADER bmfh;
@@ -511,20 +616,11 @@ void SplitBitmap ()
 	int lvl, nlng, nlat, ilng0, ilat0;
 	int nwritten = 0, nskipped = 0;
 	double lng0, lat0;
-	BGR *img = 0;
-	BGR *patch = new BGR[PS*PS];
-	BGR *limg = 0;
-	BGR *lpatch = new BGR[PS*PS];
-	Alpha *aimg = 0;
-	Alpha *apatch = new Alpha[PS*PS];
 	bool has_wmask;
 	bool skip_specular;
 	bool has_lights;
 	bool output_mask;
 
-	memset (lpatch, 0, PS*PS*sizeof(BGR));
-	memset (apatch, 0, PS*PS*sizeof(Alpha));
-
 	cout << "Enter the file name for the bitmap representing the planetary surface\n";
 	cout << "area (must be in 8-bit or 24-bit BMP format). The bitmap must contain a\n";
 	cout << "surface patch in cylindrical projection, with longitude linear along the\n";
@@ -615,13 +711,6 @@ void SplitBitmap ()
 		cerr << "Warning: Bitmap dimensions are not a multiple of patch size." << endl;
 	}
 
-	cout << "Loading bitmap ..." << endl;
-	img = ReadBMP (fname, mapw, maph, bpp);
-	if (has_wmask)
-		aimg = ReadBMPAlpha (aname, mapw, maph, abpp);
-	if (has_lights)
-		limg = ReadBMP (lname, mapw, maph, lbpp);
-
 	nlng = 2;
 	nlat = 1;
 	for (lvl = 4; lvl < level; lvl++) {
@@ -633,50 +722,82 @@ void SplitBitmap ()
 	ilng0 = (int)((lng0+180)/dlng+0.5);
 	ilat0 = (int)((90-lat0)/dlng+0.5);
 
-	for (py = 0; py < ny; py++) {
-		for (px = 0; px < nx; px++) {
-			ExtractPatch<BGR> (img, patch, py, px, mapw, maph);
-			bool genpatch = PatchHasFeatures<BGR> (patch);
-			bool skipspec = false;
-			if (output_mask) {
-				if (has_wmask) {
-					ExtractPatch<Alpha> (aimg, apatch, py, px, mapw, maph);
-					if (skip_specular) skipspec = PureSpecular (apatch);
-					genpatch = !skipspec && (genpatch || !PureDiffuse (apatch));
-					//genpatch = !skipspec && (genpatch || PatchHasFeatures<Alpha> (apatch));
-				}
-				if (has_lights && !skipspec) {
-					ExtractPatch<BGR> (limg, lpatch, py, px, mapw, maph);
-					genpatch = genpatch || PatchHasFeatures<BGR> (lpatch);
-				}
-				if (genpatch && ((has_lights && PatchHasFeatures<BGR> (lpatch)) || (has_wmask && !PureDiffuse (apatch)))) {
-					if (!has_lights) memset (lpatch, 0, PS*PS*sizeof(BGR));
-					if (!has_wmask) memset (apatch, 0, PS*PS*sizeof(Alpha));
-					WriteDDS (lpatch, apatch, PS, PS, root, "Mask", level, ilng0+px, ilat0+py);
-					nwritten++;
-				} else {
-					char cbuf[256];
-					sprintf (cbuf, "%s\\%s\\%02d\\%06d\\%06d.dds", root, "Mask", level, ilat0+py, ilng0+px);
-					cout << "Skipping patch  " << cbuf << endl;
-					nskipped++;
-				}
+	// The map is processed in bands of one patch row. The patches of a band are
+	// written in parallel while the next band is read from the bitmaps, so only
+	// two bands are kept in memory.
+	int nthread = WorkerGroup::NumThreads (g_nthread);
+	std::vector<BGR> tpatch(nthread*PS*PS), tlpatch(nthread*PS*PS); // per-thread patch buffers
+	std::vector<Alpha> tapatch(nthread*PS*PS);
+	std::vector<std::string> msg(nx); // patch messages, printed in order
+	std::atomic<int> nwr(0), nskp(0);
+	BANDIMG band[2];
+
+	auto LoadBand = [&](BANDIMG &bd, LONG py) {
+		LONG line0 = maph-(py+1)*PS; // bitmap rows are stored bottom to top
+		bd.img  = ReadBMP_band (fname, line0, PS);
+		bd.aimg = (has_wmask ? ReadBMPAlpha_band (aname, line0, PS) : 0);
+		bd.limg = (has_lights ? ReadBMP_band (lname, line0, PS) : 0);
+	};
+
+	auto SplitPatch = [&](const BANDIMG &bd, LONG py, LONG px, int ithread) {
+		BGR *patch = tpatch.data() + ithread*PS*PS;
+		BGR *lpatch = tlpatch.data() + ithread*PS*PS;
+		Alpha *apatch = tapatch.data() + ithread*PS*PS;
+		std::string &m = msg[px];
+		char cbuf[256];
+		ExtractPatch<BGR> (bd.img, patch, 0, px, mapw, PS);
+		bool genpatch = PatchHasFeatures<BGR> (patch);
+		bool skipspec = false;
+		if (output_mask) {
+			if (has_wmask) {
+				ExtractPatch<Alpha> (bd.aimg, apatch, 0, px, mapw, PS);
+				if (skip_specular) skipspec = PureSpecular (apatch);
+				genpatch = !skipspec && (genpatch || !PureDiffuse (apatch));
+				//genpatch = !skipspec && (genpatch || PatchHasFeatures<Alpha> (apatch));
+			}
+			if (has_lights && !skipspec) {
+				ExtractPatch<BGR> (bd.limg, lpatch, 0, px, mapw, PS);
+				genpatch = genpatch || PatchHasFeatures<BGR> (lpatch);
 			}
-			if (genpatch) {
-				WriteDDS (patch, 0, PS, PS, root, "Surf", level, ilng0+px, ilat0+py);
-				nwritten++;
+			PatchName (cbuf, root, "Mask", level, ilng0+px, ilat0+py);
+			if (genpatch && ((has_lights && PatchHasFeatures<BGR> (lpatch)) || (has_wmask && !PureDiffuse (apatch)))) {
+				if (!has_lights) memset (lpatch, 0, PS*PS*sizeof(BGR));
+				if (!has_wmask) memset (apatch, 0, PS*PS*sizeof(Alpha));
+				m += std::string ("Writing  patch  ") + cbuf + "\n";
+				WriteDDS (lpatch, apatch, PS, PS, root, "Mask", level, ilng0+px, ilat0+py);
+				nwr++;
 			} else {
-				char cbuf[256];
-				sprintf (cbuf, "%s\\%s\\%02d\\%06d\\%06d.dds", root, "Surf", level, ilat0+py, ilng0+px);
-				cout << "Skipping patch  " << cbuf << endl;
-				nskipped++;
+				m += std::string ("Skipping patch  ") + cbuf + "\n";
+				nskp++;
 			}
 		}
+		PatchName (cbuf, root, "Surf", level, ilng0+px, ilat0+py);
+		if (genpatch) {
+			m += std::string ("Writing  patch  ") + cbuf + "\n";
+			WriteDDS (patch, 0, PS, PS, root, "Surf", level, ilng0+px, ilat0+py);
+			nwr++;
+		} else {
+			m += std::string ("Skipping patch  ") + cbuf + "\n";
+			nskp++;
+		}
+	};
+
+	cout << "Processing bitmap with " << nthread << " thread(s) ..." << endl;
+	if (ny) LoadBand (band[0], 0);
+	for (py = 0; py < ny; py++) {
+		BANDIMG &bcur = band[py & 1];
+		WorkerGroup wg (nx, [&](int px, int ithread) { SplitPatch (bcur, py, px, ithread); }, nthread);
+		if (py+1 < ny) LoadBand (band[(py+1) & 1], py+1);
+		wg.Wait();
+		for (px = 0; px < nx; px++) {
+			cout << msg[px] << flush;
+			msg[px].clear();
+		}
+		FreeBand (bcur);
 	}
+	nwritten = nwr;
+	nskipped = nskp;
 	cout << "Wrote " << nwritten << " patches, skipped " << nskipped << endl;
-
-	delete []img;
-	if (aimg) delete []aimg;
-	delete []patch;
 }
 
 // ==============================================================================
@@ -696,13 +817,6 @@ void SplitBitmap_cloud ()
 	if (level < 3) PS /= 2;
 	if (level < 2) PS /= 2;
 
-	BGR *img = 0;
-	BGR *patch = new BGR[PS*PS];
-	Alpha *aimg = 0;
-	Alpha *apatch = new Alpha[PS*PS];
-
-	memset (apatch, 0, PS*PS*sizeof(Alpha));
-
 	cout << "Cloud colour information:\n";
 	cout << "(H) Use homogeneous cloud colour\n";
 	cout << "(T) Load texture for cloud colour\n";
@@ -785,26 +899,6 @@ void SplitBitmap_cloud ()
 		cerr << "Warning: Bitmap dimensions are not a multiple of patch size." << endl;
 	}
 
-	cout << "Loading bitmap ..." << endl;
-	if (use_homog_col) {
-		img = new BGR[mapw*maph];
-		for (LONG i = 0; i < mapw*maph; i++) {
-			img[i].r = (BYTE)r;
-			img[i].g = (BYTE)g;
-			img[i].b = (BYTE)b;
-		}
-	} else {
-		img = ReadBMP (fname, mapw, maph, bpp);
-	}
-
-	if (!has_wmask) {
-		aimg = new Alpha[mapw*maph];
-		for (LONG i = 0; i < mapw*maph; i++)
-			aimg[i] = 255;
-	} else {
-		aimg = ReadBMPAlpha (aname, mapw, maph, abpp);
-	}
-
 	nlng = 2;
 	nlat = 1;
 	for (lvl = 4; lvl < level; lvl++) {
@@ -816,20 +910,53 @@ void SplitBitmap_cloud ()
 	ilng0 = (int)((lng0+180)/dlng+0.5);
 	ilat0 = (int)((90-lat0)/dlng+0.5);
 
-	for (py = 0; py < ny; py++) {
-		for (px = 0; px < nx; px++) {
-			ExtractPatch<BGR> (img, patch, py, px, mapw, maph);
-			if (has_wmask) {
-				ExtractPatch<Alpha> (aimg, apatch, py, px, mapw, maph);
-				WriteDDS (patch, apatch, PS, PS, root, "Cloud", level, ilng0+px, ilat0+py, false, false);
-			} else
-				WriteDDS (patch, 0, PS, PS, root, "Cloud", level, ilng0+px, ilat0+py);
+	// process the map in bands of one patch row (see SplitBitmap)
+	int nthread = WorkerGroup::NumThreads (g_nthread);
+	std::vector<BGR> tpatch(nthread*PS*PS); // per-thread patch buffers
+	std::vector<Alpha> tapatch(nthread*PS*PS);
+	std::vector<std::string> msg(nx); // patch messages, printed in order
+	BANDIMG band[2];
+
+	auto LoadBand = [&](BANDIMG &bd, LONG py) {
+		LONG line0 = maph-(py+1)*PS; // bitmap rows are stored bottom to top
+		if (use_homog_col) {
+			bd.img = new BGR[mapw*PS];
+			for (LONG i = 0; i < mapw*PS; i++) {
+				bd.img[i].r = (BYTE)r;
+				bd.img[i].g = (BYTE)g;
+				bd.img[i].b = (BYTE)b;
+			}
+		} else {
+			bd.img = ReadBMP_band (fname, line0, PS);
 		}
+		bd.aimg = (has_wmask ? ReadBMPAlpha_band (aname, line0, PS) : 0);
+		bd.limg = 0;
+	};
+
+	auto SplitPatch = [&](const BANDIMG &bd, LONG py, LONG px, int ithread) {
+		BGR *patch = tpatch.data() + ithread*PS*PS;
+		Alpha *apatch = tapatch.data() + ithread*PS*PS;
+		char cbuf[256];
+		PatchName (cbuf, root, "Cloud", level, ilng0+px, ilat0+py);
+		msg[px] = std::string ("Writing  patch  ") + cbuf + "\n";
+		ExtractPatch<BGR> (bd.img, patch, 0, px, mapw, PS);
+		if (has_wmask) {
+			ExtractPatch<Alpha> (bd.aimg, apatch, 0, px, mapw, PS);
+			WriteDDS (patch, apatch, PS, PS, root, "Cloud", level, ilng0+px, ilat0+py, false, false);
+		} else
+			WriteDDS (patch, 0, PS, PS, root, "Cloud", level, ilng0+px, ilat0+py);
+	};
+
+	cout << "Processing bitmap with " << nthread << " thread(s) ..." << endl;
+	if (ny) LoadBand (band[0], 0);
+	for (py = 0; py < ny; py++) {
+		BANDIMG &bcur = band[py & 1];
+		WorkerGroup wg (nx, [&](int px, int ithread) { SplitPatch (bcur, py, px, ithread); }, nthread);
+		if (py+1 < ny) LoadBand (band[(py+1) & 1], py+1);
+		wg.Wait();
+		for (px = 0; px < nx; px++)
+			cout << msg[px] << flush;
+		FreeBand (bcur);
 	}
 	cout << "Wrote " << nx*ny << " patches" << endl;
-
-	delete []img;
-	if (aimg) delete []aimg;
-	delete []patch;
-	delete []apatch;
-}
\ No newline at end of file
+}
@@ -0,0 +1,546 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// propbench
+// Benchmark of the propagators for unpowered orbits under time
+// acceleration. Propagates a LEO and a GTO around the Earth over a number
+// of orbits with the frame interval of the given time acceleration, once
+// with the 4th order Wisdom-Holman propagator (symplectic warp option)
+// and once with the RK8 propagator, using the same substep rule as the
+// simulation (PPropSubLimit, PPropSubMax). Reports the final position
+// error, the maximum relative drift of the orbital energy, the number of
+// force evaluations and the propagation time per frame.
+// All propagators are the step drivers of the simulation (Propagator.h),
+// applied to a point mass body.
+//
+// With -a, runs the accuracy test of the adaptive embedded propagators
+// instead: orbits of increasing eccentricity are propagated with DP5 and
+// RK87 (AdaptiveFrame_LinAng), and with RK8 at the same number of force
+// evaluations as RK87. Reports the final position errors against the
+// analytic solution, and the largest error of the dense output
+// (RigidBody::DenseState) at the centre of each RK87 substep.
+//
+// With -s, runs the stage cost benchmark of the RK5-RK8 linear+angular
+// drivers instead: a body with rotational state in LEO (J2 gravity, gravity
+// gradient torque) is propagated with the runtime-tableau driver the
+// simulation used to have, and with the compile-time tableau driver
+// (RKStep_LinAng<RK>). Reports the time per stage of each, the differences
+// of the final states, and the wall-clock time per stage when the same
+// propagation runs on separate bodies in concurrent threads, which must
+// each reproduce the single-thread result.
+//
+// Usage: propbench [-w <warp>] [-n <orbits>] [-l <sublimit>]
+//                  [-m <submax>] [-r <rksub>] [-j]
+//        propbench -a [-n <orbits>] [-f <frames>] [-t <tol>]
+//        propbench -s [-k <steps>] [-p <threads>]
+//   -w: time acceleration factor, at 60 frames/s (default 100000)
+//   -n: number of orbits to propagate (default 1000)
+//   -l: orbit fraction per substep (PPropSubLimit, default 0.02)
+//   -m: max number of substeps per frame (PPropSubMax, default 10)
+//   -r: RK8 substeps per frame (default: same as the symplectic propagator)
+//   -j: add the J2 term of the Earth's gravity field. The reference
+//       solution is then an RK8 propagation with 2000 steps per orbit,
+//       instead of the analytic 2-body solution.
+//   -f: frames per orbit for the accuracy test (default 20)
+//   -t: relative error tolerance (PropTolerance, default 1e-10)
+//   -k: steps per driver for the stage cost benchmark (default 100000)
+//   -p: concurrent threads for the stage cost benchmark (default: one
+//       per processor)
+// =======================================================================
+
+#include "Propagator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+static const double mu = 3.986004418e14;  // Earth gravitational parameter [m^3/s^2]
+static const double Re = 6.378137e6;      // Earth reference radius [m]
+static const double J2 = 1.08262668e-3;   // Earth J2 coefficient
+static bool bJ2 = false;                  // J2 term enabled?
+static long nEval;                        // force evaluation counter
+
+static double Now ()
+{
+	return chrono::duration<double> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// =======================================================================
+// Forces. As in the simulation, the y-axis is the polar axis.
+
+// Perturbation (non-Keplerian) acceleration at position r
+static Vector PertAcc (const Vector &r)
+{
+	nEval++;
+	if (!bJ2) return Vector (0,0,0);
+	double r2 = r.length2(), r1 = sqrt(r2);
+	double y2 = r.y*r.y/r2;
+	double f = -1.5*J2*mu*Re*Re/(r2*r2*r1);
+	return Vector (f*r.x*(1.0-5.0*y2), f*r.y*(3.0-5.0*y2), f*r.z*(1.0-5.0*y2));
+}
+
+// Total acceleration at position r
+static Vector Acc (const Vector &r)
+{
+	double r1 = r.length();
+	return PertAcc (r) - r*(mu/(r1*r1*r1));
+}
+
+// Orbital energy per unit mass
+static double Energy (const Vector &r, const Vector &v)
+{
+	double r1 = r.length();
+	double e = 0.5*dotp (v, v) - mu/r1;
+	if (bJ2) {
+		double y2 = r.y*r.y/(r1*r1);
+		e += mu*J2*Re*Re/(r1*r1*r1) * 0.5*(3.0*y2-1.0);
+	}
+	return e;
+}
+
+// =======================================================================
+// Point mass body for the step drivers of the simulation (Propagator.h),
+// without rotational state. As in RigidBody, the RK propagators advance
+// the linear state as increments dpos, dvel to the base state pos0, vel0.
+// The Wisdom-Holman propagator advances s directly (the Earth is at the
+// origin, so the state is also the Earth-relative state).
+
+// Sub-step state for dense output
+struct Node {
+	double t;            // time since frame start
+	Vector r, v, a;
+};
+
+struct PointBody {
+	StateVectors s;             // current state
+	Vector acc, arot;           // linear and angular acceleration at s
+	Vector pos0, vel0;          // base position and velocity
+	Vector dpos, dvel;          // position and velocity increments
+	Vector accp;                // perturbation acceleration (Wisdom-Holman)
+	double T;                   // frame interval
+	vector<Node> nodes;         // sub-step states of the current frame
+
+	PointBody (const Vector &r, const Vector &v)
+	{
+		s.Set (v, r, Vector (0,0,0), Quaternion());
+		pos0 = r, vel0 = v;
+		acc = Acc (r);
+		T = 0.0;
+	}
+	LinAngState State ()
+	{
+		LinAngState st = {s, acc, arot, pos0, vel0, dpos, dvel};
+		return st;
+	}
+	void GetIntermediateMoments (Vector &a, Vector &tau, const StateVectors &state, double tfrac, double dt)
+	{
+		a = Acc (state.pos);
+		tau.Set (0,0,0);
+	}
+	void GetIntermediateMoments_WH (Vector &a, Vector &tau, double tfrac, double dt)
+	{
+		a = PertAcc (s.pos);
+		tau.Set (0,0,0);
+	}
+	Vector EulerInv_full (const Vector &tau, const Vector &omega) const
+	{
+		return Vector (0,0,0);
+	}
+	void AddDenseNode (double tfrac)
+	{
+		Node node = {tfrac*T, s.pos, s.vel, acc};
+		nodes.push_back (node);
+	}
+};
+
+// 4th order Wisdom-Holman step (WH4Step_LinAng, as RigidBody::WH4_LinAng).
+// accp contains the perturbation at the start of the step on entry, and at
+// the end of the step on exit
+static void WH4Step (PointBody &b, double h)
+{
+	WH4Step_LinAng (b, b.s.pos, b.s.vel, b.accp, b.s, b.arot, mu, h, 0.0, 1.0);
+}
+
+// RK8 step (RKStep_LinAng, as RigidBody::RK8_LinAng), followed by the update
+// of the state and acceleration, as in RigidBody::Update
+static void RK8Step (PointBody &b, double h)
+{
+	LinAngState st (b.State());
+	RKStep_LinAng<RK8_Tableau> (b, st, h, 0.0, 1.0);
+	b.s.pos = b.pos0 + b.dpos;
+	b.s.vel = b.vel0 + b.dvel;
+	b.acc = Acc (b.s.pos);
+}
+
+// Adaptive propagation across a frame of length T (AdaptiveFrame_LinAng, as
+// RigidBody::Adaptive_LinAng, with the error tolerance relative to the
+// distance at the start of the frame). h carries the step size proposal
+// between frames. Records the sub-step states in b.nodes. Returns the number
+// of accepted steps.
+template<class RK>
+static int AdaptiveFrame (PointBody &b, double T, double tol, double &h)
+{
+	LinAngState st (b.State());
+	b.T = T;
+	b.nodes.clear();
+	b.AddDenseNode (0.0);
+	return AdaptiveFrame_LinAng<RK> (b, st, T, 1, h, tol*b.s.pos.length());
+}
+
+// =======================================================================
+
+struct Result {
+	Vector r, v;   // final state
+	double dEmax;  // max. relative energy drift
+	double neval;  // force evaluations per frame
+	double usec;   // propagation time per frame [us]
+};
+
+static void Propagate (bool symplectic, const Vector &r0, const Vector &v0,
+	double dt, int nsub, long nframe, Result &res)
+{
+	PointBody b (r0, v0);
+	double E0 = Energy (r0, v0);
+	double h = dt/nsub, t = 0.0;
+	res.dEmax = 0.0;
+	nEval = 0;
+	for (long f = 0; f < nframe; f++) {
+		double t0 = Now();
+		// like the simulation, the symplectic propagator evaluates the
+		// perturbation at the start of each frame, while the RK propagator
+		// carries the acceleration over from the end of the previous frame
+		if (symplectic) {
+			b.accp = PertAcc (b.s.pos);
+			for (int i = 0; i < nsub; i++) WH4Step (b, h);
+		} else {
+			for (int i = 0; i < nsub; i++) RK8Step (b, h);
+		}
+		t += Now()-t0;
+		double dE = fabs ((Energy (b.s.pos, b.s.vel)-E0)/E0);
+		if (dE > res.dEmax) res.dEmax = dE;
+	}
+	res.r = b.s.pos, res.v = b.s.vel;
+	res.neval = (double)nEval/nframe;
+	res.usec = t*1e6/nframe;
+}
+
+// =======================================================================
+
+static void Case (const char *name, double rp, double ra, double incl,
+	double warp, double norbit, double sublimit, int submax, int rksub)
+{
+	// initial state at periapsis
+	double sma = 0.5*(rp+ra);
+	double T = Pi2*sqrt(sma*sma*sma/mu);
+	double vp = sqrt(mu*(2.0/rp - 1.0/sma));
+	Vector r0 (rp, 0, 0);
+	Vector v0 (0, vp*sin(incl), vp*cos(incl));
+
+	double dt = warp/60.0;
+	long nframe = (long)ceil (norbit*T/dt);
+	double ostep = dt/T;
+	int nsub = max (1, min (submax, (int)ceil (ostep/sublimit)));
+	if (!rksub) rksub = nsub;
+
+	// reference solution
+	Vector rref(r0), vref(v0);
+	if (bJ2) {
+		long nref = (long)ceil (nframe*dt/T*2000.0);
+		double h = nframe*dt/nref;
+		PointBody b (r0, v0);
+		for (long i = 0; i < nref; i++) RK8Step (b, h);
+		rref = b.s.pos, vref = b.s.vel;
+	} else {
+		KeplerDrift (rref, vref, mu, nframe*dt);
+	}
+
+	Result wh, rk;
+	Propagate (true, r0, v0, dt, nsub, nframe, wh);
+	Propagate (false, r0, v0, dt, rksub, nframe, rk);
+
+	printf ("%s: T=%0.0fs, frame=%0.1fs (%0.3f orbits), %ld frames\n", name, T, dt, ostep, nframe);
+	printf ("  %-4s substeps  pos.err[m]   max dE/E     evals/frame  us/frame\n", "");
+	printf ("  %-4s %8d  %11.4e  %11.4e  %11.1f  %8.2f\n", "WH4", nsub,
+		(wh.r-rref).length(), wh.dEmax, wh.neval, wh.usec);
+	printf ("  %-4s %8d  %11.4e  %11.4e  %11.1f  %8.2f\n\n", "RK8", rksub,
+		(rk.r-rref).length(), rk.dEmax, rk.neval, rk.usec);
+}
+
+// =======================================================================
+// Accuracy test of the adaptive propagators
+
+struct AdaptiveResult {
+	Vector r;       // final position
+	double nstep;   // accepted substeps per frame
+	double neval;   // force evaluations per frame
+	double dense;   // max. position error of the dense output [m]
+};
+
+template<class RK>
+static void PropagateAdaptive (const Vector &r0, const Vector &v0, double dt,
+	long nframe, double tol, AdaptiveResult &res)
+{
+	PointBody b (r0, v0);
+	double h = 0.0;
+	long nstep = 0;
+	res.dense = 0.0;
+	nEval = 0;
+	for (long f = 0; f < nframe; f++) {
+		Vector rf(b.s.pos), vf(b.s.vel);
+		nstep += AdaptiveFrame<RK> (b, dt, tol, h);
+		// dense output at the centre of each substep, against the analytic
+		// propagation from the start of the frame (as DenseState)
+		for (size_t i = 1; i < b.nodes.size(); i++) {
+			const Node &n0 = b.nodes[i-1], &n1 = b.nodes[i];
+			double hs = n1.t-n0.t, tc = n0.t + 0.5*hs;
+			Vector pos, vel, rc(rf), vc(vf);
+			HermiteInterpolate (n0.r, n0.v, n0.a, n1.r, n1.v, n1.a, hs, 0.5, pos, vel);
+			KeplerDrift (rc, vc, mu, tc);
+			double err = (pos-rc).length();
+			if (err > res.dense) res.dense = err;
+		}
+	}
+	res.r = b.s.pos;
+	res.nstep = (double)nstep/nframe;
+	res.neval = (double)nEval/nframe;
+}
+
+static void AccuracyCase (double ecc, double norbit, int fpo, double tol)
+{
+	double rp = 6.778137e6;
+	double sma = rp/(1.0-ecc);
+	double T = Pi2*sqrt(sma*sma*sma/mu);
+	double vp = sqrt(mu*(2.0/rp - 1.0/sma));
+	Vector r0 (rp, 0, 0), v0 (0, 0, vp);
+	double dt = T/fpo;
+	long nframe = (long)ceil (norbit*fpo);
+
+	Vector rref(r0), vref(v0);
+	KeplerDrift (rref, vref, mu, nframe*dt);
+
+	AdaptiveResult dp5, rk87;
+	PropagateAdaptive<DP5_Tableau> (r0, v0, dt, nframe, tol, dp5);
+	PropagateAdaptive<RK87_Tableau> (r0, v0, dt, nframe, tol, rk87);
+
+	// RK8 at the cost of RK87
+	int rksub = max (1, (int)floor (rk87.neval/RK8_Tableau::n + 0.5));
+	Result rk8;
+	Propagate (false, r0, v0, dt, rksub, nframe, rk8);
+
+	printf ("e=%0.2f: T=%0.0fs, %ld frames of %0.1fs\n", ecc, T, nframe, dt);
+	printf ("  %-5s substeps  evals/frame  pos.err[m]   dense err[m]\n", "");
+	printf ("  %-5s %8.1f  %11.1f  %11.4e  %11.4e\n", "DP5", dp5.nstep, dp5.neval, (dp5.r-rref).length(), dp5.dense);
+	printf ("  %-5s %8.1f  %11.1f  %11.4e  %11.4e\n", "RK87", rk87.nstep, rk87.neval, (rk87.r-rref).length(), rk87.dense);
+	printf ("  %-5s %8d  %11.1f  %11.4e\n\n", "RK8", rksub, rk8.neval, (rk8.r-rref).length());
+}
+
+// =======================================================================
+// Stage cost benchmark of the RK5-RK8 linear+angular drivers
+
+// Minimal rigid body for the RK drivers. Forces are the point mass + J2
+// gravity field and the gravity gradient torque.
+struct StageBody {
+	StateVectors s1;        // state
+	Vector acc, arot;       // linear and angular acceleration at s1
+	Vector rpos_base, rvel_base;
+	Vector rpos_add, rvel_add;
+	Vector pmi;             // principal moments of inertia
+
+	void GetIntermediateMoments (Vector &a, Vector &tau, const StateVectors &s, double tfrac, double dt) const
+	{
+		double r2 = s.pos.length2(), r1 = sqrt(r2);
+		double y2 = s.pos.y*s.pos.y/r2;
+		double f = -1.5*J2*mu*Re*Re/(r2*r2*r1);
+		a.Set (s.pos.x*(f*(1.0-5.0*y2) - mu/(r2*r1)),
+		       s.pos.y*(f*(3.0-5.0*y2) - mu/(r2*r1)),
+		       s.pos.z*(f*(1.0-5.0*y2) - mu/(r2*r1)));
+		Vector R0 (tmul (s.R, -s.pos)/r1); // direction to the centre, body frame
+		Vector Ir (R0.x*pmi.x, R0.y*pmi.y, R0.z*pmi.z);
+		tau = crossp (Ir, R0) * (3.0*mu/(r2*r1));
+	}
+	Vector EulerInv_full (const Vector &tau, const Vector &omega) const
+	{
+		return Vector (
+			(tau.x - (pmi.y-pmi.z)*omega.y*omega.z) / pmi.x,
+			(tau.y - (pmi.z-pmi.x)*omega.z*omega.x) / pmi.y,
+			(tau.z - (pmi.x-pmi.y)*omega.x*omega.y) / pmi.z);
+	}
+	void Init (const Vector &r, const Vector &v)
+	{
+		s1.Set (v, r, Vector (1e-3, -2e-3, 5e-4), Quaternion());
+		rpos_base = r, rvel_base = v;
+		pmi.Set (12.0, 15.0, 7.0);
+		Update ();
+	}
+	LinAngState State ()
+	{
+		LinAngState st = {s1, acc, arot, rpos_base, rvel_base, rpos_add, rvel_add};
+		return st;
+	}
+	// Complete a step: apply the increments, and evaluate the moments at
+	// the new state (as RigidBody::Update for the next step)
+	void Update ()
+	{
+		Vector tau;
+		rpos_base += rpos_add, rpos_add.Set (0,0,0);
+		rvel_base += rvel_add, rvel_add.Set (0,0,0);
+		s1.pos = rpos_base;
+		s1.vel = rvel_base;
+		s1.R.Set (s1.Q);
+		GetIntermediateMoments (acc, tau, s1, 1.0, 0.0);
+		arot = EulerInv_full (tau, s1.omega);
+	}
+
+	// The driver before the tableaux were fixed at compile time: stage count
+	// and coefficients are passed at runtime, the stage buffers are sized for
+	// the largest tableau, and every stage term is added with
+	// StateVectors::Advance, which rebuilds the rotation matrix each time.
+	void RKdrv_Legacy (double h, int n, const double *alpha, const double *beta, const double *gamma)
+	{
+		int i, j;
+		double bh;
+		StateVectors s[RK8_Tableau::n];
+		Vector a[RK8_Tableau::n];
+		Vector d[RK8_Tableau::n];
+		Vector tau;
+
+		s[0].Set (s1.vel, s1.pos, s1.omega, s1.Q);
+		a[0].Set (acc);
+		d[0].Set (arot);
+
+		for (i = 1; i < n; i++) {
+			s[i].Set (s1.vel, s1.pos, s1.omega, s1.Q);
+			for (j = 0; j < i; j++)
+				s[i].Advance (beta[j]*h, a[j], s[j].vel, d[j], s[j].omega);
+			GetIntermediateMoments (a[i], tau, s[i], alpha[i-1], h);
+			d[i].Set (EulerInv_full (tau, s[i].omega));
+			beta += n-1;
+		}
+		for (i = 0; i < n; i++) {
+			bh = gamma[i]*h;
+			rvel_add += a[i]       * bh;
+			rpos_add += s[i].vel   * bh;
+			s1.Q.Rotate (s[i].omega * bh);
+			s1.omega += d[i]      * bh;
+		}
+	}
+};
+
+// Propagate a body over nstep steps of length h with the legacy driver or
+// the driver of the simulation (RKStep_LinAng, as RigidBody::RKdrv_LinAng).
+// Returns the time per stage [ns].
+template<class RK>
+static double PropagateStages (bool legacy, StageBody &b, double h, long nstep)
+{
+	LinAngState st (b.State());
+	double t0 = Now();
+	for (long i = 0; i < nstep; i++) {
+		if (legacy) b.RKdrv_Legacy (h, RK::n, RK::alpha, RK::beta, RK::gamma);
+		else        RKStep_LinAng<RK> (b, st, h, 0.0, 1.0);
+		b.Update ();
+	}
+	return (Now()-t0)*1e9/((double)nstep*RK::n);
+}
+
+template<class RK>
+static void StageCase (const char *name, long nstep, int nthread)
+{
+	// LEO 400km, i=51.6, 10 steps per minute
+	double rp = 6.778137e6, vp = sqrt(mu/rp), incl = Rad(51.6), h = 6.0;
+	Vector r0 (rp, 0, 0), v0 (0, vp*sin(incl), vp*cos(incl));
+
+	StageBody bl, bt;
+	bl.Init (r0, v0);
+	bt.Init (r0, v0);
+	double tl = PropagateStages<RK> (true, bl, h, nstep);
+	double tt = PropagateStages<RK> (false, bt, h, nstep);
+	double dpos = (bl.s1.pos-bt.s1.pos).length();
+	double dom = (bl.s1.omega-bt.s1.omega).length()/bt.s1.omega.length();
+
+	// the same propagation on nthread bodies concurrently. Each thread must
+	// arrive at the single-thread result.
+	vector<StageBody> bp(nthread);
+	vector<thread> worker;
+	for (int i = 0; i < nthread; i++) bp[i].Init (r0, v0);
+	double t0 = Now();
+	for (int i = 0; i < nthread; i++)
+		worker.push_back (thread ([&bp,i,h,nstep]() { PropagateStages<RK> (false, bp[i], h, nstep); }));
+	for (int i = 0; i < nthread; i++) worker[i].join();
+	double tp = (Now()-t0)*1e9/((double)nstep*RK::n*nthread);
+	bool same = true;
+	for (int i = 0; i < nthread; i++)
+		if (memcmp (&bp[i].s1, &bt.s1, sizeof(StateVectors))) same = false;
+
+	printf ("  %-4s %6d  %9.1f  %9.1f  %9.1f  %10.3e  %10.3e  %s\n", name, RK::n, tl, tt, tp,
+		dpos, dom, same ? "yes" : "NO");
+}
+
+// =======================================================================
+
+static void Usage ()
+{
+	fprintf (stderr, "Usage: propbench [-w <warp>] [-n <orbits>] [-l <sublimit>]\n");
+	fprintf (stderr, "                 [-m <submax>] [-r <rksub>] [-j]\n");
+	fprintf (stderr, "       propbench -a [-n <orbits>] [-f <frames>] [-t <tol>]\n");
+	fprintf (stderr, "       propbench -s [-k <steps>] [-p <threads>]\n");
+}
+
+int main (int argc, char *argv[])
+{
+	double warp = 1e5, norbit = 1000, sublimit = 0.02, tol = 1e-10;
+	int submax = 10, rksub = 0, fpo = 20, nthread = 0;
+	long nstep = 100000;
+	bool accuracy = false, stages = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "-j")) bJ2 = true;
+		else if (!strcmp (argv[i], "-a")) accuracy = true;
+		else if (!strcmp (argv[i], "-s")) stages = true;
+		else if (i+1 < argc && !strcmp (argv[i], "-k")) nstep = atol (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-p")) nthread = atoi (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-f")) fpo = atoi (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-t")) tol = atof (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-w")) warp = atof (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-n")) norbit = atof (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-l")) sublimit = atof (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-m")) submax = atoi (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-r")) rksub = atoi (argv[++i]);
+		else { Usage(); return 1; }
+	}
+	if (warp <= 0 || norbit <= 0 || sublimit <= 0 || submax < 1 || rksub < 0 || fpo < 1 || tol <= 0 || nstep < 1 || nthread < 0) {
+		Usage(); return 1;
+	}
+
+	if (stages) {
+		if (!nthread) nthread = max (1, (int)thread::hardware_concurrency());
+		printf ("RK drivers, linear+angular, %ld steps, %d concurrent threads\n\n", nstep, nthread);
+		printf ("  %-4s %6s  %9s  %9s  %9s  %10s  %10s  %s\n", "", "stages", "legacy", "template",
+			"threaded", "dpos[m]", "domega", "same");
+		printf ("  %-4s %6s  %9s  %9s  %9s\n", "", "", "ns/stage", "ns/stage", "ns/stage");
+		StageCase<RK5_Tableau> ("RK5", nstep, nthread);
+		StageCase<RK6_Tableau> ("RK6", nstep, nthread);
+		StageCase<RK7_Tableau> ("RK7", nstep, nthread);
+		StageCase<RK8_Tableau> ("RK8", nstep, nthread);
+		return 0;
+	}
+
+	if (accuracy) {
+		static const double ecc[4] = {0.0, 0.3, 0.73, 0.9};
+		bJ2 = false;
+		printf ("Adaptive propagators, tolerance %g, %g orbits, %d frames/orbit\n\n", tol, norbit, fpo);
+		for (int i = 0; i < 4; i++)
+			AccuracyCase (ecc[i], norbit, fpo, tol);
+		return 0;
+	}
+
+	printf ("Time acceleration %gx, %g orbits, %s\n\n", warp, norbit,
+		bJ2 ? "point mass + J2 (reference: RK8, 2000 steps/orbit)" : "point mass (reference: analytic)");
+	Case ("LEO 400km, i=51.6", 6.778137e6, 6.778137e6, Rad(51.6), warp, norbit, sublimit, submax, rksub);
+	Case ("GTO 250x35786km, i=28.5", 6.628137e6, 4.2164137e7, Rad(28.5), warp, norbit, sublimit, submax, rksub);
+	return 0;
+}
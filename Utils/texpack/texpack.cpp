@@ -7,9 +7,24 @@
 #include <direct.h>
 #include <Shlwapi.h>
 #include "zlib.h"
+#ifdef TREE_LZ4
+#include "lz4.h"
+#include "lz4hc.h"
+#endif
+#ifdef TREE_ZSTD
+#include "zstd.h"
+#endif
 
 #define TREE_DEFLATE 1
 
+// compression codecs for node data
+#define TREE_CODEC_ZLIB 0
+#define TREE_CODEC_LZ4  1
+#define TREE_CODEC_ZSTD 2
+
+// size of version 1 headers, which have no codec field and imply zlib compression
+#define TREE_HEADER_V1_SIZE 48
+
 //==============================================================================
 // local prototypes
 
@@ -25,6 +40,15 @@ DWORD deflate_node_data(BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp);
 // inflate data block
 DWORD inflate_node_data(BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp);
 
+// compress/decompress a data block with any of the supported codecs
+// Returns the size of the output block, or 0 on failure
+DWORD compress_node_data(DWORD codec, BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp);
+DWORD decompress_node_data(DWORD codec, BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp);
+
+// codec names
+const char *codec_name[3] = { "zlib", "lz4", "zstd" };
+bool codec_supported(DWORD codec);
+
 //==============================================================================
 // A single MemTree node
 
@@ -252,7 +276,7 @@ struct TOCEntry {
 
 class TreeTOC {
 public:
-	TreeTOC(const char *_root, const char *_layer, const MemTree *tree); // build the TOC from a tree
+	TreeTOC(const char *_root, const char *_layer, const MemTree *tree, DWORD _codec = TREE_CODEC_ZLIB); // build the TOC from a tree
 	TreeTOC(const char *_root, const char *_layer);
 	~TreeTOC();
 	TOCEntry &operator[](int idx);
@@ -262,6 +286,8 @@ public:
 	size_t fread(FILE *f);
 	void WriteData(FILE *f);
 	void ExtractData(FILE *f, int maxlevel);
+	bool Repack(FILE *f, FILE *fout, DWORD _codec);
+	DWORD Codec() const { return header.codec; }
 
 protected:
 	int AddSubtree(const MemTreeNode *node);
@@ -280,8 +306,12 @@ private:
 		DWORD rootPos2;     // array index of level 2 tile ((DWORD)-1 for not present)
 		DWORD rootPos3;     // array index of level 3 tile ((DWORD)-1 for not present)
 		DWORD rootPos4[2];  // array indices of level 4 tiles (quadtree roots; (DWORD)-1 for not present)
+		DWORD codec;        // compression codec (TREE_CODEC_xxx; version 2 headers only)
+		DWORD reserved;     // (version 2 headers only)
 	} header;
 
+	void SetCodec(DWORD codec);
+
 	TOCEntry *toc;      // array of tree nodes
 
 	char ext[16];       // file extension for this layer
@@ -292,7 +322,7 @@ private:
 
 // -----------------------------------------------------------------------------
 
-TreeTOC::TreeTOC(const char *_root, const char *_layer, const MemTree *tree): mtree(tree)
+TreeTOC::TreeTOC(const char *_root, const char *_layer, const MemTree *tree, DWORD _codec): mtree(tree)
 {
 	deflateData = true;
 
@@ -317,11 +347,13 @@ TreeTOC::TreeTOC(const char *_root, const char *_layer, const MemTree *tree): mt
 	header.magic[1] = 'X';
 	header.magic[2] = 1;
 	header.magic[3] = 0;
-	header.size = sizeof(Header);
 	header.flags = 0;
 	if (deflateData) header.flags |= TREE_DEFLATE;
 	header.ntoc = 0;
 	header.totlength = 0;
+	header.reserved = 0;
+
+	SetCodec(_codec);
 
 	toc = new TOCEntry[tree->NodeCount()];
 	header.rootPos1 = AddSubtree(tree->FindNode(1, 0, 0));
@@ -360,11 +392,13 @@ TreeTOC::TreeTOC(const char *_root, const char *_layer): mtree(0)
 	header.magic[1] = 'X';
 	header.magic[2] = 1;
 	header.magic[3] = 0;
-	header.size = sizeof(Header);
 	header.flags = 0;
 	if (deflateData) header.flags |= TREE_DEFLATE;
 	header.ntoc = 0;
 	header.totlength = 0;
+	header.reserved = 0;
+
+	SetCodec(TREE_CODEC_ZLIB);
 
 	toc = 0;
 	header.rootPos1 = 0;
@@ -385,6 +419,17 @@ TreeTOC::~TreeTOC()
 
 // -----------------------------------------------------------------------------
 
+void TreeTOC::SetCodec(DWORD codec)
+{
+	// zlib archives are written with version 1 headers, so that older
+	// versions of Orbiter can still read them
+	header.codec = codec;
+	header.magic[2] = (codec == TREE_CODEC_ZLIB ? 1 : 2);
+	header.size = (codec == TREE_CODEC_ZLIB ? TREE_HEADER_V1_SIZE : sizeof(Header));
+}
+
+// -----------------------------------------------------------------------------
+
 int TreeTOC::AddSubtree(const MemTreeNode *node)
 {
 	static DWORD nbuf = 32768;
@@ -418,7 +463,7 @@ int TreeTOC::AddSubtree(const MemTreeNode *node)
 				exit(1);
 			}
 			if (deflateData) {
-				ndata = deflate_node_data(buf, sz.LowPart, zbuf, nzbuf);
+				ndata = compress_node_data(header.codec, buf, sz.LowPart, zbuf, nzbuf);
 			} else {
 				ndata = sz.LowPart;
 			}
@@ -456,7 +501,7 @@ TOCEntry &TreeTOC::operator[](int idx)
 size_t TreeTOC::fwrite(FILE *f)
 {
 	size_t n = 0;
-	n += ::fwrite(&header, sizeof(Header), 1, f);
+	n += ::fwrite(&header, header.size, 1, f);
 	n += ::fwrite(toc, sizeof(TOCEntry), header.ntoc, f);
 	return n;
 }
@@ -465,7 +510,13 @@ size_t TreeTOC::fwrite(FILE *f)
 
 size_t TreeTOC::fread(FILE *f)
 {
-	size_t n = ::fread(&header, sizeof(Header), 1, f);
+	size_t n = ::fread(&header, TREE_HEADER_V1_SIZE, 1, f);
+	if (n && header.magic[2] >= 2) {
+		n = ::fread(&header.codec, sizeof(Header)-TREE_HEADER_V1_SIZE, 1, f);
+	} else {
+		header.codec = TREE_CODEC_ZLIB;
+		header.reserved = 0;
+	}
 	if (n) {
 		if (toc) delete []toc;
 		toc = new TOCEntry[header.ntoc];
@@ -519,7 +570,7 @@ void TreeTOC::WriteSubtreeData(const MemTreeNode *node, FILE *f)
 				exit(1);
 			}
 			if (deflateData) {
-				ndata = deflate_node_data(buf, sz.LowPart, zbuf, nzbuf);
+				ndata = compress_node_data(header.codec, buf, sz.LowPart, zbuf, nzbuf);
 				std::cout << "deflating " << path << " [" << (ndata * 100) / sz.LowPart << "%]" << std::endl;
 				::fwrite(zbuf, 1, ndata, f);
 			} else {
@@ -566,7 +617,7 @@ void TreeTOC::ExtractSubtreeData (DWORD idx, int lvl, int ilat, int ilng, FILE *
 	int nread = ::fread(zbuf, 1, zsize, f);
 
 	BYTE *ebuf = new BYTE[esize];
-	inflate_node_data(zbuf, zsize, ebuf, esize);
+	decompress_node_data(header.codec, zbuf, zsize, ebuf, esize);
 
 	char fname[256];
 	sprintf (fname, "%s\\%s", root, layer);
@@ -592,11 +643,72 @@ void TreeTOC::ExtractSubtreeData (DWORD idx, int lvl, int ilat, int ilng, FILE *
 	delete []ebuf;
 }
 
+// -----------------------------------------------------------------------------
+
+bool TreeTOC::Repack(FILE *f, FILE *fout, DWORD _codec)
+{
+	// Nodes are stored in the order of their TOC entries. The TOC is written
+	// twice: first as a placeholder, then with the new data positions.
+	DWORD idx, zsize, esize, nzout = 1024000;
+	BYTE *zout = new BYTE[nzout];
+	DWORD oldcodec = header.codec;
+	__int64 olddataofs = header.dataOfs, oldtotlength = header.totlength;
+	__int64 *oldpos = new __int64[header.ntoc];
+	for (idx = 0; idx < header.ntoc; idx++)
+		oldpos[idx] = toc[idx].pos;
+
+	SetCodec(_codec);
+	header.dataOfs = header.size + header.ntoc*sizeof(TOCEntry);
+	header.totlength = 0;
+	fwrite(fout);
+
+	for (idx = 0; idx < header.ntoc; idx++) {
+		toc[idx].pos = header.totlength;
+		if (!(esize = toc[idx].size)) continue;
+		zsize = (DWORD)((idx < header.ntoc-1 ? oldpos[idx+1] : oldtotlength) - oldpos[idx]);
+		BYTE *zbuf = new BYTE[zsize];
+		BYTE *ebuf = new BYTE[esize];
+		_fseeki64(f, olddataofs + oldpos[idx], SEEK_SET);
+		const char *err = 0;
+		if (::fread(zbuf, 1, zsize, f) != zsize ||
+			decompress_node_data(oldcodec, zbuf, zsize, ebuf, esize) != esize) {
+			err = "Could not read node ";
+		} else {
+			if (esize + esize/16 + 1024 > nzout) { // grow output buffer to the worst-case compressed size
+				delete []zout;
+				zout = new BYTE[nzout = esize + esize/16 + 1024];
+			}
+			DWORD ndata = compress_node_data(header.codec, ebuf, esize, zout, nzout);
+			if (!ndata)
+				err = "Could not compress node ";
+			else if (::fwrite(zout, 1, ndata, fout) != ndata)
+				err = "Could not write node ";
+			else
+				header.totlength += ndata;
+		}
+		delete []zbuf;
+		delete []ebuf;
+		if (err) { // abort: a skipped node would leave the TOC positions inconsistent
+			std::cerr << err << idx << std::endl;
+			delete []zout;
+			delete []oldpos;
+			return false;
+		}
+	}
+
+	_fseeki64(fout, 0, SEEK_SET);
+	fwrite(fout);
+	delete []zout;
+	delete []oldpos;
+	return true;
+}
+
 //==============================================================================
 
 int maxlevel = 0;
+DWORD codec = TREE_CODEC_ZLIB;
 enum OP_MODE {
-	OP_ARCHIVE, OP_EXTRACT
+	OP_ARCHIVE, OP_EXTRACT, OP_REPACK
 } mode = OP_ARCHIVE;
 
 int main(int narg, char *arg[])
@@ -618,7 +730,11 @@ int main(int narg, char *arg[])
 		std::cerr << "  Label    pack surface label tiles" << std::endl;
 		std::cerr << "\n<Flags>:" << std::endl;
 		std::cerr << "  -e   : unpack compressed archive into individual tiles" << std::endl;
+		std::cerr << "  -r   : repack an existing archive with the codec given by -c" << std::endl;
 		std::cerr << "  -L<x>: pack/unpack tiles up to maximum level <x>" << std::endl;
+		std::cerr << "  -c<x>: compress with codec <x>: zlib (default), lz4 or zstd" << std::endl;
+		std::cerr << "         Archives using lz4 or zstd require Orbiter builds with" << std::endl;
+		std::cerr << "         support for these codecs." << std::endl;
 		exit(1);
 	}
 
@@ -631,13 +747,24 @@ int main(int narg, char *arg[])
 		case 'e':
 			mode = OP_EXTRACT;
 			break;
+		case 'r':
+			mode = OP_REPACK;
+			break;
+		case 'c':
+			for (codec = 0; codec < 3; codec++)
+				if (!stricmp(arg[i]+2, codec_name[codec])) break;
+			if (codec == 3 || !codec_supported(codec)) {
+				std::cerr << "Codec not supported: " << arg[i]+2 << std::endl;
+				exit(1);
+			}
+			break;
 		case 'L':
 			if (sscanf(arg[i]+2, "%d", &maxlevel))
 			break;
 		}
 	}
 
-	std::cout << (mode == OP_ARCHIVE ? "Packing " : "Unpacking ") << layer << " layer for " << root << std::endl;
+	std::cout << (mode == OP_ARCHIVE ? "Packing " : mode == OP_REPACK ? "Repacking " : "Unpacking ") << layer << " layer for " << root << std::endl;
 	if (maxlevel)
 		std::cout << "Max. level: " << maxlevel << std::endl;
 	else
@@ -652,7 +779,7 @@ int main(int narg, char *arg[])
 		int nnode = tree.NodeCount();
 
 		// construct the TOC from the tree
-		TreeTOC toc(root, layer, &tree);
+		TreeTOC toc(root, layer, &tree, codec);
 
 		char outf[256];
 		sprintf(outf, "%s\\Archive", root);
@@ -668,6 +795,36 @@ int main(int narg, char *arg[])
 
 		std::cout << std::endl << "Quadtree data written to " << outf << std::endl;
 		std::cout << toc.length() << " nodes" << std::endl;
+		std::cout << toc.DataSize() << " bytes of data (" << codec_name[codec] << ")" << std::endl;
+
+	} else if (mode == OP_REPACK) {
+
+		TreeTOC toc(root, layer);
+		char fname[256], tmpname[256];
+		sprintf(fname, "%s\\Archive\\%s.tree", root, layer);
+		sprintf(tmpname, "%s.tmp", fname);
+		FILE *f = fopen(fname, "rb");
+		if (!f || !toc.fread(f)) {
+			std::cerr << "Could not read " << fname << std::endl;
+			exit(1);
+		}
+		if (!codec_supported(toc.Codec())) {
+			std::cerr << "Codec of " << fname << " not supported" << std::endl;
+			exit(1);
+		}
+		std::cout << "Codec: " << codec_name[toc.Codec()] << " -> " << codec_name[codec] << std::endl;
+		FILE *fout = fopen(tmpname, "wb");
+		bool ok = (fout && toc.Repack(f, fout, codec));
+		fclose(f);
+		if (fout) fclose(fout);
+		if (!ok || !MoveFileEx(tmpname, fname, MOVEFILE_REPLACE_EXISTING)) {
+			std::cerr << "Could not write " << fname << std::endl;
+			DeleteFile(tmpname);
+			exit(1);
+		}
+
+		std::cout << std::endl << "Quadtree data repacked in " << fname << std::endl;
+		std::cout << toc.length() << " nodes" << std::endl;
 		std::cout << toc.DataSize() << " bytes of data" << std::endl;
 
 	} else {
@@ -724,6 +881,71 @@ DWORD deflate_node_data(BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp)
 	return strm.total_out;
 }
 
+bool codec_supported(DWORD codec)
+{
+	switch (codec) {
+	case TREE_CODEC_ZLIB:
+		return true;
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4:
+		return true;
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+DWORD compress_node_data(DWORD codec, BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp)
+{
+	int ndata = 0;
+	switch (codec) {
+	case TREE_CODEC_ZLIB:
+		return deflate_node_data(inp, ninp, outp, noutp);
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4:
+		ndata = LZ4_compress_HC((const char*)inp, (char*)outp, ninp, noutp, LZ4HC_CLEVEL_DEFAULT);
+		break;
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD: {
+		size_t n = ZSTD_compress(outp, noutp, inp, ninp, 19);
+		ndata = (ZSTD_isError(n) ? 0 : (int)n);
+		} break;
+#endif
+	}
+	if (ndata <= 0) {
+		std::cerr << "Compression failed" << std::endl;
+		exit(1);
+	}
+	return ndata;
+}
+
+DWORD decompress_node_data(DWORD codec, BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp)
+{
+	switch (codec) {
+	case TREE_CODEC_ZLIB:
+		return inflate_node_data(inp, ninp, outp, noutp);
+#ifdef TREE_LZ4
+	case TREE_CODEC_LZ4: {
+		int ndata = LZ4_decompress_safe((const char*)inp, (char*)outp, ninp, noutp);
+		return (ndata > 0 ? ndata : 0);
+		}
+#endif
+#ifdef TREE_ZSTD
+	case TREE_CODEC_ZSTD: {
+		size_t ndata = ZSTD_decompress(outp, noutp, inp, ninp);
+		return (ZSTD_isError(ndata) ? 0 : (DWORD)ndata);
+		}
+#endif
+	default:
+		return 0;
+	}
+}
+
 DWORD inflate_node_data(BYTE *inp, DWORD ninp, BYTE *outp, DWORD noutp)
 {
 	DWORD ndata = noutp;
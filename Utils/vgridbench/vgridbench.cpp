@@ -0,0 +1,230 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// vgridbench
+// Benchmark of the vessel proximity queries. Places a number of vessels
+// in low Earth orbits, half of them in clusters around stations, and
+// advances them along their orbits in time steps. In each step, every
+// vessel looks up its closest vessel (Vessel::UpdateProxies) and the
+// vessels within transponder range (Vessel::UpdateReceiverStatus), once
+// with the brute-force loops over all vessels that the simulation used
+// before, and once through the spatial index (VesselGrid), including the
+// rebuild of the index after the vessels have moved. Reports the time per
+// step of both, and checks that both return the same vessels.
+//
+// The grid is compiled from the simulation source (VesselGrid.cpp), with
+// a minimal Vessel class that only provides the position and size.
+//
+// Usage: vgridbench [-n <vessels>] [-k <steps>] [-c <cluster size>]
+//   -n: number of vessels (default 2000)
+//   -k: number of time steps (default 100)
+//   -c: vessels per station cluster (default 10)
+// =======================================================================
+
+#include "Vecmat.h"
+
+// Minimal vessel: global position and radius
+class Vessel {
+public:
+	inline const Vector &GPos() const { return gpos; }
+	inline double Size() const { return size; }
+	Vector gpos;
+	double size;
+};
+
+#define __VESSEL_H // use the class above instead of the simulation vessel
+#include "VesselGrid.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+static const double mu = 3.986004418e14;  // Earth gravitational parameter [m^3/s^2]
+static const double Re = 6.378137e6;      // Earth reference radius [m]
+static const double xpdr_range = 1e6;     // max. transponder range [m]
+static const Vector epos (1.496e11, 0, 0); // Earth global position [m]
+
+static double Now ()
+{
+	return chrono::duration<double> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// uniform random number in [0,1)
+static double Rand1 ()
+{
+	return rand()/(RAND_MAX+1.0);
+}
+
+// =======================================================================
+// Circular orbits. Vessels of a cluster share the orbit of their station,
+// with a small offset in orbit phase and plane.
+
+struct Orbit {
+	double r;          // orbit radius
+	double n;          // mean motion
+	double lan, incl;  // orientation
+	double phase;      // phase at t=0
+};
+
+static Vector OrbitPos (const Orbit &o, double t)
+{
+	double u = o.phase + o.n*t;
+	double x = o.r*cos(u), y = o.r*sin(u);
+	double ci = cos(o.incl), si = sin(o.incl), cl = cos(o.lan), sl = sin(o.lan);
+	return epos + Vector (x*cl - y*ci*sl, y*si, x*sl + y*ci*cl);
+}
+
+static void InitOrbits (vector<Orbit> &orbit, int ncluster)
+{
+	size_t i, n = orbit.size();
+	Orbit station;
+	for (i = 0; i < n; i++) {
+		Orbit &o = orbit[i];
+		if (i < n/2) { // clusters
+			if (!(i % ncluster)) {
+				station.r = Re + 3e5 + 2e5*Rand1();
+				station.n = sqrt (mu/(station.r*station.r*station.r));
+				station.lan = Pi2*Rand1();
+				station.incl = Rad(60.0)*Rand1();
+				station.phase = Pi2*Rand1();
+				o = station;
+			} else {
+				o = station;
+				o.r += 2e3*(Rand1()-0.5);
+				o.n = sqrt (mu/(o.r*o.r*o.r));
+				o.phase += 2e-3*(Rand1()-0.5);
+				o.incl += 1e-4*(Rand1()-0.5);
+			}
+		} else {
+			o.r = Re + 2e5 + 1.8e6*Rand1();
+			o.n = sqrt (mu/(o.r*o.r*o.r));
+			o.lan = Pi2*Rand1();
+			o.incl = Pi*Rand1();
+			o.phase = Pi2*Rand1();
+		}
+	}
+}
+
+// =======================================================================
+// Proximity queries for all vessels
+
+struct Result {
+	vector<Vessel*> closest;  // closest vessel of each vessel
+	vector<Vessel*> inrange;  // vessels in XPDR range of each vessel, concatenated
+};
+
+// Brute-force loops, as in Vessel::UpdateProxies and Vessel::UpdateReceiverStatus
+// before the spatial index
+static void QueryScan (Vessel *const *vessel, DWORD nvessel, Result &res)
+{
+	int i, j;
+	double dist2, proxydist2;
+	for (j = 0; j < (int)nvessel; j++) {
+		const Vector &gpos = vessel[j]->GPos();
+		Vessel *proxy = 0;
+		for (i = nvessel-1, proxydist2 = 1e100; i >= 0; i--) {
+			if (i == j) continue;
+			if ((dist2 = gpos.dist2 (vessel[i]->GPos())) < proxydist2) {
+				proxydist2 = dist2;
+				proxy = vessel[i];
+			}
+		}
+		res.closest.push_back (proxy);
+		for (i = nvessel-1; i >= 0; i--) {
+			if (i == j) continue;
+			if (gpos.dist2 (vessel[i]->GPos()) < xpdr_range*xpdr_range)
+				res.inrange.push_back (vessel[i]);
+		}
+	}
+}
+
+// Queries through the spatial index, as PlanetarySystem::ClosestVessel and
+// PlanetarySystem::VesselsInRange
+static void QueryGrid (VesselGrid &grid, Vessel *const *vessel, DWORD nvessel, Result &res)
+{
+	DWORD i, j, n;
+	Vessel **list;
+	grid.Build (vessel, nvessel);
+	for (j = 0; j < nvessel; j++) {
+		const Vector &gpos = vessel[j]->GPos();
+		res.closest.push_back (grid.Closest (gpos, vessel[j]));
+		n = grid.InRange (gpos, xpdr_range, list);
+		for (i = 0; i < n; i++)
+			if (list[i] != vessel[j]) res.inrange.push_back (list[i]);
+	}
+}
+
+// =======================================================================
+
+static void Usage ()
+{
+	fprintf (stderr, "Usage: vgridbench [-n <vessels>] [-k <steps>] [-c <cluster size>]\n");
+}
+
+int main (int argc, char *argv[])
+{
+	int nvessel = 2000, nstep = 100, ncluster = 10;
+
+	for (int i = 1; i < argc; i++) {
+		if (i+1 < argc && !strcmp (argv[i], "-n")) nvessel = atoi (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-k")) nstep = atoi (argv[++i]);
+		else if (i+1 < argc && !strcmp (argv[i], "-c")) ncluster = atoi (argv[++i]);
+		else { Usage(); return 1; }
+	}
+	if (nvessel < 2 || nstep < 1 || ncluster < 1) {
+		Usage(); return 1;
+	}
+
+	srand (1);
+	vector<Orbit> orbit(nvessel);
+	vector<Vessel> vbuf(nvessel);
+	vector<Vessel*> vessel(nvessel);
+	InitOrbits (orbit, ncluster);
+	for (int i = 0; i < nvessel; i++) {
+		vbuf[i].size = 5.0 + 45.0*Rand1();
+		vessel[i] = &vbuf[i];
+	}
+
+	VesselGrid grid (xpdr_range); // cell size as PlanetarySystem
+	double tscan = 0.0, tgrid = 0.0;
+	double nclose = 0.0, nrange = 0.0;
+	int nmismatch = 0;
+	for (int k = 0; k < nstep; k++) {
+		double t = k*10.0; // 10 s per step
+		for (int i = 0; i < nvessel; i++)
+			vbuf[i].gpos = OrbitPos (orbit[i], t);
+
+		Result rs, rg;
+		double t0 = Now();
+		QueryScan (vessel.data(), nvessel, rs);
+		double t1 = Now();
+		QueryGrid (grid, vessel.data(), nvessel, rg);
+		double t2 = Now();
+		tscan += t1-t0;
+		tgrid += t2-t1;
+
+		if (rs.closest != rg.closest || rs.inrange != rg.inrange) nmismatch++;
+		for (int i = 0; i < nvessel; i++)
+			nclose += rs.closest[i]->GPos().dist (vessel[i]->GPos());
+		nrange += rs.inrange.size();
+	}
+
+	printf ("%d vessels in LEO (%d%% in clusters of %d), %d steps\n", nvessel, 50, ncluster, nstep);
+	printf ("Mean distance to the closest vessel: %0.1f km\n", nclose/((double)nstep*nvessel)*1e-3);
+	printf ("Mean vessels in XPDR range: %0.1f\n\n", nrange/((double)nstep*nvessel));
+	printf ("  %-12s %10s\n", "", "ms/step");
+	printf ("  %-12s %10.3f\n", "brute force", tscan*1e3/nstep);
+	printf ("  %-12s %10.3f\n", "grid", tgrid*1e3/nstep);
+	printf ("Speedup: %0.1f\n", tscan/tgrid);
+	if (nmismatch) {
+		printf ("Query results differ in %d steps!\n", nmismatch);
+		return 1;
+	}
+	printf ("Query results are identical.\n");
+	return 0;
+}
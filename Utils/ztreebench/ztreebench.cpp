@@ -0,0 +1,137 @@
+// Copyright (c) Martin Schweiger
+// Licensed under the MIT License
+
+// =======================================================================
+// ztreebench
+// Tile throughput benchmark for compressed tile tree archives.
+// Reads and inflates all tiles of a layer archive with a number of
+// concurrent threads, as the tile loaders do, and reports the throughput
+// for each pass. The first pass includes the disk access unless the
+// archive is already in the file cache.
+//
+// Usage: ztreebench <planet dir> [-l <layer>] [-t <threads>] [-n <passes>] [-r] [-p]
+//   <planet dir>: directory containing the Archive subdirectory, e.g. Textures/Earth
+//   -l: layer (Surf, Mask, Elev, Elev_mod, Label, Cloud; default: Surf)
+//   -t: number of reader threads (default: 1)
+//   -n: number of passes (default: 3)
+//   -r: use positioned reads instead of mapping the archive
+//   -p: inflate into pooled buffers (ReadData/ReleaseData) instead of
+//       caller-provided buffers
+//
+// Builds with the Utils tools, or standalone on Linux with
+//   g++ -O2 -I../../Src/Orbiter ztreebench.cpp ../../Src/Orbiter/ZTreeMgr.cpp -lz -lpthread
+// adding -DTREE_LZ4 -llz4 and/or -DTREE_ZSTD -lzstd for archives using these codecs
+// =======================================================================
+
+#include "ZTreeMgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+struct PASSDATA {
+	ZTreeMgr *mgr;
+	int ithread, nthread;
+	bool pooled;
+	DWORD maxsize;    // largest inflated node size
+	DWORD ntile;      // tiles read
+	__int64 nzbyte;   // bytes read
+	__int64 nebyte;   // bytes inflated
+};
+
+static void ReadTiles (PASSDATA *pd)
+{
+	ZTreeMgr *mgr = pd->mgr;
+	std::vector<BYTE> buf(pd->maxsize);
+	DWORD i, ndata, ntree = mgr->TOC().size();
+	BYTE *data;
+
+	for (i = pd->ithread; i < ntree; i += pd->nthread) {
+		if (!mgr->NodeSizeInflated(i)) continue;
+		if (pd->pooled) {
+			if (ndata = mgr->ReadData(i, &data))
+				mgr->ReleaseData(data);
+		} else {
+			ndata = mgr->ReadData(i, buf.data(), pd->maxsize);
+		}
+		if (ndata) {
+			pd->ntile++;
+			pd->nzbyte += mgr->NodeSizeDeflated(i);
+			pd->nebyte += ndata;
+		}
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	const char *lname[6] = { "Surf", "Mask", "Elev", "Elev_mod", "Label", "Cloud" };
+	const char *dir = 0;
+	int i, j, layer = 0, nthread = 1, npass = 3;
+	bool mapped = true, pooled = false;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp (argv[i], "-l") && i < argc-1) {
+			for (j = 0, i++; j < 6; j++)
+				if (!strcmp (argv[i], lname[j])) break;
+			if (j == 6) {
+				fprintf (stderr, "Unknown layer %s\n", argv[i]);
+				return 1;
+			}
+			layer = j;
+		} else if (!strcmp (argv[i], "-t") && i < argc-1) {
+			nthread = atoi (argv[++i]);
+		} else if (!strcmp (argv[i], "-n") && i < argc-1) {
+			npass = atoi (argv[++i]);
+		} else if (!strcmp (argv[i], "-r")) {
+			mapped = false;
+		} else if (!strcmp (argv[i], "-p")) {
+			pooled = true;
+		} else {
+			dir = argv[i];
+		}
+	}
+	if (!dir || nthread < 1 || npass < 1) {
+		fprintf (stderr, "Usage: ztreebench <planet dir> [-l <layer>] [-t <threads>] [-n <passes>] [-r] [-p]\n");
+		return 1;
+	}
+
+	ZTreeMgr *mgr = ZTreeMgr::CreateFromFile (dir, (ZTreeMgr::Layer)layer, mapped);
+	if (!mgr) {
+		fprintf (stderr, "Could not open the %s archive in %s\n", lname[layer], dir);
+		return 1;
+	}
+
+	DWORD maxsize = 0, ntree = mgr->TOC().size();
+	for (i = 0; i < (int)ntree; i++)
+		if (mgr->NodeSizeInflated(i) > maxsize) maxsize = mgr->NodeSizeInflated(i);
+	const char *cname[3] = { "zlib", "lz4", "zstd" };
+	printf ("%s: %d nodes, %s, %s, %s buffers, %d thread(s)\n", lname[layer], ntree, cname[mgr->Codec()],
+		mgr->Mapped() ? "mapped" : "positioned reads", pooled ? "pooled" : "caller", nthread);
+
+	for (i = 0; i < npass; i++) {
+		std::vector<PASSDATA> pd(nthread);
+		std::vector<std::thread> th;
+		auto t0 = std::chrono::steady_clock::now();
+		for (j = 0; j < nthread; j++) {
+			PASSDATA p = { mgr, j, nthread, pooled, maxsize, 0, 0, 0 };
+			pd[j] = p;
+			th.push_back (std::thread (ReadTiles, &pd[j]));
+		}
+		DWORD ntile = 0;
+		__int64 nzbyte = 0, nebyte = 0;
+		for (j = 0; j < nthread; j++) {
+			th[j].join();
+			ntile += pd[j].ntile;
+			nzbyte += pd[j].nzbyte;
+			nebyte += pd[j].nebyte;
+		}
+		double dt = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		printf ("pass %d: %d tiles in %0.3f s: %0.0f tiles/s, %0.1f MB/s read, %0.1f MB/s inflated\n",
+			i+1, ntile, dt, ntile/dt, nzbyte/dt/(1024.0*1024.0), nebyte/dt/(1024.0*1024.0));
+	}
+
+	delete mgr;
+	return 0;
+}